@@ -15,6 +15,9 @@
 #include "log.h"
 #include "ngfunc.h"
 #include "msoft.h"
+#include "metrics.h"
+#include "sessevent.h"
+#include "trace.h"
 #include "util.h"
 
 #ifdef USE_PAM
@@ -46,6 +49,7 @@ static int
 AuthGetExternalPassword(const char *extcmd, char *authname,
     char *password, size_t passlen);
 static void AuthAsync(void *arg);
+static void AuthAsyncRun(AuthData auth);
 static void AuthAsyncFinish(void *arg, int was_canceled);
 static int AuthPreChecks(AuthData auth);
 static void AuthAccount(void *arg);
@@ -650,6 +654,7 @@ AuthDataNew(Link l)
 	strlcpy(auth->info.peer_ident, l->lcp.peer_ident, sizeof(l->lcp.peer_ident));
 	auth->info.originate = l->originate;
 	auth->info.downReason = NULL;
+	auth->trace = l->trace ? gLogTraceOptions : 0;
 
 	if (l->bund) {
 		strlcpy(auth->info.ifname, l->bund->iface.ifname, sizeof(auth->info.ifname));
@@ -870,7 +875,7 @@ AuthAccountStart(Link l, int type)
 			return;
 		}
 	}
-	LinkUpdateStats(l);
+	LinkUpdateStats(l, NGSTATS_ACCT);
 	if (type == AUTH_ACCT_STOP) {
 		Log(LG_AUTH2, ("[%s] ACCT: Accounting data for user '%s': %lu seconds, %llu octets in, %llu octets out",
 		    l->name, a->params.authname,
@@ -977,6 +982,7 @@ AuthAccount(void *arg)
 	AuthData const auth = (AuthData) arg;
 	int err = 0;
 
+	gLogTrace = auth->trace;
 	Log(LG_AUTH2, ("[%s] ACCT: Thread started", auth->info.lnkname));
 
 	if (Enabled(&auth->conf.options, AUTH_CONF_RADIUS_ACCT))
@@ -1111,6 +1117,11 @@ AuthAsyncStart(Link l, AuthData auth)
 	Auth const a = &l->lcp.auth;
 	const char *rept;
 
+	/* Peer name may select session for tracing */
+	TraceLinkUpdate(l, auth->params.authname);
+	TraceLink(l);
+	auth->trace = gLogTrace;
+
 	/* Check link action */
 	rept = LinkMatchAction(l, 2, auth->params.authname);
 	if (rept) {
@@ -1151,6 +1162,8 @@ AuthAsyncStart(Link l, AuthData auth)
 		auth->finish(l, auth);
 		return;
 	}
+	clock_gettime(CLOCK_MONOTONIC, &auth->started);
+	LinkSetupMark(l, LINK_SETUP_AUTH_START, 0);
 	if (paction_start(&a->thread, &gGiantMutex, AuthAsync,
 	    AuthAsyncFinish, auth) == -1) {
 		Perror("[%s] AUTH: Couldn't start thread", l->name);
@@ -1172,8 +1185,24 @@ AuthAsync(void *arg)
 {
 	AuthData const auth = (AuthData) arg;
 
+	gLogTrace = auth->trace;
 	Log(LG_AUTH2, ("[%s] AUTH: Thread started", auth->info.lnkname));
 
+	auth->run = EventNow();
+	AuthAsyncRun(auth);
+	auth->done = EventNow();
+}
+
+/*
+ * AuthAsyncRun()
+ *
+ * Try the configured backends in order.
+ * NOTE: Thread safety is needed here
+ */
+
+static void
+AuthAsyncRun(AuthData auth)
+{
 	if (Enabled(&auth->conf.options, AUTH_CONF_EXT_AUTH)) {
 		auth->params.authentic = AUTH_CONF_EXT_AUTH;
 		Log(LG_AUTH, ("[%s] AUTH: Trying EXTERNAL", auth->info.lnkname));
@@ -1270,6 +1299,7 @@ AuthAsyncFinish(void *arg, int was_canceled)
 {
 	AuthData auth = (AuthData) arg;
 	Link l;
+	struct timespec now;
 
 	if (was_canceled)
 		Log(LG_AUTH2, ("[%s] AUTH: Thread was canceled", auth->info.lnkname));
@@ -1286,7 +1316,16 @@ AuthAsyncFinish(void *arg, int was_canceled)
 		AuthDataDestroy(auth);
 		return;
 	}
+	TraceLink(l);
 	Log(LG_AUTH2, ("[%s] AUTH: Thread finished normally", l->name));
+	LinkSetupMark(l, LINK_SETUP_AUTH_RUN, auth->run);
+	LinkSetupMark(l, LINK_SETUP_AUTH_DONE, auth->done);
+	LinkSetupMark(l, LINK_SETUP_AUTH_END, 0);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	MetricsAuth(auth->params.authentic, auth->status,
+	    (now.tv_sec - auth->started.tv_sec) * 1000 +
+	    (now.tv_nsec - auth->started.tv_nsec) / 1000000);
 
 	/* Replace modified data */
 	authparamsDestroy(&l->lcp.auth.params);
@@ -1315,6 +1354,15 @@ AuthAsyncFinish(void *arg, int was_canceled)
 		AuthDataDestroy(auth);
 		return;
 	}
+	if (auth->status == AUTH_STATUS_SUCCESS)
+		SessEventPost(SESSEV_AUTH_SUCCESS, l, NULL, NULL);
+	else if (auth->status == AUTH_STATUS_FAIL) {
+		char	buf[64];
+
+		SessEventPost(SESSEV_AUTH_FAIL, l, NULL, "%s",
+		    auth->reply_message ? auth->reply_message :
+		    AuthFailMsg(auth, buf, sizeof(buf)));
+	}
 	auth->finish(l, auth);
 }
 
@@ -1748,6 +1796,7 @@ AuthTimeout(void *arg)
 {
 	Link l = (Link) arg;
 
+	TraceLink(l);
 	Log(LG_AUTH, ("[%s] %s: authorization timer expired", Pref(&l->lcp.fsm), Fsm(&l->lcp.fsm)));
 	AuthStop(l);
 	LcpAuthResult(l, FALSE);
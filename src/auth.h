@@ -262,6 +262,10 @@ struct authdata {
 	void    (*finish) (Link l, struct authdata *auth);	/* Finish handler */
 	int	drop_user;		/* RAD_MPD_DROP_USER value sent by
 					 * RADIUS server */
+	struct timespec started;	/* When auth thread was started */
+	u_int64_t run;			/* EventNow() when backends started */
+	u_int64_t done;			/* EventNow() when backends returned */
+	int	trace;			/* Log options of traced session */
 	struct {
 		struct rad_handle *handle;	/* the RADIUS handle */
 	}	radius;
@@ -0,0 +1,414 @@
+
+/*
+ * batch.c
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "batch.h"
+#include "command.h"
+#include "console.h"
+#include "util.h"
+
+/*
+ * DEFINITIONS
+ */
+
+  /*
+   * Batch of commands, one per line, with context switching commands
+   * like "link X" applying to the lines below them. Commands are run
+   * in chunks of at most BATCH_CHUNK commands and BATCH_SLICE ms with
+   * gGiantMutex held, and the lock is given away between the chunks:
+   * the event loop runs console batches from a timer, web workers
+   * unlock it. Commands have their own context and console session,
+   * so their output is kept with their results instead of written.
+   *
+   * A dry run only resolves commands and checks their context, the
+   * context switching commands are the only ones run.
+   */
+
+  struct batchres {
+    int			line;		/* In the script */
+    int			status;		/* CMD_ERR_* or 0 */
+    const char		*cmd;		/* Points into the script copy */
+    char		*error;
+    char		*output;
+  };
+
+  struct batch {
+    struct console_session	cs;	/* Commands run in its context */
+    char			*script;
+    struct batchres		*res;
+    int				num;
+    int				next;	/* Command to run next */
+    u_char			dry_run;
+    int				ok;
+    int				failed;
+    int				chunks;
+    u_int64_t			usec;	/* Spent running, lock held */
+    char			out[BATCH_MAX_OUTPUT];	/* Of the command */
+    size_t			outlen;
+    u_char			outlost;
+    void			(*done)(Batch b, void *arg);
+    void			*arg;
+    struct pppTimer		timer;
+  };
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static void	BatchExec(Batch b, struct batchres *r);
+  static void	BatchTimeout(void *arg);
+  static void	BatchConsoleDone(Batch b, void *arg);
+  static void	BatchSessionWrite(ConsoleSession cs, const char *fmt, ...);
+  static void	BatchSessionWriteV(ConsoleSession cs, const char *fmt,
+		  va_list vl);
+  static void	BatchSessionPrompt(ConsoleSession cs);
+  static const char	*BatchStatus(int status);
+
+/*
+ * BatchCreate()
+ *
+ * Split script into commands. Empty lines and lines starting
+ * with '#' are skipped.
+ */
+
+Batch
+BatchCreate(const char *script, int priv, int dry_run)
+{
+    Batch	b;
+    char	*tmp, *line, *p;
+    int		n, k;
+
+    b = Malloc(MB_CMD, sizeof(*b));
+    b->cs.cookie = b;
+    b->cs.close = NULL;
+    b->cs.write = BatchSessionWrite;
+    b->cs.writev = BatchSessionWriteV;
+    b->cs.prompt = BatchSessionPrompt;
+    b->cs.context.cs = &b->cs;
+    b->cs.context.priv = priv;
+    b->dry_run = dry_run;
+
+    b->script = Mstrdup(MB_CMD, script);
+    for (n = 1, p = b->script; *p != '\0'; p++) {
+	if (*p == '\n')
+	    n++;
+    }
+    b->res = Malloc(MB_CMD, n * sizeof(*b->res));
+    for (k = 1, tmp = b->script; (line = strsep(&tmp, "\n")) != NULL; k++) {
+	line += strspn(line, " \t");
+	if ((p = strchr(line, '\r')) != NULL)
+	    *p = '\0';
+	if (*line == '\0' || *line == '#')
+	    continue;
+	b->res[b->num].line = k;
+	b->res[b->num].cmd = line;
+	b->num++;
+    }
+    return (b);
+}
+
+/*
+ * BatchRun()
+ *
+ * Run next chunk of commands, gGiantMutex held. Returns non-zero
+ * when all are done, then the context is released already.
+ */
+
+int
+BatchRun(Batch b)
+{
+    Context	ctx = &b->cs.context;
+    u_int64_t	start = EventNow(), now = start;
+    int		n;
+
+    /* The lock was given away since the last chunk */
+    if (ctx->lnk && ctx->lnk->dead)
+	RESETREF(ctx->lnk, NULL);
+    if (ctx->bund && ctx->bund->dead)
+	RESETREF(ctx->bund, NULL);
+    if (ctx->rep && ctx->rep->dead)
+	RESETREF(ctx->rep, NULL);
+
+    for (n = 0; b->next < b->num && n < BATCH_CHUNK &&
+	    now - start < BATCH_SLICE * 1000; n++) {
+	BatchExec(b, &b->res[b->next++]);
+	now = EventNow();
+    }
+    b->chunks++;
+    b->usec += now - start;
+    if (b->next < b->num)
+	return (0);
+    RESETREF(ctx->lnk, NULL);
+    RESETREF(ctx->bund, NULL);
+    RESETREF(ctx->rep, NULL);
+    return (1);
+}
+
+/*
+ * BatchExec()
+ */
+
+static void
+BatchExec(Batch b, struct batchres *r)
+{
+    Context	ctx = &b->cs.context;
+    char	line[MAX_CONSOLE_LINE];
+    char	*av[MAX_CONSOLE_ARGS];
+    int		ac;
+
+    Log2(LG_CONSOLE, ("[%s] BATCH: %s",
+	ctx->lnk ? ctx->lnk->name : (ctx->bund ? ctx->bund->name : ""),
+	r->cmd));
+    ctx->errmsg[0] = 0;
+    b->outlen = 0;
+    b->outlost = 0;
+    if (strlcpy(line, r->cmd, sizeof(line)) >= sizeof(line)) {
+	r->status = CMD_ERR_OTHER;
+	strlcpy(ctx->errmsg, "Line too long", sizeof(ctx->errmsg));
+    } else {
+	ac = ParseLine(line, av, sizeof(av) / sizeof(*av), 0);
+	if (b->dry_run)
+	    r->status = CheckCommand(ctx, gCommands, ac,
+		(const char *const *)av);
+	else
+	    r->status = DoCommandTab(ctx, gCommands, ac,
+		(const char *const *)av);
+    }
+    if (r->status == 0)
+	b->ok++;
+    else {
+	b->failed++;
+	r->error = Mstrdup(MB_CMD, r->status == CMD_ERR_OTHER ?
+	    ctx->errmsg : BatchStatus(r->status));
+    }
+    if (b->outlen > 0) {
+	r->output = Malloc(MB_CMD, b->outlen + 1);
+	memcpy(r->output, b->out, b->outlen);
+    }
+}
+
+/*
+ * BatchStart()
+ *
+ * Run batch from the event loop, a chunk per timer event, and call
+ * "done" when finished.
+ */
+
+void
+BatchStart(Batch b, void (*done)(Batch b, void *arg), void *arg)
+{
+    b->done = done;
+    b->arg = arg;
+    TimerInit(&b->timer, "Batch", 0, BatchTimeout, b);
+    TimerStart(&b->timer);
+}
+
+/*
+ * BatchTimeout()
+ */
+
+static void
+BatchTimeout(void *arg)
+{
+    Batch	b = arg;
+
+    if (BatchRun(b))
+	(*b->done)(b, b->arg);
+    else
+	TimerStart(&b->timer);
+}
+
+/*
+ * BatchWrite()
+ *
+ * Write results as JSON. Needs no lock after BatchRun() is done.
+ */
+
+void
+BatchWrite(Batch b, FILE *f)
+{
+    struct batchres	*r;
+    int			k;
+
+    fprintf(f, "{\"dry_run\": %s, \"commands\": %d, \"ok\": %d, "
+	"\"failed\": %d, \"chunks\": %d, \"usec\": %llu,\n\"results\": [",
+	b->dry_run ? "true" : "false", b->num, b->ok, b->failed, b->chunks,
+	(unsigned long long)b->usec);
+    for (k = 0; k < b->next; k++) {
+	r = &b->res[k];
+	fprintf(f, "%s{\"line\": %d, \"command\": ", k ? ",\n" : "\n",
+	    r->line);
+	JSONString(f, r->cmd);
+	fprintf(f, ", \"status\": %d", r->status);
+	if (r->error != NULL) {
+	    fprintf(f, ", \"error\": ");
+	    JSONString(f, r->error);
+	}
+	if (r->output != NULL) {
+	    fprintf(f, ", \"output\": ");
+	    JSONString(f, r->output);
+	}
+	fprintf(f, "}");
+    }
+    fprintf(f, "\n]}\n");
+}
+
+/*
+ * BatchDestroy()
+ *
+ * Called with gGiantMutex held, unless BatchRun() is done.
+ */
+
+void
+BatchDestroy(Batch b)
+{
+    int		k;
+
+    TimerStop(&b->timer);
+    RESETREF(b->cs.context.lnk, NULL);
+    RESETREF(b->cs.context.bund, NULL);
+    RESETREF(b->cs.context.rep, NULL);
+    for (k = 0; k < b->next; k++) {
+	Freee(b->res[k].error);
+	Freee(b->res[k].output);
+    }
+    Freee(b->res);
+    Freee(b->script);
+    Freee(b);
+}
+
+/*
+ * BatchCommand()
+ *
+ * Run commands from file. The console is free while they run,
+ * results are written when all are done.
+ */
+
+int
+BatchCommand(Context ctx, int ac, const char *const av[], const void *arg)
+{
+    ConsoleSession	cs = ctx->cs;
+    Batch		b;
+    FILE		*fp;
+    char		*buf;
+    size_t		len;
+    int			dry_run = 0;
+
+    (void)arg;
+
+    if (ac == 2 && strcasecmp(av[0], "dry-run") == 0)
+	dry_run = 1;
+    else if (ac != 1)
+	return (-1);
+    /* Web and batch sessions have no close, results need a console */
+    if (cs == NULL || cs->close == NULL)
+	Error("Batch can be run from console only");
+    if (cs->batch != NULL)
+	Error("Batch is already running");
+
+    if ((fp = fopen(av[ac - 1], "r")) == NULL)
+	Error("%s: %s", av[ac - 1], strerror(errno));
+    buf = Malloc(MB_CMD, BATCH_MAX_SCRIPT + 1);
+    len = fread(buf, 1, BATCH_MAX_SCRIPT + 1, fp);
+    fclose(fp);
+    if (len > BATCH_MAX_SCRIPT) {
+	Freee(buf);
+	Error("%s: larger than %d bytes", av[ac - 1], BATCH_MAX_SCRIPT);
+    }
+    buf[len] = '\0';
+    b = BatchCreate(buf, ctx->priv, dry_run);
+    Freee(buf);
+
+    Printf("Batch of %d commands started\r\n", b->num);
+    cs->batch = b;
+    BatchStart(b, BatchConsoleDone, cs);
+    return (0);
+}
+
+/*
+ * BatchConsoleDone()
+ */
+
+static void
+BatchConsoleDone(Batch b, void *arg)
+{
+    ConsoleSession	cs = arg;
+    FILE		*f;
+    char		*buf = NULL;
+    size_t		len = 0;
+
+    cs->batch = NULL;
+    if ((f = open_memstream(&buf, &len)) != NULL) {
+	BatchWrite(b, f);
+	if (fclose(f) == 0)
+	    cs->write(cs, "%s", buf);
+	free(buf);
+    }
+    BatchDestroy(b);
+    cs->prompt(cs);
+}
+
+/*
+ * BatchSessionWrite()
+ *
+ * Keep command output, what does not fit is dropped.
+ */
+
+static void
+BatchSessionWrite(ConsoleSession cs, const char *fmt, ...)
+{
+    va_list	vl;
+
+    va_start(vl, fmt);
+    BatchSessionWriteV(cs, fmt, vl);
+    va_end(vl);
+}
+
+static void
+BatchSessionWriteV(ConsoleSession cs, const char *fmt, va_list vl)
+{
+    Batch	b = cs->cookie;
+    int		n;
+
+    if (b->outlost)
+	return;
+    n = vsnprintf(b->out + b->outlen, sizeof(b->out) - b->outlen, fmt, vl);
+    if (n < 0 || (size_t)n >= sizeof(b->out) - b->outlen) {
+	b->outlen = sizeof(b->out) - 1;
+	b->outlost = 1;
+    } else
+	b->outlen += n;
+}
+
+static void
+BatchSessionPrompt(ConsoleSession cs)
+{
+    (void)cs;
+}
+
+/*
+ * BatchStatus()
+ */
+
+static const char *
+BatchStatus(int status)
+{
+    switch (status) {
+	case CMD_ERR_UNDEF:
+	    return ("Unknown command");
+	case CMD_ERR_AMBIG:
+	    return ("Ambiguous command");
+	case CMD_ERR_RECUR:
+	    return ("Recursion detected");
+	case CMD_ERR_NOCTX:
+	    return ("Incorrect context");
+	case CMD_ERR_OTHER:
+	    return ("Error");
+	default:
+	    return ("Usage error");
+    }
+}
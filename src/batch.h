@@ -0,0 +1,40 @@
+
+/*
+ * batch.h
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include "defs.h"
+#include <stdio.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  #define BATCH_CHUNK		100		/* Commands run at once */
+  #define BATCH_SLICE		10		/* Time run at once, ms */
+  #define BATCH_MAX_SCRIPT	(4 * 1024 * 1024)
+  #define BATCH_MAX_OUTPUT	4096		/* Output kept per command */
+
+  struct batch;
+  typedef struct batch	*Batch;
+
+/*
+ * FUNCTIONS
+ */
+
+  extern Batch	BatchCreate(const char *script, int priv, int dry_run);
+  extern int	BatchRun(Batch b);
+  extern void	BatchStart(Batch b, void (*done)(Batch b, void *arg),
+		  void *arg);
+  extern void	BatchWrite(Batch b, FILE *f);
+  extern void	BatchDestroy(Batch b);
+  extern int	BatchCommand(Context ctx, int ac, const char *const av[],
+		  const void *arg);
+
+#endif
+
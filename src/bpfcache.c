@@ -0,0 +1,320 @@
+
+/*
+ * bpfcache.c
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "bpfcache.h"
+#include "util.h"
+
+#ifdef USE_NG_BPF
+
+#include <pcap.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  /*
+   * Compiled filter programs are shared by all bundles. The cache is
+   * keyed by the expression text together with snaplen and netmask,
+   * as those are the only inputs of pcap_compile_nopcap().
+   * Failed compilations are cached too, so a broken filter referenced
+   * by many sessions is reported once and not recompiled every time.
+   */
+  struct bpfcache_ent {
+    char			*expr;		/* Filter expression */
+    int				snaplen;
+    u_int32_t			netmask;
+    int				error;		/* Compilation failed */
+    u_int			len;		/* Program length */
+    struct bpf_insn		*insns;		/* Optimized program */
+    TAILQ_ENTRY(bpfcache_ent)	lru;
+  };
+
+  typedef struct bpfcache_ent	*BpfCacheEnt;
+
+  struct bpfcache_stats {
+    u_int64_t	hits;
+    u_int64_t	misses;
+    u_int64_t	evictions;
+    u_int64_t	errors;
+  };
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static int		BpfCacheEntEqual(struct ghash *g, const void *item1,
+			  const void *item2);
+  static u_int32_t	BpfCacheEntHash(struct ghash *g, const void *item);
+  static void		BpfCacheEntFree(BpfCacheEnt e);
+  static void		BpfCacheTrim(u_int size);
+
+/*
+ * INTERNAL VARIABLES
+ */
+
+  static struct ghash			*gBpfCache;
+  static TAILQ_HEAD(bpfcache_ent_head, bpfcache_ent) gBpfCacheLru;
+  static pthread_mutex_t		gBpfCacheMutex;
+  static u_int				gBpfCacheSize = BPFCACHE_DEFAULT_SIZE;
+  static struct bpfcache_stats		gBpfCacheStats;
+
+/*
+ * BpfCacheInit()
+ */
+
+void
+BpfCacheInit(void)
+{
+    int ret = pthread_mutex_init(&gBpfCacheMutex, NULL);
+    if (ret != 0) {
+	Log(LG_ERR, ("Could not create BPF cache mutex: %d", ret));
+	exit(EX_UNAVAILABLE);
+    }
+    TAILQ_INIT(&gBpfCacheLru);
+    gBpfCache = ghash_create(NULL, 0, 0, MB_ACL, BpfCacheEntHash,
+	BpfCacheEntEqual, NULL, NULL);
+    if (gBpfCache == NULL) {
+	Log(LG_ERR, ("Could not create BPF cache"));
+	exit(EX_UNAVAILABLE);
+    }
+}
+
+/*
+ * BpfCacheCompile()
+ *
+ * Get compiled and optimized BPF program for the filter expression,
+ * compiling it only when it is not already cached.
+ *
+ * Returns the program length, copying the program into insns if it
+ * fits into maxlen instructions (like snprintf() does), or -1 if the
+ * expression can not be compiled.
+ */
+
+int
+BpfCacheCompile(const char *expr, int snaplen, u_int32_t netmask,
+	struct bpf_insn *insns, u_int maxlen)
+{
+    struct bpfcache_ent	key;
+    BpfCacheEnt		e;
+    struct bpf_program	pr;
+    int			len, cached = 1;
+
+    key.expr = __DECONST(char *, expr);
+    key.snaplen = snaplen;
+    key.netmask = netmask;
+
+    MUTEX_LOCK(gBpfCacheMutex);
+    if ((e = ghash_get(gBpfCache, &key)) != NULL) {
+	gBpfCacheStats.hits++;
+	TAILQ_REMOVE(&gBpfCacheLru, e, lru);
+	TAILQ_INSERT_HEAD(&gBpfCacheLru, e, lru);
+    } else {
+	gBpfCacheStats.misses++;
+	cached = 0;
+	e = Malloc(MB_ACL, sizeof(*e));
+	e->expr = Mstrdup(MB_ACL, expr);
+	e->snaplen = snaplen;
+	e->netmask = netmask;
+	/* libpcap compiler is not reentrant, keep it under our lock. */
+	if (pcap_compile_nopcap(snaplen, DLT_RAW, &pr, e->expr, 1, netmask)) {
+	    gBpfCacheStats.errors++;
+	    e->error = 1;
+	} else {
+	    e->len = pr.bf_len;
+	    e->insns = Mdup(MB_ACL, pr.bf_insns,
+		pr.bf_len * sizeof(struct bpf_insn));
+	    pcap_freecode(&pr);
+	}
+	if (gBpfCacheSize > 0) {
+	    BpfCacheTrim(gBpfCacheSize - 1);
+	    if (ghash_put(gBpfCache, e) == -1)
+		Perror("BPFCACHE: ghash_put");
+	    else {
+		TAILQ_INSERT_HEAD(&gBpfCacheLru, e, lru);
+		cached = 1;
+	    }
+	}
+    }
+
+    if (e->error) {
+	len = -1;
+    } else {
+	len = e->len;
+	if (e->len <= maxlen)
+	    memcpy(insns, e->insns, e->len * sizeof(struct bpf_insn));
+    }
+
+    /* Caching disabled or failed, use the result only once. */
+    if (!cached)
+	BpfCacheEntFree(e);
+    MUTEX_UNLOCK(gBpfCacheMutex);
+    return (len);
+}
+
+/*
+ * BpfCacheSetSize()
+ *
+ * Set maximal number of cached programs. Zero disables caching.
+ */
+
+void
+BpfCacheSetSize(u_int size)
+{
+    MUTEX_LOCK(gBpfCacheMutex);
+    gBpfCacheSize = size;
+    BpfCacheTrim(size);
+    MUTEX_UNLOCK(gBpfCacheMutex);
+}
+
+u_int
+BpfCacheGetSize(void)
+{
+    return (gBpfCacheSize);
+}
+
+/*
+ * BpfCacheFlush()
+ */
+
+void
+BpfCacheFlush(void)
+{
+    MUTEX_LOCK(gBpfCacheMutex);
+    BpfCacheTrim(0);
+    MUTEX_UNLOCK(gBpfCacheMutex);
+}
+
+/*
+ * BpfCacheStat()
+ */
+
+int
+BpfCacheStat(Context ctx, int ac, const char *const av[], const void *arg)
+{
+    struct bpfcache_stats	st;
+    u_int			count;
+
+    (void)ac;
+    (void)av;
+    (void)arg;
+
+    MUTEX_LOCK(gBpfCacheMutex);
+    st = gBpfCacheStats;
+    count = ghash_size(gBpfCache);
+    MUTEX_UNLOCK(gBpfCacheMutex);
+
+    Printf("BPF programs cache:\r\n");
+    Printf("\tSize           : %u\r\n", gBpfCacheSize);
+    Printf("\tEntries        : %u\r\n", count);
+    Printf("\tHits           : %llu\r\n", (unsigned long long)st.hits);
+    Printf("\tMisses         : %llu\r\n", (unsigned long long)st.misses);
+    Printf("\tEvictions      : %llu\r\n", (unsigned long long)st.evictions);
+    Printf("\tCompile errors : %llu\r\n", (unsigned long long)st.errors);
+    return (0);
+}
+
+/*
+ * BpfProgMerge()
+ *
+ * Join two BPF programs stored one after another into a program,
+ * that matches if any of them matches. Every "reject" of the first
+ * program is turned into a jump to the start of the second one.
+ * Returns length of the merged program or -1 if it is impossible.
+ */
+
+int
+BpfProgMerge(struct bpf_insn *prog, int len1, int len2)
+{
+    int		i;
+
+    if (len1 <= 0 || len2 <= 0 || len1 + len2 > BPF_MAXINSNS)
+	return (-1);
+
+    /* Return value must be known to find rejects. */
+    for (i = 0; i < len1; i++) {
+	if (BPF_CLASS(prog[i].code) == BPF_RET &&
+		BPF_RVAL(prog[i].code) != BPF_K)
+	    return (-1);
+    }
+
+    for (i = 0; i < len1; i++) {
+	if (BPF_CLASS(prog[i].code) == BPF_RET && prog[i].k == 0) {
+	    prog[i].code = BPF_JMP+BPF_JA;
+	    prog[i].jt = prog[i].jf = 0;
+	    prog[i].k = len1 - i - 1;
+	}
+    }
+    return (len1 + len2);
+}
+
+/*
+ * BpfCacheTrim()
+ *
+ * Evict least recently used programs until no more then size left.
+ * Called with cache mutex held.
+ */
+
+static void
+BpfCacheTrim(u_int size)
+{
+    BpfCacheEnt	e;
+
+    while (ghash_size(gBpfCache) > size &&
+	    (e = TAILQ_LAST(&gBpfCacheLru, bpfcache_ent_head)) != NULL) {
+	TAILQ_REMOVE(&gBpfCacheLru, e, lru);
+	ghash_remove(gBpfCache, e);
+	BpfCacheEntFree(e);
+	gBpfCacheStats.evictions++;
+    }
+}
+
+static void
+BpfCacheEntFree(BpfCacheEnt e)
+{
+    if (e->insns)
+	Freee(e->insns);
+    Freee(e->expr);
+    Freee(e);
+}
+
+static int
+BpfCacheEntEqual(struct ghash *g, const void *item1, const void *item2)
+{
+    const struct bpfcache_ent *e1 = (const struct bpfcache_ent *)item1;
+    const struct bpfcache_ent *e2 = (const struct bpfcache_ent *)item2;
+
+    (void)g;
+    return (e1->snaplen == e2->snaplen && e1->netmask == e2->netmask &&
+	strcmp(e1->expr, e2->expr) == 0);
+}
+
+/*
+ * BpfCacheEntHash()
+ *
+ * Fowler/Noll/Vo- hash over expression, snaplen and netmask.
+ */
+
+static u_int32_t
+BpfCacheEntHash(struct ghash *g, const void *item)
+{
+    const struct bpfcache_ent *e = (const struct bpfcache_ent *)item;
+    const u_char *s = (const u_char *)e->expr;
+    u_int32_t hash = 0x811c9dc5;
+
+    (void)g;
+    while (*s) {
+	hash += (hash<<1) + (hash<<4) + (hash<<7) + (hash<<8) + (hash<<24);
+	hash ^= (u_int32_t)*s++;
+    }
+    hash ^= (u_int32_t)e->snaplen;
+    hash += (hash<<1) + (hash<<4) + (hash<<7) + (hash<<8) + (hash<<24);
+    hash ^= e->netmask;
+    return (hash);
+}
+
+#endif /* USE_NG_BPF */
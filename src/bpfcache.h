@@ -0,0 +1,37 @@
+
+/*
+ * bpfcache.h
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#ifndef _BPFCACHE_H_
+#define _BPFCACHE_H_
+
+#ifdef USE_NG_BPF
+
+#include <net/bpf.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  #define BPFCACHE_DEFAULT_SIZE	256	/* Default number of cached programs */
+  #define BPFCACHE_MAX_SIZE	65536
+
+/*
+ * FUNCTIONS
+ */
+
+  extern void	BpfCacheInit(void);
+  extern int	BpfCacheCompile(const char *expr, int snaplen,
+		  u_int32_t netmask, struct bpf_insn *insns, u_int maxlen);
+  extern void	BpfCacheSetSize(u_int size);
+  extern u_int	BpfCacheGetSize(void);
+  extern void	BpfCacheFlush(void);
+  extern int	BpfCacheStat(Context ctx, int ac, const char *const av[], const void *arg);
+  extern int	BpfProgMerge(struct bpf_insn *prog, int len1, int len2);
+
+#endif /* USE_NG_BPF */
+
+#endif
@@ -21,6 +21,8 @@
 #include "log.h"
 #include "util.h"
 #include "input.h"
+#include "sessevent.h"
+#include "trace.h"
 
 #include <netgraph.h>
 #include <netgraph/ng_message.h>
@@ -301,6 +303,7 @@ BundJoin(Link l)
     }
     l->joined_bund = 1;
     b->n_up++;
+    SessEventPost(SESSEV_BUND_JOIN, l, b, NULL);
 
     LinkResetStats(l);
 
@@ -398,6 +401,7 @@ BundLeave(Link l)
     assert(b->n_up > 0);
   
     Log(LG_LINK, ("[%s] Link: Leave bundle \"%s\"", l->name, b->name));
+    SessEventPost(SESSEV_BUND_LEAVE, l, b, NULL);
 
     AuthAccountStart(l, AUTH_ACCT_STOP);
 
@@ -501,6 +505,7 @@ BundMsg(int type, void *arg)
 	UNREF(b);
 	return;
     }
+    TraceBund(b);
     Log(LG_BUND, ("[%s] Bundle: %s event in state %s",
 	b->name, MsgName(type), b->open ? "OPENED" : "CLOSED"));
     TimerStop(&b->reOpenTimer);
@@ -687,11 +692,36 @@ BundNcpsFinish(Bund b, int proto)
     }
 }
 
+/*
+ * BundSetupMark()
+ *
+ * Mark session setup milestone on all links of the bundle.
+ */
+
+void
+BundSetupMark(Bund b, int m)
+{
+    int		k;
+
+    for (k = 0; k < NG_PPP_MAX_LINKS; k++) {
+	if (b->links[k])
+	    LinkSetupMark(b->links[k], m, 0);
+    }
+}
+
 void
 BundNcpsJoin(Bund b, int proto)
 {
 	IfaceState	iface = &b->iface;
 
+	if (proto == NCP_IPCP)
+		SessEventPost(SESSEV_NCP_UP, NULL, b, "ipcp %s",
+		    inet_ntoa(b->ipcp.peer_addr));
+	else if (proto == NCP_IPV6CP)
+		SessEventPost(SESSEV_NCP_UP, NULL, b, "ipv6cp");
+	if (proto != NCP_NONE)
+		BundSetupMark(b, LINK_SETUP_NCP_UP);
+
 	if (iface->dod) {
 		if (iface->ip_up) {
 			iface->ip_up = 0;
@@ -760,6 +790,12 @@ void
 BundNcpsLeave(Bund b, int proto)
 {
 	IfaceState	iface = &b->iface;
+
+	if (proto == NCP_IPCP)
+		SessEventPost(SESSEV_NCP_DOWN, NULL, b, "ipcp");
+	else if (proto == NCP_IPV6CP)
+		SessEventPost(SESSEV_NCP_DOWN, NULL, b, "ipv6cp");
+
 	switch(proto) {
 	case NCP_IPCP:
 		if (iface->ip_up) {
@@ -1111,6 +1147,7 @@ BundCreate(Context ctx, int ac, const char *const av[], const void *arg)
 	    LengthenArray(&gBundles, sizeof(*gBundles), &gNumBundles, MB_BUND);
 
 	b->id = k;
+	b->hookgen = NgFuncHookGen();
 	gBundles[k] = b;
 	REF(b);
 
@@ -1219,6 +1256,7 @@ BundInst(Bund bt, const char *name, int tmpl, int stay)
 	LengthenArray(&gBundles, sizeof(*gBundles), &gNumBundles, MB_BUND);
 
     b->id = k;
+    b->hookgen = NgFuncHookGen();
     if (name)
 	strlcpy(b->name, name, sizeof(b->name));
     else
@@ -1363,7 +1401,7 @@ BundStat(Context ctx, int ac, const char *const av[], const void *arg)
 
     if (!sb->tmpl) {
 	/* Show stats */
-	BundUpdateStats(sb);
+	BundUpdateStats(sb, NGSTATS_SHOW);
 	Printf("Traffic stats:\r\n");
 
 	Printf("\tInput octets   : %llu\r\n", (unsigned long long)sb->stats.recvOctets);
@@ -1384,7 +1422,7 @@ BundStat(Context ctx, int ac, const char *const av[], const void *arg)
  */
 
 void
-BundUpdateStats(Bund b)
+BundUpdateStats(Bund b, int consumer)
 {
 #ifndef NG_PPP_STATS64
   struct ng_ppp_link_stat	stats;
@@ -1398,7 +1436,7 @@ BundUpdateStats(Bund b)
 #endif
 
 #ifndef NG_PPP_STATS64
-  if (NgFuncGetStats(b, l, &stats) != -1) {
+  if (NgStatsGet(b, l, consumer, &stats) != -1) {
     b->stats.xmitFrames += abs(stats.xmitFrames - b->oldStats.xmitFrames);
     b->stats.xmitOctets += abs(stats.xmitOctets - b->oldStats.xmitOctets);
     b->stats.recvFrames += abs(stats.recvFrames - b->oldStats.recvFrames);
@@ -1411,7 +1449,7 @@ BundUpdateStats(Bund b)
   }
 
 #else
-    NgFuncGetStats64(b, l, &b->stats);
+    NgStatsGet(b, l, consumer, &b->stats);
 #endif
 }
 
@@ -1425,10 +1463,10 @@ BundUpdateStatsTimer(void *cookie)
     Bund	b = (Bund)cookie;
     int		k;
   
-    BundUpdateStats(b);
+    BundUpdateStats(b, NGSTATS_UPDATE);
     for (k = 0; k < NG_PPP_MAX_LINKS; k++) {
 	if (b->links[k] && b->links[k]->joined_bund)
-	    LinkUpdateStats(b->links[k]);
+	    LinkUpdateStats(b->links[k], NGSTATS_UPDATE);
     }
 }
 
@@ -1440,12 +1478,30 @@ void
 BundResetStats(Bund b)
 {
   NgFuncClrStats(b, NG_PPP_BUNDLE_LINKNUM);
+  NgStatsInvalidate(b, NG_PPP_BUNDLE_LINKNUM);
   memset(&b->stats, 0, sizeof(b->stats));
 #ifndef NG_PPP_STATS64
   memset(&b->oldStats, 0, sizeof(b->oldStats));
 #endif
 }
 
+/*
+ * BundChanged()
+ *
+ * Bundle state is a part of every its link session state.
+ */
+
+void
+BundChanged(Bund b)
+{
+    int		k;
+
+    for (k = 0; k < NG_PPP_MAX_LINKS; k++) {
+	if (b->links[k] != NULL)
+	    LinkChanged(b->links[k]);
+    }
+}
+
 /*
  * BundShowLinks()
  */
@@ -1570,11 +1626,7 @@ BundBmTimeout(void *arg)
 	
 	    /* Get updated link traffic statistics */
 	    oldStats = l->bm.idleStats;
-#ifndef NG_PPP_STATS64
-	    NgFuncGetStats(l->bund, l->bundleIndex, &l->bm.idleStats);
-#else
-	    NgFuncGetStats64(l->bund, l->bundleIndex, &l->bm.idleStats);
-#endif
+	    NgStatsGet(l->bund, l->bundleIndex, NGSTATS_BM, &l->bm.idleStats);
 	    b->bm.traffic[0][0] += l->bm.idleStats.recvOctets - oldStats.recvOctets;
 	    b->bm.traffic[1][0] += l->bm.idleStats.xmitOctets - oldStats.xmitOctets;
 	}
@@ -1710,7 +1762,8 @@ BundNgInit(Bund b)
 	b->name, b->iface.ifname));
 
     /* Create new PPP node */
-    snprintf(b->hook, sizeof(b->hook), "b%d", b->id);
+    NgFuncHookToken(b->hook, sizeof(b->hook), MPD_HOOK_BYPASS,
+	b->id, b->hookgen);
     memset(&mp, 0, sizeof(mp));
     strcpy(mp.type, NG_PPP_NODE_TYPE);
     strcpy(mp.ourhook, b->hook);
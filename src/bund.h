@@ -22,6 +22,7 @@
 #include "msg.h"
 #include "auth.h"
 #include "command.h"
+#include "ngstats.h"
 #include <netgraph/ng_message.h>
 
 /*
@@ -127,6 +128,7 @@
     u_short		n_up;			/* Number of links joined the bundle */
     ng_ID_t		nodeID;			/* ID of ppp node */
     char		hook[NG_HOOKSIZ];	/* session hook name */
+    u_int16_t		hookgen;		/* Generation of hook names */
     MsgHandler		msgs;			/* Bundle events */
     int			refs;			/* Number of references */
 
@@ -140,6 +142,7 @@
     struct bundbm	bm;		/* Bandwidth management state */
     struct bundconf	conf;		/* Configuration for this bundle */
     struct ng_ppp_link_stat64	stats;	/* Statistics for this bundle */
+    struct ngstats_snap	statsSnap;	/* Last ng_ppp stats read */
 #ifndef NG_PPP_STATS64
     struct ng_ppp_link_stat oldStats;	/* Previous stats for 64bit emulation */
     struct pppTimer     statsUpdateTimer;       /* update Timer */
@@ -188,9 +191,10 @@
   extern Bund	BundInst(Bund bt, const char *name, int tmpl, int stay);
   extern Bund	BundFind(const char *name);
   extern void	BundShutdown(Bund b);
-  extern void   BundUpdateStats(Bund b);
+  extern void   BundUpdateStats(Bund b, int consumer);
   extern void	BundUpdateStatsTimer(void *cookie);
   extern void	BundResetStats(Bund b);
+  extern void	BundChanged(Bund b);
 
   extern int	BundJoin(Link l);
   extern void	BundLeave(Link l);
@@ -198,6 +202,7 @@
   extern void	BundNcpsLeave(Bund b, int proto);
   extern void	BundNcpsStart(Bund b, int proto);
   extern void	BundNcpsFinish(Bund b, int proto);
+  extern void	BundSetupMark(Bund b, int m);
   extern void	BundOpenLinks(Bund b);
   extern void	BundCloseLinks(Bund b);
   extern int	BundCreateOpenLink(Bund b, int n);
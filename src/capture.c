@@ -0,0 +1,726 @@
+
+/*
+ * capture.c
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "capture.h"
+#include "util.h"
+
+/*
+ * DEFINITIONS
+ */
+
+  /*
+   * Control frames are copied with a timestamp and the link name into
+   * a bounded ring and written by a writer thread to a pcapng file,
+   * rotated by size. Callers never wait for the file: when the ring
+   * is full frames are dropped and counted. The ring mutex is held
+   * only to copy a frame in or a batch out.
+   *
+   * PPP frames are written as LINKTYPE_PPP_WITH_DIR, PPPoE discovery
+   * frames as Ethernet and L2TP control messages, which ng_l2tp gives
+   * us without the header, with a rebuilt L2TP header as Wireshark
+   * upper PDU. The link name is stored in the packet comment.
+   */
+
+  #define CAPT_SNAPLEN		1600	/* Max bytes kept of frame */
+  #define CAPT_RING		512	/* Frames waiting for the writer */
+  #define CAPT_BATCH		16	/* Frames written at once */
+  #define CAPT_MAX_LINKS	8	/* Names in link filter */
+  #define CAPT_BUFSIZE		65536	/* File buffer */
+
+  #define CAPT_DEF_SIZE		16	/* File size, MB */
+  #define CAPT_DEF_FILES	4	/* Rotated files kept */
+
+  /* pcapng file interfaces */
+  enum {
+    CAPT_IF_PPP,
+    CAPT_IF_ETHER,
+    CAPT_IF_L2TP,
+    CAPT_IF_NUM
+  };
+
+  /* pcapng blocks */
+  #define PCAPNG_SHB		0x0A0D0D0A
+  #define PCAPNG_IDB		0x00000001
+  #define PCAPNG_EPB		0x00000006
+  #define PCAPNG_MAGIC		0x1A2B3C4D
+  #define PCAPNG_OPT_END	0
+  #define PCAPNG_OPT_COMMENT	1
+  #define PCAPNG_OPT_IFNAME	2
+
+  #define LINKTYPE_ETHERNET	1
+  #define LINKTYPE_PPP_WITH_DIR	204
+  #define LINKTYPE_UPPER_PDU	252
+
+  #define EXP_PDU_TAG_END	0
+  #define EXP_PDU_TAG_DISSECTOR	12
+
+  #define PAD4(x)		(((x) + 3) & ~3)
+
+  /* Queued frame */
+  struct captrec
+  {
+    struct timeval	when;
+    u_char		iface;
+    u_short		caplen;
+    u_int		len;			/* Original length */
+    char		name[LINK_MAX_NAME];
+    u_char		data[CAPT_SNAPLEN];
+  };
+
+  struct captstats
+  {
+    u_int64_t	frames;
+    u_int64_t	octets;
+    u_int64_t	dropped;		/* Ring was full */
+    u_int64_t	batches;
+    u_int	rotated;
+    u_int	errors;			/* File write errors */
+  };
+
+  enum {
+    CAPT_CMD_START,
+    CAPT_CMD_STOP,
+    CAPT_CMD_PROTO,
+    CAPT_CMD_LINK
+  };
+
+  /* Protocol option descriptor */
+  struct captopt
+  {
+    int		mask;
+    const char	*name;
+    const char	*desc;
+  };
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static int	CaptureCommand(Context ctx, int ac, const char *const av[], const void *arg);
+  static int	CaptureStart(const char *file, int size, int files);
+  static void	CaptureStop(void);
+  static int	CaptureProto(int proto);
+  static void	CaptureEnqueue(int iface, const char *name, const u_char *hdr,
+		    int hlen, const u_char *data, int len);
+  static FILE	*CaptureOpen(void);
+  static void	CaptureRotate(void);
+  static int	CaptureWriteHeader(FILE *fp);
+  static int	CaptureWriteFrame(FILE *fp, const struct captrec *r);
+  static void	*CaptureWriter(void *arg);
+
+/*
+ * GLOBAL VARIABLES
+ */
+
+  int	gCapture = 0;
+
+  const struct cmdtab CaptureCmds[] = {
+    { "start {file} [{MB} [{files}]]",	"Start capture to file",
+	CaptureCommand, NULL, 2, (void *) CAPT_CMD_START },
+    { "stop",				"Stop capture",
+	CaptureCommand, NULL, 2, (void *) CAPT_CMD_STOP },
+    { "proto [+/-{proto} ...]",		"Set/view captured protocols",
+	CaptureCommand, NULL, 2, (void *) CAPT_CMD_PROTO },
+    { "link [{name} ...]",		"Capture only these links",
+	CaptureCommand, NULL, 2, (void *) CAPT_CMD_LINK },
+    { NULL, NULL, NULL, NULL, 0, NULL },
+  };
+
+/*
+ * INTERNAL VARIABLES
+ */
+
+  static const struct captopt	gCaptOptList[] = {
+    { CAPT_LCP,		"lcp",		"LCP and LQR" },
+    { CAPT_AUTH,	"auth",		"PAP, CHAP and EAP" },
+    { CAPT_NCP,		"ncp",		"IPCP and IPV6CP" },
+    { CAPT_CCP,		"ccp",		"CCP" },
+    { CAPT_ECP,		"ecp",		"ECP" },
+    { CAPT_PPPOE,	"pppoe",	"PPPoE discovery" },
+    { CAPT_L2TP,	"l2tp",		"L2TP control" },
+  };
+
+  #define NUM_CAPT_OPTS	(sizeof(gCaptOptList) / sizeof(*gCaptOptList))
+
+  static int		gCaptProtos = CAPT_DEFAULT;
+  static char		gCaptLinks[CAPT_MAX_LINKS][LINK_MAX_NAME];
+  static int		gCaptNumLinks;
+  static char		gCaptFile[PATH_MAX];
+  static off_t		gCaptSize;
+  static int		gCaptFiles;
+
+  static pthread_mutex_t	gCaptMutex;
+  static pthread_cond_t		gCaptCond;
+  static pthread_t		gCaptThread;
+  static int			gCaptUp;
+  static int			gCaptStopping;		/* Mutex */
+  static int			gCaptFailed;		/* Mutex */
+  static struct captrec		*gCaptRing;		/* Mutex */
+  static u_int			gCaptHead, gCaptTail;	/* Mutex */
+  static struct captstats	gCaptStats;		/* Mutex */
+  static FILE			*gCaptFp;		/* Writer only */
+  static off_t			gCaptWritten;		/* Writer only */
+  static struct captrec		gCaptBatch[CAPT_BATCH];	/* Writer only */
+
+/*
+ * CaptureCommand()
+ */
+
+static int
+CaptureCommand(Context ctx, int ac, const char *const av[], const void *arg)
+{
+    u_int	k;
+    int		bits, add, size = CAPT_DEF_SIZE, files = CAPT_DEF_FILES;
+    const char	*s;
+
+    switch ((intptr_t)arg) {
+    case CAPT_CMD_START:
+	if (ac < 1 || ac > 3)
+	    return(-1);
+	if (gCaptUp)
+	    Error("Capture is already running");
+	if (ac > 1 && ((size = atoi(av[1])) <= 0 || size > 4096))
+	    Error("Incorrect capture file size");
+	if (ac > 2 && ((files = atoi(av[2])) < 0 || files > 100))
+	    Error("Incorrect number of capture files");
+	if (CaptureStart(av[0], size, files) < 0)
+	    Error("Can't start capture to %s: %s", av[0], strerror(errno));
+	break;
+
+    case CAPT_CMD_STOP:
+	if (ac != 0)
+	    return(-1);
+	CaptureStop();
+	break;
+
+    case CAPT_CMD_PROTO:
+	if (ac == 0) {
+	    Printf("    %-8s  %-7s  %s\r\n", "Protocol", "Enabled", "Description");
+	    for (k = 0; k < NUM_CAPT_OPTS; k++) {
+		Printf("    %-8s  %-7s  %s\r\n", gCaptOptList[k].name,
+		    (gCaptProtos & gCaptOptList[k].mask) ? "Yes" : "No",
+		    gCaptOptList[k].desc);
+	    }
+	    break;
+	}
+	for (; ac > 0; ac--, av++) {
+	    s = *av;
+	    add = (*s != '-');
+	    if (*s == '+' || *s == '-')
+		s++;
+	    for (k = 0; k < NUM_CAPT_OPTS &&
+		strcasecmp(s, gCaptOptList[k].name); k++);
+	    if (k < NUM_CAPT_OPTS)
+		bits = gCaptOptList[k].mask;
+	    else if (strcasecmp(s, "all") == 0)
+		bits = CAPT_DEFAULT;
+	    else
+		Error("\"%s\" is unknown protocol", s);
+	    if (add)
+		gCaptProtos |= bits;
+	    else
+		gCaptProtos &= ~bits;
+	}
+	if (gCaptUp) {
+	    /* Writer has no file after failed rotation */
+	    MUTEX_LOCK(gCaptMutex);
+	    if (!gCaptFailed)
+		gCapture = gCaptProtos;
+	    MUTEX_UNLOCK(gCaptMutex);
+	}
+	break;
+
+    case CAPT_CMD_LINK:
+	if (ac > CAPT_MAX_LINKS)
+	    Error("No more than %d links", CAPT_MAX_LINKS);
+	for (k = 0; k < (u_int)ac; k++)
+	    strlcpy(gCaptLinks[k], av[k], sizeof(gCaptLinks[k]));
+	gCaptNumLinks = ac;
+	break;
+
+    default:
+	return(-1);
+    }
+    return(0);
+}
+
+/*
+ * CaptureStart()
+ */
+
+static int
+CaptureStart(const char *file, int size, int files)
+{
+    int	ret;
+
+    strlcpy(gCaptFile, file, sizeof(gCaptFile));
+    gCaptSize = (off_t)size * 1024 * 1024;
+    gCaptFiles = files;
+    if ((gCaptFp = CaptureOpen()) == NULL)
+	return (-1);
+
+    if ((ret = pthread_mutex_init(&gCaptMutex, NULL)) != 0 ||
+	    (ret = pthread_cond_init(&gCaptCond, NULL)) != 0) {
+	fclose(gCaptFp);
+	errno = ret;
+	return (-1);
+    }
+    gCaptRing = Malloc(MB_LOG, CAPT_RING * sizeof(*gCaptRing));
+    gCaptHead = gCaptTail = 0;
+    gCaptStopping = 0;
+    gCaptFailed = 0;
+    memset(&gCaptStats, 0, sizeof(gCaptStats));
+    if ((ret = pthread_create(&gCaptThread, NULL, CaptureWriter, NULL)) != 0) {
+	fclose(gCaptFp);
+	Freee(gCaptRing);
+	pthread_cond_destroy(&gCaptCond);
+	pthread_mutex_destroy(&gCaptMutex);
+	errno = ret;
+	return (-1);
+    }
+    gCaptUp = 1;
+    gCapture = gCaptProtos;
+    Log(LG_ALWAYS, ("Capture: started to %s", gCaptFile));
+    return (0);
+}
+
+/*
+ * CaptureStop()
+ *
+ * Let the writer write the ring out and wait for it.
+ */
+
+static void
+CaptureStop(void)
+{
+    if (!gCaptUp)
+	return;
+    gCapture = 0;
+    MUTEX_LOCK(gCaptMutex);
+    gCaptStopping = 1;
+    pthread_cond_signal(&gCaptCond);
+    MUTEX_UNLOCK(gCaptMutex);
+    pthread_join(gCaptThread, NULL);
+    gCaptUp = 0;
+
+    if (gCaptFp != NULL) {
+	fclose(gCaptFp);
+	gCaptFp = NULL;
+    }
+    Freee(gCaptRing);
+    gCaptRing = NULL;
+    pthread_cond_destroy(&gCaptCond);
+    pthread_mutex_destroy(&gCaptMutex);
+    Log(LG_ALWAYS, ("Capture: stopped, %llu frames, %llu dropped",
+	(unsigned long long)gCaptStats.frames,
+	(unsigned long long)gCaptStats.dropped));
+}
+
+/*
+ * CaptureShutdown()
+ */
+
+void
+CaptureShutdown(void)
+{
+    CaptureStop();
+}
+
+/*
+ * CaptureProto()
+ *
+ * Captured protocol class of PPP protocol, 0 for data.
+ */
+
+static int
+CaptureProto(int proto)
+{
+    switch (proto) {
+    case PROTO_LCP:
+    case PROTO_LQR:
+	return (CAPT_LCP);
+    case PROTO_PAP:
+    case PROTO_SPAP:
+    case PROTO_CHAP:
+    case PROTO_EAP:
+	return (CAPT_AUTH);
+    case PROTO_IPCP:
+    case PROTO_IPV6CP:
+    case PROTO_ATCP:
+	return (CAPT_NCP);
+    case PROTO_CCP:
+    case PROTO_ICCP:
+	return (CAPT_CCP);
+    case PROTO_ECP:
+    case PROTO_IECP:
+	return (CAPT_ECP);
+    default:
+	return (0);
+    }
+}
+
+/*
+ * CapturePpp2()
+ *
+ * PPP frame without address, control and protocol fields.
+ */
+
+void
+CapturePpp2(const char *name, int dir, int proto, Mbuf bp)
+{
+    u_char	hdr[5];
+    int		k;
+
+    if ((gCapture & CaptureProto(proto)) == 0)
+	return;
+    if (gCaptNumLinks > 0) {
+	for (k = 0; k < gCaptNumLinks && strcmp(name, gCaptLinks[k]); k++);
+	if (k == gCaptNumLinks)
+	    return;
+    }
+    hdr[0] = dir;
+    hdr[1] = 0xff;
+    hdr[2] = 0x03;
+    hdr[3] = proto >> 8;
+    hdr[4] = proto & 0xff;
+    CaptureEnqueue(CAPT_IF_PPP, name, hdr, sizeof(hdr), MBDATA(bp), MBLEN(bp));
+}
+
+/*
+ * CapturePppoe2()
+ *
+ * PPPoE discovery frame with Ethernet header.
+ */
+
+void
+CapturePppoe2(const char *name, const u_char *buf, int len)
+{
+    CaptureEnqueue(CAPT_IF_ETHER, name, NULL, 0, buf, len);
+}
+
+/*
+ * CaptureL2tp2()
+ *
+ * L2TP control message as exchanged with ng_l2tp: session ID and
+ * AVPs. Tunnel ID is the one in the header, sequence numbers are
+ * not known here and are left zero.
+ */
+
+void
+CaptureL2tp2(const char *name, u_int16_t tun, const u_char *buf, int len)
+{
+    static const char	dissector[] = "l2tp_udp";
+    u_char		hdr[4 + PAD4(sizeof(dissector) - 1) + 4 + 12];
+    u_int16_t		v;
+    int			k = 0;
+
+    if (len < 2)
+	return;
+
+    /* Exported PDU tags */
+    v = htons(EXP_PDU_TAG_DISSECTOR);
+    memcpy(hdr + k, &v, 2);
+    v = htons(sizeof(dissector) - 1);
+    memcpy(hdr + k + 2, &v, 2);
+    memset(hdr + k + 4, 0, PAD4(sizeof(dissector) - 1));
+    memcpy(hdr + k + 4, dissector, sizeof(dissector) - 1);
+    k += 4 + PAD4(sizeof(dissector) - 1);
+    memset(hdr + k, 0, 4);
+    k += 4;
+
+    /* L2TP header: T, L, S bits, version 2 */
+    v = htons(0xc802);
+    memcpy(hdr + k, &v, 2);
+    v = htons(12 + len - 2);
+    memcpy(hdr + k + 2, &v, 2);
+    v = htons(tun);
+    memcpy(hdr + k + 4, &v, 2);
+    memcpy(hdr + k + 6, buf, 2);
+    memset(hdr + k + 8, 0, 4);
+    k += 12;
+
+    CaptureEnqueue(CAPT_IF_L2TP, name, hdr, k, buf + 2, len - 2);
+}
+
+/*
+ * CaptureEnqueue()
+ */
+
+static void
+CaptureEnqueue(int iface, const char *name, const u_char *hdr, int hlen,
+	const u_char *data, int len)
+{
+    struct captrec	*r;
+    struct timeval	now;
+    int			cap;
+
+    gettimeofday(&now, NULL);
+    MUTEX_LOCK(gCaptMutex);
+    if (gCaptHead - gCaptTail >= CAPT_RING) {
+	gCaptStats.dropped++;
+	MUTEX_UNLOCK(gCaptMutex);
+	return;
+    }
+    r = &gCaptRing[gCaptHead++ % CAPT_RING];
+    r->when = now;
+    r->iface = iface;
+    r->len = hlen + len;
+    strlcpy(r->name, name, sizeof(r->name));
+    if (hlen > 0)
+	memcpy(r->data, hdr, hlen);
+    cap = MIN(len, CAPT_SNAPLEN - hlen);
+    if (cap > 0)
+	memcpy(r->data + hlen, data, cap);
+    r->caplen = hlen + MAX(cap, 0);
+    pthread_cond_signal(&gCaptCond);
+    MUTEX_UNLOCK(gCaptMutex);
+}
+
+/*
+ * CaptureOpen()
+ */
+
+static FILE *
+CaptureOpen(void)
+{
+    FILE	*fp;
+
+    if ((fp = fopen(gCaptFile, "w")) == NULL)
+	return (NULL);
+    setvbuf(fp, NULL, _IOFBF, CAPT_BUFSIZE);
+    if (CaptureWriteHeader(fp) < 0) {
+	fclose(fp);
+	return (NULL);
+    }
+    gCaptWritten = ftello(fp);
+    return (fp);
+}
+
+/*
+ * CaptureRotate()
+ *
+ * Keep old files as file.1 ... file.N, newest first.
+ */
+
+static void
+CaptureRotate(void)
+{
+    char	from[PATH_MAX + 8], to[PATH_MAX + 8];
+    int		k;
+
+    fclose(gCaptFp);
+    for (k = gCaptFiles; k > 0; k--) {
+	if (k > 1)
+	    snprintf(from, sizeof(from), "%s.%d", gCaptFile, k - 1);
+	else
+	    strlcpy(from, gCaptFile, sizeof(from));
+	snprintf(to, sizeof(to), "%s.%d", gCaptFile, k);
+	(void)rename(from, to);
+    }
+    if ((gCaptFp = CaptureOpen()) == NULL)
+	Perror("Capture: can't reopen %s", gCaptFile);
+    MUTEX_LOCK(gCaptMutex);
+    if (gCaptFp == NULL) {
+	gCaptFailed = 1;
+	gCapture = 0;
+    }
+    gCaptStats.rotated++;
+    MUTEX_UNLOCK(gCaptMutex);
+}
+
+/*
+ * CaptureWriteHeader()
+ *
+ * Section header and interface description blocks.
+ */
+
+static int
+CaptureWriteHeader(FILE *fp)
+{
+    static const struct {
+	u_int16_t	linktype;
+	const char	*name;
+    } ifs[CAPT_IF_NUM] = {
+	{ LINKTYPE_PPP_WITH_DIR,	"ppp" },
+	{ LINKTYPE_ETHERNET,		"pppoe" },
+	{ LINKTYPE_UPPER_PDU,		"l2tp" },
+    };
+    u_int32_t	b[16];
+    int		k, n, olen;
+
+    /* Section header */
+    b[0] = PCAPNG_SHB;
+    b[1] = 28;
+    b[2] = PCAPNG_MAGIC;
+    b[3] = 1;				/* Version 1.0 */
+    b[4] = 0xffffffff;			/* Section length unknown */
+    b[5] = 0xffffffff;
+    b[6] = 28;
+    if (fwrite(b, 28, 1, fp) != 1)
+	return (-1);
+
+    /* Interface descriptions */
+    for (k = 0; k < CAPT_IF_NUM; k++) {
+	olen = strlen(ifs[k].name);
+	memset(b, 0, sizeof(b));
+	n = 16 + 4 + PAD4(olen) + 4 + 4;
+	b[0] = PCAPNG_IDB;
+	b[1] = n;
+	b[2] = ifs[k].linktype;
+	b[3] = CAPT_SNAPLEN;
+	b[4] = PCAPNG_OPT_IFNAME | (olen << 16);
+	memcpy(&b[5], ifs[k].name, olen);
+	b[n / 4 - 1] = n;
+	if (fwrite(b, n, 1, fp) != 1)
+	    return (-1);
+    }
+    return (0);
+}
+
+/*
+ * CaptureWriteFrame()
+ *
+ * Enhanced packet block with link name as comment.
+ */
+
+static int
+CaptureWriteFrame(FILE *fp, const struct captrec *r)
+{
+    u_int32_t	b[(28 + CAPT_SNAPLEN + 4 + LINK_MAX_NAME + 8) / 4 + 1];
+    u_char	*const p = (u_char *)b;
+    u_int64_t	ts;
+    u_int16_t	opt[2];
+    int		clen, n;
+
+    memset(b, 0, sizeof(b));
+    clen = strlen(r->name);
+    ts = (u_int64_t)r->when.tv_sec * 1000000 + r->when.tv_usec;
+    b[0] = PCAPNG_EPB;
+    b[2] = r->iface;
+    b[3] = ts >> 32;
+    b[4] = ts & 0xffffffff;
+    b[5] = r->caplen;
+    b[6] = r->len;
+    memcpy(p + 28, r->data, r->caplen);
+    n = 28 + PAD4(r->caplen);
+    if (clen) {
+	opt[0] = PCAPNG_OPT_COMMENT;
+	opt[1] = clen;
+	memcpy(p + n, opt, sizeof(opt));
+	memcpy(p + n + 4, r->name, clen);
+	n += 4 + PAD4(clen);
+    }
+    n += 8;			/* End of options and length */
+    b[1] = n;
+    b[n / 4 - 1] = n;
+    if (fwrite(b, n, 1, fp) != 1)
+	return (-1);
+    gCaptWritten += n;
+    return (0);
+}
+
+/*
+ * CaptureWriter()
+ *
+ * Writer thread.
+ */
+
+static void *
+CaptureWriter(void *arg)
+{
+    u_int64_t	octets;
+    int		k, n, errors;
+
+    (void)arg;
+    for (;;) {
+	MUTEX_LOCK(gCaptMutex);
+	while (gCaptHead == gCaptTail && !gCaptStopping)
+	    pthread_cond_wait(&gCaptCond, &gCaptMutex);
+	if (gCaptHead == gCaptTail) {
+	    MUTEX_UNLOCK(gCaptMutex);
+	    break;
+	}
+	for (n = 0; n < CAPT_BATCH && gCaptTail != gCaptHead; n++)
+	    gCaptBatch[n] = gCaptRing[gCaptTail++ % CAPT_RING];
+	MUTEX_UNLOCK(gCaptMutex);
+
+	octets = 0;
+	errors = 0;
+	for (k = 0; k < n && gCaptFp != NULL; k++) {
+	    if (CaptureWriteFrame(gCaptFp, &gCaptBatch[k]) < 0)
+		errors++;
+	    octets += gCaptBatch[k].caplen;
+	}
+	if (gCaptFp != NULL && fflush(gCaptFp) != 0)
+	    errors++;
+
+	MUTEX_LOCK(gCaptMutex);
+	gCaptStats.frames += n;
+	gCaptStats.octets += octets;
+	gCaptStats.batches++;
+	gCaptStats.errors += errors;
+	MUTEX_UNLOCK(gCaptMutex);
+
+	if (gCaptFp != NULL && gCaptWritten >= gCaptSize)
+	    CaptureRotate();
+    }
+    return (NULL);
+}
+
+/*
+ * CaptureStat()
+ */
+
+int
+CaptureStat(Context ctx, int ac, const char *const av[], const void *arg)
+{
+    struct captstats	st;
+    u_int		queued = 0;
+    u_int		k;
+    int			failed;
+
+    (void)ac;
+    (void)av;
+    (void)arg;
+
+    Printf("Capture:\r\n");
+    Printf("\tProtocols      :");
+    for (k = 0; k < NUM_CAPT_OPTS; k++) {
+	if (gCaptProtos & gCaptOptList[k].mask)
+	    Printf(" %s", gCaptOptList[k].name);
+    }
+    Printf("\r\n");
+    Printf("\tLinks          :");
+    if (gCaptNumLinks == 0)
+	Printf(" all");
+    for (k = 0; k < (u_int)gCaptNumLinks; k++)
+	Printf(" %s", gCaptLinks[k]);
+    Printf("\r\n");
+    if (!gCaptUp) {
+	Printf("\tState          : stopped\r\n");
+	return (0);
+    }
+    MUTEX_LOCK(gCaptMutex);
+    st = gCaptStats;
+    queued = gCaptHead - gCaptTail;
+    failed = gCaptFailed;
+    MUTEX_UNLOCK(gCaptMutex);
+
+    Printf("\tState          : %s\r\n", failed ? "failed" :
+	gCapture ? "running" : "idle");
+    Printf("\tFile           : %s, %d MB x %d\r\n", gCaptFile,
+	(int)(gCaptSize / (1024 * 1024)), gCaptFiles + 1);
+    Printf("\tQueued         : %u of %d\r\n", queued, CAPT_RING);
+    Printf("\tFrames         : %llu\r\n", (unsigned long long)st.frames);
+    Printf("\tOctets         : %llu\r\n", (unsigned long long)st.octets);
+    Printf("\tBatches        : %llu\r\n", (unsigned long long)st.batches);
+    Printf("\tDropped        : %llu\r\n", (unsigned long long)st.dropped);
+    Printf("\tRotated        : %u\r\n", st.rotated);
+    Printf("\tWrite errors   : %u\r\n", st.errors);
+    return (0);
+}
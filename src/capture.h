@@ -0,0 +1,79 @@
+
+/*
+ * capture.h
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include "defs.h"
+#include "mbuf.h"
+
+/*
+ * DEFINITIONS
+ */
+
+  /* Captured protocols */
+  enum {
+    CAPT_I_LCP = 0,
+    CAPT_I_AUTH,
+    CAPT_I_NCP,
+    CAPT_I_CCP,
+    CAPT_I_ECP,
+    CAPT_I_PPPOE,
+    CAPT_I_L2TP
+  };
+
+  #define CAPT_LCP		(1 << CAPT_I_LCP)
+  #define CAPT_AUTH		(1 << CAPT_I_AUTH)
+  #define CAPT_NCP		(1 << CAPT_I_NCP)
+  #define CAPT_CCP		(1 << CAPT_I_CCP)
+  #define CAPT_ECP		(1 << CAPT_I_ECP)
+  #define CAPT_PPPOE		(1 << CAPT_I_PPPOE)
+  #define CAPT_L2TP		(1 << CAPT_I_L2TP)
+
+  #define CAPT_DEFAULT		(CAPT_LCP | CAPT_AUTH | CAPT_NCP	\
+				| CAPT_CCP | CAPT_ECP | CAPT_PPPOE	\
+				| CAPT_L2TP)
+
+  /* Frame direction */
+  #define CAPT_IN		0
+  #define CAPT_OUT		1
+
+  #define CapturePpp(name, dir, proto, bp) do {		\
+				  if (gCapture)			\
+				    CapturePpp2(name, dir, proto, bp);	\
+				} while (0)
+
+  #define CapturePppoe(name, buf, len) do {			\
+				  if (gCapture & CAPT_PPPOE)	\
+				    CapturePppoe2(name, buf, len);	\
+				} while (0)
+
+  #define CaptureL2tp(name, tun, buf, len) do {			\
+				  if (gCapture & CAPT_L2TP)	\
+				    CaptureL2tp2(name, tun, buf, len);	\
+				} while (0)
+
+/*
+ * VARIABLES
+ */
+
+  extern int			gCapture;	/* Protocols being captured */
+  extern const struct cmdtab	CaptureCmds[];
+
+/*
+ * FUNCTIONS
+ */
+
+  extern void	CapturePpp2(const char *name, int dir, int proto, Mbuf bp);
+  extern void	CapturePppoe2(const char *name, const u_char *buf, int len);
+  extern void	CaptureL2tp2(const char *name, u_int16_t tun,
+		    const u_char *buf, int len);
+  extern void	CaptureShutdown(void);
+  extern int	CaptureStat(Context ctx, int ac, const char *const av[], const void *arg);
+
+#endif
+
@@ -40,7 +40,13 @@
     SET_ENABLE,
     SET_DISABLE,
     SET_YES,
-    SET_NO
+    SET_NO,
+#ifdef CCP_DEFLATE
+    SET_DEFLATE_WINDOW,
+#ifndef USE_NG_DEFLATE
+    SET_DEFLATE_LEVEL,
+#endif
+#endif
   };
 
 /*
@@ -82,6 +88,14 @@
 	CcpSetCommand, NULL, 2, (void *) SET_YES },
     { "no [opt ...]",			"Disable and deny option",
 	CcpSetCommand, NULL, 2, (void *) SET_NO },
+#ifdef CCP_DEFLATE
+    { "deflate-window {bits}",		"Deflate compression window",
+	CcpSetCommand, NULL, 2, (void *) SET_DEFLATE_WINDOW },
+#ifndef USE_NG_DEFLATE
+    { "deflate-level {level}",		"Deflate compression level",
+	CcpSetCommand, NULL, 2, (void *) SET_DEFLATE_LEVEL },
+#endif
+#endif
     { NULL, NULL, NULL, NULL, 0, NULL },
   };
 
@@ -207,6 +221,12 @@ CcpInit(Bund b)
   memset(ccp, 0, sizeof(*ccp));
   FsmInit(&ccp->fsm, &gCcpFsmType, b);
   ccp->fsm.conf.maxfailure = CCP_MAXFAILURE;
+#ifdef CCP_DEFLATE
+  ccp->deflate.conf.window = DEFLATE_DEF_WINDOW;
+#ifndef USE_NG_DEFLATE
+  ccp->deflate.conf.level = DEFLATE_DEF_LEVEL;
+#endif
+#endif
 
   /* Construct options list if we haven't done so already */
   if (gConfList == NULL) {
@@ -376,7 +396,7 @@ CcpNgDataEvent(int type, void *cookie)
     socklen_t		nsize;
     Mbuf		bp;
     int			num = 0;
-    char                *bundname, *rest;
+    char                *bundname, *rest, *b1;
     int                 id;
 		
     (void)cookie;
@@ -412,6 +432,8 @@ CcpNgDataEvent(int type, void *cookie)
 	    mbfree(bp);
     	    continue;
 	}
+	/* Keep old value */
+	b1 = bundname;
 	bundname++;
 	id = strtol(bundname, &rest, 10);
 	if (rest[0] != 0 || !gBundles[id] || gBundles[id]->dead) {
@@ -424,7 +446,7 @@ CcpNgDataEvent(int type, void *cookie)
 	b = gBundles[id];
 
 	/* Packet requiring compression */
-	if (bundname[0] == 'c') {
+	if (b1[0] == 'c') {
 	    bp = CcpDataOutput(b, bp);
 	} else {
 	    /* Packet requiring decompression */
@@ -1077,6 +1099,31 @@ CcpSetCommand(Context ctx, int ac, const char *const av[], const void *arg)
       NoCommand(ac, av, &ccp->options, gConfList);
       break;
 
+#ifdef CCP_DEFLATE
+    case SET_DEFLATE_WINDOW:
+      {
+	int	val = atoi(*av);
+
+	if (val < DEFLATE_MIN_WINDOW || val > DEFLATE_MAX_WINDOW)
+	  Error("Incorrect deflate window %d, must be %d..%d", val,
+	    DEFLATE_MIN_WINDOW, DEFLATE_MAX_WINDOW);
+	ccp->deflate.conf.window = val;
+      }
+      break;
+
+#ifndef USE_NG_DEFLATE
+    case SET_DEFLATE_LEVEL:
+      {
+	int	val = atoi(*av);
+
+	if (val < 0 || val > 9)
+	  Error("Incorrect deflate level %d, must be 0..9", val);
+	ccp->deflate.conf.level = val;
+      }
+      break;
+#endif
+#endif
+
     default:
       assert(0);
   }
@@ -17,6 +17,18 @@
 #include <netgraph/ng_message.h>
 #include <netgraph.h>
 
+/*
+ * DEFINITIONS
+ */
+
+#ifndef USE_NG_DEFLATE
+  #define DEFLATE_HDRLEN	4	/* PROTO_COMPD + sequence number */
+  #define DEFLATE_BUF_SIZE	4096	/* Max decompressed frame size */
+
+  /* Compressed data of the expected size plus worst case bloat */
+  #define DEFLATE_MAX_BLOWUP(n)	((n) + ((n) >> 3) + 64)
+#endif
+
 /*
  * INTERNAL FUNCTIONS
  */
@@ -34,6 +46,12 @@
   static int    DeflateNegotiated(Bund b, int xmit);
   static int    DeflateSubtractBloat(Bund b, int size);
   static int	DeflateStat(Context ctx, int dir);
+#ifndef USE_NG_DEFLATE
+  static Mbuf	DeflateCompress(Bund b, Mbuf plain);
+  static Mbuf	DeflateDecompress(Bund b, Mbuf comp);
+  static int	DeflateInflate(DeflateInfo deflate, const u_char *in, int len,
+		    u_char *out, int olen);
+#endif
 
 /*
  * GLOBAL VARIABLES
@@ -57,10 +75,23 @@
     DeflateRecvResetAck,
     DeflateNegotiated,
     DeflateStat,
+#ifndef USE_NG_DEFLATE
+    DeflateCompress,
+    DeflateDecompress,
+#else
     NULL,
     NULL,
+#endif
   };
 
+#ifndef USE_NG_DEFLATE
+  /* Sync flush trailer the compressor strips from each frame */
+  static const u_char	gDeflateTail[] = { 0x00, 0x00, 0xff, 0xff };
+
+  /* Scratch space for history updates from uncompressed frames */
+  static u_char		gDeflateScratch[DEFLATE_BUF_SIZE];
+#endif
+
 /*
  * DeflateInit()
  */
@@ -69,6 +100,37 @@ static int
 DeflateInit(Bund b, int dir)
 {
     DeflateInfo		const deflate = &b->ccp.deflate;
+#ifndef USE_NG_DEFLATE
+    int			rtn;
+
+    /* Streams live as long as the CCP session, so history is kept */
+    if (dir == COMP_DIR_XMIT) {
+	memset(&deflate->cx_xmit, 0, sizeof(deflate->cx_xmit));
+	memset(&deflate->xmit_stats, 0, sizeof(deflate->xmit_stats));
+	deflate->xmit_seq = 0;
+	rtn = deflateInit2(&deflate->cx_xmit, deflate->conf.level, Z_DEFLATED,
+	    -deflate->xmit_windowBits, 8, Z_DEFAULT_STRATEGY);
+	if (rtn != Z_OK) {
+	    Log(LG_ERR, ("[%s] deflateInit2: %s", b->name,
+		deflate->cx_xmit.msg ? deflate->cx_xmit.msg : "error"));
+	    return(-1);
+	}
+	deflate->xmit_init = 1;
+    } else {
+	memset(&deflate->cx_recv, 0, sizeof(deflate->cx_recv));
+	memset(&deflate->recv_stats, 0, sizeof(deflate->recv_stats));
+	deflate->recv_seq = 0;
+	/* Larger window decodes anything the peer may send */
+	rtn = inflateInit2(&deflate->cx_recv, -DEFLATE_MAX_WINDOW);
+	if (rtn != Z_OK) {
+	    Log(LG_ERR, ("[%s] inflateInit2: %s", b->name,
+		deflate->cx_recv.msg ? deflate->cx_recv.msg : "error"));
+	    return(-1);
+	}
+	deflate->recv_init = 1;
+    }
+    return 0;
+#else
     struct ng_deflate_config	conf;
     struct ngm_mkpeer	mp;
     char		path[NG_PATHSIZ];
@@ -126,6 +188,7 @@ DeflateInit(Bund b, int dir)
 fail:
     NgFuncShutdownNode(gCcpCsock, b->name, path);
     return(-1);
+#endif
 }
 
 /*
@@ -138,7 +201,7 @@ DeflateConfigure(Bund b)
     CcpState	const ccp = &b->ccp;
     DeflateInfo	const deflate = &ccp->deflate;
   
-    deflate->xmit_windowBits=15;
+    deflate->xmit_windowBits=deflate->conf.window;
     deflate->recv_windowBits=0;
   
     return(0);
@@ -175,6 +238,21 @@ DeflateDescribe(Bund b, int dir, char *buf, size_t len)
 void
 DeflateCleanup(Bund b, int dir)
 {
+#ifndef USE_NG_DEFLATE
+    DeflateInfo		const deflate = &b->ccp.deflate;
+
+    if (dir == COMP_DIR_XMIT) {
+	if (deflate->xmit_init) {
+	    deflateEnd(&deflate->cx_xmit);
+	    deflate->xmit_init = 0;
+	}
+    } else {
+	if (deflate->recv_init) {
+	    inflateEnd(&deflate->cx_recv);
+	    deflate->recv_init = 0;
+	}
+    }
+#else
     char		path[NG_PATHSIZ];
 
     /* Remove node */
@@ -186,6 +264,7 @@ DeflateCleanup(Bund b, int dir)
 	b->ccp.decomp_node_id = 0;
     }
     NgFuncShutdownNode(gCcpCsock, b->name, path);
+#endif
 }
 
 /*
@@ -195,18 +274,29 @@ DeflateCleanup(Bund b, int dir)
 static Mbuf
 DeflateRecvResetReq(Bund b, int id, Mbuf bp, int *noAck)
 {
+#ifndef USE_NG_DEFLATE
+    DeflateInfo		const deflate = &b->ccp.deflate;
+#else
     char		path[NG_PATHSIZ];
+#endif
 
     (void)bp;
     (void)id;
     (void)noAck;
 
+#ifndef USE_NG_DEFLATE
+    /* Start over with empty history */
+    if (deflate->xmit_init)
+	deflateReset(&deflate->cx_xmit);
+    deflate->xmit_seq = 0;
+#else
     /* Forward ResetReq to the DEFLATE compression node */
     snprintf(path, sizeof(path), "[%x]:", b->ccp.comp_node_id);
     if (NgSendMsg(gCcpCsock, path,
     	    NGM_DEFLATE_COOKIE, NGM_DEFLATE_RESETREQ, NULL, 0) < 0) {
 	Perror("[%s] reset-req to %s node", b->name, NG_DEFLATE_NODE_TYPE);
     }
+#endif
     return(NULL);
 }
 
@@ -228,19 +318,241 @@ DeflateSendResetReq(Bund b)
 static void
 DeflateRecvResetAck(Bund b, int id, Mbuf bp)
 {
+#ifndef USE_NG_DEFLATE
+    DeflateInfo		const deflate = &b->ccp.deflate;
+#else
     char		path[NG_PATHSIZ];
+#endif
 
     (void)bp;
     (void)id;
 
+#ifndef USE_NG_DEFLATE
+    if (deflate->recv_init)
+	inflateReset(&deflate->cx_recv);
+    deflate->recv_seq = 0;
+#else
     /* Forward ResetReq to the DEFLATE compression node */
     snprintf(path, sizeof(path), "[%x]:", b->ccp.decomp_node_id);
     if (NgSendMsg(gCcpCsock, path,
     	    NGM_DEFLATE_COOKIE, NGM_DEFLATE_RESETREQ, NULL, 0) < 0) {
 	Perror("[%s] reset-ack to %s node", b->name, NG_DEFLATE_NODE_TYPE);
     }
+#endif
 }
 
+#ifndef USE_NG_DEFLATE
+
+/*
+ * DeflateCompress()
+ *
+ * Input is a full PPP frame starting with the protocol field. Frames
+ * that do not shrink are sent as is; their data stays in the history.
+ */
+
+static Mbuf
+DeflateCompress(Bund b, Mbuf plain)
+{
+    DeflateInfo		const di = &b->ccp.deflate;
+    z_stream		*const cx = &di->cx_xmit;
+    const u_char	*in = MBDATAU(plain);
+    int			inlen = MBLEN(plain);
+    int			orglen = inlen;
+    u_char		*out;
+    int			outlen;
+    Mbuf		res;
+    int			rtn;
+
+    di->xmit_stats.FramesPlain++;
+    di->xmit_stats.InOctets += orglen;
+
+    if (inlen < 2) {
+	di->xmit_stats.FramesUncomp++;
+	di->xmit_stats.OutOctets += orglen;
+	return (plain);
+    }
+
+    /* Protocol field is compressed in its PFC form */
+    if (in[0] == 0) {
+	in++;
+	inlen--;
+    }
+
+    res = mballoc(DEFLATE_HDRLEN + DEFLATE_MAX_BLOWUP(inlen));
+    out = MBDATAU(res);
+
+    cx->next_in = (u_char *)in;
+    cx->avail_in = inlen;
+    cx->next_out = out + DEFLATE_HDRLEN;
+    cx->avail_out = MBSPACE(res) - DEFLATE_HDRLEN;
+    rtn = deflate(cx, Z_SYNC_FLUSH);
+    if (rtn != Z_OK || cx->avail_in != 0 || cx->avail_out == 0) {
+	/* History is lost, peer will ask for a reset */
+	Log(LG_CCP2, ("[%s] deflate: %s", b->name,
+	    cx->msg ? cx->msg : "output overflow"));
+	deflateReset(cx);
+	di->xmit_stats.Errors++;
+	di->xmit_stats.FramesUncomp++;
+	di->xmit_stats.OutOctets += orglen;
+	mbfree(res);
+	return (plain);
+    }
+    outlen = MBSPACE(res) - DEFLATE_HDRLEN - cx->avail_out;
+
+    /* Strip sync flush trailer, decompressor adds it back */
+    if (outlen >= (int)sizeof(gDeflateTail) &&
+	    memcmp(out + DEFLATE_HDRLEN + outlen - sizeof(gDeflateTail),
+	    gDeflateTail, sizeof(gDeflateTail)) == 0)
+	outlen -= sizeof(gDeflateTail);
+
+    if (DEFLATE_HDRLEN + outlen >= orglen) {
+	di->xmit_stats.FramesUncomp++;
+	di->xmit_stats.OutOctets += orglen;
+	mbfree(res);
+	return (plain);
+    }
+
+    out[0] = PROTO_COMPD >> 8;
+    out[1] = PROTO_COMPD & 0xff;
+    out[2] = di->xmit_seq >> 8;
+    out[3] = di->xmit_seq & 0xff;
+    di->xmit_seq++;
+    res->cnt = DEFLATE_HDRLEN + outlen;
+
+    di->xmit_stats.FramesComp++;
+    di->xmit_stats.OutOctets += res->cnt;
+    mbfree(plain);
+    return (res);
+}
+
+/*
+ * DeflateDecompress()
+ *
+ * Gets every frame with a protocol below 0x4000. Uncompressed ones
+ * are only fed to the history in a fake stored block.
+ */
+
+static Mbuf
+DeflateDecompress(Bund b, Mbuf comp)
+{
+    DeflateInfo		const deflate = &b->ccp.deflate;
+    const u_char	*in = MBDATAU(comp);
+    int			inlen = MBLEN(comp);
+    u_char		hdr[5];
+    u_int16_t		seq;
+    u_char		*out;
+    int			outlen;
+    Mbuf		res;
+
+    deflate->recv_stats.InOctets += inlen;
+
+    if (inlen < 2) {
+	Log(LG_CCP2, ("[%s] deflate: short frame (%d)", b->name, inlen));
+	goto fail;
+    }
+
+    if (((in[0] << 8) | in[1]) != PROTO_COMPD) {
+	/* Protocol field went into the history in its PFC form */
+	if (in[0] == 0) {
+	    in++;
+	    inlen--;
+	}
+	hdr[0] = 0x00;
+	hdr[1] = inlen & 0xff;
+	hdr[2] = inlen >> 8;
+	hdr[3] = ~inlen & 0xff;
+	hdr[4] = ~inlen >> 8;
+	if (DeflateInflate(deflate, hdr, sizeof(hdr),
+		gDeflateScratch, sizeof(gDeflateScratch)) != 0 ||
+	    DeflateInflate(deflate, in, inlen,
+		gDeflateScratch, sizeof(gDeflateScratch)) != inlen) {
+	    /* Frame itself is fine, only the history is lost */
+	    Log(LG_CCP2, ("[%s] deflate: history update failed", b->name));
+	    deflate->recv_stats.Errors++;
+	    CcpSendResetReq(b);
+	}
+	deflate->recv_stats.FramesUncomp++;
+	deflate->recv_stats.OutOctets += MBLEN(comp);
+	return (comp);
+    }
+
+    if (inlen < DEFLATE_HDRLEN) {
+	Log(LG_CCP2, ("[%s] deflate: short frame (%d)", b->name, inlen));
+	goto fail;
+    }
+    seq = (in[2] << 8) | in[3];
+    if (seq != deflate->recv_seq) {
+	Log(LG_CCP2, ("[%s] deflate: seq 0x%04x, expected 0x%04x",
+	    b->name, seq, deflate->recv_seq));
+	goto fail;
+    }
+    deflate->recv_seq++;
+
+    /* Leave room to expand the protocol field */
+    res = mballoc(DEFLATE_BUF_SIZE + 1);
+    res->offset++;
+    out = MBDATAU(res);
+    outlen = DeflateInflate(deflate, in + DEFLATE_HDRLEN,
+	inlen - DEFLATE_HDRLEN, out, DEFLATE_BUF_SIZE);
+    if (outlen >= 0) {
+	int	tail;
+
+	tail = DeflateInflate(deflate, gDeflateTail, sizeof(gDeflateTail),
+	    out + outlen, DEFLATE_BUF_SIZE - outlen);
+	outlen = (tail == 0) ? outlen : -1;
+    }
+    if (outlen < 1) {
+	Log(LG_CCP2, ("[%s] deflate: %s", b->name,
+	    deflate->cx_recv.msg ? deflate->cx_recv.msg : "bad frame"));
+	mbfree(res);
+	goto fail;
+    }
+    if (out[0] & 1) {
+	res->offset--;
+	out--;
+	out[0] = 0;
+	outlen++;
+    }
+    res->cnt = outlen;
+
+    deflate->recv_stats.FramesComp++;
+    deflate->recv_stats.OutOctets += outlen;
+    mbfree(comp);
+    return (res);
+
+fail:
+    deflate->recv_stats.Errors++;
+    mbfree(comp);
+    CcpSendResetReq(b);
+    return (NULL);
+}
+
+/*
+ * DeflateInflate()
+ *
+ * Run decompressor over one piece of input. Returns number of bytes
+ * produced, or -1 if input is broken or doesn't fit.
+ */
+
+static int
+DeflateInflate(DeflateInfo deflate, const u_char *in, int len,
+    u_char *out, int olen)
+{
+    z_stream	*const cx = &deflate->cx_recv;
+    int		rtn;
+
+    cx->next_in = (u_char *)in;
+    cx->avail_in = len;
+    cx->next_out = out;
+    cx->avail_out = olen;
+    rtn = inflate(cx, Z_SYNC_FLUSH);
+    if ((rtn != Z_OK && rtn != Z_BUF_ERROR) || cx->avail_in != 0)
+	return (-1);
+    return (olen - cx->avail_out);
+}
+
+#endif /* USE_NG_DEFLATE */
+
 /*
  * DeflateBuildConfigReq()
  */
@@ -306,7 +618,7 @@ DeflateDecodeConfigReq(Fsm fp, FsmOption opt, int mode)
       break;
 
     case MODE_NAK:
-	if ((window > 0) && (window<=7) && (method == 8) && (chk == 0))
+	if ((window + 8 >= DEFLATE_MIN_WINDOW) && (window<=7) && (method == 8) && (chk == 0))
 	    deflate->xmit_windowBits = window + 8;
 	else {
 	    deflate->xmit_windowBits = 0;
@@ -345,6 +657,21 @@ static int
 DeflateStat(Context ctx, int dir) 
 {
     Bund			b = ctx->bund;
+#ifndef USE_NG_DEFLATE
+    struct deflate_stats	stats;
+
+    switch (dir) {
+	case COMP_DIR_XMIT:
+	    stats = b->ccp.deflate.xmit_stats;
+	    break;
+	case COMP_DIR_RECV:
+	    stats = b->ccp.deflate.recv_stats;
+	    break;
+	default:
+	    assert(0);
+	    return(0);
+    }
+#else
     char			path[NG_PATHSIZ];
     struct ng_deflate_stats	stats;
     union {
@@ -370,34 +697,35 @@ DeflateStat(Context ctx, int dir)
 	    return(0);
     }
     memcpy(&stats, u.reply.data, sizeof(stats));
+#endif
     switch (dir) {
 	case COMP_DIR_XMIT:
 	    Printf("\tBytes\t: %llu -> %llu (%+lld%%)\r\n",
-		stats.InOctets,
-		stats.OutOctets,
+		(unsigned long long)stats.InOctets,
+		(unsigned long long)stats.OutOctets,
 		((stats.InOctets!=0)?
-		    ((int64_t)(stats.OutOctets - stats.InOctets)*100/(int64_t)stats.InOctets):
+		    ((long long)(stats.OutOctets - stats.InOctets)*100/(long long)stats.InOctets):
 		    0));
 	    Printf("\tFrames\t: %llu -> %lluc + %lluu\r\n",
-		stats.FramesPlain,
-		stats.FramesComp,
-		stats.FramesUncomp);
+		(unsigned long long)stats.FramesPlain,
+		(unsigned long long)stats.FramesComp,
+		(unsigned long long)stats.FramesUncomp);
 	    Printf("\tErrors\t: %llu\r\n",
-		stats.Errors);
+		(unsigned long long)stats.Errors);
 	    break;
 	case COMP_DIR_RECV:
 	    Printf("\tBytes\t: %llu <- %llu (%+lld%%)\r\n",
-		stats.OutOctets,
-		stats.InOctets,
+		(unsigned long long)stats.OutOctets,
+		(unsigned long long)stats.InOctets,
 		((stats.OutOctets!=0)?
-		    ((int64_t)(stats.InOctets - stats.OutOctets)*100/(int64_t)stats.OutOctets):
+		    ((long long)(stats.InOctets - stats.OutOctets)*100/(long long)stats.OutOctets):
 		    0));
 	    Printf("\tFrames\t: %llu <- %lluc + %lluu\r\n",
-		stats.FramesPlain,
-		stats.FramesComp,
-		stats.FramesUncomp);
+		(unsigned long long)stats.FramesPlain,
+		(unsigned long long)stats.FramesComp,
+		(unsigned long long)stats.FramesUncomp);
 	    Printf("\tErrors\t: %llu\r\n",
-		stats.Errors);
+		(unsigned long long)stats.Errors);
     	    break;
 	default:
     	    assert(0);
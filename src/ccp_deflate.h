@@ -8,8 +8,12 @@
 #ifndef _CCP_DEFLATE_H_
 #define _CCP_DEFLATE_H_
 
+#ifdef USE_NG_DEFLATE
 #include <netgraph/ng_message.h>
 #include <netgraph/ng_deflate.h>
+#else
+#include <zlib.h>
+#endif
 
 #include "defs.h"
 #include "mbuf.h"
@@ -19,9 +23,43 @@
  * DEFINITIONS
  */
 
+  #define DEFLATE_DEF_WINDOW	15	/* Default window size, bits */
+  #define DEFLATE_MIN_WINDOW	9	/* zlib can't do 8 bit windows */
+  #define DEFLATE_MAX_WINDOW	15
+
+#ifndef USE_NG_DEFLATE
+  #define DEFLATE_DEF_LEVEL	Z_DEFAULT_COMPRESSION
+
+  struct deflate_stats {
+	uint64_t	FramesPlain;
+	uint64_t	FramesComp;
+	uint64_t	FramesUncomp;
+	uint64_t	InOctets;
+	uint64_t	OutOctets;
+	uint64_t	Errors;
+  };
+  typedef struct deflate_stats	*DeflateStats;
+#endif
+
   struct deflateinfo {
 	int	xmit_windowBits;
 	int	recv_windowBits;
+	struct {
+	    int		window;		/* Configured xmit window, bits */
+#ifndef USE_NG_DEFLATE
+	    int		level;		/* Configured compression level */
+#endif
+	} conf;
+#ifndef USE_NG_DEFLATE
+	z_stream	cx_xmit;	/* Persistent compressor stream */
+	z_stream	cx_recv;	/* Persistent decompressor stream */
+	u_char		xmit_init;
+	u_char		recv_init;
+	u_int16_t	xmit_seq;	/* Next sequence number to send */
+	u_int16_t	recv_seq;	/* Next sequence number expected */
+	struct deflate_stats	xmit_stats;
+	struct deflate_stats	recv_stats;
+#endif
   };
   typedef struct deflateinfo	*DeflateInfo;
 
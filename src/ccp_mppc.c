@@ -33,6 +33,26 @@
 
 #define MPPC_SUPPORTED	(MPPC_BIT | MPPE_BITS | MPPE_STATELESS)
 
+#ifndef USE_NG_MPPC
+  /* MPPC/MPPE header bits (RFC 2118, RFC 3078) */
+  #define MPPC_FLAG_FLUSHED	0x8000
+  #define MPPC_FLAG_RESTART	0x4000
+  #define MPPC_FLAG_COMPRESSED	0x2000
+  #define MPPE_FLAG_ENCRYPTED	0x1000
+  #define MPPC_CCOUNT_MASK	0x0fff
+  #define MPPC_HDRLEN		2
+
+  /* Stateful mode changes key every 256 packets */
+  #define MPPE_UPDATE_MASK	0xff
+  #define MPPE_UPDATE_FLAG	0xff
+
+  /* Max key changes to resync in stateless mode, older frames dropped */
+  #define MPPE_MAX_REKEY	1000
+
+  /* Repeat ResetReq after that many frames without a flushed one */
+  #define MPPC_RESET_REPEAT	16
+#endif
+
   /* Set menu options */
   enum {
     SET_ACCEPT,
@@ -75,6 +95,16 @@
   static short	MppcAcceptableMppeType(Bund b, short type);
   static int	MppcKeyAvailable(Bund b, short type);
 
+#ifndef USE_NG_MPPC
+  static Mbuf	MppcCompress(Bund b, Mbuf plain);
+  static Mbuf	MppcDecompress(Bund b, Mbuf comp);
+  static int	MppcDirStat(Context ctx, int dir);
+  static void	MppeStartKey(u_int32_t bits, const u_char *key0, struct mppcdir *d);
+  static void	MppeUpdateKey(u_int32_t bits, const u_char *key0, struct mppcdir *d);
+  static void	MppeRc4Init(struct mppe_rc4 *rc4, const u_char *key, int len);
+  static void	MppeRc4Crypt(struct mppe_rc4 *rc4, u_char *data, int len);
+#endif
+
 #ifdef DEBUG_KEYS
   static void	KeyDebug(const u_char *data, int len, const char *fmt, ...);
   #define KEYDEBUG(x)	KeyDebug x
@@ -112,9 +142,15 @@
     MppcRecvResetReq,
     NULL,
     MppcNegotiated,
+#ifndef USE_NG_MPPC
+    MppcDirStat,
+    MppcCompress,
+    MppcDecompress,
+#else
     NULL,
     NULL,
     NULL,
+#endif
   };
 
   const struct cmdtab MppcSetCmds[] = {
@@ -144,6 +180,32 @@ static int
 MppcInit(Bund b, int dir)
 {
     MppcInfo		const mppc = &b->ccp.mppc;
+#ifndef USE_NG_MPPC
+    struct mppcdir	*d;
+    u_int32_t		bits;
+    u_char		*key0;
+
+    if (dir == COMP_DIR_XMIT) {
+	d = &mppc->xmit;
+	bits = mppc->xmit_bits;
+	key0 = mppc->xmit_key0;
+    } else {
+	d = &mppc->recv;
+	bits = mppc->recv_bits;
+	key0 = mppc->recv_key0;
+    }
+    memset(d, 0, sizeof(*d));
+    if (bits & MPPE_BITS) {
+	if (b->params.msoft.chap_alg == CHAP_ALG_MSOFT)
+	    MppeInitKey(b, mppc, dir);
+	else
+	    MppeInitKeyv2(b, mppc, dir);
+	MppeStartKey(bits, key0, d);
+    }
+    if (bits & MPPC_BIT)
+	d->hist = Malloc(MB_COMP, sizeof(*d->hist));
+    return(0);
+#else
     struct ng_mppc_config	conf;
     struct ngm_mkpeer	mp;
     char		path[NG_PATHSIZ];
@@ -223,6 +285,7 @@ MppcInit(Bund b, int dir)
 fail:
     NgFuncShutdownNode(gCcpCsock, b->name, path);
     return(-1);
+#endif
 }
 
 static int
@@ -328,6 +391,14 @@ MppcNegotiated(Bund b, int dir)
 static void
 MppcCleanup(Bund b, int dir)
 {
+#ifndef USE_NG_MPPC
+    struct mppcdir	*const d = (dir == COMP_DIR_XMIT) ?
+			    &b->ccp.mppc.xmit : &b->ccp.mppc.recv;
+
+    Freee(d->hist);
+    /* Don't leave keys behind */
+    memset(d, 0, sizeof(*d));
+#else
     char		path[NG_PATHSIZ];
 
     /* Remove node */
@@ -339,6 +410,7 @@ MppcCleanup(Bund b, int dir)
 	b->ccp.decomp_node_id = 0;
     }
     NgFuncShutdownNode(gCcpCsock, b->name, path);
+#endif
 }
 
 /*
@@ -495,17 +567,24 @@ MppcDecodeConfigReq(Fsm fp, FsmOption opt, int mode)
 static Mbuf
 MppcRecvResetReq(Bund b, int id, Mbuf bp, int *noAck)
 {
+#ifdef USE_NG_MPPC
     char		path[NG_PATHSIZ];
+#endif
 
     (void)id;
     (void)bp;
 
+#ifndef USE_NG_MPPC
+    /* Next frame goes out flushed */
+    b->ccp.mppc.xmit.flushed = 1;
+#else
     /* Forward ResetReq to the MPPC compression node */
     snprintf(path, sizeof(path), "[%x]:", b->ccp.comp_node_id);
     if (NgSendMsg(gCcpCsock, path,
     	    NGM_MPPC_COOKIE, NGM_MPPC_RESETREQ, NULL, 0) < 0) {
 	Perror("[%s] reset-req to %s node", b->name, NG_MPPC_NODE_TYPE);
     }
+#endif
 
     /* No ResetAck required for MPPC */
     if (noAck)
@@ -708,6 +787,371 @@ MppeInitKeyv2(Bund b, MppcInfo mppc, int dir)
   return;
 }
 
+#ifndef USE_NG_MPPC
+
+/*
+ * MppcCompress()
+ *
+ * Compress and/or encrypt a frame. Only the header is prepended
+ * in place if the frame is sent uncompressed and there is room.
+ */
+
+static Mbuf
+MppcCompress(Bund b, Mbuf plain)
+{
+    MppcInfo		const mppc = &b->ccp.mppc;
+    struct mppcdir	*const d = &mppc->xmit;
+    u_int32_t		const bits = mppc->xmit_bits;
+    int			const len = MBLEN(plain);
+    u_int16_t		header = d->cc;
+    Mbuf		res = NULL;
+    u_char		*out;
+    int			restart = 0;
+    int			clen = -1;
+
+    d->stats.FramesPlain++;
+    d->stats.InOctets += len;
+
+    /* Stateless mode resets everything for each frame */
+    if ((bits & MPPE_STATELESS) || d->flushed) {
+	header |= MPPC_FLAG_FLUSHED;
+	d->flushed = 0;
+	if (d->hist)
+	    MppccReset(d->hist);
+    }
+
+    if ((bits & MPPC_BIT) && d->hist) {
+	res = mballoc(MPPC_HDRLEN + MPPC_MAX_BLOWUP(len));
+	clen = MppccCompress(d->hist, MBDATAU(plain), len,
+	    MBDATAU(res) + MPPC_HDRLEN, &restart);
+	if (clen >= 0) {
+	    header |= MPPC_FLAG_COMPRESSED;
+	    if (restart)
+		header |= MPPC_FLAG_RESTART;
+	    res->cnt = MPPC_HDRLEN + clen;
+	    mbfree(plain);
+	    d->stats.FramesComp++;
+	} else {
+	    /* Peer drops its history on flushed uncompressed frames */
+	    header |= MPPC_FLAG_FLUSHED;
+	    d->stats.FramesUncomp++;
+	}
+    } else
+	d->stats.FramesUncomp++;
+
+    if (clen < 0) {
+	if (plain->offset >= MPPC_HDRLEN) {
+	    if (res)
+		mbfree(res);
+	    res = plain;
+	    res->offset -= MPPC_HDRLEN;
+	    res->cnt += MPPC_HDRLEN;
+	} else {
+	    if (res == NULL)
+		res = mballoc(MPPC_HDRLEN + len);
+	    memcpy(MBDATAU(res) + MPPC_HDRLEN, MBDATAU(plain), len);
+	    res->cnt = MPPC_HDRLEN + len;
+	    mbfree(plain);
+	}
+    }
+    out = MBDATAU(res);
+
+    if (bits & MPPE_BITS) {
+	header |= MPPE_FLAG_ENCRYPTED;
+	if ((bits & MPPE_STATELESS) ||
+		(d->cc & MPPE_UPDATE_MASK) == MPPE_UPDATE_FLAG) {
+	    MppeUpdateKey(bits, mppc->xmit_key0, d);
+	} else if (header & MPPC_FLAG_FLUSHED) {
+	    /* Flushed frame restarts the keystream */
+	    MppeRc4Init(&d->rc4, d->key, KEYLEN(bits));
+	}
+	MppeRc4Crypt(&d->rc4, out + MPPC_HDRLEN, res->cnt - MPPC_HDRLEN);
+    }
+
+    d->cc = (d->cc + 1) & MPPC_CCOUNT_MASK;
+    out[0] = header >> 8;
+    out[1] = header & 0xff;
+
+    d->stats.OutOctets += res->cnt;
+    return(res);
+}
+
+/*
+ * MppcDecompress()
+ *
+ * Decrypt and/or decompress a frame. Lost frames are skipped by
+ * the coherency count: on a flushed frame in any mode, otherwise by
+ * asking the peer for a flushed one with ResetReq.
+ */
+
+static Mbuf
+MppcDecompress(Bund b, Mbuf comp)
+{
+    MppcInfo		const mppc = &b->ccp.mppc;
+    struct mppcdir	*const d = &mppc->recv;
+    u_int32_t		const bits = mppc->recv_bits;
+    u_char		*in = MBDATAU(comp);
+    int			len = MBLEN(comp);
+    u_int16_t		header, cc, lost;
+    u_char		*plain;
+    Mbuf		res;
+    int			flags, plen;
+
+    d->stats.InOctets += len;
+
+    if (len < MPPC_HDRLEN) {
+	Log(LG_CCP2, ("[%s] MPPC: short frame (%d)", b->name, len));
+	goto drop;
+    }
+    header = (in[0] << 8) | in[1];
+    cc = header & MPPC_CCOUNT_MASK;
+    lost = (cc - d->cc) & MPPC_CCOUNT_MASK;
+
+    if (header & MPPC_FLAG_FLUSHED) {
+	/* Too far in stateless mode means old or bogus frame */
+	if ((bits & MPPE_STATELESS) && (bits & MPPE_BITS) &&
+		lost > MPPE_MAX_REKEY) {
+	    Log(LG_CCP2, ("[%s] MPPC: cc %d is %d frames ahead, dropped",
+		b->name, cc, lost));
+	    goto drop;
+	}
+	/* Resync, skipping lost frames */
+	while (d->cc != cc) {
+	    if ((bits & MPPE_BITS) && ((bits & MPPE_STATELESS) ||
+		    (d->cc & MPPE_UPDATE_MASK) == MPPE_UPDATE_FLAG))
+		MppeUpdateKey(bits, mppc->recv_key0, d);
+	    d->cc = (d->cc + 1) & MPPC_CCOUNT_MASK;
+	}
+	if ((bits & MPPE_BITS) && !(bits & MPPE_STATELESS))
+	    MppeRc4Init(&d->rc4, d->key, KEYLEN(bits));
+	d->flushed = 0;
+    } else if (d->flushed) {
+	/* Waiting for flushed frame, it or ResetReq may be lost too */
+	if (++d->waiting % MPPC_RESET_REPEAT == 0)
+	    CcpSendResetReq(b);
+	goto drop;
+    } else if (lost != 0) {
+	Log(LG_CCP2, ("[%s] MPPC: %d frames lost", b->name, lost));
+	goto reset;
+    }
+
+    if ((bits & MPPE_BITS) && !(header & MPPE_FLAG_ENCRYPTED)) {
+	Log(LG_CCP2, ("[%s] MPPC: unencrypted frame", b->name));
+	goto reset;
+    }
+    if (!(bits & MPPC_BIT) && (header & MPPC_FLAG_COMPRESSED)) {
+	Log(LG_CCP2, ("[%s] MPPC: unexpected compressed frame", b->name));
+	goto reset;
+    }
+
+    in += MPPC_HDRLEN;
+    len -= MPPC_HDRLEN;
+    if (header & MPPE_FLAG_ENCRYPTED) {
+	if ((bits & MPPE_STATELESS) ||
+		(d->cc & MPPE_UPDATE_MASK) == MPPE_UPDATE_FLAG)
+	    MppeUpdateKey(bits, mppc->recv_key0, d);
+	MppeRc4Crypt(&d->rc4, in, len);
+    }
+    d->cc = (d->cc + 1) & MPPC_CCOUNT_MASK;
+
+    if (header & MPPC_FLAG_COMPRESSED) {
+	flags = 0;
+	if (header & MPPC_FLAG_FLUSHED)
+	    flags |= MPPCC_FLUSHED;
+	if (header & MPPC_FLAG_RESTART)
+	    flags |= MPPCC_RESTART;
+	if ((plen = MppccDecompress(d->hist, in, len, flags, &plain)) < 0) {
+	    Log(LG_CCP2, ("[%s] MPPC: decompression failed", b->name));
+	    goto reset;
+	}
+	res = mballoc(plen);
+	memcpy(MBDATAU(res), plain, plen);
+	res->cnt = plen;
+	mbfree(comp);
+	d->stats.FramesComp++;
+    } else {
+	if (d->hist && (header & MPPC_FLAG_FLUSHED))
+	    MppccReset(d->hist);
+	res = comp;
+	res->offset += MPPC_HDRLEN;
+	res->cnt -= MPPC_HDRLEN;
+	d->stats.FramesUncomp++;
+    }
+
+    d->stats.FramesPlain++;
+    d->stats.OutOctets += res->cnt;
+    return(res);
+
+reset:
+    /* Drop everything up to the next flushed frame */
+    d->flushed = 1;
+    d->waiting = 0;
+    d->stats.Errors++;
+    mbfree(comp);
+    if (!(bits & MPPE_STATELESS))
+	CcpSendResetReq(b);
+    return(NULL);
+
+drop:
+    d->stats.Errors++;
+    mbfree(comp);
+    return(NULL);
+}
+
+/*
+ * MppeStartKey()
+ *
+ * Initial session key from the start key (RFC 3079).
+ */
+
+static void
+MppeStartKey(u_int32_t bits, const u_char *key0, struct mppcdir *d)
+{
+    int		const keylen = KEYLEN(bits);
+
+    memcpy(d->key, key0, keylen);
+    MsoftGetKey(key0, d->key, keylen);
+    if (bits & MPPE_40)
+	memcpy(d->key, "\xd1\x26\x9e", 3);
+    else if (bits & MPPE_56)
+	memcpy(d->key, "\xd1", 1);
+    MppeRc4Init(&d->rc4, d->key, keylen);
+}
+
+/*
+ * MppeUpdateKey()
+ *
+ * Change session key (RFC 3078 section 7.3).
+ */
+
+static void
+MppeUpdateKey(u_int32_t bits, const u_char *key0, struct mppcdir *d)
+{
+    int		const keylen = KEYLEN(bits);
+
+    MsoftGetKey(key0, d->key, keylen);
+    MppeRc4Init(&d->rc4, d->key, keylen);
+    MppeRc4Crypt(&d->rc4, d->key, keylen);
+    if (bits & MPPE_40)
+	memcpy(d->key, "\xd1\x26\x9e", 3);
+    else if (bits & MPPE_56)
+	memcpy(d->key, "\xd1", 1);
+    MppeRc4Init(&d->rc4, d->key, keylen);
+    d->stats.Rekeys++;
+}
+
+/*
+ * MppeRc4Init()
+ */
+
+static void
+MppeRc4Init(struct mppe_rc4 *rc4, const u_char *key, int len)
+{
+    u_char	*const perm = rc4->perm;
+    u_char	j = 0, t;
+    int		i;
+
+    for (i = 0; i < 256; i++)
+	perm[i] = i;
+    for (i = 0; i < 256; i++) {
+	j += perm[i] + key[i % len];
+	t = perm[i];
+	perm[i] = perm[j];
+	perm[j] = t;
+    }
+    rc4->index1 = 0;
+    rc4->index2 = 0;
+}
+
+/*
+ * MppeRc4Crypt()
+ *
+ * Encrypt or decrypt in place. Indexes live in registers and the
+ * loop is unrolled by four.
+ */
+
+#define RC4_STEP(p)	do {						\
+	u_char	t;							\
+									\
+	i++;								\
+	t = perm[i];							\
+	j += t;								\
+	perm[i] = perm[j];						\
+	perm[j] = t;							\
+	(p) ^= perm[(u_char)(t + perm[i])];				\
+  } while (0)
+
+static void
+MppeRc4Crypt(struct mppe_rc4 *rc4, u_char *data, int len)
+{
+    u_char	*const perm = rc4->perm;
+    u_char	i = rc4->index1;
+    u_char	j = rc4->index2;
+
+    for (; len >= 4; len -= 4, data += 4) {
+	RC4_STEP(data[0]);
+	RC4_STEP(data[1]);
+	RC4_STEP(data[2]);
+	RC4_STEP(data[3]);
+    }
+    for (; len > 0; len--, data++)
+	RC4_STEP(data[0]);
+    rc4->index1 = i;
+    rc4->index2 = j;
+}
+
+#undef RC4_STEP
+
+/*
+ * MppcDirStat()
+ */
+
+static int
+MppcDirStat(Context ctx, int dir)
+{
+    MppcInfo		const mppc = &ctx->bund->ccp.mppc;
+    struct mppc_stats	*st;
+
+    switch (dir) {
+	case COMP_DIR_XMIT:
+	    st = &mppc->xmit.stats;
+	    Printf("\tBytes\t: %llu -> %llu (%+lld%%)\r\n",
+		(unsigned long long)st->InOctets,
+		(unsigned long long)st->OutOctets,
+		((st->InOctets!=0)?
+		    ((long long)(st->OutOctets - st->InOctets)
+			*100/(long long)st->InOctets):
+		    0));
+	    Printf("\tFrames\t: %llu -> %lluc + %lluu\r\n",
+		(unsigned long long)st->FramesPlain,
+		(unsigned long long)st->FramesComp,
+		(unsigned long long)st->FramesUncomp);
+	    break;
+	case COMP_DIR_RECV:
+	    st = &mppc->recv.stats;
+	    Printf("\tBytes\t: %llu <- %llu (%+lld%%)\r\n",
+		(unsigned long long)st->OutOctets,
+		(unsigned long long)st->InOctets,
+		((st->OutOctets!=0)?
+		    ((long long)(st->InOctets - st->OutOctets)
+			*100/(long long)st->OutOctets):
+		    0));
+	    Printf("\tFrames\t: %llu <- %lluc + %lluu\r\n",
+		(unsigned long long)st->FramesPlain,
+		(unsigned long long)st->FramesComp,
+		(unsigned long long)st->FramesUncomp);
+	    break;
+	default:
+	    assert(0);
+	    return(0);
+    }
+    Printf("\tErrors\t: %llu\r\n", (unsigned long long)st->Errors);
+    Printf("\tRekeys\t: %llu\r\n", (unsigned long long)st->Rekeys);
+    return(0);
+}
+
+#endif /* USE_NG_MPPC */
+
 #ifdef DEBUG_KEYS
 
 /*
@@ -757,6 +1201,12 @@ MppcKeyAvailable(Bund b, short type) {
 int
 MppcTestCap(void)
 {
+#ifndef USE_NG_MPPC
+    /* Done in user-level, always there */
+    MPPCPresent = 1;
+    MPPEPresent = 1;
+    return(0);
+#else
     struct ng_mppc_config	conf;
     struct ngm_mkpeer		mp;
     int				cs, ds;
@@ -807,6 +1257,7 @@ done:
     close(cs);
     close(ds);
     return(0);
+#endif
 }
 
 /*
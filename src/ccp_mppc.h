@@ -20,10 +20,43 @@
 #include <netgraph/ng_message.h>
 #include <netgraph/ng_mppc.h>
 
+#ifndef USE_NG_MPPC
+#include "mppcc.h"
+#endif
+
 /*
  * DEFINITIONS
  */
 
+#ifndef USE_NG_MPPC
+  struct mppe_rc4 {
+    u_char	perm[256];
+    u_char	index1;
+    u_char	index2;
+  };
+
+  struct mppc_stats {
+    uint64_t	FramesPlain;
+    uint64_t	FramesComp;
+    uint64_t	FramesUncomp;
+    uint64_t	InOctets;
+    uint64_t	OutOctets;
+    uint64_t	Errors;
+    uint64_t	Rekeys;
+  };
+
+  /* State of one direction */
+  struct mppcdir {
+    u_char		key[MPPE_KEY_LEN];	/* Current session key */
+    struct mppe_rc4	rc4;
+    u_int16_t		cc;			/* Coherency count */
+    u_char		flushed;		/* Flush pending */
+    u_int16_t		waiting;		/* Frames dropped waiting for flush */
+    MppcHist		hist;			/* MPPC history */
+    struct mppc_stats	stats;
+  };
+#endif
+
   struct mppcinfo {
     struct optinfo	options;	/* configured protocols */
     uint32_t	peer_reject;		/* types rejected by peer */
@@ -31,6 +64,10 @@
     uint32_t	xmit_bits;		/* xmit config bits */
     u_char	xmit_key0[MPPE_KEY_LEN];/* xmit start key */
     u_char	recv_key0[MPPE_KEY_LEN];/* recv start key */
+#ifndef USE_NG_MPPC
+    struct mppcdir	xmit;		/* Userland compressor state */
+    struct mppcdir	recv;		/* Userland decompressor state */
+#endif
   };
   typedef struct mppcinfo	*MppcInfo;
 
@@ -71,7 +71,7 @@
 #ifndef USE_NG_PRED1
   static int	Compress(Bund b, u_char *source, u_char *dest, int len);
   static int	Decompress(Bund b, u_char *source, u_char *dest, int slen, int dlen);
-  static void	SyncTable(Bund b, u_char *source, u_char *dest, int len);
+  static void	SyncTable(Bund b, const u_char *source, int len);
 #endif
 
 /*
@@ -115,12 +115,19 @@ Pred1Init(Bund b, int dir)
 #ifndef USE_NG_PRED1
     Pred1Info	p = &b->ccp.pred1;
 
+    /* Resets come here too, with the table allocated already */
     if (dir == COMP_DIR_XMIT) {
 	p->oHash = 0;
-	p->OutputGuessTable = Malloc(MB_COMP, PRED1_TABLE_SIZE);
+	if (p->OutputGuessTable == NULL)
+	    p->OutputGuessTable = Malloc(MB_COMP, PRED1_TABLE_SIZE);
+	else
+	    memset(p->OutputGuessTable, 0, PRED1_TABLE_SIZE);
     } else {
 	p->iHash = 0;
-	p->InputGuessTable = Malloc(MB_COMP, PRED1_TABLE_SIZE);
+	if (p->InputGuessTable == NULL)
+	    p->InputGuessTable = Malloc(MB_COMP, PRED1_TABLE_SIZE);
+	else
+	    memset(p->InputGuessTable, 0, PRED1_TABLE_SIZE);
     }
 #else
     struct ngm_mkpeer	mp;
@@ -174,9 +181,11 @@ Pred1Init(Bund b, int dir)
 #endif
     return 0;
 
+#ifdef USE_NG_PRED1
 fail:
     NgFuncShutdownNode(gCcpCsock, b->name, path);
     return(-1);
+#endif
 }
 
 /*
@@ -220,7 +229,8 @@ Pred1Cleanup(Bund b, int dir)
  * Pred1Compress()
  *
  * Compress a packet and return a compressed version.
- * The original is untouched.
+ * Incompressible packet is returned in the original mbuf if it has
+ * room for the header and FCS.
  */
 
 Mbuf
@@ -265,6 +275,21 @@ Pred1Compress(Bund b, Mbuf plain)
     wp += len;
     p->xmit_stats.FramesComp++;
   }
+  else if (plain->offset >= 2 && MBSPACE(plain) - orglen >= 2)
+  {
+    p->xmit_stats.FramesUncomp++;
+    mbfree(res);
+    plain->offset -= 2;
+    plain->cnt += 4;
+    wp = MBDATAU(plain);
+    wp[0] = (orglen >> 8) & 0x7F;
+    wp[1] = orglen & 0xFF;
+    wp[orglen + 2] = fcs & 0xFF;
+    wp[orglen + 3] = fcs >> 8;
+    Log(LG_CCP2, ("[%s] Pred1: orig (%d) --> comp (%d)", b->name, orglen, plain->cnt));
+    p->xmit_stats.OutOctets += plain->cnt;
+    return plain;
+  }
   else
   {
     memcpy(wp, uncomp, orglen);
@@ -290,8 +315,8 @@ Pred1Compress(Bund b, Mbuf plain)
 /*
  * Pred1Decompress()
  *
- * Decompress a packet and return a compressed version.
- * The original is untouched.
+ * Decompress a packet and return a decompressed version.
+ * Uncompressed packet is returned in the original mbuf.
  */
 
 Mbuf
@@ -310,9 +335,15 @@ Pred1Decompress(Bund b, Mbuf mbcomp)
   cp = comp;
   
   p->recv_stats.InOctets += orglen;
-  
-  mbuncomp = mballoc(PRED1_DECOMP_BUF_SIZE);
-  uncomp = MBDATA(mbuncomp);
+
+  if (orglen < 4)
+  {
+    Log(LG_CCP2, ("[%s] Pred1: Short frame (%d)", b->name, orglen));
+    p->recv_stats.Errors++;
+    mbfree(mbcomp);
+    CcpSendResetReq(b);
+    return NULL;
+  }
 
 /* Get initial length value */
   len = *cp++ << 8;
@@ -320,29 +351,53 @@ Pred1Decompress(Bund b, Mbuf mbcomp)
   
   cf = (len & 0x8000);
   len &= 0x7fff;
-  
-/* Is data compressed or not really? */
-  if (cf)
+
+/* Uncompressed data is used in place */
+  if (!cf)
   {
-    p->recv_stats.FramesComp++;
-    len1 = Decompress(b, cp, uncomp, orglen - 4, PRED1_DECOMP_BUF_SIZE);
-    if (len != len1)	/* Error is detected. Send reset request */
+    p->recv_stats.FramesUncomp++;
+    if (len > orglen - 4)
     {
-      Log(LG_CCP2, ("[%s] Length error (%d) --> len (%d)", b->name, len, len1));
+      Log(LG_CCP2, ("[%s] Length error (%d) --> len (%d)", b->name, len, orglen - 4));
       p->recv_stats.Errors++;
       mbfree(mbcomp);
-      mbfree(mbuncomp);
       CcpSendResetReq(b);
       return NULL;
     }
-    cp += orglen - 4;
+    fcs = Crc16(PPP_INITFCS, comp, len + 4);
+    if (fcs != PPP_GOODFCS)
+    {
+      Log(LG_CCP2, ("[%s] Pred1: Bad CRC-16", b->name));
+      p->recv_stats.Errors++;
+      mbfree(mbcomp);
+      CcpSendResetReq(b);
+      return NULL;
+    }
+    SyncTable(b, cp, len);
+    mbcomp->offset += 2;
+    mbcomp->cnt = len;
+    Log(LG_CCP2, ("[%s] Pred1: orig (%d) <-- comp (%d)", b->name, len, orglen));
+    p->recv_stats.FramesPlain++;
+    p->recv_stats.OutOctets += len;
+    return mbcomp;
   }
-  else
+
+  mbuncomp = mballoc(PRED1_DECOMP_BUF_SIZE);
+  uncomp = MBDATA(mbuncomp);
+
+/* Data is compressed */
+  p->recv_stats.FramesComp++;
+  len1 = Decompress(b, cp, uncomp, orglen - 4, PRED1_DECOMP_BUF_SIZE);
+  if (len != len1)	/* Error is detected. Send reset request */
   {
-    p->recv_stats.FramesUncomp++;
-    SyncTable(b, cp, uncomp, len);
-    cp += len;
+    Log(LG_CCP2, ("[%s] Length error (%d) --> len (%d)", b->name, len, len1));
+    p->recv_stats.Errors++;
+    mbfree(mbcomp);
+    mbfree(mbuncomp);
+    CcpSendResetReq(b);
+    return NULL;
   }
+  cp += orglen - 4;
 
   mbuncomp->cnt = len;
 
@@ -617,33 +672,58 @@ Pred1Stat(Context ctx, int dir)
 #ifndef USE_NG_PRED1
 /*
  * Compress()
+ *
+ * Whole groups of 8 bytes are processed without length checks and
+ * without branches on data: the guess table and output byte are always
+ * written, output pointer only advances when the guess was wrong.
+ * Destination must have one spare byte after the result.
  */
 
+#define PRED1_COMP_BYTE(n)					\
+    do {							\
+	c = source[n];						\
+	hit = (table[hash] == c);				\
+	flags |= hit << (n);					\
+	table[hash] = c;					\
+	*dest = c;						\
+	dest += hit ^ 1;					\
+	hash = (hash << 4) ^ c;					\
+    } while (0)
+
 static int
 Compress(Bund b, u_char *source, u_char *dest, int len)
 {
   Pred1Info	p = &b->ccp.pred1;
-  int		i, bitmask;
-  u_char	flags;
+  u_char	*const table = p->OutputGuessTable;
+  u_short	hash = p->oHash;
   u_char	*flagdest, *orgdest;
+  u_int		flags, hit, c;
+  int		i;
 
   orgdest = dest;
-  while (len)
+  while (len >= 8)
   {
-    flagdest = dest++; flags = 0;   /* All guess wrong initially */
-    for (bitmask=1, i=0; i < 8 && len; i++, bitmask <<= 1) {
-      if (p->OutputGuessTable[p->oHash] == *source)
-	flags |= bitmask;       /* Guess was right - don't output */
-      else
-      {
-	p->OutputGuessTable[p->oHash] = *source;
-	*dest++ = *source;      /* Guess wrong, output char */
-      }
-      OHASH(*source++);
-      len--;
-    }
+    flagdest = dest++; flags = 0;
+    PRED1_COMP_BYTE(0);
+    PRED1_COMP_BYTE(1);
+    PRED1_COMP_BYTE(2);
+    PRED1_COMP_BYTE(3);
+    PRED1_COMP_BYTE(4);
+    PRED1_COMP_BYTE(5);
+    PRED1_COMP_BYTE(6);
+    PRED1_COMP_BYTE(7);
     *flagdest = flags;
+    source += 8;
+    len -= 8;
   }
+  if (len > 0)
+  {
+    flagdest = dest++; flags = 0;
+    for (i = 0; i < len; i++)
+      PRED1_COMP_BYTE(i);
+    *flagdest = flags;
+  }
+  p->oHash = hash;
   return(dest - orgdest);
 }
 
@@ -653,53 +733,94 @@ Compress(Bund b, u_char *source, u_char *dest, int len)
  * Returns decompressed size, or -1 if we ran out of space
  */
 
+#define PRED1_DECOMP_BYTE(n)					\
+    do {							\
+	hit = (flags >> (n)) & 1;				\
+	c = hit ? table[hash] : *source;			\
+	table[hash] = c;					\
+	source += hit ^ 1;					\
+	dest[n] = c;						\
+	hash = (hash << 4) ^ c;					\
+    } while (0)
+
 static int
 Decompress(Bund b, u_char *source, u_char *dest, int slen, int dlen)
 {
   Pred1Info	p = &b->ccp.pred1;
-  int		i, bitmask;
-  u_char	flags, *orgdest;
+  u_char	*const table = p->InputGuessTable;
+  u_short	hash = p->iHash;
+  u_char	*orgdest, *group;
+  u_int		flags, hit, c;
+  int		i;
 
   orgdest = dest;
+
+  /* Whole groups with all their literals available */
+  while (slen >= 9 && dlen >= 8)
+  {
+    flags = *source++;
+    group = source;
+    PRED1_DECOMP_BYTE(0);
+    PRED1_DECOMP_BYTE(1);
+    PRED1_DECOMP_BYTE(2);
+    PRED1_DECOMP_BYTE(3);
+    PRED1_DECOMP_BYTE(4);
+    PRED1_DECOMP_BYTE(5);
+    PRED1_DECOMP_BYTE(6);
+    PRED1_DECOMP_BYTE(7);
+    slen -= 1 + (source - group);
+    dest += 8;
+    dlen -= 8;
+  }
+
+  /* The rest, byte by byte */
   while (slen)
   {
     flags = *source++;
     slen--;
-    for (i=0, bitmask = 1; i < 8; i++, bitmask <<= 1)
+    for (i = 0; i < 8; i++)
     {
-      if (dlen <= 0)
+      if (dlen <= 0) {
+	p->iHash = hash;
 	return(-1);
-      if (flags & bitmask)
-	*dest = p->InputGuessTable[p->iHash];		/* Guess correct */
+      }
+      if (flags & (1 << i))
+	c = table[hash];		/* Guess correct */
       else
       {
 	if (!slen)
 	  break;			/* we seem to be really done -- cabo */
-	p->InputGuessTable[p->iHash] = *source;		/* Guess wrong */
-	*dest = *source++;				/* Read from source */
+	c = *source++;			/* Guess wrong, read from source */
+	table[hash] = c;
 	slen--;
       }
-      IHASH(*dest++);
+      *dest++ = c;
+      hash = (hash << 4) ^ c;
       dlen--;
     }
   }
+  p->iHash = hash;
   return(dest - orgdest);
 }
 
 /*
  * SyncTable()
+ *
+ * Update the input guess table with uncompressed data.
  */
 
 static void
-SyncTable(Bund b, u_char *source, u_char *dest, int len)
+SyncTable(Bund b, const u_char *source, int len)
 {
   Pred1Info	p = &b->ccp.pred1;
+  u_char	*const table = p->InputGuessTable;
+  u_short	hash = p->iHash;
 
   while (len--)
   {
-    if (p->InputGuessTable[p->iHash] != *source)
-      p->InputGuessTable[p->iHash] = *source;
-    IHASH(*dest++ = *source++);
+    table[hash] = *source;
+    hash = (hash << 4) ^ *source++;
   }
+  p->iHash = hash;
 }
 #endif
@@ -31,9 +31,21 @@
 #include "ipcp.h"
 #include "ip.h"
 #include "ippool.h"
+#include "rtqueue.h"
+#include "bpfcache.h"
+#ifdef USE_IPFW
+#include "ipfwbatch.h"
+#endif
+#include "spawn.h"
 #include "devices.h"
 #include "netgraph.h"
 #include "ngfunc.h"
+#include "ngstats.h"
+#include "sessevent.h"
+#include "sesssnap.h"
+#include "trace.h"
+#include "capture.h"
+#include "batch.h"
 #ifdef CCP_MPPC
 #include "ccp_mppc.h"
 #endif
@@ -80,8 +92,14 @@
 #endif
     SET_MAX_CHILDREN,
     SET_QTHRESHOLD,
+    SET_SCRIPT_LIMIT,
+    SET_SCRIPT_TIMEOUT,
+    SET_STATS_PERIOD,
+    SET_STATS_AGE,
+    SET_LOG_RATE,
 #ifdef USE_NG_BPF
-    SET_FILTER
+    SET_FILTER,
+    SET_FILTER_CACHE
 #endif
   };
 
@@ -155,9 +173,21 @@
 	GlobalSetCommand, NULL, 2, (void *) SET_MAX_CHILDREN },
     { "qthreshold {min} {max}",		"Message queue limit thresholds",
         GlobalSetCommand, NULL, 2, (void *) SET_QTHRESHOLD },
+    { "script-limit {num}",		"Max instances of each script at once",
+	GlobalSetCommand, NULL, 2, (void *) SET_SCRIPT_LIMIT },
+    { "script-timeout {seconds}",	"Script execution timeout",
+	GlobalSetCommand, NULL, 2, (void *) SET_SCRIPT_TIMEOUT },
+    { "stats-period {seconds}",		"Link statistics sweep period",
+	GlobalSetCommand, NULL, 2, (void *) SET_STATS_PERIOD },
+    { "stats-age {consumer} {seconds}",	"Max age of cached link statistics",
+	GlobalSetCommand, NULL, 2, (void *) SET_STATS_AGE },
+    { "log-rate {lines}",		"Max log lines per second",
+	GlobalSetCommand, NULL, 2, (void *) SET_LOG_RATE },
 #ifdef USE_NG_BPF
     { "filter {num} add|clear [\"{flt}\"]",	"Global traffic filters management",
 	GlobalSetCommand, NULL, 2, (void *) SET_FILTER },
+    { "filter-cache {num}",		"Compiled filters cache size",
+	GlobalSetCommand, NULL, 2, (void *) SET_FILTER_CACHE },
 #endif
     { NULL, NULL, NULL, NULL, 0, NULL },
   };
@@ -169,6 +199,7 @@
     { 0,	GLOBAL_CONF_ONESHOT,	"one-shot"	},
     { 0,	GLOBAL_CONF_AGENT_CID,	"agent-cid"	},
     { 0,	GLOBAL_CONF_SESS_TIME,	"session-time"	},
+    { 0,	GLOBAL_CONF_GIANT_PROF,	"giant-prof"	},
     { 0,	0,			NULL		},
   };
 
@@ -225,7 +256,7 @@
 	EcpStat, AdmitBund, 0, NULL },
     { "eap",				"EAP status",
 	EapStat, AdmitLink, 0, NULL },
-    { "events",				"Current events",
+    { "events [stats [reset]]",		"Current events",
 	ShowEvents, NULL, 0, NULL },
     { "ipcp",				"IPCP status",
 	IpcpStat, AdmitBund, 0, NULL },
@@ -233,10 +264,36 @@
 	Ipv6cpStat, AdmitBund, 0, NULL },
     { "ippool",				"IP pool status",
 	IPPoolStat, NULL, 0, NULL },
+#ifdef USE_NG_BPF
+    { "bpfcache",			"Compiled filters cache status",
+	BpfCacheStat, NULL, 0, NULL },
+#endif
     { "iface",				"Interface status",
 	IfaceStat, AdmitBund, 0, NULL },
     { "routes",				"IP routing table",
 	IpShowRoutes, NULL, 0, NULL },
+    { "rtqueue",			"Route queue status",
+	RtQueueStat, NULL, 0, NULL },
+#ifdef USE_IPFW
+    { "ipfw",				"IPFW helper status",
+	IpfwBatchStat, NULL, 0, NULL },
+#endif
+    { "spawn",				"Script spawn server status",
+	SpawnStat, NULL, 0, NULL },
+    { "ngstats",			"Link statistics collector status",
+	NgStatsStat, NULL, 0, NULL },
+    { "sessevents",			"Session events status",
+	SessEventStat, NULL, 0, NULL },
+    { "snapshot",			"Session snapshot status",
+	SessSnapStat, NULL, 0, NULL },
+    { "log",				"Log writer status",
+	LogStat, NULL, 0, NULL },
+    { "trace",				"Trace selectors",
+	TraceStat, NULL, 0, NULL },
+    { "capture",			"Frame capture status",
+	CaptureStat, NULL, 0, NULL },
+    { "giant [reset]",			"Lock profiling report",
+	GiantStat, NULL, 0, NULL },
     { "layers",				"Layers to open/close",
 	ShowLayers, NULL, 0, NULL },
     { "device",				"Physical device status",
@@ -251,6 +308,8 @@
 #endif
     { "link",				"Link status",
 	LinkStat, AdmitLink, 0, NULL },
+    { "linkrx",				"Link data socket statistics",
+	LinksRxStat, NULL, 0, NULL },
     { "auth",				"Auth status",
 	AuthStat, AdmitLink, 0, NULL },
     { "radius",				"RADIUS status",
@@ -361,8 +420,12 @@
   const struct cmdtab gCommands[] = {
     { "authname {name} [CI]",		"Choose link by auth name",
 	AuthnameCommand, NULL, 0, NULL },
+    { "batch [dry-run] {file}",		"Run commands from file in batch",
+	BatchCommand, NULL, 2, NULL },
     { "bundle [{name}]",		"Choose/list bundles",
 	BundCommand, NULL, 0, NULL },
+    { "capture ...",			"Capture control frames",
+	CMD_SUBMENU, NULL, 2, CaptureCmds },
     { "close [{layer}]",		"Close a layer",
 	CloseCommand, NULL, 1, NULL },
     { "create ...",			"Create new item",
@@ -387,6 +450,8 @@
 	OpenCommand, NULL, 1, NULL },
     { "shutdown",			"Shutdown program",
 	QuitCommand, NULL, 2, NULL },
+    { "trace ...",			"Trace selected sessions",
+	CMD_SUBMENU, NULL, 2, TraceCmds },
     { "repeater [{name}]",		"Choose/list repeaters",
 	RepCommand, NULL, 0, NULL },
     { "session {sesid}",		"Choose link by session-id",
@@ -562,6 +627,41 @@ DoCommandTab(Context ctx, CmdTab cmdlist, int ac, const char *const av[])
     return(rtn);
 }
 
+/*
+ * CheckCommand()
+ *
+ * Resolve command as DoCommandTab() would, without executing it.
+ * Context switching commands are executed, so following commands
+ * are checked in the context they would run in.
+ */
+
+int
+CheckCommand(Context ctx, CmdTab cmdlist, int ac, const char *const av[])
+{
+    CmdTab	cmd;
+    int		rtn;
+
+    if (ac <= 0)
+	return(CMD_ERR_UNFIN);
+    if ((rtn = FindCommand(ctx, cmdlist, av[0], &cmd)))
+	return(rtn);
+    if (cmd->admit && !(cmd->admit)(ctx, cmd))
+	return(CMD_ERR_NOCTX);
+    if (cmd->func == CMD_SUBMENU) {
+	if (ac > 1)
+	    return(CheckCommand(ctx, (CmdTab) cmd->arg, ac - 1, av + 1));
+	if ((intptr_t)cmd->arg == (intptr_t)ShowSessCmds)
+	    return(0);
+	return(CMD_ERR_UNFIN);
+    }
+    if (cmd->func == LinkCommand || cmd->func == BundCommand ||
+	    cmd->func == RepCommand || cmd->func == IfaceCommand ||
+	    cmd->func == SessionCommand || cmd->func == MSessionCommand ||
+	    cmd->func == AuthnameCommand)
+	return((cmd->func)(ctx, ac - 1, av + 1, cmd->arg));
+    return(0);
+}
+
 /*
  * FindCommand()
  */
@@ -607,10 +707,12 @@ GlobalSetCommand(Context ctx, int ac, const char *const av[], const void *arg)
   switch ((intptr_t)arg) {
     case SET_ENABLE:
       EnableCommand(ac, av, &gGlobalConf.options, gGlobalConfList);
+      gGiantProf = Enabled(&gGlobalConf.options, GLOBAL_CONF_GIANT_PROF);
       break;
 
     case SET_DISABLE:
       DisableCommand(ac, av, &gGlobalConf.options, gGlobalConfList);
+      gGiantProf = Enabled(&gGlobalConf.options, GLOBAL_CONF_GIANT_PROF);
       break;
 
 #ifdef USE_IPFW
@@ -707,6 +809,53 @@ GlobalSetCommand(Context ctx, int ac, const char *const av[], const void *arg)
 	    gMaxChildren = val;
       break;
 
+    case SET_SCRIPT_LIMIT:
+	val = atoi(*av);
+	if (val < 0 || val > SPAWN_MAX_RUNNING)
+	    Error("Incorrect script limit, must be between 0 and %d",
+		SPAWN_MAX_RUNNING);
+	else
+	    gSpawnLimit = val;
+      break;
+
+    case SET_SCRIPT_TIMEOUT:
+	val = atoi(*av);
+	if (val < 0 || val > 86400)
+	    Error("Incorrect script timeout");
+	else
+	    gSpawnTimeout = val;
+      break;
+
+    case SET_STATS_PERIOD:
+	val = atoi(*av);
+	if (val < 0 || val > 3600)
+	    Error("Incorrect statistics sweep period");
+	else
+	    NgStatsSetPeriod(val);
+      break;
+
+    case SET_STATS_AGE:
+	{
+	    int	k;
+
+	    if (ac != 2)
+		return(-1);
+	    if ((k = NgStatsConsumer(av[0])) < 0)
+		Error("Unknown statistics consumer \"%s\"", av[0]);
+	    val = atoi(av[1]);
+	    if (val < 0 || val > 3600)
+		Error("Incorrect statistics max age");
+	    gNgStatsMaxAge[k] = val;
+	}
+      break;
+
+    case SET_LOG_RATE:
+	val = atoi(*av);
+	if (val < 0)
+	    Error("Incorrect log rate");
+	gLogRate = val;
+      break;
+
 #ifdef USE_NG_BPF
     case SET_FILTER:
 	if (ac == 4 && strcasecmp(av[1], "add") == 0) {
@@ -756,6 +905,16 @@ GlobalSetCommand(Context ctx, int ac, const char *const av[], const void *arg)
 	    acl_filters[i - 1] = NULL;
 	} else
 	    return(-1);
+	/* Programs of the old rules are not going to be used again */
+	BpfCacheFlush();
+	break;
+
+    case SET_FILTER_CACHE:
+	val = atoi(*av);
+	if (val < 0 || val > BPFCACHE_MAX_SIZE)
+	    Error("Incorrect filter cache size");
+	else
+	    BpfCacheSetSize((u_int)val);
 	break;
 #endif /* USE_NG_BPF */
 	
@@ -921,7 +1080,7 @@ ShowVersion(Context ctx, int ac, const char *const av[], const void *arg)
 #else
   Printf("	ng_ipacct	: no\r\n");
 #endif
-#ifdef  CCP_MPPC
+#ifdef  USE_NG_MPPC
   Printf("	ng_mppc (MPPC)	: %s\r\n", MPPCPresent?"yes":"no");
   Printf("	ng_mppc (MPPE)	: %s\r\n", MPPEPresent?"yes":"no");
 #else
@@ -968,11 +1127,20 @@ ShowVersion(Context ctx, int ac, const char *const av[], const void *arg)
 static int
 ShowEvents(Context ctx, int ac, const char *const av[], const void *arg)
 {
-  (void)ac;
-  (void)av;
   (void)arg;
 
-  EventDump(ctx);
+  if (ac == 0) {
+    EventDump(ctx);
+    return(0);
+  }
+  if (ac > 2 || strcasecmp(av[0], "stats") != 0 ||
+      (ac == 2 && strcasecmp(av[1], "reset") != 0))
+    return(-1);
+  EventStatDump(ctx);
+  if (ac == 2) {
+    EventStatReset();
+    Printf("Statistics reset\r\n");
+  }
   return(0);
 }
 
@@ -983,9 +1151,7 @@ ShowEvents(Context ctx, int ac, const char *const av[], const void *arg)
 static int
 ShowGlobal(Context ctx, int ac, const char *const av[], const void *arg)
 {
-#ifdef USE_NG_BPF
     int	k;
-#endif
 
     (void)ac;
     (void)av;
@@ -1008,6 +1174,16 @@ ShowGlobal(Context ctx, int ac, const char *const av[], const void *arg)
 #endif
     Printf("	max-children	: %d\r\n", gMaxChildren);
     Printf("	qthreshold	: %d %d\r\n", gQThresMin, gQThresMax);
+    Printf("	script-limit	: %d\r\n", gSpawnLimit);
+    Printf("	script-timeout	: %d\r\n", gSpawnTimeout);
+    Printf("	stats-period	: %d\r\n", gNgStatsPeriod);
+    for (k = 0; k < NGSTATS_NUM; k++)
+	Printf("	stats-age	: %s %d\r\n", NgStatsConsumerName(k),
+	    gNgStatsMaxAge[k]);
+    Printf("	log-rate	: %d\r\n", gLogRate);
+#ifdef USE_NG_BPF
+    Printf("	filter-cache	: %u\r\n", BpfCacheGetSize());
+#endif
     Printf("Global options:\r\n");
     OptStat(ctx, &gGlobalConf.options, gGlobalConfList);
 #ifdef USE_NG_BPF
@@ -1260,83 +1436,86 @@ ShowTypes(Context ctx, int ac, const char *const av[], const void *arg)
 
 /*
  * ShowSummary()
+ *
+ * Printed from the session snapshot, refreshed first.
  */
 
 static int
 ShowSummary(Context ctx, int ac, const char *const av[], const void *arg)
 {
   int		b, l, f;
-  Bund		B;
-  Link  	L;
-  Rep		R;
-  char	buf[64];
+  SessTab	t;
+  SessLink	L;
+  struct sessbund	*B;
+  struct sessrep	*R;
 
   (void)ac;
   (void)av;
   (void)arg;
 
+  SessSnapUpdate();
+  if ((t = SessSnapGet()) == NULL)
+    return(0);
+
   Printf("Current daemon status summary\r\n");
   Printf("Iface\tBund\t\tLink\tLCP\tDevice\t\tUser\t\tFrom\r\n");
-  for (b = 0; b<gNumLinks; b++) {
-    if ((L=gLinks[b]) != NULL && L->bund == NULL && L->rep == NULL) {
+  for (b = 0; b<t->nlinks; b++) {
+    if ((L=t->links[b]) != NULL && L->bund < 0 && L->rep < 0) {
 	Printf("\t\t\t");
 	Printf("%s\t%s\t", 
 	    L->name,
-	    FsmStateName(L->lcp.fsm.state));
-	PhysGetPeerAddr(L, buf, sizeof(buf));
+	    FsmStateName(L->lcp));
 	Printf("%s\t%s\t%8s\t%s", 
-	    (L->type?L->type->name:""),
+	    L->type,
 	    gPhysStateNames[L->state],
-	    L->lcp.auth.params.authname,
-	    buf
+	    L->user,
+	    L->peer
 	);
 	Printf("\r\n");
     }
   }
-  for (b = 0; b<gNumBundles; b++) {
-    if ((B=gBundles[b]) != NULL) {
-	Printf("%s\t%s\t%s\t", B->iface.ifname, B->name, (B->iface.up?"Up":"Down"));
+  for (b = 0; b<t->nbunds; b++) {
+    if ((B=&t->bunds[b])->valid) {
+	Printf("%s\t%s\t%s\t", B->iface, B->name, (B->up?"Up":"Down"));
 	f = 1;
 	if (B->n_links == 0)
 	    Printf("\r\n");
 	else for (l = 0; l < NG_PPP_MAX_LINKS; l++) {
-	    if ((L=B->links[l]) != NULL) {
+	    if ((L=SessSnapLink(t, B->links[l])) != NULL) {
 		if (f == 1)
 		    f = 0;
 		else
 		    Printf("\t\t\t");
-		PhysGetPeerAddr(L, buf, sizeof(buf));
 		Printf("%s\t%s\t%s\t%s\t%8s\t%s", 
 		    L->name,
-		    FsmStateName(L->lcp.fsm.state),
-		    (L->type?L->type->name:""),
+		    FsmStateName(L->lcp),
+		    L->type,
 		    gPhysStateNames[L->state],
-		    L->lcp.auth.params.authname,
-		    buf
+		    L->user,
+		    L->peer
 		    );
 		Printf("\r\n");
 	    }
 	}
     }
   }
-  for (b = 0; b < gNumReps; b++) {
-    if ((R = gReps[b]) != NULL) {
+  for (b = 0; b < t->nreps; b++) {
+    if ((R = &t->reps[b])->valid) {
 	Printf("Repeater\t%s\t", R->name);
 	f = 1;
 	for (l = 0; l < 2; l++) {
-	    if ((L = R->links[l])!= NULL) {
+	    if ((L = SessSnapLink(t, R->links[l]))!= NULL) {
 		if (f)
 		    f = 0;
 		else
 		    Printf("\t\t\t");
-		PhysGetPeerAddr(L, buf, sizeof(buf));
 		Printf("%s\t%s\t%s\t%s\t%8s\t%s", 
 		    L->name,
 		    "",
-		    (L->type?L->type->name:""),
+		    L->type,
 		    gPhysStateNames[L->state],
 		    "",
-		    buf
+		    L->peer
 		    );
 		Printf("\r\n");
 	    }
@@ -1345,46 +1524,49 @@ ShowSummary(Context ctx, int ac, const char *const av[], const void *arg)
 	    Printf("\r\n");
     }
   }
+  SessSnapRelease(t);
   return(0);
 }
 
 /*
  * ShowSessions()
+ *
+ * Printed from the session snapshot, refreshed first.
  */
 
 static int
 ShowSessions(Context ctx, int ac, const char *const av[], const void *arg)
 {
-    int		l;
-    Bund	B;
-    Link  	L;
-    char	peer[64], addr[64], buf[64];
+    int		l, rtn = 0;
+    SessTab	t;
+    SessLink	L;
 
     if (ac != 0 && ac != 1)
 	return (-1);
 
-    for (l = 0; l < gNumLinks; l++) {
-	if ((L=gLinks[l]) != NULL && L->session_id[0] && L->bund) {
-	    B = L->bund;
-	    u_addrtoa(&B->iface.peer_addr, addr, sizeof(addr));
-	    PhysGetPeerAddr(L, peer, sizeof(peer));
+    SessSnapUpdate();
+    if ((t = SessSnapGet()) == NULL)
+	return (0);
+
+    for (l = 0; l < t->nlinks; l++) {
+	if ((L=t->links[l]) != NULL && L->session_id[0] && L->bund >= 0) {
 	    if (ac == 0)
 	        goto out;
 	    switch ((intptr_t)arg) {
 		case SHOW_IFACE:
-		    if (strcmp(av[0], B->iface.ifname))
+		    if (strcmp(av[0], L->iface))
 			continue;
 		    break;
 		case SHOW_IP:
-		    if (strcmp(av[0], addr))
+		    if (strcmp(av[0], L->iface_peer))
 			continue;
 		    break;
 		case SHOW_USER:
-		    if (strcmp(av[0], L->lcp.auth.params.authname))
+		    if (strcmp(av[0], L->user))
 			continue;
 		    break;
 		case SHOW_MSESSION:
-		    if (strcmp(av[0], B->msession_id))
+		    if (strcmp(av[0], L->msession_id))
 			continue;
 		    break;
 		case SHOW_SESSION:
@@ -1392,15 +1574,16 @@ ShowSessions(Context ctx, int ac, const char *const av[], const void *arg)
 			continue;
 		    break;
 		case SHOW_BUNDLE:
-		    if (strcmp(av[0], B->name))
+		    if (strcmp(av[0], L->bundle))
 			continue;
 		    break;
 		case SHOW_LINK:
 		    if (av[0][0] == '[') {
 			int k;
-			if (sscanf(av[0], "[%x]", &k) != 1)
-			    return (-1);
-			else {
+			if (sscanf(av[0], "[%x]", &k) != 1) {
+			    rtn = -1;
+			    goto done;
+			} else {
 			    if (L->id != k)
 				continue;
 			}
@@ -1410,26 +1593,25 @@ ShowSessions(Context ctx, int ac, const char *const av[], const void *arg)
 		    }
 		    break;
 		case SHOW_PEER:
-		    if (strcmp(av[0], peer))
+		    if (strcmp(av[0], L->peer))
 			continue;
 		    break;
 		default:
-		    return (-1);
+		    rtn = -1;
+		    goto done;
 	    }
 out:
-	    Printf("%s\t%s\t%s\t%s\t", B->iface.ifname,
-		addr, B->name, B->msession_id);
+	    Printf("%s\t%s\t%s\t%s\t", L->iface,
+		L->iface_peer, L->bundle, L->msession_id);
 	    Printf("%s\t%d\t%s\t%s\t%s", 
 		L->name,
 		L->id,
 		L->session_id,
-		L->lcp.auth.params.authname,
-		peer
+		L->user,
+		L->peer
 	    );
-	    if (Enabled(&gGlobalConf.options, GLOBAL_CONF_AGENT_CID)) {
-		PhysGetSelfName(L, buf, sizeof(buf));
-		Printf("\t%s", buf);
-	    }
+	    if (Enabled(&gGlobalConf.options, GLOBAL_CONF_AGENT_CID))
+		Printf("\t%s", L->self);
 	    if (Enabled(&gGlobalConf.options, GLOBAL_CONF_SESS_TIME)) {
 		if (L->state == PHYS_STATE_UP)
 		    Printf("\t%ld", (long int)(time(NULL) - L->last_up));
@@ -1437,7 +1619,9 @@ out:
 	    Printf("\r\n");
 	}
     }
-    return(0);
+done:
+    SessSnapRelease(t);
+    return(rtn);
 }
 
 /*
@@ -1572,7 +1756,7 @@ ShowCustomer(Context ctx, int ac, const char *const av[], const void *arg)
 
 	if (!b->tmpl) {
 	    /* Show stats */
-	    BundUpdateStats(b);
+	    BundUpdateStats(b, NGSTATS_SHOW);
 	    Printf("\tTraffic stats:\r\n");
 
 	    Printf("\t\tInput octets   : %llu\r\n", (unsigned long long)b->stats.recvOctets);
@@ -1617,7 +1801,7 @@ ShowCustomer(Context ctx, int ac, const char *const av[], const void *arg)
 	    Printf("\tCalled          : %s\r\n", buf);
 
 	    if (l->bund) {
-		LinkUpdateStats(l);
+		LinkUpdateStats(l, NGSTATS_SHOW);
 		Printf("\tTraffic stats:\r\n");
 		Printf("\t\tInput octets   : %llu\r\n", (unsigned long long)l->stats.recvOctets);
 		Printf("\t\tInput frames   : %llu\r\n", (unsigned long long)l->stats.recvFrames);
@@ -33,7 +33,8 @@
 #endif
     GLOBAL_CONF_ONESHOT,	/* enable OneShot mode */
     GLOBAL_CONF_AGENT_CID,	/* enable display Agent CID in show session */
-    GLOBAL_CONF_SESS_TIME	/* enable display uptime in show session */
+    GLOBAL_CONF_SESS_TIME,	/* enable display uptime in show session */
+    GLOBAL_CONF_GIANT_PROF	/* enable lock profiling */
   };
 
   struct globalconf {
@@ -61,6 +62,7 @@
   extern int	DoConsole(void);
   extern int	DoCommand(Context ctx, int ac, const char *const av[], const char *file, int line);
   extern int	DoCommandTab(Context ctx, CmdTab cmdlist, int ac, const char *const av[]);
+  extern int	CheckCommand(Context ctx, CmdTab cmdlist, int ac, const char *const av[]);
   extern int	HelpCommand(Context ctx, int ac, const char *const av[], const void *arg);
   extern int	FindCommand(Context ctx, CmdTab cmds, const char* str, CmdTab *cp);
   extern int	AdmitBund(Context ctx, CmdTab cmd);
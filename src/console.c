@@ -9,6 +9,7 @@
 
 #include "ppp.h"
 #include "console.h"
+#include "batch.h"
 #include "util.h"
 #include <termios.h>
 
@@ -355,6 +356,10 @@ static void
 ConsoleSessionClose(ConsoleSession cs)
 {
     cs->write(cs, "Console closed.\r\n");
+    if (cs->batch != NULL) {
+	BatchDestroy(cs->batch);
+	cs->batch = NULL;
+    }
     RWLOCK_WRLOCK(cs->console->lock);
     SLIST_REMOVE(&cs->console->sessions, cs, console_session, next);
     RWLOCK_UNLOCK(cs->console->lock);
@@ -372,6 +377,10 @@ static void
 StdConsoleSessionClose(ConsoleSession cs)
 {
     cs->write(cs, "Console closed.\r\n");
+    if (cs->batch != NULL) {
+	BatchDestroy(cs->batch);
+	cs->batch = NULL;
+    }
     EventUnRegister(&cs->readEvent);
     /* Restore original attrs */
     tcsetattr(cs->fd, TCSANOW, &gOrigTermiosAttrs);
@@ -97,6 +97,7 @@
     char		cmd[MAX_CONSOLE_LINE];
     int			currhist;
     char		history[MAX_CONSOLE_HIST][MAX_CONSOLE_LINE];	/* last command */
+    struct batch	*batch;		/* Running batch */
     SLIST_ENTRY(console_session)	next;
   };
 
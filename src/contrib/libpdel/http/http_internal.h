@@ -57,12 +57,16 @@ struct http_connection {
 	struct in_addr		remote_ip;	/* remote host ip */
 	u_int16_t		remote_port;	/* remote host port */
 	FILE			*fp;		/* connection to peer */
-	pthread_t		tid;		/* connection thread id */
+	pthread_t		tid;		/* worker serving it, if any */
 	u_char			keep_alive;	/* connection keep-alive */
 	u_char			server;		/* we are server (not client) */
 	u_char			proxy;		/* proxy request/response */
-	u_char			started;	/* conn. thread has started */
+	u_char			queued;		/* on server ready queue */
+	struct pevent		*read_event;	/* idle: request arrives */
+	struct pevent		*idle_event;	/* idle: timeout */
+	u_int64_t		ready_time;	/* queued at, usec */
 	LIST_ENTRY(http_connection) next;	/* next in connection list */
+	TAILQ_ENTRY(http_connection) ready;	/* next in ready queue */
 	http_logger_t		*logger;	/* error logging routine */
 	SSL_CTX			*ssl;		/* ssl context, if doing ssl */
 	int			sock;		/* socket cached */
@@ -57,9 +57,11 @@
 #include <regex.h>
 #include <pthread.h>
 #include <netdb.h>
+#include <time.h>
 
 #include <netinet/in_systm.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 
 #include <openssl/ssl.h>
@@ -79,11 +81,38 @@
 
 /*
  * Embedded HTTP[S] web server.
+ *
+ * Connections waiting for a request are parked in the event context
+ * and cost no thread. When a request arrives the connection is queued
+ * and served by one of a bounded pool of worker threads, started as
+ * needed, which parks it again afterwards if it is kept alive. Parked
+ * connections are closed after idle_timeout seconds.
+ *
+ * A worker serving a request can still block on the connection I/O,
+ * bounded by HTTP_SERVER_TIMEOUT. A servlet sending a long-lived
+ * response, like an event stream, takes its worker out of the pool
+ * with http_server_stream(), and another one is started in its place
+ * if needed. Such workers are limited by max_streams, and rejoin the
+ * pool when done if there is room or exit. Streams are unbuffered, so nothing
+ * of a pipelined request is left in the stream when a connection is
+ * parked, except what SSL may have decrypted ahead.
  */
 
 #define MAX_CONNECTIONS		1024
+#define MAX_WORKERS		32
+#define MAX_STREAMS		16
+#define IDLE_TIMEOUT		90
 #define HTTP_SERVER_TIMEOUT	90
 
+/* Worker thread */
+struct http_worker {
+	struct http_server	*server;	/* back pointer to server */
+	pthread_t		tid;		/* thread id */
+	struct http_connection	*conn;		/* connection being served */
+	u_char			stream;		/* out of the pool, streaming */
+	LIST_ENTRY(http_worker)	next;		/* next in server list */
+};
+
 /* HTTP server */
 struct http_server {
 	struct pevent_ctx	*ctx;		/* event context */
@@ -97,8 +126,21 @@ struct http_server {
 	void			*proxy_arg;	/* proxy handler cookie */
 	LIST_HEAD(,http_connection)
 				conn_list;	/* active connections */
-	int			max_conn;	/* max number of connections */
-	int			num_conn;	/* number of connections */
+	TAILQ_HEAD(,http_connection)
+				ready;		/* waiting for a worker */
+	pthread_cond_t		ready_cond;	/* connection made ready */
+	LIST_HEAD(,http_worker)	workers;	/* worker threads */
+	u_int			max_conn;	/* max number of connections */
+	u_int			max_workers;	/* max number of workers */
+	u_int			max_streams;	/* max number of streams */
+	u_int			idle_timeout;	/* keep-alive idle seconds */
+	u_int			num_conn;	/* number of connections */
+	u_int			num_idle;	/* parked connections */
+	u_int			num_ready;	/* queued connections */
+	u_int			num_workers;	/* number of workers */
+	u_int			idle_workers;	/* workers waiting */
+	u_int			num_streams;	/* workers streaming */
+	struct http_server_stats stats;		/* counters, histograms */
 	http_logger_t		*logger;	/* error logging routine */
 	pthread_mutex_t		mutex;		/* mutex */
 	u_char			stopping;	/* server being stopped */
@@ -139,14 +181,29 @@ struct http_servlet_hook {
 /*
  * Internal functions
  */
-static void	*http_server_connection_main(void *arg);
-static void	http_server_connection_cleanup(void *arg);
+static int	http_server_park(struct http_server *serv,
+			struct http_connection *conn);
+static void	http_server_enqueue(struct http_server *serv,
+			struct http_connection *conn);
+static void	http_server_close(struct http_server *serv,
+			struct http_connection *conn);
+static void	http_server_accept_update(struct http_server *serv);
+static int	http_server_worker_start(struct http_server *serv);
+static void	*http_server_worker_main(void *arg);
+static void	http_server_worker_cleanup(void *arg);
+static int	http_server_serve(struct http_connection *conn,
+			u_int64_t *usec);
 static void	http_server_dispatch(struct http_request *req,
 			struct http_response *resp);
+static u_int64_t http_server_now(void);
+static void	http_server_hist_add(struct http_server_hist *h,
+			u_int64_t usec);
 static int	http_server_ssl_pem_password_cb(char *buf, int size,
 			int rwflag, void *udata);
 
 static pevent_handler_t		http_server_accept;
+static pevent_handler_t		http_server_readable;
+static pevent_handler_t		http_server_idle;
 
 static ghash_equal_t		http_server_virthost_equal;
 static ghash_hash_t		http_server_virthost_hash;
@@ -169,6 +226,7 @@ http_server_start(struct pevent_ctx *ctx, struct in_addr ip,
 	struct http_server *serv;
 	struct sockaddr_in sin;
 	int got_mutex = 0;
+	int got_cond = 0;
 
 	/* Initialize new server structure */
 	if ((serv = MALLOC("http_server", sizeof(*serv))) == NULL) {
@@ -177,10 +235,15 @@ http_server_start(struct pevent_ctx *ctx, struct in_addr ip,
 	}
 	memset(serv, 0, sizeof(*serv));
 	LIST_INIT(&serv->conn_list);
+	TAILQ_INIT(&serv->ready);
+	LIST_INIT(&serv->workers);
 	serv->ctx = ctx;
 	serv->logger = logger;
 	serv->sock = -1;
-	serv->max_conn = MAX_CONNECTIONS;	/* XXX make configurable */
+	serv->max_conn = MAX_CONNECTIONS;
+	serv->max_workers = MAX_WORKERS;
+	serv->max_streams = MAX_STREAMS;
+	serv->idle_timeout = IDLE_TIMEOUT;
 
 	/* Copy server name */
 	if ((serv->server_name
@@ -277,6 +340,12 @@ http_server_start(struct pevent_ctx *ctx, struct in_addr ip,
 		goto fail;
 	}
 	got_mutex = 1;
+	if ((errno = pthread_cond_init(&serv->ready_cond, NULL)) != 0) {
+		(*serv->logger)(LOG_ERR, "%s: %s",
+		    "pthread_cond_init", strerror(errno));
+		goto fail;
+	}
+	got_cond = 1;
 
 	/* Start accepting connections */
 	if (pevent_register(serv->ctx, &serv->conn_event, PEVENT_RECURRING,
@@ -293,6 +362,8 @@ http_server_start(struct pevent_ctx *ctx, struct in_addr ip,
 
 fail:
 	/* Cleanup after failure */
+	if (got_cond)
+		pthread_cond_destroy(&serv->ready_cond);
 	if (got_mutex)
 		pthread_mutex_destroy(&serv->mutex);
 	if (serv->pkey_pw != NULL) {
@@ -317,6 +388,7 @@ http_server_stop(struct http_server **sp)
 {
 	struct http_server *const serv = *sp;
 	struct http_connection *conn;
+	struct http_worker *worker;
 
 	/* Already stopped? */
 	if (serv == NULL)
@@ -335,6 +407,40 @@ http_server_stop(struct http_server **sp)
 	/* Stop accepting new connections */
 	pevent_unregister(&serv->conn_event);
 
+	/* Close connections not being served */
+	while ((conn = TAILQ_FIRST(&serv->ready)) != NULL)
+		http_server_close(serv, conn);
+	while (serv->num_idle > 0) {
+		LIST_FOREACH(conn, &serv->conn_list, next) {
+			if (conn->read_event != NULL)
+				break;
+		}
+		assert(conn != NULL);
+		http_server_close(serv, conn);
+	}
+
+	/* Kill workers serving requests; they will clean up themselves */
+	LIST_FOREACH(worker, &serv->workers, next) {
+		if (worker->conn != NULL) {
+			DBG(HTTP, "canceling conn %p (thread %p)",
+			    worker->conn, worker->tid);
+			assert(worker->tid != pthread_self());
+			pthread_cancel(worker->tid);
+		}
+	}
+
+	/* Wake up waiting workers and wait for all of them to exit */
+	pthread_cond_broadcast(&serv->ready_cond);
+	MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
+	LIST_FOREACH(worker, &serv->workers, next)
+		pthread_join(worker->tid, NULL);
+	MUTEX_LOCK(&serv->mutex, serv->mutex_count);
+	while ((worker = LIST_FIRST(&serv->workers)) != NULL) {
+		LIST_REMOVE(worker, next);
+		FREE("http_worker", worker);
+	}
+	assert(LIST_EMPTY(&serv->conn_list));
+
 	/*
 	 * Destroy all registered servlets. Because we must unlock the
 	 * server to do this, don't rely on iteration. Instead, start at
@@ -362,26 +468,6 @@ http_server_stop(struct http_server **sp)
 		MUTEX_LOCK(&serv->mutex, serv->mutex_count);
 	}
 
-	/* Kill any remaining connections */
-	while (!LIST_EMPTY(&serv->conn_list)) {
-
-		/* Kill active connections; they will clean up themselves */
-		LIST_FOREACH(conn, &serv->conn_list, next) {
-			if (conn->started && conn->tid != 0) {
-				DBG(HTTP, "canceling conn %p (thread %p)",
-				    conn, conn->tid);
-				assert(conn->tid != pthread_self());
-				pthread_cancel(conn->tid);
-				conn->tid = 0;		/* don't cancel twice */
-			}
-		}
-
-		/* Wait for outstanding connections to complete */
-		MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
-		usleep(100000);
-		MUTEX_LOCK(&serv->mutex, serv->mutex_count);
-	}
-
 	/* Free SSL context */
 	if (serv->ssl != NULL)
 		SSL_CTX_free(serv->ssl);
@@ -402,6 +488,7 @@ http_server_stop(struct http_server **sp)
 
 	/* Free server structure itself */
 	MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
+	pthread_cond_destroy(&serv->ready_cond);
 	pthread_mutex_destroy(&serv->mutex);
 	DBG(HTTP, "freeing server %p", serv);
 	FREE("http_server", serv);
@@ -613,6 +700,87 @@ http_server_set_proxy_handler(struct http_server *serv,
 	MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
 }
 
+/*
+ * Set limits. Zero idle_timeout keeps idle connections until the
+ * client closes them, zero max_streams refuses all streams. Running
+ * workers and streams over a lowered limit are kept, connections over
+ * it are not closed but no new ones are accepted.
+ */
+void
+http_server_set_limits(struct http_server *serv, u_int max_conn,
+	u_int max_workers, u_int max_streams, u_int idle_timeout)
+{
+	MUTEX_LOCK(&serv->mutex, serv->mutex_count);
+	serv->max_conn = MAX(max_conn, 1);
+	serv->max_workers = MAX(max_workers, 1);
+	serv->max_streams = max_streams;
+	serv->idle_timeout = idle_timeout;
+	http_server_accept_update(serv);
+	MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
+}
+
+/*
+ * Get statistics.
+ */
+void
+http_server_get_stats(struct http_server *serv,
+	struct http_server_stats *stats)
+{
+	MUTEX_LOCK(&serv->mutex, serv->mutex_count);
+	*stats = serv->stats;
+	stats->max_conn = serv->max_conn;
+	stats->max_workers = serv->max_workers;
+	stats->max_streams = serv->max_streams;
+	stats->idle_timeout = serv->idle_timeout;
+	stats->num_conn = serv->num_conn;
+	stats->num_idle = serv->num_idle;
+	stats->num_ready = serv->num_ready;
+	stats->num_workers = serv->num_workers;
+	stats->busy_workers = serv->num_workers - serv->idle_workers;
+	stats->num_streams = serv->num_streams;
+	MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
+}
+
+/*
+ * Take the worker serving this response out of the pool, for a
+ * response that lasts as long as the client wants, like an event
+ * stream. Call it before sending anything. Returns -1 with errno
+ * set to EAGAIN if there are max_streams already.
+ */
+int
+http_server_stream(struct http_response *resp)
+{
+	struct http_connection *const conn = resp->msg->conn;
+	struct http_server *const serv = conn->owner;
+	struct http_worker *worker;
+
+	MUTEX_LOCK(&serv->mutex, serv->mutex_count);
+	LIST_FOREACH(worker, &serv->workers, next) {
+		if (worker->conn == conn)
+			break;
+	}
+	if (worker == NULL || worker->stream) {
+		MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
+		return (0);
+	}
+	if (serv->num_streams >= serv->max_streams) {
+		serv->stats.streams_refused++;
+		MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
+		errno = EAGAIN;
+		return (-1);
+	}
+	worker->stream = 1;
+	serv->num_workers--;
+	serv->num_streams++;
+	serv->stats.streams++;
+
+	/* Requests waiting for this worker get another one */
+	if (serv->num_ready > serv->idle_workers)
+		(void)http_server_worker_start(serv);
+	MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
+	return (0);
+}
+
 /*********************************************************************
 			SERVER MAIN THREAD
 *********************************************************************/
@@ -630,6 +798,7 @@ http_server_accept(void *arg)
 	struct sockaddr_in sin;
 	socklen_t slen = sizeof(sin);
 	int sock;
+	int one = 1;
 
 	/* Accept next connection */
 	if ((sock = accept(serv->sock, (struct sockaddr *)&sin, &slen)) == -1) {
@@ -641,6 +810,12 @@ http_server_accept(void *arg)
 	}
 	(void)fcntl(sock, F_SETFD, 1);
 
+	/*
+	 * Headers and body go out in separate writes; don't let Nagle
+	 * hold back the body until the client's delayed ACK comes.
+	 */
+	(void)setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
 	/* Get new connection object */
 	if ((conn = _http_connection_create(NULL, sock, 1, sin.sin_addr,
 	    ntohs(sin.sin_port), serv->ssl, serv->logger,
@@ -651,179 +826,394 @@ http_server_accept(void *arg)
 		return;
 	}
 	conn->owner = serv;
+	conn->keep_alive = 1;
 
 	/* Add to server's list of active connections */
 	LIST_INSERT_HEAD(&serv->conn_list, conn, next);
 	serv->num_conn++;
+	serv->stats.accepted++;
+	DBG(HTTP, "connection %p from %s:%u",
+	    conn, inet_ntoa(conn->remote_ip), conn->remote_port);
 
-	/* Spawn a new thread to handle request */
-	if ((errno = pthread_create(&conn->tid, NULL,
-	    http_server_connection_main, conn)) != 0) {
-		(*serv->logger)(LOG_ERR, "%s: %s",
-		    "pthread_create", strerror(errno));
-		conn->tid = 0;
-		LIST_REMOVE(conn, next);
-		serv->num_conn--;
-		_http_connection_free(&conn);
+	/* Wait for the request without holding a worker */
+	if (http_server_park(serv, conn) == -1) {
+		http_server_close(serv, conn);
+		return;
 	}
 
-	/* Detach thread */
-	pthread_detach(conn->tid);
-	DBG(HTTP, "spawning %p for connection %p from %s:%u",
-	    conn->tid, conn, inet_ntoa(conn->remote_ip), conn->remote_port);
-
 	/* If maximum number of connections reached, stop accepting new ones */
-	if (serv->num_conn >= serv->max_conn)
+	if (serv->num_conn >= serv->max_conn) {
 		pevent_unregister(&serv->conn_event);
+		serv->stats.paused++;
+	}
+}
+
+/*
+ * Stop or restart accepting connections after a change.
+ *
+ * The mutex must be locked.
+ */
+static void
+http_server_accept_update(struct http_server *serv)
+{
+	if (serv->num_conn >= serv->max_conn) {
+		pevent_unregister(&serv->conn_event);
+		return;
+	}
+	if (serv->conn_event == NULL && !serv->stopping) {
+		if (pevent_register(serv->ctx, &serv->conn_event,
+		    PEVENT_RECURRING, &serv->mutex, http_server_accept,
+		    serv, PEVENT_READ, serv->sock) == -1) {
+			(*serv->logger)(LOG_ERR, "%s: %s",
+			    "pevent_register", strerror(errno));
+		}
+	}
 }
 
 /*********************************************************************
-		    SERVER CONNECTION MAIN THREAD
+			IDLE CONNECTIONS
 *********************************************************************/
 
 /*
- * HTTP connection thread main routine.
+ * Park a connection until its next request arrives.
+ *
+ * The mutex must be locked.
  */
-static void *
-http_server_connection_main(void *arg)
+static int
+http_server_park(struct http_server *serv, struct http_connection *conn)
+{
+	if (pevent_register(serv->ctx, &conn->read_event, 0, &serv->mutex,
+	    http_server_readable, conn, PEVENT_READ, conn->sock) == -1) {
+		(*serv->logger)(LOG_ERR, "%s: %s",
+		    "pevent_register", strerror(errno));
+		return (-1);
+	}
+	if (serv->idle_timeout > 0
+	    && pevent_register(serv->ctx, &conn->idle_event, 0, &serv->mutex,
+	      http_server_idle, conn, PEVENT_TIME,
+	      serv->idle_timeout * 1000) == -1) {
+		(*serv->logger)(LOG_ERR, "%s: %s",
+		    "pevent_register", strerror(errno));
+		pevent_unregister(&conn->read_event);
+		return (-1);
+	}
+	serv->num_idle++;
+	return (0);
+}
+
+/*
+ * Request arrived on a parked connection (or the peer closed it).
+ *
+ * The mutex will be locked when this is called.
+ */
+static void
+http_server_readable(void *arg)
 {
 	struct http_connection *const conn = arg;
 	struct http_server *const serv = conn->owner;
 
-	/* Add shutdown cleanup hook */
-	pthread_cleanup_push(http_server_connection_cleanup, conn);
-	conn->started = 1;		/* avoids pthread_cancel() race */
-	DBG(HTTP, "connection %p started", conn);
+	pevent_unregister(&conn->idle_event);
+	serv->num_idle--;
+	http_server_enqueue(serv, conn);
+}
 
-	/* Read requests as long as connection is kept alive */
-	conn->keep_alive = 1;
-	while (1) {
-		struct http_request *const req = conn->req;
-		struct http_response *const resp = conn->resp;
-		const char *hval;
-		char dbuf[64];
-		struct tm tm;
-		time_t now;
-
-		/* Read in request */
-		if (_http_request_read(conn) == -1) {
-			if (errno == ENOTCONN)	/* remote side disconnected */
-				break;
-			conn->keep_alive = 0;
-			goto send_response;
-		}
+/*
+ * Parked connection idle for too long.
+ *
+ * The mutex will be locked when this is called.
+ */
+static void
+http_server_idle(void *arg)
+{
+	struct http_connection *const conn = arg;
+	struct http_server *const serv = conn->owner;
 
-		/* Set default response headers */
-		now = time(NULL);
-		strftime(dbuf, sizeof(dbuf),
-		    HTTP_TIME_FMT_RFC1123, gmtime_r(&now, &tm));
-		if (http_response_set_header(resp, 0,
-		      HDR_REPLY_VERSION, HTTP_PROTO_1_1) == -1
-		    || http_response_set_header(resp, 0, HDR_REPLY_STATUS,
-		      "%d", HTTP_STATUS_OK) == -1
-		    || http_response_set_header(resp, 0, HDR_REPLY_REASON,
-		      "%s", http_response_status_msg(HTTP_STATUS_OK)) == -1
-		    || http_response_set_header(resp, 0, HTTP_HEADER_SERVER,
-		      "%s", serv->server_name) == -1
-		    || http_response_set_header(resp, 0, HTTP_HEADER_DATE,
-		      "%s", dbuf) == -1
-		    || http_response_set_header(resp, 0,
-		      HTTP_HEADER_LAST_MODIFIED, "%s", dbuf) == -1) {
-			conn->keep_alive = 0;
-			goto send_response;
-		}
+	DBG(HTTP, "connection %p idle timeout", conn);
+	serv->stats.idle_closed++;
+	http_server_close(serv, conn);
+}
 
-		/* Turn off keep-alive if client doesn't want it */
-		if (!_http_head_want_keepalive(req->msg->head))
-			conn->keep_alive = 0;
+/*
+ * Queue a connection for a worker, starting a new one if all
+ * are busy and the limit allows.
+ *
+ * The mutex must be locked.
+ */
+static void
+http_server_enqueue(struct http_server *serv, struct http_connection *conn)
+{
+	conn->ready_time = http_server_now();
+	TAILQ_INSERT_TAIL(&serv->ready, conn, ready);
+	conn->queued = 1;
+	serv->num_ready++;
+	if (serv->idle_workers > 0) {
+		pthread_cond_signal(&serv->ready_cond);
+		if (serv->num_ready <= serv->idle_workers)
+			return;
+	}
 
-		/* Handle request */
-		http_server_dispatch(req, resp);
-
-		/* Set Connection: header if not already set */
-		if (((hval = http_request_get_method(req)) == NULL
-		      || strcmp(hval, HTTP_METHOD_CONNECT) != 0)
-		    && http_response_get_header(resp,
-		      _http_message_connection_header(resp->msg)) == NULL) {
-			http_response_set_header(resp, 0,
-			    _http_message_connection_header(resp->msg),
-			    conn->keep_alive ? "Keep-Alive" : "Close");
-		}
+	/* Nobody would ever serve it */
+	if (http_server_worker_start(serv) == -1 && serv->num_workers == 0)
+		http_server_close(serv, conn);
+}
 
-		/* Slurp up any remaining entity data if keep-alive */
-		if (conn->keep_alive && req != NULL && !feof(req->msg->input)) {
-			static char buf[1024];
+/*
+ * Close a connection not being served by a worker.
+ *
+ * The mutex must be locked.
+ */
+static void
+http_server_close(struct http_server *serv, struct http_connection *conn)
+{
+	if (conn->read_event != NULL) {
+		pevent_unregister(&conn->read_event);
+		pevent_unregister(&conn->idle_event);
+		serv->num_idle--;
+	}
+	if (conn->queued) {
+		TAILQ_REMOVE(&serv->ready, conn, ready);
+		conn->queued = 0;
+		serv->num_ready--;
+	}
+	LIST_REMOVE(conn, next);
+	serv->num_conn--;
+	_http_connection_free(&conn);
 
-			while (fgets(buf, sizeof(buf), req->msg->input) != NULL)
-				;
-		}
+	/* Restart accepting new connections if needed */
+	http_server_accept_update(serv);
+}
 
-send_response:
-		/* Send back headers (if not already sent) */
-		http_response_send_headers(resp, 0);
-
-		/* Send back body (if it was buffered) */
-		_http_message_send_body(resp->msg);
-
-		/* Determine if we can still keep this connection alive */
-		if (!resp->msg->no_body
-		    && (http_response_get_header(resp,
-		       HTTP_HEADER_CONTENT_LENGTH) == NULL
-		      || ferror(conn->fp)
-		      || feof(conn->fp)
-		      || !_http_head_want_keepalive(resp->msg->head)))
-			conn->keep_alive = 0;
-
-		/* Close connection unless keeping it alive */
-		if (!conn->keep_alive)
+/*********************************************************************
+			    WORKER THREADS
+*********************************************************************/
+
+/*
+ * Start a new worker, unless the limit is reached.
+ *
+ * The mutex must be locked.
+ */
+static int
+http_server_worker_start(struct http_server *serv)
+{
+	struct http_worker *worker;
+
+	if (serv->num_workers >= serv->max_workers || serv->stopping)
+		return (0);
+	if ((worker = MALLOC("http_worker", sizeof(*worker))) == NULL) {
+		(*serv->logger)(LOG_ERR, "%s: %s", "malloc", strerror(errno));
+		return (-1);
+	}
+	memset(worker, 0, sizeof(*worker));
+	worker->server = serv;
+	if ((errno = pthread_create(&worker->tid, NULL,
+	    http_server_worker_main, worker)) != 0) {
+		(*serv->logger)(LOG_ERR, "%s: %s",
+		    "pthread_create", strerror(errno));
+		FREE("http_worker", worker);
+		return (-1);
+	}
+	LIST_INSERT_HEAD(&serv->workers, worker, next);
+	serv->num_workers++;
+	DBG(HTTP, "started worker %p", worker->tid);
+	return (0);
+}
+
+/*
+ * Worker thread main routine.
+ *
+ * Workers can be canceled only while serving a request, so that
+ * http_server_stop() never cancels one holding the server mutex.
+ * A worker done with a stream exits if the pool is full meanwhile;
+ * unless the server is stopping and joins it, it frees itself.
+ */
+static void *
+http_server_worker_main(void *arg)
+{
+	struct http_worker *const worker = arg;
+	struct http_server *const serv = worker->server;
+	struct http_connection *conn;
+	u_int64_t usec;
+	int leave = 0;
+	int keep;
+
+	(void)pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	MUTEX_LOCK(&serv->mutex, serv->mutex_count);
+	while (1) {
+
+		/* Wait for a connection with a request */
+		serv->idle_workers++;
+		while (TAILQ_EMPTY(&serv->ready) && !serv->stopping)
+			pthread_cond_wait(&serv->ready_cond, &serv->mutex);
+		serv->idle_workers--;
+		if (serv->stopping)
 			break;
+		conn = TAILQ_FIRST(&serv->ready);
+		TAILQ_REMOVE(&serv->ready, conn, ready);
+		conn->queued = 0;
+		serv->num_ready--;
+		conn->tid = worker->tid;
+		worker->conn = conn;
+		http_server_hist_add(&serv->stats.wait,
+		    http_server_now() - conn->ready_time);
+		MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
+
+		/* Serve one request */
+		pthread_cleanup_push(http_server_worker_cleanup, worker);
+		(void)pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		keep = http_server_serve(conn, &usec);
+		(void)pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		pthread_cleanup_pop(0);
 
-		/* Reset request & response for next time */
-		_http_request_free(&conn->req);
-		_http_response_free(&conn->resp);
-		if (_http_request_new(conn) == -1
-		    || _http_response_new(conn) == -1)
+		/* Park connection again if kept alive */
+		MUTEX_LOCK(&serv->mutex, serv->mutex_count);
+		worker->conn = NULL;
+		conn->tid = 0;
+		if (worker->stream) {
+			worker->stream = 0;
+			serv->num_streams--;
+			if (serv->num_workers < serv->max_workers)
+				serv->num_workers++;
+			else
+				leave = 1;
+		} else if (usec != 0)
+			http_server_hist_add(&serv->stats.service, usec);
+		if (!keep || serv->stopping || http_server_park(serv, conn) == -1)
+			http_server_close(serv, conn);
+		if (leave)
 			break;
 	}
-
-	/* Done with this connection */
-	DBG(HTTP, "done with connection %p", conn);
-	pthread_cleanup_pop(1);
+	DBG(HTTP, "worker %p exiting", worker->tid);
+	if (leave && !serv->stopping) {
+		LIST_REMOVE(worker, next);
+		(void)pthread_detach(worker->tid);
+		FREE("http_worker", worker);
+	}
+	MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
 	return (NULL);
 }
 
 /*
- * Cleanup when shutting down an HTTP server connection.
+ * Cleanup when a worker is canceled while serving a request.
  */
 static void
-http_server_connection_cleanup(void *arg)
+http_server_worker_cleanup(void *arg)
 {
-	struct http_connection *conn = arg;
-	struct http_server *const serv = conn->owner;
+	struct http_worker *const worker = arg;
+	struct http_server *const serv = worker->server;
+	struct http_connection *const conn = worker->conn;
 
-	/* Lock server */
 	DBG(HTTP, "connection %p cleaning up", conn);
 	MUTEX_LOCK(&serv->mutex, serv->mutex_count);
+	worker->conn = NULL;
+	conn->tid = 0;
+	if (worker->stream) {
+		worker->stream = 0;
+		serv->num_streams--;
+	}
+	http_server_close(serv, conn);
+	MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
+}
 
-	/* Restart accepting new connections if needed */
-	if (serv->conn_event == NULL && !serv->stopping) {
-		if (pevent_register(serv->ctx, &serv->conn_event,
-		    PEVENT_RECURRING, &serv->mutex, http_server_accept,
-		    serv, PEVENT_READ, serv->sock) == -1) {
-			(*serv->logger)(LOG_ERR, "%s: %s",
-			    "pevent_register", strerror(errno));
-		}
+/*
+ * Read and answer one request. Returns whether the connection
+ * is kept alive, with the time taken in "usec", or zero if the
+ * peer closed the connection.
+ */
+static int
+http_server_serve(struct http_connection *conn, u_int64_t *usec)
+{
+	struct http_server *const serv = conn->owner;
+	struct http_request *const req = conn->req;
+	struct http_response *const resp = conn->resp;
+	u_int64_t start = http_server_now();
+	const char *hval;
+	char dbuf[64];
+	struct tm tm;
+	time_t now;
+
+	*usec = 0;
+
+	/* Read in request */
+	if (_http_request_read(conn) == -1) {
+		if (errno == ENOTCONN)		/* remote side disconnected */
+			return (0);
+		conn->keep_alive = 0;
+		goto send_response;
 	}
 
-	/* Remove this connection from the list of connections */
-	LIST_REMOVE(conn, next);
-	serv->num_conn--;
+	/* Set default response headers */
+	now = time(NULL);
+	strftime(dbuf, sizeof(dbuf),
+	    HTTP_TIME_FMT_RFC1123, gmtime_r(&now, &tm));
+	if (http_response_set_header(resp, 0,
+	      HDR_REPLY_VERSION, HTTP_PROTO_1_1) == -1
+	    || http_response_set_header(resp, 0, HDR_REPLY_STATUS,
+	      "%d", HTTP_STATUS_OK) == -1
+	    || http_response_set_header(resp, 0, HDR_REPLY_REASON,
+	      "%s", http_response_status_msg(HTTP_STATUS_OK)) == -1
+	    || http_response_set_header(resp, 0, HTTP_HEADER_SERVER,
+	      "%s", serv->server_name) == -1
+	    || http_response_set_header(resp, 0, HTTP_HEADER_DATE,
+	      "%s", dbuf) == -1
+	    || http_response_set_header(resp, 0,
+	      HTTP_HEADER_LAST_MODIFIED, "%s", dbuf) == -1) {
+		conn->keep_alive = 0;
+		goto send_response;
+	}
 
-	/* Unlock server */
-	MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
+	/* Turn off keep-alive if client doesn't want it */
+	if (!_http_head_want_keepalive(req->msg->head))
+		conn->keep_alive = 0;
+
+	/* Handle request */
+	http_server_dispatch(req, resp);
+
+	/* Set Connection: header if not already set */
+	if (((hval = http_request_get_method(req)) == NULL
+	      || strcmp(hval, HTTP_METHOD_CONNECT) != 0)
+	    && http_response_get_header(resp,
+	      _http_message_connection_header(resp->msg)) == NULL) {
+		http_response_set_header(resp, 0,
+		    _http_message_connection_header(resp->msg),
+		    conn->keep_alive ? "Keep-Alive" : "Close");
+	}
 
-	/* Free connection */
-	_http_connection_free(&conn);
+	/* Slurp up any remaining entity data if keep-alive */
+	if (conn->keep_alive && req != NULL && !feof(req->msg->input)) {
+		char buf[1024];
+
+		while (fgets(buf, sizeof(buf), req->msg->input) != NULL)
+			;
+	}
+
+send_response:
+	/* Send back headers (if not already sent) */
+	http_response_send_headers(resp, 0);
+
+	/* Send back body (if it was buffered) */
+	_http_message_send_body(resp->msg);
+	*usec = MAX(http_server_now() - start, 1);
+
+	/* Determine if we can still keep this connection alive */
+	if (!resp->msg->no_body
+	    && (http_response_get_header(resp,
+	       HTTP_HEADER_CONTENT_LENGTH) == NULL
+	      || ferror(conn->fp)
+	      || feof(conn->fp)
+	      || !_http_head_want_keepalive(resp->msg->head)))
+		conn->keep_alive = 0;
+
+	/* Close connection unless keeping it alive */
+	if (!conn->keep_alive)
+		return (0);
+
+	/* Reset request & response for next time */
+	_http_request_free(&conn->req);
+	_http_response_free(&conn->resp);
+	if (_http_request_new(conn) == -1
+	    || _http_response_new(conn) == -1)
+		return (0);
+	return (1);
 }
 
 /*
@@ -972,6 +1362,36 @@ http_server_dispatch(struct http_request *req, struct http_response *resp)
 			MISC ROUTINES
 *********************************************************************/
 
+/*
+ * Monotonic time in microseconds.
+ */
+static u_int64_t
+http_server_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((u_int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+/*
+ * Count time in histogram.
+ */
+static void
+http_server_hist_add(struct http_server_hist *h, u_int64_t usec)
+{
+	int k;
+
+	for (k = 0; k < HTTP_SERVER_HIST_BUCKETS - 1
+	    && usec >= ((u_int64_t)1 << k); k++)
+		;
+	h->bucket[k]++;
+	h->count++;
+	h->sum += usec;
+	if (usec > h->max)
+		h->max = usec;
+}
+
 /*
  * SSL callback to get the password for encrypted private key files.
  */
@@ -62,6 +62,39 @@ struct http_server_ssl {
 	const char	*pkey_password;	/* private key password, if needed */
 };
 
+/*
+ * Server statistics. Histograms count times in power of 2 microsecond
+ * buckets: bucket k counts values below 2^k usec, the last one the rest.
+ */
+#define HTTP_SERVER_HIST_BUCKETS	24
+
+struct http_server_hist {
+	u_int64_t	bucket[HTTP_SERVER_HIST_BUCKETS];
+	u_int64_t	count;
+	u_int64_t	sum;		/* usec */
+	u_int64_t	max;		/* usec */
+};
+
+struct http_server_stats {
+	u_int		max_conn;	/* connection limit */
+	u_int		max_workers;	/* worker thread limit */
+	u_int		max_streams;	/* stream limit */
+	u_int		idle_timeout;	/* keep-alive idle seconds */
+	u_int		num_conn;	/* open connections */
+	u_int		num_idle;	/* waiting for a request */
+	u_int		num_ready;	/* waiting for a worker */
+	u_int		num_workers;	/* worker threads */
+	u_int		busy_workers;	/* workers serving a request */
+	u_int		num_streams;	/* streams, not in the pool */
+	u_int64_t	accepted;	/* connections accepted */
+	u_int64_t	idle_closed;	/* closed by idle timeout */
+	u_int64_t	paused;		/* accepting stopped at max_conn */
+	u_int64_t	streams;	/* streams started */
+	u_int64_t	streams_refused; /* refused at max_streams */
+	struct http_server_hist	wait;	/* ready until picked by a worker */
+	struct http_server_hist	service; /* request read until sent */
+};
+
 /*
  * Special "headers" from the first line
  * of an HTTP request or HTTP response.
@@ -97,6 +130,12 @@ extern struct	http_server *http_server_start(struct pevent_ctx *ctx,
 			const struct http_server_ssl *ssl,
 			const char *server_name, http_logger_t *logger);
 extern void	http_server_stop(struct http_server **serverp);
+extern void	http_server_set_limits(struct http_server *serv,
+			u_int max_conn, u_int max_workers, u_int max_streams,
+			u_int idle_timeout);
+extern void	http_server_get_stats(struct http_server *serv,
+			struct http_server_stats *stats);
+extern int	http_server_stream(struct http_response *resp);
 extern int	http_server_register_servlet(struct http_server *serv,
 			struct http_servlet *servlet, const char *vhost,
 			const char *urlpat, int order);
@@ -49,6 +49,7 @@
 #include <stdio.h>
 #include <syslog.h>
 #include <string.h>
+#include <time.h>
 #include <errno.h>
 #include <assert.h>
 #include <unistd.h>
@@ -106,6 +107,8 @@ struct pevent_ctx {
 	u_char			notified;	/* data in the pipe */
 	u_char			has_attr;	/* 'attr' is valid */
 	u_int			refs;		/* references to this context */
+	pevent_poll_hook_t	*poll_hook;	/* called after poll(2) */
+	void			*poll_arg;	/* poll hook argument */
 };
 
 /* Event object */
@@ -297,6 +300,20 @@ pevent_ctx_count(struct pevent_ctx *ctx)
 	return (nevents);
 }
 
+/*
+ * Set the poll(2) hook.
+ */
+void
+pevent_ctx_set_poll_hook(struct pevent_ctx *ctx,
+	pevent_poll_hook_t *hook, void *arg)
+{
+	assert(ctx->magic == PEVENT_CTX_MAGIC);
+	MUTEX_LOCK(&ctx->mutex, ctx->mutex_count);
+	ctx->poll_hook = hook;
+	ctx->poll_arg = arg;
+	MUTEX_UNLOCK(&ctx->mutex, ctx->mutex_count);
+}
+
 /*
  * Create a new schedule item.
  */
@@ -539,9 +556,12 @@ pevent_ctx_main(void *arg)
 {
 	struct pevent_ctx *const ctx = arg;
 	struct timeval now;
+	struct timespec poll_start, poll_end;
 	struct pollfd *fd;
 	struct pevent *ev;
 	struct pevent *next_ev;
+	pevent_poll_hook_t *poll_hook;
+	void *poll_arg;
 	unsigned poll_idx;
 	int timeout;
 	int r;
@@ -663,9 +683,19 @@ loop:
 #endif
 
 	/* Wait for something to happen */
+	poll_hook = ctx->poll_hook;
+	poll_arg = ctx->poll_arg;
 	MUTEX_UNLOCK(&ctx->mutex, ctx->mutex_count);
 	DBG(PEVENT, "ctx %p thread sleeping", ctx);
+	if (poll_hook != NULL)
+		clock_gettime(CLOCK_MONOTONIC, &poll_start);
 	r = poll(ctx->fds, poll_idx, timeout);
+	if (poll_hook != NULL) {
+		clock_gettime(CLOCK_MONOTONIC, &poll_end);
+		(*poll_hook)(poll_arg,
+		    (poll_end.tv_sec - poll_start.tv_sec) * 1000000
+		    + (poll_end.tv_nsec - poll_start.tv_nsec) / 1000);
+	}
 	DBG(PEVENT, "ctx %p thread woke up", ctx);
 	assert(ctx->magic == PEVENT_CTX_MAGIC);
 	MUTEX_LOCK(&ctx->mutex, ctx->mutex_count);
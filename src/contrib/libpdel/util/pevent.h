@@ -56,6 +56,11 @@ struct mesg_port;
  */
 typedef void	pevent_handler_t(void *arg);
 
+/*
+ * Poll hook function type
+ */
+typedef void	pevent_poll_hook_t(void *arg, long usec);
+
 /*
  * Event types
  */
@@ -106,6 +111,13 @@ extern void	pevent_ctx_destroy(struct pevent_ctx **ctxp);
  */
 extern u_int	pevent_ctx_count(struct pevent_ctx *ctx);
 
+/*
+ * Set a function called by the event thread each time poll(2)
+ * returns, with the time spent waiting in microseconds.
+ */
+extern void	pevent_ctx_set_poll_hook(struct pevent_ctx *ctx,
+			pevent_poll_hook_t *hook, void *arg);
+
 /*
  * Create a new event.
  */
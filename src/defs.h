@@ -23,15 +23,13 @@
 #ifndef HAVE_NG_CAR
   #undef USE_NG_CAR
 #endif
-#if !defined(HAVE_NG_DEFLATE) || !defined(USE_NG_DEFLATE) || !defined(CCP_DEFLATE)
-  #undef CCP_DEFLATE
+#if !defined(HAVE_NG_DEFLATE) || !defined(CCP_DEFLATE)
   #undef USE_NG_DEFLATE
 #endif
 #ifndef HAVE_NG_IPACCT
   #undef USE_NG_IPACCT
 #endif
-#if !defined(HAVE_NG_MPPC) || !defined(USE_NG_MPPC) || !defined(CCP_MPPC)
-  #undef CCP_MPPC
+#if !defined(HAVE_NG_MPPC) || !defined(CCP_MPPC)
   #undef USE_NG_MPPC
 #endif
 #ifndef HAVE_NG_NAT
@@ -108,6 +106,10 @@
 
   #define DEFAULT_WEB_PORT	5006
   #define DEFAULT_WEB_IP	"127.0.0.1"
+  #define DEFAULT_WEB_MAX_CONN	1024
+  #define DEFAULT_WEB_WORKERS	32
+  #define DEFAULT_WEB_STREAMS	16
+  #define DEFAULT_WEB_IDLE	60
 
   #define DEFAULT_RADSRV_PORT	3799
   #define DEFAULT_RADSRV_IP	"0.0.0.0"
@@ -12,6 +12,11 @@
 #include "ecp.h"
 #include "log.h"
 
+#include <openssl/err.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/provider.h>
+#endif
+
 /*
  * DEFINITIONS
  */
@@ -69,9 +74,13 @@ DesInit(Bund b, int dir)
   switch (dir) {
     case ECP_DIR_XMIT:
 	des->xmit_seq = 0;
+	EVP_CIPHER_CTX_free(des->xmit_ctx);
+	des->xmit_ctx = DesCbcNew(&des->key, TRUE);
       break;
     case ECP_DIR_RECV:
 	des->recv_seq = 0;
+	EVP_CIPHER_CTX_free(des->recv_ctx);
+	des->recv_ctx = DesCbcNew(&des->key, FALSE);
       break;
     default:
       assert(0);
@@ -89,10 +98,9 @@ DesConfigure(Bund b)
 {
   EcpState	const ecp = &b->ecp;
   DesInfo	const des = &ecp->des;
-  DES_cblock	key;
 
-  DES_string_to_key(ecp->key, &key);
-  DES_set_key(&key, &des->ks);
+  DES_string_to_key(ecp->key, &des->key);
+  DES_set_key(&des->key, &des->ks);
   des->xmit_seq = 0;
   des->recv_seq = 0;
 }
@@ -164,43 +172,46 @@ DesEncrypt(Bund b, Mbuf plain)
   int		padlen = roundup2(plen, 8) - plen;
   int		clen = plen + padlen;
   Mbuf		cypher;
-  int		k;
+  u_char	*data;
 
   des->xmit_stats.FramesIn++;
   des->xmit_stats.OctetsIn += plen;
 
-/* Get mbuf for encrypted frame */
+/* Encrypt in place if there is room for header and padding */
 
-  cypher = mballoc(DES_OVERHEAD + clen);
+  if (plain != NULL && plain->offset >= DES_OVERHEAD &&
+      MBSPACE(plain) - plen >= padlen)
+  {
+    cypher = plain;
+    cypher->offset -= DES_OVERHEAD;
+  }
+  else
+  {
+    cypher = mballoc(DES_OVERHEAD + clen);
+    if (plen > 0)
+      memcpy(MBDATAU(cypher) + DES_OVERHEAD, MBDATAU(plain), plen);
+    mbfree(plain);
+  }
+  cypher->cnt = DES_OVERHEAD + clen;
+  data = MBDATAU(cypher);
 
 /* Copy in sequence number */
 
-  MBDATAU(cypher)[0] = des->xmit_seq >> 8;
-  MBDATAU(cypher)[1] = des->xmit_seq & 0xff;
+  data[0] = des->xmit_seq >> 8;
+  data[1] = des->xmit_seq & 0xff;
   des->xmit_seq++;
 
-/* Copy in plaintext */
+/* Pad and encrypt the whole frame at once */
 
-  mbcopy(plain, 0, MBDATA(cypher) + DES_OVERHEAD, plen);
-  
-  cypher->cnt = DES_OVERHEAD + clen;
-  
-/* Copy in plaintext and encrypt it */
-  
-  for (k = 0; k < clen; k += 8)
-  {
-    u_char	*const block = MBDATA(cypher) + DES_OVERHEAD + k;
-
-    DES_cbc_encrypt(block, block, 8, &des->ks, &des->xmit_ivec, TRUE);
-    memcpy(des->xmit_ivec, block, 8);
-  }
+  memset(data + DES_OVERHEAD + plen, 0, padlen);
+  DesCbc(des->xmit_ctx, &des->ks, data + DES_OVERHEAD, clen,
+    &des->xmit_ivec, TRUE);
 
   des->xmit_stats.FramesOut++;
   des->xmit_stats.OctetsOut += DES_OVERHEAD + clen;
 
 /* Return cyphertext */
 
-  mbfree(plain);
   return(cypher);
 }
 
@@ -216,7 +227,6 @@ DesDecrypt(Bund b, Mbuf cypher)
   const int	clen = MBLEN(cypher) - DES_OVERHEAD;
   u_int16_t	seq;
   Mbuf		plain;
-  int		k;
 
   des->recv_stats.FramesIn++;
   des->recv_stats.OctetsIn += clen + DES_OVERHEAD;
@@ -255,15 +265,8 @@ DesDecrypt(Bund b, Mbuf cypher)
 /* Decrypt frame */
 
   plain = cypher;
-  for (k = 0; k < clen; k += 8)
-  {
-    u_char	*const block = MBDATA(plain) + k;
-    DES_cblock	next_ivec;
-
-    memcpy(next_ivec, block, 8);
-    DES_cbc_encrypt(block, block, 8, &des->ks, &des->recv_ivec, FALSE);
-    memcpy(des->recv_ivec, next_ivec, 8);
-  }
+  DesCbc(des->recv_ctx, &des->ks, MBDATAU(plain), clen,
+    &des->recv_ivec, FALSE);
 
   des->recv_stats.FramesOut++;
   des->recv_stats.OctetsOut += clen;
@@ -286,10 +289,14 @@ DesCleanup(Bund b, int dir)
   if (dir == ECP_DIR_RECV)
   {
     memset(&des->recv_stats, 0, sizeof(des->recv_stats));
+    EVP_CIPHER_CTX_free(des->recv_ctx);
+    des->recv_ctx = NULL;
   }
   if (dir == ECP_DIR_XMIT)
   {
     memset(&des->xmit_stats, 0, sizeof(des->xmit_stats));
+    EVP_CIPHER_CTX_free(des->xmit_ctx);
+    des->xmit_ctx = NULL;
   }
 }
 
@@ -339,3 +346,69 @@ DesDecodeConfigReq(Fsm fp, FsmOption opt, int mode)
   }
 }
 
+/*
+ * DesCbcNew()
+ *
+ * OpenSSL cipher context for frames of one direction, or NULL
+ * if OpenSSL has no DES, then DesCbc() uses DES_ncbc_encrypt().
+ */
+
+EVP_CIPHER_CTX *
+DesCbcNew(const DES_cblock *key, int enc)
+{
+  EVP_CIPHER_CTX	*ctx;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  static int		tried;
+
+  /* OpenSSL 3 has single DES in the legacy provider only */
+  if (!tried) {
+    tried = 1;
+    (void)OSSL_PROVIDER_try_load(NULL, "legacy", 1);
+  }
+#endif
+
+  if ((ctx = EVP_CIPHER_CTX_new()) == NULL)
+    return(NULL);
+  if (!EVP_CipherInit_ex(ctx, EVP_des_cbc(), NULL, *key, NULL, enc) ||
+      !EVP_CIPHER_CTX_set_padding(ctx, 0))
+  {
+    Log(LG_ECP, ("DESE: no DES in OpenSSL EVP, using DES_ncbc_encrypt()"));
+    EVP_CIPHER_CTX_free(ctx);
+    ERR_clear_error();
+    return(NULL);
+  }
+  return(ctx);
+}
+
+/*
+ * DesCbc()
+ *
+ * Encrypt or decrypt data in place, len is a multiple of 8. The
+ * chain goes on with the next frame from the updated ivec.
+ */
+
+void
+DesCbc(EVP_CIPHER_CTX *ctx, DES_key_schedule *ks, u_char *data, int len,
+  DES_cblock *ivec, int enc)
+{
+  DES_cblock	next;
+  int		outlen;
+
+  if (ctx == NULL)
+  {
+    DES_ncbc_encrypt(data, data, len, ks, ivec,
+      enc ? DES_ENCRYPT : DES_DECRYPT);
+    return;
+  }
+  if (len <= 0)
+    return;
+  if (!enc)
+    memcpy(next, data + len - 8, 8);
+  if (!EVP_CipherInit_ex(ctx, NULL, NULL, NULL, *ivec, -1) ||
+      !EVP_CipherUpdate(ctx, data, &outlen, data, len) || outlen != len)
+  {
+    Log(LG_ERR, ("DESE: OpenSSL EVP cipher failed"));
+    ERR_clear_error();
+  }
+  memcpy(*ivec, enc ? data + len - 8 : next, 8);
+}
@@ -14,6 +14,7 @@
 #include "defs.h"
 #include "mbuf.h"
 #include <openssl/des.h>
+#include <openssl/evp.h>
 
 /*
  * DEFINITIONS
@@ -34,7 +35,10 @@
     DES_cblock		recv_ivec;	/* Recv initialization vector */
     u_int16_t		xmit_seq;	/* Transmit sequence number */
     u_int16_t		recv_seq;	/* Receive sequence number */
+    DES_cblock		key;		/* Key */
     DES_key_schedule	ks;		/* Key schedule */
+    EVP_CIPHER_CTX	*xmit_ctx;	/* OpenSSL cipher, if it has DES */
+    EVP_CIPHER_CTX	*recv_ctx;
     struct dese_stats	recv_stats;	
     struct dese_stats	xmit_stats;	
   };
@@ -46,5 +50,13 @@
 
   extern const struct enctype	gDeseEncType;
 
+/*
+ * FUNCTIONS
+ */
+
+  extern EVP_CIPHER_CTX	*DesCbcNew(const DES_cblock *key, int enc);
+  extern void		DesCbc(EVP_CIPHER_CTX *ctx, DES_key_schedule *ks,
+			  u_char *data, int len, DES_cblock *ivec, int enc);
+
 #endif
 
@@ -69,9 +69,13 @@ DeseBisInit(Bund b, int dir)
   switch (dir) {
     case ECP_DIR_XMIT:
 	des->xmit_seq = 0;
+	EVP_CIPHER_CTX_free(des->xmit_ctx);
+	des->xmit_ctx = DesCbcNew(&des->key, TRUE);
       break;
     case ECP_DIR_RECV:
 	des->recv_seq = 0;
+	EVP_CIPHER_CTX_free(des->recv_ctx);
+	des->recv_ctx = DesCbcNew(&des->key, FALSE);
       break;
     default:
       assert(0);
@@ -89,10 +93,9 @@ DeseBisConfigure(Bund b)
 {
   EcpState	const ecp = &b->ecp;
   DeseBisInfo	const des = &ecp->desebis;
-  DES_cblock	key;
 
-  DES_string_to_key(ecp->key, &key);
-  DES_set_key(&key, &des->ks);
+  DES_string_to_key(ecp->key, &des->key);
+  DES_set_key(&des->key, &des->ks);
   des->xmit_seq = 0;
   des->recv_seq = 0;
 }
@@ -165,55 +168,59 @@ DeseBisEncrypt(Bund b, Mbuf plain)
   int		padlen = roundup2(plen + 1, 8) - plen;
   int		clen = plen + padlen;
   Mbuf		cypher;
+  u_char	*data;
   int		k;
 
   des->xmit_stats.FramesIn++;
   des->xmit_stats.OctetsIn += plen;
 
-/* Get mbuf for encrypted frame */
+/* Encrypt in place if there is room for header and padding */
 
-  cypher = mballoc(DES_OVERHEAD + clen);
+  if (plain != NULL && plain->offset >= DES_OVERHEAD &&
+      MBSPACE(plain) - plen >= padlen)
+  {
+    cypher = plain;
+    cypher->offset -= DES_OVERHEAD;
+  }
+  else
+  {
+    cypher = mballoc(DES_OVERHEAD + clen);
+    if (plen > 0)
+      memcpy(MBDATAU(cypher) + DES_OVERHEAD, MBDATAU(plain), plen);
+    mbfree(plain);
+  }
+  data = MBDATAU(cypher);
 
 /* Copy in sequence number */
 
-  MBDATAU(cypher)[0] = des->xmit_seq >> 8;
-  MBDATAU(cypher)[1] = des->xmit_seq & 0xff;
+  data[0] = des->xmit_seq >> 8;
+  data[1] = des->xmit_seq & 0xff;
   des->xmit_seq++;
 
-/* Copy in plaintext */
-
-  mbcopy(plain, 0, MBDATA(cypher) + DES_OVERHEAD, plen);
-
 /* Correct and add padding */
 
   if ((padlen>7) &&
-    ((MBDATA(cypher)[DES_OVERHEAD + plen - 1]==0) ||
-     (MBDATA(cypher)[DES_OVERHEAD + plen - 1]>8))) {
+    ((data[DES_OVERHEAD + plen - 1]==0) ||
+     (data[DES_OVERHEAD + plen - 1]>8))) {
         padlen -=8;
 	clen = plen + padlen;
   }
   for (k = 0; k < padlen; k++) {
-    MBDATA(cypher)[DES_OVERHEAD + plen + k] = k + 1;
+    data[DES_OVERHEAD + plen + k] = k + 1;
   }
   
   cypher->cnt = DES_OVERHEAD + clen;
   
-/* Copy in plaintext and encrypt it */
-  
-  for (k = 0; k < clen; k += 8)
-  {
-    u_char	*const block = MBDATA(cypher) + DES_OVERHEAD + k;
+/* Encrypt the whole frame at once */
 
-    DES_cbc_encrypt(block, block, 8, &des->ks, &des->xmit_ivec, TRUE);
-    memcpy(des->xmit_ivec, block, 8);
-  }
+  DesCbc(des->xmit_ctx, &des->ks, data + DES_OVERHEAD, clen,
+    &des->xmit_ivec, TRUE);
 
   des->xmit_stats.FramesOut++;
   des->xmit_stats.OctetsOut += DES_OVERHEAD + clen;
 
 /* Return cyphertext */
 
-  mbfree(plain);
   return(cypher);
 }
 
@@ -229,7 +236,6 @@ DeseBisDecrypt(Bund b, Mbuf cypher)
   int		clen = MBLEN(cypher) - DES_OVERHEAD;
   u_int16_t	seq;
   Mbuf		plain;
-  int		k;
 
   des->recv_stats.FramesIn++;
   des->recv_stats.OctetsIn += clen + DES_OVERHEAD;
@@ -268,15 +274,8 @@ DeseBisDecrypt(Bund b, Mbuf cypher)
 /* Decrypt frame */
 
   plain = cypher;
-  for (k = 0; k < clen; k += 8)
-  {
-    u_char	*const block = MBDATA(plain) + k;
-    DES_cblock	next_ivec;
-
-    memcpy(next_ivec, block, 8);
-    DES_cbc_encrypt(block, block, 8, &des->ks, &des->recv_ivec, FALSE);
-    memcpy(des->recv_ivec, next_ivec, 8);
-  }
+  DesCbc(des->recv_ctx, &des->ks, MBDATAU(plain), clen,
+    &des->recv_ivec, FALSE);
 
 /* Strip padding */
   if (MBDATAU(plain)[clen-1]>0 &&
@@ -306,10 +305,14 @@ DeseBisCleanup(Bund b, int dir)
   if (dir == ECP_DIR_RECV)
   {
     memset(&des->recv_stats, 0, sizeof(des->recv_stats));
+    EVP_CIPHER_CTX_free(des->recv_ctx);
+    des->recv_ctx = NULL;
   }
   if (dir == ECP_DIR_XMIT)
   {
     memset(&des->xmit_stats, 0, sizeof(des->xmit_stats));
+    EVP_CIPHER_CTX_free(des->xmit_ctx);
+    des->xmit_ctx = NULL;
   }
 }
 
@@ -7,11 +7,25 @@
 
   #include "ppp.h"
   #include "event.h"
+  #include "trace.h"
+
+  #include <time.h>
 
 /*
  * DEFINITIONS
  */
 
+  /*
+   * Handler statistics are kept per debug name, so all instances of
+   * a timer or event share one entry. They are updated and read with
+   * gGiantMutex held, except the poll wait histogram which is updated
+   * by the event thread while it sleeps and has its own mutex.
+   */
+
+  #define EVSTAT_MAX		256		/* Distinct names */
+  #define EVSTAT_HASH		512		/* Power of 2 */
+  #define EVSTAT_OTHER		"(other)"
+
   struct pevent_ctx	*gPeventCtx = NULL;
 
 /*
@@ -19,6 +33,23 @@
  */
 
   static void		EventHandler(void *arg);
+  static void		EventPollHook(void *arg, long usec);
+  static struct evstat	*EventStatFind(const char *name, int timer);
+  static int		EventStatCmp(const void *p1, const void *p2);
+  static void		EventStatPrint(Context ctx, const char *name,
+			  const struct evstat_hist *h);
+
+/*
+ * INTERNAL VARIABLES
+ */
+
+  static struct evstat		gEventStats[EVSTAT_MAX];
+  static int			gEventStatNum;
+  static u_short		gEventStatHash[EVSTAT_HASH];	/* Index + 1 */
+  static const char		*gEventStatTimer;	/* Timer being run */
+  static struct evstat_hist	gEventLag;
+  static struct evstat_hist	gEventPoll;		/* gEventPollMutex */
+  static pthread_mutex_t	gEventPollMutex = PTHREAD_MUTEX_INITIALIZER;
 
 /*
  * EventInit()
@@ -34,6 +65,9 @@ EventInit(void)
     Log(LG_ERR, ("%s: error pevent_ctx_create: %d", __FUNCTION__, errno));
     return(-1);
   }
+#ifdef NOLIBPDEL
+  pevent_ctx_set_poll_hook(gPeventCtx, EventPollHook, NULL);
+#endif
 
   return(0);
 }
@@ -141,8 +175,239 @@ EventHandler(void *arg)
 {
     EventRef	*refp = (EventRef *) arg;
     const char	*dbg = refp->dbg;
+    struct evstat	*e;
+    u_int64_t	start, now;
 
+    TraceNone();
     Log(LG_EVENTS, ("EVENT: Processing event %s", dbg));
+    gEventStatTimer = NULL;
+    start = EventNow();
     (refp->handler)(refp->type, refp->arg);
+    /* Handler may be gone now, don't touch refp */
+    if (gEventStatTimer != NULL)
+	e = EventStatFind(gEventStatTimer, 1);
+    else
+	e = EventStatFind(dbg, 0);
+    now = EventNow();
+    EventStatAdd(&e->lat, now - start);
+    if (gGiantProf)
+	GiantProfHeld(e->name, now - start);
     Log(LG_EVENTS, ("EVENT: Processing event %s done", dbg));
 }
+
+/*
+ * EventNow()
+ *
+ * Monotonic time in microseconds.
+ */
+
+u_int64_t
+EventNow(void)
+{
+    struct timespec	ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((u_int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+/*
+ * EventPollHook()
+ *
+ * Called by the event thread after each poll(2).
+ */
+
+static void
+EventPollHook(void *arg, long usec)
+{
+    (void)arg;
+
+    MUTEX_LOCK(gEventPollMutex);
+    EventStatAdd(&gEventPoll, usec > 0 ? usec : 0);
+    MUTEX_UNLOCK(gEventPollMutex);
+}
+
+/*
+ * EventStatTimer()
+ *
+ * Called by timer event handler, so its run is accounted to the
+ * timer name. Also accounts the delay after the timer deadline.
+ */
+
+void
+EventStatTimer(const char *name, u_int64_t now, u_int64_t due)
+{
+    gEventStatTimer = name;
+    if (due != 0)
+	EventStatAdd(&gEventLag, now > due ? now - due : 0);
+}
+
+/*
+ * EventStatFind()
+ *
+ * Get entry for the name, creating it if needed. When the table is
+ * full new names share one entry.
+ */
+
+static struct evstat *
+EventStatFind(const char *name, int timer)
+{
+    struct evstat	*e;
+    const u_char	*p;
+    u_int		h = 2166136261U;
+    int			k;
+
+    for (p = (const u_char *)name; *p; p++)
+	h = (h ^ *p) * 16777619U;
+    h = (h + timer) & (EVSTAT_HASH - 1);
+    while ((k = gEventStatHash[h]) != 0) {
+	e = &gEventStats[k - 1];
+	if (e->timer == timer && (e->name == name || strcmp(e->name, name) == 0))
+	    return (e);
+	h = (h + 1) & (EVSTAT_HASH - 1);
+    }
+    if (gEventStatNum >= EVSTAT_MAX - 1 && strcmp(name, EVSTAT_OTHER) != 0)
+	return (EventStatFind(EVSTAT_OTHER, 0));
+    e = &gEventStats[gEventStatNum++];
+    e->name = name;
+    e->timer = timer;
+    gEventStatHash[h] = gEventStatNum;
+    return (e);
+}
+
+/*
+ * EventStatAdd()
+ */
+
+void
+EventStatAdd(struct evstat_hist *h, u_int64_t usec)
+{
+    int	k;
+
+    for (k = 0; k < EVSTAT_BUCKETS - 1 && usec >= ((u_int64_t)1 << k); k++)
+	;
+    h->bucket[k]++;
+    h->count++;
+    h->sum += usec;
+    if (usec > h->max)
+	h->max = usec;
+}
+
+/*
+ * EventStatGet()
+ *
+ * Get k-th handler entry, NULL past the last one.
+ */
+
+const struct evstat *
+EventStatGet(int k)
+{
+    return ((k >= 0 && k < gEventStatNum) ? &gEventStats[k] : NULL);
+}
+
+/*
+ * EventStatLoop()
+ *
+ * Copy timer lag and poll wait histograms.
+ */
+
+void
+EventStatLoop(struct evstat_hist *lag, struct evstat_hist *wait)
+{
+    *lag = gEventLag;
+    MUTEX_LOCK(gEventPollMutex);
+    *wait = gEventPoll;
+    MUTEX_UNLOCK(gEventPollMutex);
+}
+
+/*
+ * EventStatPct()
+ *
+ * Upper bound of the bucket holding the percentile, usec.
+ */
+
+u_int64_t
+EventStatPct(const struct evstat_hist *h, int pct)
+{
+    u_int64_t	need, cum = 0;
+    int		k;
+
+    if (h->count == 0)
+	return (0);
+    need = (h->count * pct + 99) / 100;
+    for (k = 0; k < EVSTAT_BUCKETS - 1; k++) {
+	if ((cum += h->bucket[k]) >= need)
+	    return (MIN((u_int64_t)1 << k, h->max));
+    }
+    return (h->max);
+}
+
+/*
+ * EventStatReset()
+ */
+
+void
+EventStatReset(void)
+{
+    memset(gEventStats, 0, sizeof(gEventStats));
+    memset(gEventStatHash, 0, sizeof(gEventStatHash));
+    gEventStatNum = 0;
+    memset(&gEventLag, 0, sizeof(gEventLag));
+    MUTEX_LOCK(gEventPollMutex);
+    memset(&gEventPoll, 0, sizeof(gEventPoll));
+    MUTEX_UNLOCK(gEventPollMutex);
+}
+
+/*
+ * EventStatDump()
+ *
+ * Show handlers sorted by total time.
+ */
+
+void
+EventStatDump(Context ctx)
+{
+    struct evstat	*list[EVSTAT_MAX];
+    struct evstat_hist	lag, wait;
+    int			k;
+
+    EventStatLoop(&lag, &wait);
+    Printf("Event loop statistics:\r\n");
+    Printf("\t%-36s %10s %10s %8s %8s %8s %8s\r\n", "Name", "Count",
+	"Total ms", "Avg us", "p50 us", "p99 us", "Max us");
+    EventStatPrint(ctx, "poll wait", &wait);
+    EventStatPrint(ctx, "timer lag", &lag);
+    Printf("Handlers:\r\n");
+    for (k = 0; k < gEventStatNum; k++)
+	list[k] = &gEventStats[k];
+    qsort(list, gEventStatNum, sizeof(*list), EventStatCmp);
+    for (k = 0; k < gEventStatNum; k++) {
+	char	name[64];
+
+	snprintf(name, sizeof(name), "%s%s", list[k]->timer ? "timer " : "",
+	    list[k]->name);
+	EventStatPrint(ctx, name, &list[k]->lat);
+    }
+}
+
+static void
+EventStatPrint(Context ctx, const char *name, const struct evstat_hist *h)
+{
+    Printf("\t%-36.36s %10llu %10llu %8llu %8llu %8llu %8llu\r\n", name,
+	(unsigned long long)h->count,
+	(unsigned long long)(h->sum / 1000),
+	(unsigned long long)(h->count ? h->sum / h->count : 0),
+	(unsigned long long)EventStatPct(h, 50),
+	(unsigned long long)EventStatPct(h, 99),
+	(unsigned long long)h->max);
+}
+
+static int
+EventStatCmp(const void *p1, const void *p2)
+{
+    const struct evstat	*e1 = *(const struct evstat *const *)p1;
+    const struct evstat	*e2 = *(const struct evstat *const *)p2;
+
+    if (e1->lat.sum != e2->lat.sum)
+	return (e1->lat.sum > e2->lat.sum ? -1 : 1);
+    return (0);
+}
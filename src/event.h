@@ -32,6 +32,23 @@
   };
   typedef struct event_ref	EventRef;
 
+  /* Latency histogram, bucket k counts values below 2^k usec */
+  #define EVSTAT_BUCKETS	24		/* Last is +Inf */
+
+  struct evstat_hist {
+    u_int64_t	bucket[EVSTAT_BUCKETS];
+    u_int64_t	count;
+    u_int64_t	sum;			/* usec */
+    u_int64_t	max;			/* usec */
+  };
+
+  /* Handler statistics by debug name */
+  struct evstat {
+    const char		*name;
+    u_char		timer;		/* Name of a timer handler */
+    struct evstat_hist	lat;
+  };
+
 /*
  * FUNCTIONS
  */
@@ -50,6 +67,14 @@
   extern int	EventIsRegistered(EventRef *ref);
   extern int	EventTimerRemain(EventRef *ref);
   extern void	EventDump(Context ctx);
+  extern u_int64_t	EventNow(void);
+  extern void	EventStatAdd(struct evstat_hist *h, u_int64_t usec);
+  extern void	EventStatTimer(const char *name, u_int64_t now, u_int64_t due);
+  extern const struct evstat	*EventStatGet(int k);
+  extern void	EventStatLoop(struct evstat_hist *lag, struct evstat_hist *wait);
+  extern u_int64_t	EventStatPct(const struct evstat_hist *h, int pct);
+  extern void	EventStatDump(Context ctx);
+  extern void	EventStatReset(void);
 
 #endif
 
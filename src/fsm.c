@@ -14,6 +14,7 @@
 #include "ppp.h"
 #include "fsm.h"
 #include "ngfunc.h"
+#include "trace.h"
 #include "util.h"
 
 /*
@@ -83,6 +84,7 @@
 
   static Mbuf	FsmCheckMagic(Fsm fp, Mbuf bp);
   static void	FsmEchoTimeout(void *arg);
+  static void	FsmTrace(Fsm fp);
   static void	FsmDecodeBuffer(Fsm fp, u_char *buf, int size, int mode);
   static int	FsmExtractOptions(Fsm fp, u_char *data,
 		  int dlen, FsmOption opts, int max);
@@ -186,6 +188,10 @@ FsmNewState(Fsm fp, enum fsm_state new)
   if (fp->type->NewState)
     (*fp->type->NewState)(fp, old, new);
   fp->state = new;
+  if (fp->type->link_layer)
+    LinkChanged((Link)fp->arg);
+  else
+    BundChanged((Bund)fp->arg);
   if ((new >= ST_INITIAL && new <= ST_STOPPED) || (new == ST_OPENED))
     TimerStop(&fp->timer);
 
@@ -483,6 +489,7 @@ FsmTimeout(void *arg)
 {
   Fsm	fp = (Fsm) arg;
 
+  FsmTrace(fp);
   if (fp->restart > 0) {	/* TO+ */
     switch (fp->state) {
       case ST_CLOSING:
@@ -1404,6 +1411,7 @@ FsmEchoTimeout(void *arg)
     struct ng_ppp_link_stat64	oldStats;
 #endif
 
+    FsmTrace(fp);
     if (fp->type->link_layer) {
 	l = (Link)fp->arg;
 	b = l->bund;
@@ -1419,13 +1427,8 @@ FsmEchoTimeout(void *arg)
 
     /* See if there was any traffic since last time */
     oldStats = fp->idleStats;
-#ifndef NG_PPP_STATS64
-    NgFuncGetStats(b, l ?
-	l->bundleIndex : NG_PPP_BUNDLE_LINKNUM, &fp->idleStats);
-#else
-    NgFuncGetStats64(b, l ?
-	l->bundleIndex : NG_PPP_BUNDLE_LINKNUM, &fp->idleStats);
-#endif
+    NgStatsGet(b, l ? l->bundleIndex : NG_PPP_BUNDLE_LINKNUM,
+	NGSTATS_ECHO, &fp->idleStats);
     if (fp->idleStats.recvFrames > oldStats.recvFrames)
 	fp->quietCount = 0;
     else
@@ -1455,6 +1458,21 @@ FsmEchoTimeout(void *arg)
     }
 }
 
+/*
+ * FsmTrace()
+ *
+ * Use log options of the traced session from timer handlers.
+ */
+
+static void
+FsmTrace(Fsm fp)
+{
+    if (fp->type->link_layer)
+	TraceLink((Link)fp->arg);
+    else
+	TraceBund((Bund)fp->arg);
+}
+
 /*
  * FsmInput()
  *
@@ -0,0 +1,288 @@
+
+/*
+ * giant.c
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "giant.h"
+#include "util.h"
+
+/*
+ * DEFINITIONS
+ */
+
+  /*
+   * Lock profiling. When enabled, GIANT_MUTEX_LOCK() and MUTEX_LOCK()
+   * call in here with their file and line, and waits for the mutex are
+   * accounted to that site. gGiantMutex owners taken by these macros
+   * also get their hold time accounted when they unlock; event and
+   * timer handlers, which get gGiantMutex from the event loop, are
+   * accounted by handler name. Holds taken inside libpdel on its own
+   * (paction finish functions, L2TP control events) are not seen.
+   *
+   * Sites are never removed, so gGiantHolder stays valid over reset.
+   * The table is protected by its own mutex, locked directly to not
+   * profile itself.
+   */
+
+  #define GIANT_HASH		512		/* Power of 2 */
+
+  struct giantsite {
+    const char		*file;		/* Or handler name */
+    int			line;		/* 0 for handlers */
+    const char		*lock;		/* Mutex name */
+    u_int64_t		contended;	/* Acquisitions that waited */
+    struct evstat_hist	wait;
+    struct evstat_hist	hold;		/* gGiantMutex only */
+  };
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static struct giantsite	*GiantSiteFind(const char *file, int line,
+				  const char *lock);
+  static int			GiantSiteCmp(const void *p1, const void *p2);
+
+/*
+ * GLOBAL VARIABLES
+ */
+
+  int			gGiantProf = 0;
+  struct giantsite	*gGiantHolder = NULL;		/* gGiantMutex */
+
+/*
+ * INTERNAL VARIABLES
+ */
+
+  static pthread_mutex_t	gGiantProfMutex = PTHREAD_MUTEX_INITIALIZER;
+  static struct giantsite	gGiantSites[GIANT_MAX_SITES];	/* Mutex */
+  static int			gGiantSiteNum;			/* Mutex */
+  static u_short		gGiantSiteHash[GIANT_HASH];	/* Mutex */
+  static int			gGiantSiteLost;			/* Mutex */
+  static u_int64_t		gGiantSince;			/* gGiantMutex */
+
+/*
+ * GiantProfLock()
+ *
+ * Lock gGiantMutex, account wait and start the hold.
+ */
+
+void
+GiantProfLock(const char *file, int line)
+{
+    struct giantsite	*s;
+    u_int64_t		start = EventNow(), now;
+    int			contended = 0;
+
+    if (pthread_mutex_trylock(&gGiantMutex) != 0) {
+	contended = 1;
+	assert(pthread_mutex_lock(&gGiantMutex) == 0);
+    }
+    now = EventNow();
+    pthread_mutex_lock(&gGiantProfMutex);
+    if ((s = GiantSiteFind(file, line, "gGiantMutex")) != NULL) {
+	s->contended += contended;
+	EventStatAdd(&s->wait, now - start);
+    }
+    pthread_mutex_unlock(&gGiantProfMutex);
+    gGiantHolder = s;
+    gGiantSince = now;
+}
+
+/*
+ * GiantProfUnlock()
+ *
+ * Account the hold of the profiled owner and unlock gGiantMutex.
+ */
+
+void
+GiantProfUnlock(void)
+{
+    struct giantsite	*const s = gGiantHolder;
+    u_int64_t		hold = EventNow() - gGiantSince;
+
+    gGiantHolder = NULL;
+    pthread_mutex_lock(&gGiantProfMutex);
+    EventStatAdd(&s->hold, hold);
+    pthread_mutex_unlock(&gGiantProfMutex);
+    assert(pthread_mutex_unlock(&gGiantMutex) == 0);
+}
+
+/*
+ * GiantProfMutex()
+ *
+ * Lock other mutex and account the wait.
+ */
+
+void
+GiantProfMutex(pthread_mutex_t *m, const char *name, const char *file,
+	int line)
+{
+    struct giantsite	*s;
+    u_int64_t		start, now;
+    int			contended = 0;
+
+    if (pthread_mutex_trylock(m) == 0) {
+	start = now = 0;
+    } else {
+	contended = 1;
+	start = EventNow();
+	assert(pthread_mutex_lock(m) == 0);
+	now = EventNow();
+    }
+    pthread_mutex_lock(&gGiantProfMutex);
+    if ((s = GiantSiteFind(file, line, name)) != NULL) {
+	s->contended += contended;
+	EventStatAdd(&s->wait, now - start);
+    }
+    pthread_mutex_unlock(&gGiantProfMutex);
+}
+
+/*
+ * GiantProfHeld()
+ *
+ * Account gGiantMutex hold by an event or timer handler.
+ */
+
+void
+GiantProfHeld(const char *name, u_int64_t usec)
+{
+    struct giantsite	*s;
+
+    pthread_mutex_lock(&gGiantProfMutex);
+    if ((s = GiantSiteFind(name, 0, "gGiantMutex")) != NULL)
+	EventStatAdd(&s->hold, usec);
+    pthread_mutex_unlock(&gGiantProfMutex);
+}
+
+/*
+ * GiantSiteFind()
+ *
+ * Find or add site. Returns NULL if the table is full.
+ */
+
+static struct giantsite *
+GiantSiteFind(const char *file, int line, const char *lock)
+{
+    struct giantsite	*s;
+    const u_char	*p;
+    u_int		h = 2166136261U;
+    int			k;
+
+    for (p = (const u_char *)file; *p; p++)
+	h = (h ^ *p) * 16777619U;
+    h = (h ^ line) * 16777619U;
+    h &= GIANT_HASH - 1;
+    while ((k = gGiantSiteHash[h]) != 0) {
+	s = &gGiantSites[k - 1];
+	if (s->line == line &&
+		(s->file == file || strcmp(s->file, file) == 0) &&
+		(s->lock == lock || strcmp(s->lock, lock) == 0))
+	    return (s);
+	h = (h + 1) & (GIANT_HASH - 1);
+    }
+    if (gGiantSiteNum >= GIANT_MAX_SITES) {
+	gGiantSiteLost++;
+	return (NULL);
+    }
+    s = &gGiantSites[gGiantSiteNum++];
+    s->file = file;
+    s->line = line;
+    s->lock = lock;
+    gGiantSiteHash[h] = gGiantSiteNum;
+    return (s);
+}
+
+/*
+ * GiantStat()
+ *
+ * Show sites ranked by the sum of hold and wait time.
+ */
+
+int
+GiantStat(Context ctx, int ac, const char *const av[], const void *arg)
+{
+    struct giantsite	*list;
+    int			k, num, lost;
+
+    (void)arg;
+
+    if (ac > 1 || (ac == 1 && strcasecmp(av[0], "reset") != 0))
+	return (-1);
+
+    /* Copy, Printf() may take profiled mutexes */
+    list = Malloc(MB_UTIL, sizeof(gGiantSites));
+    pthread_mutex_lock(&gGiantProfMutex);
+    num = gGiantSiteNum;
+    lost = gGiantSiteLost;
+    memcpy(list, gGiantSites, num * sizeof(*list));
+    if (ac == 1) {
+	for (k = 0; k < gGiantSiteNum; k++) {
+	    gGiantSites[k].contended = 0;
+	    memset(&gGiantSites[k].wait, 0, sizeof(gGiantSites[k].wait));
+	    memset(&gGiantSites[k].hold, 0, sizeof(gGiantSites[k].hold));
+	}
+	gGiantSiteLost = 0;
+    }
+    pthread_mutex_unlock(&gGiantProfMutex);
+
+    Printf("Lock profiling: %s\r\n", gGiantProf ? "enabled" : "disabled");
+    Printf("\tSites          : %d of %d\r\n", num, GIANT_MAX_SITES);
+    if (lost)
+	Printf("\tNot recorded   : %d\r\n", lost);
+    qsort(list, num, sizeof(*list), GiantSiteCmp);
+    Printf("\t%-32s %-14s %9s %9s %9s %8s %9s %8s %8s\r\n", "Site", "Lock",
+	"Acquired", "Waited", "Wait ms", "Wait max", "Hold ms", "Hold p99",
+	"Hold max");
+    for (k = 0; k < num; k++) {
+	struct giantsite	*const s = &list[k];
+	char			site[64];
+
+	if (s->wait.count == 0 && s->hold.count == 0)
+	    continue;
+	if (s->line) {
+	    const char	*file = strrchr(s->file, '/');
+
+	    snprintf(site, sizeof(site), "%s:%d", file ? file + 1 : s->file,
+		s->line);
+	} else
+	    strlcpy(site, s->file, sizeof(site));
+	if (s->line) {
+	    Printf("\t%-32.32s %-14.14s %9llu %9llu %9llu %8llu", site,
+		s->lock, (unsigned long long)s->wait.count,
+		(unsigned long long)s->contended,
+		(unsigned long long)(s->wait.sum / 1000),
+		(unsigned long long)s->wait.max);
+	} else {
+	    Printf("\t%-32.32s %-14.14s %9llu %9s %9s %8s", site,
+		s->lock, (unsigned long long)s->hold.count, "-", "-", "-");
+	}
+	if (s->hold.count) {
+	    Printf(" %9llu %8llu %8llu\r\n",
+		(unsigned long long)(s->hold.sum / 1000),
+		(unsigned long long)EventStatPct(&s->hold, 99),
+		(unsigned long long)s->hold.max);
+	} else
+	    Printf(" %9s %8s %8s\r\n", "-", "-", "-");
+    }
+    if (ac == 1)
+	Printf("Statistics reset\r\n");
+    Freee(list);
+    return (0);
+}
+
+static int
+GiantSiteCmp(const void *p1, const void *p2)
+{
+    const struct giantsite	*s1 = p1;
+    const struct giantsite	*s2 = p2;
+    u_int64_t			t1 = s1->wait.sum + s1->hold.sum;
+    u_int64_t			t2 = s2->wait.sum + s2->hold.sum;
+
+    if (t1 != t2)
+	return (t1 > t2 ? -1 : 1);
+    return (0);
+}
@@ -0,0 +1,41 @@
+
+/*
+ * giant.h
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#ifndef _GIANT_H_
+#define _GIANT_H_
+
+#include "defs.h"
+#include <pthread.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  #define GIANT_MAX_SITES	256	/* Lock sites profiled */
+
+  struct giantsite;
+
+/*
+ * VARIABLES
+ */
+
+  extern int			gGiantProf;	/* Profiling enabled */
+  extern struct giantsite	*gGiantHolder;	/* Profiled gGiantMutex owner */
+
+/*
+ * FUNCTIONS
+ */
+
+  extern void	GiantProfLock(const char *file, int line);
+  extern void	GiantProfUnlock(void);
+  extern void	GiantProfMutex(pthread_mutex_t *m, const char *name,
+		  const char *file, int line);
+  extern void	GiantProfHeld(const char *name, u_int64_t usec);
+  extern int	GiantStat(Context ctx, int ac, const char *const av[], const void *arg);
+
+#endif
+
@@ -17,7 +17,12 @@
 #include "auth.h"
 #include "ngfunc.h"
 #include "netgraph.h"
+#include "rtqueue.h"
+#include "spawn.h"
 #include "util.h"
+#ifdef USE_IPFW
+#include "ipfwbatch.h"
+#endif
 
 #include <sys/limits.h>
 #include <sys/types.h>
@@ -59,7 +64,7 @@
 #endif
 
 #ifdef USE_NG_BPF
-#include <pcap.h>
+#include "bpfcache.h"
 #endif
 
 #include <string.h>
@@ -68,6 +73,21 @@
  * DEFINITIONS
  */
 
+  /* "up" script completion argument */
+  struct ifacescript {
+    int		bund;
+    int		af;
+    u_int	seq;
+  };
+
+#ifdef USE_IPFW
+  /* ACLs install completion argument */
+  struct ifaceacls {
+    int		bund;
+    u_int	seq;
+  };
+#endif
+
 /* Set menu options */
 
   enum {
@@ -93,6 +113,16 @@
  * INTERNAL FUNCTIONS
  */
 
+  static void	IfaceUpDone(Bund b, int ready);
+#ifdef USE_IPFW
+  static void	IfaceAclsDone(void *arg);
+#endif
+  static void	IfaceIpIfaceReady(Bund b, int failed);
+  static void	IfaceIpIfaceScript(Bund b);
+  static void	IfaceIpv6IfaceReady(Bund b, int failed);
+  static void	IfaceIpv6IfaceScript(Bund b);
+  static void	*IfaceScriptArg(Bund b, int af);
+  static void	IfaceScriptDone(void *arg, int status);
   static int	IfaceNgIpInit(Bund b, int ready);
   static void	IfaceNgIpShutdown(Bund b);
   static int	IfaceNgIpv6Init(Bund b, int ready);
@@ -128,6 +158,8 @@
   static int    IfaceInitLimits(Bund b, char *path, char *hook);
   static void	IfaceSetupLimits(Bund b);
   static void	IfaceShutdownLimits(Bund b);
+  static int	IfaceLimitProg(Bund b, const char *name, struct bpf_insn *prog, u_int maxlen);
+  static int	IfaceLimitMergeable(struct acl *l, const char *action);
 #endif
 
   static int	IfaceSetCommand(Context ctx, int ac, const char *const av[], const void *arg);
@@ -435,6 +467,8 @@ IfaceCloseCmd(Context ctx)
  *
  * Our underlying PPP bundle is ready for traffic.
  * We may signal that the interface is in DoD with the IFF_LINK0 flag.
+ * When IPFW ACLs are set, the interface is brought up only when they
+ * are installed, not to pass any traffic around them.
  */
 
 void
@@ -443,16 +477,19 @@ IfaceUp(Bund b, int ready)
   IfaceState	const iface = &b->iface;
   int		session_timeout = 0, idle_timeout = 0;
 #ifdef USE_IPFW
+  IpfwBatch	q;
   struct acl	*acls, *acl;
   char			*buf;
   struct acl_pool 	**poollast;
   int 			poollaststart;
   int		prev_number;
   int		prev_real_number;
+  struct ifaceacls	*ia;
 #endif
 
   Log(LG_IFACE, ("[%s] IFACE: Up event", b->name));
   iface->last_up = time(NULL);
+  BundChanged(b);
 
   if (ready) {
 
@@ -589,15 +626,16 @@ IfaceUp(Bund b, int ready)
   };
 
   /* Set ACLs */
+  q = IpfwBatchNew(LG_IFACE2, b->name);
   acls = b->params.acl_pipe;
   while (acls != NULL) {
-    ExecCmd(LG_IFACE2, b->name, "%s pipe %d config %s", PATH_IPFW, acls->real_number, acls->rule);
+    IpfwBatchAdd(q, "pipe %d config %s", acls->real_number, acls->rule);
     acls = acls->next;
   }
   acls = b->params.acl_queue;
   while (acls != NULL) {
     buf = IfaceParseACL(acls->rule, iface);
-    ExecCmd(LG_IFACE2, b->name, "%s queue %d config %s", PATH_IPFW, acls->real_number, buf);
+    IpfwBatchAdd(q, "queue %d config %s", acls->real_number, buf);
     Freee(buf);
     acls = acls->next;
   }
@@ -612,32 +650,81 @@ IfaceUp(Bund b, int ready)
     iface->tables = acl;
     if (strncmp(acl->rule, "peer_addr", 9) == 0) {
 	char hisaddr[20];
-	ExecCmd(LG_IFACE2, b->name, "%s -q table %d add %s",
-	    PATH_IPFW, acl->real_number,
+	IpfwBatchAdd(q, "-q table %d add %s", acl->real_number,
 	    u_addrtoa(&iface->peer_addr, hisaddr, sizeof(hisaddr)));
     } else {
-	ExecCmd(LG_IFACE2, b->name, "%s -q table %d add %s", PATH_IPFW, acl->real_number, acl->rule);
+	IpfwBatchAdd(q, "-q table %d add %s", acl->real_number, acl->rule);
     }
     acls = acls->next;
   };
   acls = b->params.acl_rule;
   while (acls != NULL) {
     buf = IfaceParseACL(acls->rule, iface);
-    ExecCmd(LG_IFACE2, b->name, "%s add %d %s via %s", PATH_IPFW, acls->real_number, buf, iface->ifname);
+    IpfwBatchAdd(q, "add %d %s via %s", acls->real_number, buf, iface->ifname);
     Freee(buf);
     acls = acls->next;
   };
+
+  /* The rest is done when the helper completes the batch */
+  ia = Malloc(MB_IFACE, sizeof(*ia));
+  ia->bund = b->id;
+  ia->seq = ++iface->acl_seq;
+  iface->acls_pending = 1;
+  IpfwBatchRun(q, IfaceAclsDone, ia);
+  return;
 #endif /* USE_IPFW */
 
   };
 
-  /* Bring up system interface */
-  IfaceChangeFlags(b, 0, IFF_UP | (ready?0:IFF_LINK0));
+  IfaceUpDone(b, ready);
+}
 
-  /* Send any cached packets */
+/*
+ * IfaceUpDone()
+ *
+ * Bring up system interface and send any cached packets.
+ */
+
+static void
+IfaceUpDone(Bund b, int ready)
+{
+  IfaceChangeFlags(b, 0, IFF_UP | (ready?0:IFF_LINK0));
   IfaceCacheSend(b);
+}
 
+#ifdef USE_IPFW
+/*
+ * IfaceAclsDone()
+ *
+ * Called when ACLs of IfaceUp() are installed, unless the interface
+ * went down meanwhile. Run "up" scripts waiting for that.
+ */
+
+static void
+IfaceAclsDone(void *arg)
+{
+  struct ifaceacls	*const ia = (struct ifaceacls *)arg;
+  Bund			b;
+  IfaceState		iface;
+
+  if (ia->bund < gNumBundles && (b = gBundles[ia->bund]) != NULL &&
+      b->iface.acls_pending && b->iface.acl_seq == ia->seq) {
+    iface = &b->iface;
+    iface->acls_pending = 0;
+    BundSetupMark(b, LINK_SETUP_ACLS);
+    IfaceUpDone(b, 1);
+    if (iface->ip_script_wait) {
+      iface->ip_script_wait = 0;
+      IfaceIpIfaceScript(b);
+    }
+    if (iface->ipv6_script_wait) {
+      iface->ipv6_script_wait = 0;
+      IfaceIpv6IfaceScript(b);
+    }
+  }
+  Freee(ia);
 }
+#endif /* USE_IPFW */
 
 /*
  * IfaceDown()
@@ -650,12 +737,22 @@ IfaceDown(Bund b)
 {
   IfaceState	const iface = &b->iface;
 #ifdef USE_IPFW
+  IpfwBatch	q;
   struct acl_pool	**rp, *rp1;
   char		cb[LINE_MAX - sizeof(PATH_IPFW) - 14];
   struct acl    *acl, *aclnext;
 #endif
 
   Log(LG_IFACE, ("[%s] IFACE: Down event", b->name));
+  BundChanged(b);
+
+#ifdef USE_IPFW
+  /* Forget about ACLs being installed */
+  iface->acl_seq++;
+  iface->acls_pending = 0;
+  iface->ip_script_wait = 0;
+  iface->ipv6_script_wait = 0;
+#endif
 
   /* Bring down system interface */
   IfaceChangeFlags(b, IFF_UP | IFF_LINK0, 0);
@@ -664,6 +761,8 @@ IfaceDown(Bund b)
   TimerStop(&iface->sessionTimer);
 
 #ifdef USE_IPFW
+  q = IpfwBatchNew(LG_IFACE2, b->name);
+
   /* Remove rule ACLs */
   rp = &rule_pool;
   cb[0]=0;
@@ -678,8 +777,7 @@ IfaceDown(Bund b)
     };
   };
   if (cb[0]!=0)
-    ExecCmdNosh(LG_IFACE2, b->name, "%s delete%s",
-      PATH_IPFW, cb);
+    IpfwBatchAdd(q, "delete%s", cb);
 
   /* Remove table ACLs */
   rp = &table_pool;
@@ -696,13 +794,11 @@ IfaceDown(Bund b)
   while (acl != NULL) {
     if (strncmp(acl->rule, "peer_addr", 9) == 0) {
       char hisaddr[20];
-      ExecCmd(LG_IFACE2, b->name, "%s -q table %d delete %s",
-        PATH_IPFW, acl->real_number,
+      IpfwBatchAdd(q, "-q table %d delete %s", acl->real_number,
         u_addrtoa(&iface->peer_addr, hisaddr, sizeof(hisaddr)));
     } else {
       char buf[ACL_LEN];
-      ExecCmd(LG_IFACE2, b->name, "%s -q table %d delete %s",
-        PATH_IPFW, acl->real_number,
+      IpfwBatchAdd(q, "-q table %d delete %s", acl->real_number,
         IfaceFixAclForDelete(acl->rule, buf, sizeof(buf)));
     }
     aclnext = acl->next;
@@ -725,8 +821,7 @@ IfaceDown(Bund b)
     };
   };
   if (cb[0]!=0)
-    ExecCmdNosh(LG_IFACE2, b->name, "%s queue delete%s",
-      PATH_IPFW, cb);
+    IpfwBatchAdd(q, "queue delete%s", cb);
 
   /* Remove pipe ACLs */
   rp = &pipe_pool;
@@ -742,8 +837,9 @@ IfaceDown(Bund b)
     };
   };
   if (cb[0]!=0)
-    ExecCmdNosh(LG_IFACE2, b->name, "%s pipe delete%s",
-      PATH_IPFW, cb);
+    IpfwBatchAdd(q, "pipe delete%s", cb);
+
+  IpfwBatchRun(q, NULL, NULL);
 #endif /* USE_IPFW */
 
     /* Clearing self and peer addresses */
@@ -1042,12 +1138,9 @@ IfaceIpIfaceUp(Bund b, int ready)
     };
 
     /* Set addresses */
-    if (!u_rangeempty(&iface->self_addr) &&
-	    IfaceChangeAddr(b, 1, &iface->self_addr, &iface->peer_addr)) {
-	Log(LG_ERR, ("[%s] IFACE: IfaceChangeAddr() error, closing IPCP", b->name));
-	FsmFailure(&b->ipcp.fsm, FAIL_NEGOT_FAILURE);
-	return (-1);
-    };
+    iface->ip_rtseq = RtQueueNewSeq();
+    if (!u_rangeempty(&iface->self_addr))
+	RtQueueAddr(b, iface->ip_rtseq, 1, &iface->self_addr, &iface->peer_addr);
 
     /* Proxy ARP for peer if desired and peer's address is known */
     u_addrclear(&iface->proxy_addr);
@@ -1073,13 +1166,15 @@ IfaceIpIfaceUp(Bund b, int ready)
     /* Add static routes */
     SLIST_FOREACH(r, &iface->routes, next) {
 	if (u_rangefamily(&r->dest)==AF_INET) {
-	    r->ok = (IfaceSetRoute(b, RTM_ADD, &r->dest, &iface->peer_addr) == 0);
+	    RtQueueRoute(b, iface->ip_rtseq, RTM_ADD, &r->dest, &iface->peer_addr);
+	    r->ok = 1;
 	}
     }
     /* Add dynamic routes */
     SLIST_FOREACH(r, &b->params.routes, next) {
 	if (u_rangefamily(&r->dest)==AF_INET) {
-	    r->ok = (IfaceSetRoute(b, RTM_ADD, &r->dest, &iface->peer_addr) == 0);
+	    RtQueueRoute(b, iface->ip_rtseq, RTM_ADD, &r->dest, &iface->peer_addr);
+	    r->ok = 1;
 	}
     }
 
@@ -1089,11 +1184,56 @@ IfaceIpIfaceUp(Bund b, int ready)
 	IfaceSetupNAT(b);
 #endif
 
+    /* Continue when addresses and routes are really set */
+    RtQueueDone(b, iface->ip_rtseq, AF_INET, IfaceIpIfaceReady);
+    RtQueueFlush();
+    return (0);
+}
+
+/*
+ * IfaceIpIfaceReady()
+ *
+ * Called from the route queue when IP interface is configured.
+ */
+
+static void
+IfaceIpIfaceReady(Bund b, int failed)
+{
+    IfaceState		const iface = &b->iface;
+
+    if (failed) {
+	Log(LG_ERR, ("[%s] IFACE: Adding interface address failed, closing IPCP", b->name));
+	FsmFailure(&b->ipcp.fsm, FAIL_NEGOT_FAILURE);
+	return;
+    }
+    BundSetupMark(b, LINK_SETUP_IFACE_UP);
+#ifdef USE_IPFW
+    if (iface->acls_pending) {
+	iface->ip_script_wait = 1;
+	return;
+    }
+#endif
+    IfaceIpIfaceScript(b);
+}
+
+/*
+ * IfaceIpIfaceScript()
+ *
+ * Call "up" script for IP, the session is ready when it completes.
+ */
+
+static void
+IfaceIpIfaceScript(Bund b)
+{
+    IfaceState		const iface = &b->iface;
+
+    if (!*iface->up_script)
+	BundSetupMark(b, LINK_SETUP_READY);
+
     /* Call "up" script */
     if (*iface->up_script) {
 	char	selfbuf[40],peerbuf[40];
 	char	ns1buf[21], ns2buf[21];
-	int	res;
 
 	if(b->ipcp.want_dns[0].s_addr != 0)
     	    snprintf(ns1buf, sizeof(ns1buf), "dns1 %s", inet_ntoa(b->ipcp.want_dns[0]));
@@ -1104,19 +1244,60 @@ IfaceIpIfaceUp(Bund b, int ready)
 	else
     	    ns2buf[0] = '\0';
 
-	res = ExecCmd(LG_IFACE2, b->name, "%s %s inet %s %s '%s' '%s' '%s' '%s' '%s'",
+	SpawnRun(LG_IFACE2, b->name, IfaceScriptDone, IfaceScriptArg(b, AF_INET),
+	    "%s %s inet %s %s '%s' '%s' '%s' '%s' '%s'",
 	    iface->up_script, iface->ifname,
 	    u_rangetoa(&iface->self_addr,selfbuf, sizeof(selfbuf)),
     	    u_addrtoa(&iface->peer_addr, peerbuf, sizeof(peerbuf)), 
     	    *b->params.authname ? b->params.authname : "-", 
     	    ns1buf, ns2buf, *b->params.peeraddr ? b->params.peeraddr : "-",
     	    b->params.filter_id ? b->params.filter_id : "-");
-	if (res != 0) {
+    }
+}
+
+/*
+ * IfaceScriptArg()
+ *
+ * Remember which interface configuration the "up" script belongs to.
+ */
+
+static void *
+IfaceScriptArg(Bund b, int af)
+{
+    struct ifacescript	*sc;
+
+    sc = Malloc(MB_IFACE, sizeof(*sc));
+    sc->bund = b->id;
+    sc->af = af;
+    sc->seq = (af == AF_INET6) ? b->iface.ipv6_rtseq : b->iface.ip_rtseq;
+    return (sc);
+}
+
+/*
+ * IfaceScriptDone()
+ *
+ * Called when the "up" script completes. The session is ready, or the
+ * NCP is closed if it failed, unless the interface went down or was
+ * reconfigured meanwhile.
+ */
+
+static void
+IfaceScriptDone(void *arg, int status)
+{
+    struct ifacescript	*const sc = (struct ifacescript *)arg;
+    Bund		b;
+
+    if (sc->bund < gNumBundles && (b = gBundles[sc->bund]) != NULL &&
+	    sc->seq == ((sc->af == AF_INET6) ?
+		b->iface.ipv6_rtseq : b->iface.ip_rtseq)) {
+	if (status == 0)
+	    BundSetupMark(b, LINK_SETUP_READY);
+	else if (sc->af == AF_INET6)
+	    FsmFailure(&b->ipv6cp.fsm, FAIL_NEGOT_FAILURE);
+	else
 	    FsmFailure(&b->ipcp.fsm, FAIL_NEGOT_FAILURE);
-	    return (-1);
-	}
     }
-    return (0);
+    Freee(sc);
 }
 
 /*
@@ -1132,11 +1313,16 @@ IfaceIpIfaceDown(Bund b)
     IfaceRoute	r;
     char	buf[48];
 
+#ifdef USE_IPFW
+    iface->ip_script_wait = 0;
+#endif
+
     /* Call "down" script */
     if (*iface->down_script) {
 	char	selfbuf[40],peerbuf[40];
 
-	ExecCmd(LG_IFACE2, b->name, "%s %s inet %s %s '%s' '%s' '%s'",
+	SpawnRun(LG_IFACE2, b->name, NULL, NULL,
+	    "%s %s inet %s %s '%s' '%s' '%s'",
     	    iface->down_script, iface->ifname,
     	    u_rangetoa(&iface->self_addr,selfbuf, sizeof(selfbuf)),
     	    u_addrtoa(&iface->peer_addr, peerbuf, sizeof(peerbuf)), 
@@ -1150,7 +1336,7 @@ IfaceIpIfaceDown(Bund b)
 	if (u_rangefamily(&r->dest)==AF_INET) {
 	    if (!r->ok)
 		continue;
-	    IfaceSetRoute(b, RTM_DELETE, &r->dest, &iface->peer_addr);
+	    RtQueueRoute(b, iface->ip_rtseq, RTM_DELETE, &r->dest, &iface->peer_addr);
 	    r->ok = 0;
 	}
     }
@@ -1159,7 +1345,7 @@ IfaceIpIfaceDown(Bund b)
 	if (u_rangefamily(&r->dest)==AF_INET) {
 	    if (!r->ok)
 		continue;
-	    IfaceSetRoute(b, RTM_DELETE, &r->dest, &iface->peer_addr);
+	    RtQueueRoute(b, iface->ip_rtseq, RTM_DELETE, &r->dest, &iface->peer_addr);
 	    r->ok = 0;
 	}
     }
@@ -1171,7 +1357,10 @@ IfaceIpIfaceDown(Bund b)
 
     /* Remove address from interface */
     if (!u_rangeempty(&iface->self_addr))
-	IfaceChangeAddr(b, 0, &iface->self_addr, &iface->peer_addr);
+	RtQueueAddr(b, iface->ip_rtseq, 0, &iface->self_addr, &iface->peer_addr);
+    RtQueueFlush();
+    /* Results of operations queued before are not interesting any more */
+    iface->ip_rtseq = 0;
     
     IfaceNgIpShutdown(b);
 }
@@ -1219,49 +1408,88 @@ IfaceIpv6IfaceUp(Bund b, int ready)
     };
   
     /* Set addresses */
+    iface->ipv6_rtseq = RtQueueNewSeq();
     if (!u_addrempty(&iface->self_ipv6_addr)) {
 	struct u_range	rng;
 	rng.addr = iface->self_ipv6_addr;
 	rng.width = 64;
-	if (IfaceChangeAddr(b, 1, &rng, &iface->peer_ipv6_addr)) {
-	    Log(LG_ERR, ("[%s] IFACE: IfaceChangeAddr() failed, closing IPv6CP", b->name));
-	    FsmFailure(&b->ipv6cp.fsm, FAIL_NEGOT_FAILURE);
-    	    return (-1);
-	}
+	RtQueueAddr(b, iface->ipv6_rtseq, 1, &rng, &iface->peer_ipv6_addr);
     };
   
     /* Add static routes */
     SLIST_FOREACH(r, &iface->routes, next) {
 	if (u_rangefamily(&r->dest)==AF_INET6) {
-	    r->ok = (IfaceSetRoute(b, RTM_ADD, &r->dest, &iface->peer_ipv6_addr) == 0);
+	    RtQueueRoute(b, iface->ipv6_rtseq, RTM_ADD, &r->dest, &iface->peer_ipv6_addr);
+	    r->ok = 1;
 	}
     }
     /* Add dynamic routes */
     SLIST_FOREACH(r, &b->params.routes, next) {
 	if (u_rangefamily(&r->dest)==AF_INET6) {
-	    r->ok = (IfaceSetRoute(b, RTM_ADD, &r->dest, &iface->peer_ipv6_addr) == 0);
+	    RtQueueRoute(b, iface->ipv6_rtseq, RTM_ADD, &r->dest, &iface->peer_ipv6_addr);
+	    r->ok = 1;
 	}
     }
 
+    /* Continue when addresses and routes are really set */
+    RtQueueDone(b, iface->ipv6_rtseq, AF_INET6, IfaceIpv6IfaceReady);
+    RtQueueFlush();
+    return (0);
+}
+
+/*
+ * IfaceIpv6IfaceReady()
+ *
+ * Called from the route queue when IPv6 interface is configured.
+ */
+
+static void
+IfaceIpv6IfaceReady(Bund b, int failed)
+{
+    IfaceState		const iface = &b->iface;
+
+    if (failed) {
+	Log(LG_ERR, ("[%s] IFACE: Adding interface address failed, closing IPv6CP", b->name));
+	FsmFailure(&b->ipv6cp.fsm, FAIL_NEGOT_FAILURE);
+	return;
+    }
+    BundSetupMark(b, LINK_SETUP_IFACE_UP);
+#ifdef USE_IPFW
+    if (iface->acls_pending) {
+	iface->ipv6_script_wait = 1;
+	return;
+    }
+#endif
+    IfaceIpv6IfaceScript(b);
+}
+
+/*
+ * IfaceIpv6IfaceScript()
+ *
+ * Call "up" script for IPv6, the session is ready when it completes.
+ */
+
+static void
+IfaceIpv6IfaceScript(Bund b)
+{
+    IfaceState		const iface = &b->iface;
+
+    if (!*iface->up_script)
+	BundSetupMark(b, LINK_SETUP_READY);
+
     /* Call "up" script */
     if (*iface->up_script) {
 	char	selfbuf[48],peerbuf[48];
-	int	res;
 
-	res = ExecCmd(LG_IFACE2, b->name, "%s %s inet6 %s%%%s %s%%%s '%s' '%s' '%s'",
+	SpawnRun(LG_IFACE2, b->name, IfaceScriptDone, IfaceScriptArg(b, AF_INET6),
+	    "%s %s inet6 %s%%%s %s%%%s '%s' '%s' '%s'",
     	    iface->up_script, iface->ifname, 
     	    u_addrtoa(&iface->self_ipv6_addr, selfbuf, sizeof(selfbuf)), iface->ifname,
     	    u_addrtoa(&iface->peer_ipv6_addr, peerbuf, sizeof(peerbuf)), iface->ifname, 
     	    *b->params.authname ? b->params.authname : "-",
     	    *b->params.peeraddr ? b->params.peeraddr : "-",
     	    b->params.filter_id ? b->params.filter_id : "-");
-	if (res != 0) {
-	    FsmFailure(&b->ipv6cp.fsm, FAIL_NEGOT_FAILURE);
-	    return (-1);
-	}
     }
-    return (0);
-
 }
 
 /*
@@ -1277,11 +1505,16 @@ IfaceIpv6IfaceDown(Bund b)
     IfaceRoute		r;
     struct u_range	rng;
 
+#ifdef USE_IPFW
+    iface->ipv6_script_wait = 0;
+#endif
+
     /* Call "down" script */
     if (*iface->down_script) {
 	char	selfbuf[48],peerbuf[48];
 
-	ExecCmd(LG_IFACE2, b->name, "%s %s inet6 %s%%%s %s%%%s '%s' '%s' '%s'",
+	SpawnRun(LG_IFACE2, b->name, NULL, NULL,
+	    "%s %s inet6 %s%%%s %s%%%s '%s' '%s' '%s'",
     	    iface->down_script, iface->ifname, 
     	    u_addrtoa(&iface->self_ipv6_addr, selfbuf, sizeof(selfbuf)), iface->ifname,
     	    u_addrtoa(&iface->peer_ipv6_addr, peerbuf, sizeof(peerbuf)), iface->ifname, 
@@ -1295,7 +1528,7 @@ IfaceIpv6IfaceDown(Bund b)
 	if (u_rangefamily(&r->dest)==AF_INET6) {
 	    if (!r->ok)
 		continue;
-	    IfaceSetRoute(b, RTM_DELETE, &r->dest, &iface->peer_ipv6_addr);
+	    RtQueueRoute(b, iface->ipv6_rtseq, RTM_DELETE, &r->dest, &iface->peer_ipv6_addr);
 	    r->ok = 0;
 	}
     }
@@ -1304,7 +1537,7 @@ IfaceIpv6IfaceDown(Bund b)
 	if (u_rangefamily(&r->dest)==AF_INET6) {
 	    if (!r->ok)
 		continue;
-	    IfaceSetRoute(b, RTM_DELETE, &r->dest, &iface->peer_ipv6_addr);
+	    RtQueueRoute(b, iface->ipv6_rtseq, RTM_DELETE, &r->dest, &iface->peer_ipv6_addr);
 	    r->ok = 0;
 	}
     }
@@ -1313,8 +1546,11 @@ IfaceIpv6IfaceDown(Bund b)
 	/* Remove address from interface */
 	rng.addr = iface->self_ipv6_addr;
 	rng.width = 64;
-	IfaceChangeAddr(b, 0, &rng, &iface->peer_ipv6_addr);
+	RtQueueAddr(b, iface->ipv6_rtseq, 0, &rng, &iface->peer_ipv6_addr);
     }
+    RtQueueFlush();
+    /* Results of operations queued before are not interesting any more */
+    iface->ipv6_rtseq = 0;
 
     IfaceNgIpv6Shutdown(b);
 }
@@ -1332,7 +1568,7 @@ IfaceIdleTimeout(void *arg)
   int				k;
 
   /* Get updated bpf node traffic statistics */
-  BundUpdateStats(b);
+  BundUpdateStats(b, NGSTATS_IDLE);
 
   /* Mark current traffic period if there was traffic */
   if (iface->idleStats.recvFrames + iface->idleStats.xmitFrames < 
@@ -1968,198 +2204,6 @@ IfaceChangeFlags(Bund b, int clear, int set)
     close(s);
 }
 
-#if defined(__KAME__) && !defined(NOINET6)
-static void
-add_scope(struct sockaddr *sa, int ifindex)
-{
-  struct sockaddr_in6 *sa6;
-
-  if (sa->sa_family != AF_INET6)
-    return;
-  sa6 = (struct sockaddr_in6 *)(void *)sa;
-  if (!IN6_IS_ADDR_LINKLOCAL(&sa6->sin6_addr) &&
-      !IN6_IS_ADDR_MC_LINKLOCAL(&sa6->sin6_addr))
-    return;
-  if (sa6->sin6_addr.__u6_addr.__u6_addr16[1] != 0)
-    return;
-  sa6->sin6_addr.__u6_addr.__u6_addr16[1] = htons(ifindex);
-}
-#endif
-
-int
-IfaceChangeAddr(Bund b, int add, struct u_range *self, struct u_addr *peer)
-{
-    struct ifaliasreq ifra;
-    struct in6_aliasreq ifra6;
-    struct sockaddr_in *me4, *msk4, *peer4;
-    struct sockaddr_storage ssself, sspeer, ssmsk;
-    int res = 0;
-    int s;
-    char buf[48], buf1[48];
-
-    Log(LG_IFACE2, ("[%s] IFACE: %s address %s->%s %s %s",
-	b->name, add?"Add":"Remove", u_rangetoa(self, buf, sizeof(buf)), 
-	((peer != NULL)?u_addrtoa(peer, buf1, sizeof(buf1)):""),
-	add?"to":"from", b->iface.ifname));
-
-    u_rangetosockaddrs(self, &ssself, &ssmsk);
-    if (peer)
-	u_addrtosockaddr(peer, 0, &sspeer);
-
-    if ((s = socket(self->addr.family, SOCK_DGRAM, 0)) < 0) {
-	Perror("[%s] IFACE: Can't get socket to change interface address", b->name);
-	return (s);
-    }
-
-    switch (self->addr.family) {
-      case AF_INET:
-	memset(&ifra, '\0', sizeof(ifra));
-	strlcpy(ifra.ifra_name, b->iface.ifname, sizeof(ifra.ifra_name));
-
-	me4 = (struct sockaddr_in *)(void *)&ifra.ifra_addr;
-	memcpy(me4, &ssself, sizeof(*me4));
-
-	msk4 = (struct sockaddr_in *)(void *)&ifra.ifra_mask;
-	memcpy(msk4, &ssmsk, sizeof(*msk4));
-
-	peer4 = (struct sockaddr_in *)(void *)&ifra.ifra_broadaddr;
-	if (peer == NULL || peer->family == AF_UNSPEC) {
-    	    peer4->sin_family = AF_INET;
-    	    peer4->sin_len = sizeof(*peer4);
-    	    peer4->sin_addr.s_addr = INADDR_NONE;
-	} else
-    	    memcpy(peer4, &sspeer, sizeof(*peer4));
-
-	res = ioctl(s, add?SIOCAIFADDR:SIOCDIFADDR, &ifra);
-	if (res == -1) {
-	    Perror("[%s] IFACE: %s IPv4 address %s %s failed", 
-		b->name, add?"Adding":"Removing", add?"to":"from", b->iface.ifname);
-	}
-	break;
-
-      case AF_INET6:
-	memset(&ifra6, '\0', sizeof(ifra6));
-	strlcpy(ifra6.ifra_name, b->iface.ifname, sizeof(ifra6.ifra_name));
-
-	memcpy(&ifra6.ifra_addr, &ssself, sizeof(ifra6.ifra_addr));
-	memcpy(&ifra6.ifra_prefixmask, &ssmsk, sizeof(ifra6.ifra_prefixmask));
-	if (peer == NULL || peer->family == AF_UNSPEC)
-    	    ifra6.ifra_dstaddr.sin6_family = AF_UNSPEC;
-	else if (memcmp(&((struct sockaddr_in6 *)&ssmsk)->sin6_addr, &in6mask128,
-		    sizeof(in6mask128)) == 0)
-    	    memcpy(&ifra6.ifra_dstaddr, &sspeer, sizeof(ifra6.ifra_dstaddr));
-	ifra6.ifra_lifetime.ia6t_vltime = ND6_INFINITE_LIFETIME;
-	ifra6.ifra_lifetime.ia6t_pltime = ND6_INFINITE_LIFETIME;
-
-	res = ioctl(s, add?SIOCAIFADDR_IN6:SIOCDIFADDR_IN6, &ifra6);
-	if (res == -1) {
-		if (add && errno == EEXIST) {
-			/* this can happen if the kernel has already automatically added
-			   the same link-local address - ignore the error */
-			res = 0;
-		} else {
-			Perror("[%s] IFACE: %s IPv6 address %s %s failed", 
-				b->name, add?"Adding":"Removing", add?"to":"from", b->iface.ifname);
-		}
-	}
-	break;
-
-      default:
-        res = -1;
-	break;
-    }
-    close(s);
-    return (res);
-}
-
-struct rtmsg {
-  struct rt_msghdr m_rtm;
-  char m_space[256];
-};
-
-static size_t
-memcpy_roundup(char *cp, const void *data, size_t len)
-{
-  size_t padlen;
-
-#define ROUNDUP(x) ((x) ? (1 + (((x) - 1) | (sizeof(long) - 1))) : sizeof(long))
-  padlen = ROUNDUP(len);
-  memcpy(cp, data, len);
-  if (padlen > len)
-    memset(cp + len, '\0', padlen - len);
-
-  return padlen;
-}
-
-int
-IfaceSetRoute(Bund b, int cmd, struct u_range *dst,
-       struct u_addr *gw)
-{
-    struct rtmsg rtmes;
-    int s, nb, wb;
-    char *cp;
-    const char *cmdstr = (cmd == RTM_ADD ? "Add" : "Delete");
-    struct sockaddr_storage sadst, samask, sagw;
-    char buf[48], buf1[48];
-
-    s = socket(PF_ROUTE, SOCK_RAW, 0);
-    if (s < 0) {
-	Perror("[%s] IFACE: Can't get route socket", b->name);
-	return (-1);
-    }
-    memset(&rtmes, '\0', sizeof(rtmes));
-    rtmes.m_rtm.rtm_version = RTM_VERSION;
-    rtmes.m_rtm.rtm_type = cmd;
-    rtmes.m_rtm.rtm_addrs = RTA_DST;
-    rtmes.m_rtm.rtm_seq = ++gRouteSeq;
-    rtmes.m_rtm.rtm_pid = gPid;
-    rtmes.m_rtm.rtm_flags = RTF_UP | RTF_GATEWAY | RTF_STATIC;
-
-    u_rangetosockaddrs(dst, &sadst, &samask);
-#if defined(__KAME__) && !defined(NOINET6)
-    add_scope((struct sockaddr *)&sadst, b->iface.ifindex);
-#endif
-
-    cp = rtmes.m_space;
-    cp += memcpy_roundup(cp, &sadst, sadst.ss_len);
-    if (gw != NULL) {
-	u_addrtosockaddr(gw, 0, &sagw);
-#if defined(__KAME__) && !defined(NOINET6)
-	add_scope((struct sockaddr *)&sagw, b->iface.ifindex);
-#endif
-    	cp += memcpy_roundup(cp, &sagw, sagw.ss_len);
-    	rtmes.m_rtm.rtm_addrs |= RTA_GATEWAY;
-    } else if (cmd == RTM_ADD) {
-    	Log(LG_ERR, ("[%s] IfaceSetRoute: gw is not set\n", b->name));
-    	close(s);
-    	return (-1);
-    }
-
-    if (u_rangehost(dst)) {
-	rtmes.m_rtm.rtm_flags |= RTF_HOST;
-    } else {
-	cp += memcpy_roundup(cp, &samask, samask.ss_len);
-	rtmes.m_rtm.rtm_addrs |= RTA_NETMASK;
-    }
-
-    nb = cp - (char *)&rtmes;
-    rtmes.m_rtm.rtm_msglen = nb;
-    wb = write(s, &rtmes, nb);
-    if (wb < 0) {
-    	Log(LG_ERR, ("[%s] IFACE: %s route %s %s failed: %s",
-	    b->name, cmdstr, u_rangetoa(dst, buf, sizeof(buf)), 
-	    ((gw != NULL)?u_addrtoa(gw, buf1, sizeof(buf1)):""),
-	    (rtmes.m_rtm.rtm_errno != 0)?strerror(rtmes.m_rtm.rtm_errno):strerror(errno)));
-	close(s);
-	return (-1);
-    }
-    close(s);
-    Log(LG_IFACE2, ("[%s] IFACE: %s route %s %s",
-	    b->name, cmdstr, u_rangetoa(dst, buf, sizeof(buf)), 
-	    ((gw != NULL)?u_addrtoa(gw, buf1, sizeof(buf1)):"")));
-    return (0);
-}
-
 #ifndef USE_NG_TCPMSS
 void
 IfaceCorrectMSS(Mbuf pkt, uint16_t maxmss)
@@ -2224,7 +2268,8 @@ IfaceNgIpInit(Bund b, int ready)
 	/* Dial-on-Demand mode */
 	/* Use demand hook of the socket node */
 	snprintf(path, sizeof(path), ".:");
-	snprintf(hook, sizeof(hook), "4%d", b->id);
+	NgFuncHookToken(hook, sizeof(hook), MPD_HOOK_DEMAND4,
+	    b->id, b->hookgen);
 
     } else {
 	snprintf(path, sizeof(path), "[%x]:", b->nodeID);
@@ -2406,7 +2451,8 @@ IfaceNgIpv6Init(Bund b, int ready)
 	/* Dial-on-Demand mode */
 	/* Use demand hook of the socket node */
 	snprintf(path, sizeof(path), ".:");
-	snprintf(hook, sizeof(hook), "6%d", b->id);
+	NgFuncHookToken(hook, sizeof(hook), MPD_HOOK_DEMAND6,
+	    b->id, b->hookgen);
     } else {
 	snprintf(path, sizeof(path), "[%x]:", b->nodeID);
 	strcpy(hook, NG_PPP_HOOK_IPV6);
@@ -3043,7 +3089,8 @@ IfaceInitMSS(Bund b, char *path, char *hook)
 
     /* Connect to the bundle socket node. */
     strlcpy(cn.path, path, sizeof(cn.path));
-    snprintf(cn.ourhook, sizeof(cn.ourhook), "i%d", b->id);
+    NgFuncHookToken(cn.ourhook, sizeof(cn.ourhook), MPD_HOOK_MSS_IN,
+	b->id, b->hookgen);
     strcpy(cn.peerhook, MPD_HOOK_TCPMSS_IN);
     if (NgSendMsg(gLinksCsock, ".:", NGM_GENERIC_COOKIE, NGM_CONNECT, &cn,
     	    sizeof(cn)) < 0) {
@@ -3053,7 +3100,8 @@ IfaceInitMSS(Bund b, char *path, char *hook)
     }
 
     strlcpy(cn.path, path, sizeof(cn.path));
-    snprintf(cn.ourhook, sizeof(cn.ourhook), "o%d", b->id);
+    NgFuncHookToken(cn.ourhook, sizeof(cn.ourhook), MPD_HOOK_MSS_OUT,
+	b->id, b->hookgen);
     strcpy(cn.peerhook, MPD_HOOK_TCPMSS_OUT);
     if (NgSendMsg(gLinksCsock, ".:", NGM_GENERIC_COOKIE, NGM_CONNECT, &cn,
     	    sizeof(cn)) < 0) {
@@ -3111,7 +3159,7 @@ IfaceSetupMSS(Bund b, uint16_t maxMSS)
     char			hook[NG_HOOKSIZ];
 
     /* Setup programs for ng_bpf hooks */
-    snprintf(hook, sizeof(hook), "i%d", b->id);
+    NgFuncHookToken(hook, sizeof(hook), MPD_HOOK_MSS_IN, b->id, b->hookgen);
 
     memset(&u, 0, sizeof(u));
     strcpy(hp->thisHook, "ppp");
@@ -3137,7 +3185,7 @@ IfaceSetupMSS(Bund b, uint16_t maxMSS)
 	    NGM_BPF_SET_PROGRAM, hp, NG_BPF_HOOKPROG_SIZE(hp->bpf_prog_len)) < 0)
 	Perror("[%s] can't set %s node program", b->name, NG_BPF_NODE_TYPE);
 
-    snprintf(hook, sizeof(hook), "o%d", b->id);
+    NgFuncHookToken(hook, sizeof(hook), MPD_HOOK_MSS_OUT, b->id, b->hookgen);
     memset(&u, 0, sizeof(u));
     strcpy(hp->thisHook, "iface");
     hp->bpf_prog_len = TCPSYN_PROG_LEN;
@@ -3174,7 +3222,7 @@ IfaceShutdownMSS(Bund b)
 	snprintf(path, sizeof(path), "mpd%d-%s-mss:", gPid, b->name);
 	NgFuncShutdownNode(gLinksCsock, b->name, path);
 #else
-	snprintf(path, sizeof(path), "i%d", b->id);
+	NgFuncHookToken(path, sizeof(path), MPD_HOOK_MSS_IN, b->id, b->hookgen);
 	NgFuncShutdownNode(gLinksCsock, b->name, path);
 #endif
 }
@@ -3225,6 +3273,117 @@ fail:
     return (-1);
 }
 
+#define	ACL_MAX_PROGLEN	65536
+#define	ACL_MAX_MERGELEN	BPF_MAXINSNS	/* kernel limit for merged program */
+#define	ACL_MAX_PARAMS	7	/* one more then max number of arguments */
+
+/*
+ * IfaceLimitProg()
+ *
+ * Build BPF program for the limit filter name ("all" or "fltN").
+ * Returns program length, the program is stored only if it fits
+ * into maxlen instructions. Returns -1 on error.
+ */
+
+static int
+IfaceLimitProg(Bund b, const char *name, struct bpf_insn *prog, u_int maxlen)
+{
+    struct acl	*f;
+    char	*buf;
+    int		flt, bufbraces, len, i;
+
+    if (strcasecmp(name, "all") == 0) {
+	if (maxlen >= MATCH_PROG_LEN)
+	    memcpy(prog, &gMatchProg, MATCH_PROG_LEN * sizeof(*gMatchProg));
+	return (MATCH_PROG_LEN);
+    }
+    if (strncasecmp(name, "flt", 3) != 0) {
+	Log(LG_ERR, ("[%s] IFACE: incorrect filter: '%s'",
+	    b->name, name));
+	return (-1);
+    }
+    flt = atoi(name + 3);
+    if (flt <= 0 || flt > ACL_FILTERS) {
+	Log(LG_ERR, ("[%s] IFACE: incorrect filter number: '%s'",
+	    b->name, name));
+	return (-1);
+    }
+    if ((f = b->params.acl_filters[flt - 1]) == NULL &&
+	    (f = acl_filters[flt - 1]) == NULL) {
+	Log(LG_ERR, ("[%s] IFACE: Undefined filter: '%s'",
+	    b->name, name));
+	return (-1);
+    }
+
+#define ACL_BUF_SIZE	256*1024
+    buf = Malloc(MB_ACL, ACL_BUF_SIZE);
+    buf[0] = 0;
+    bufbraces = 0;
+    while (f) {
+	char	*b1, *b2, *sbuf;
+	sbuf = Mstrdup(MB_ACL, f->rule);
+	b2 = sbuf;
+	b1 = strsep(&b2, " ");
+	if (b2 != NULL) {
+	    if (strcasecmp(b1, "match") == 0) {
+		strlcat(buf, "( ", ACL_BUF_SIZE);
+		strlcat(buf, b2, ACL_BUF_SIZE);
+		strlcat(buf, " ) ", ACL_BUF_SIZE);
+		if (f->next) {
+		    strlcat(buf, "|| ( ", ACL_BUF_SIZE);
+		    bufbraces++;
+		}
+	    } else if (strcasecmp(b1, "nomatch") == 0) {
+		strlcat(buf, "( not ( ", ACL_BUF_SIZE);
+		strlcat(buf, b2, ACL_BUF_SIZE);
+		strlcat(buf, " ) ) ", ACL_BUF_SIZE);
+		if (f->next) {
+		    strlcat(buf, "&& ( ", ACL_BUF_SIZE);
+		    bufbraces++;
+		}
+	    } else {
+		Log(LG_ERR, ("[%s] IFACE: filter action '%s' is unknown",
+		    b->name, b1));
+	    }
+	};
+	Freee(sbuf);
+	f = f->next;
+    }
+    for (i = 0; i < bufbraces; i++)
+	strlcat(buf, ") ", ACL_BUF_SIZE);
+    Log(LG_IFACE2, ("[%s] IFACE: flt%d: '%s'",
+	b->name, flt, buf));
+
+    len = BpfCacheCompile(buf, (u_int)-1, 0xffffff00, prog, maxlen);
+    if (len < 0)
+	Log(LG_ERR, ("[%s] IFACE: filter '%s' compilation error",
+	    b->name, name));
+    Freee(buf);
+    return (len);
+}
+
+/*
+ * IfaceLimitMergeable()
+ *
+ * Check that limit rule is an unnamed filter with given final action,
+ * so it may share one BPF program with the previous rule.
+ */
+
+static int
+IfaceLimitMergeable(struct acl *l, const char *action)
+{
+    char	str[ACL_LEN];
+    char	*av[ACL_MAX_PARAMS];
+    int		ac;
+
+    if (l->name[0])
+	return (0);
+    strlcpy(str, l->rule, sizeof(str));
+    ac = ParseLine(str, av, ACL_MAX_PARAMS, 0);
+    return (ac == 2 && strcasecmp(av[0], "all") != 0 &&
+	strcasecmp(av[1], action) == 0);
+}
+
 /*
  * BundConfigLimits()
  *
@@ -3234,16 +3393,18 @@ fail:
 static void
 IfaceSetupLimits(Bund b)
 {
-#define	ACL_MAX_PROGLEN	65536
-    union {
+    /* Program buffer is big, so it is allocated once and kept.
+     * It is only used from here, under the giant lock. */
+    static union {
 	u_char			buf[NG_BPF_HOOKPROG_SIZE(ACL_MAX_PROGLEN)];
 	struct ng_bpf_hookprog	hprog;
-    }				*hpu;
+    }				*hpu = NULL;
     struct ng_bpf_hookprog	*hp;
     struct ngm_connect  cn;
     int			i;
     
-    hpu = Malloc(MB_ACL, sizeof(*hpu));
+    if (hpu == NULL)
+	hpu = Malloc(MB_ACL, sizeof(*hpu));
     hp = &hpu->hprog;
 
     if (b->params.acl_limits[0] || b->params.acl_limits[1]) {
@@ -3268,10 +3429,9 @@ IfaceSetupLimits(Bund b)
 	    strcpy(inhook[1], "");
 	    num = 0;
 	    for (l = b->params.acl_limits[dir]; l; l = l->next) {
-	        char		str[ACL_LEN];
-#define	ACL_MAX_PARAMS	7	/* one more then max number of arguments */
-	        int		ac;
-	        char		*av[ACL_MAX_PARAMS];
+	        char		str[ACL_LEN], str1[ACL_LEN];
+	        int		ac, len;
+	        char		*av[ACL_MAX_PARAMS], *av1[ACL_MAX_PARAMS];
 		int		p;
 		char		stathook[NG_HOOKSIZ];
 		struct svcs	*ss = NULL;
@@ -3289,99 +3449,46 @@ IfaceSetupLimits(Bund b)
 		}
 		
 		stathook[0] = 0;
-	    	memset(hpu, 0, sizeof(*hpu));
+	    	memset(hp, 0, sizeof(*hp));
 		/* Prepare filter */
-		if (strcasecmp(av[0], "all") == 0) {
-		    hp->bpf_prog_len = MATCH_PROG_LEN;
-		    memcpy(&hp->bpf_prog, &gMatchProg,
-    		        MATCH_PROG_LEN * sizeof(*gMatchProg));
-		} else if (strncasecmp(av[0], "flt", 3) == 0) {
-		    struct acl  *f;
-		    int		flt;
-		    
-		    flt = atoi(av[0] + 3);
-		    if (flt <= 0 || flt > ACL_FILTERS) {
-			Log(LG_ERR, ("[%s] IFACE: incorrect filter number: '%s'",
-    			    b->name, av[0]));
-		    } else if ((f = b->params.acl_filters[flt - 1]) == NULL &&
-			(f = acl_filters[flt - 1]) == NULL) {
-			Log(LG_ERR, ("[%s] IFACE: Undefined filter: '%s'",
-    			    b->name, av[0]));
-		    } else {
-			struct bpf_program pr;
-		    	char		*buf;
-		    	int		bufbraces;
-
-#define ACL_BUF_SIZE	256*1024
-			buf = Malloc(MB_ACL, ACL_BUF_SIZE);
-			buf[0] = 0;
-			bufbraces = 0;
-			while (f) {
-			    char	*b1, *b2, *sbuf;
-			    sbuf = Mstrdup(MB_ACL, f->rule);
-			    b2 = sbuf;
-			    b1 = strsep(&b2, " ");
-			    if (b2 != NULL) {
-			        if (strcasecmp(b1, "match") == 0) {
-			    	    strlcat(buf, "( ", ACL_BUF_SIZE);
-				    strlcat(buf, b2, ACL_BUF_SIZE);
-				    strlcat(buf, " ) ", ACL_BUF_SIZE);
-				    if (f->next) {
-				        strlcat(buf, "|| ( ", ACL_BUF_SIZE);
-				        bufbraces++;
-				    }
-				} else if (strcasecmp(b1, "nomatch") == 0) {
-				    strlcat(buf, "( not ( ", ACL_BUF_SIZE);
-				    strlcat(buf, b2, ACL_BUF_SIZE);
-				    strlcat(buf, " ) ) ", ACL_BUF_SIZE);
-				    if (f->next) {
-				        strlcat(buf, "&& ( ", ACL_BUF_SIZE);
-				        bufbraces++;
-				    }
-				} else {
-			    	    Log(LG_ERR, ("[%s] IFACE: filter action '%s' is unknown",
-        		    		b->name, b1));
-				}
-			    };
-			    Freee(sbuf);
-			    f = f->next;
-			}
-			for (i = 0; i < bufbraces; i++)
-			    strlcat(buf, ") ", ACL_BUF_SIZE);
-			Log(LG_IFACE2, ("[%s] IFACE: flt%d: '%s'",
-        		    b->name, flt, buf));
-			
-			if (pcap_compile_nopcap((u_int)-1, DLT_RAW, &pr, buf, 1, 0xffffff00)) {
-			    Log(LG_ERR, ("[%s] IFACE: filter '%s' compilation error",
-    			        b->name, av[0]));
-			    /* Incorrect matches nothing. */
-			    hp->bpf_prog_len = NOMATCH_PROG_LEN;
-			    memcpy(&hp->bpf_prog, &gNoMatchProg,
-    		    		NOMATCH_PROG_LEN * sizeof(*gNoMatchProg));
-			} else if (pr.bf_len > ACL_MAX_PROGLEN) {
-			    Log(LG_ERR, ("[%s] IFACE: filter '%s' is too long",
-        		        b->name, av[0]));
-			    pcap_freecode(&pr);
-			    /* Incorrect matches nothing. */
-			    hp->bpf_prog_len = NOMATCH_PROG_LEN;
-			    memcpy(&hp->bpf_prog, &gNoMatchProg,
-    		    		NOMATCH_PROG_LEN * sizeof(*gNoMatchProg));
-			} else {
-			    hp->bpf_prog_len = pr.bf_len;
-			    memcpy(&hp->bpf_prog, pr.bf_insns,
-    			        pr.bf_len * sizeof(struct bpf_insn));
-			    pcap_freecode(&pr);
-			}
-			Freee(buf);
-		    }
-		} else {
-		    Log(LG_ERR, ("[%s] IFACE: incorrect filter: '%s'",
-    		        b->name, av[0]));
+		len = IfaceLimitProg(b, av[0], hp->bpf_prog, ACL_MAX_PROGLEN);
+		if (len > ACL_MAX_PROGLEN) {
+		    Log(LG_ERR, ("[%s] IFACE: filter '%s' is too long",
+        	        b->name, av[0]));
+		    len = -1;
+		}
+		if (len < 0) {
 		    /* Incorrect matches nothing. */
-		    hp->bpf_prog_len = NOMATCH_PROG_LEN;
+		    len = NOMATCH_PROG_LEN;
 		    memcpy(&hp->bpf_prog, &gNoMatchProg,
     		        NOMATCH_PROG_LEN * sizeof(*gNoMatchProg));
 		}
+		hp->bpf_prog_len = len;
+
+		/* Merge following rules with the same final action into this
+		 * program, so that packet is classified in one pass. */
+		if (ac == 2 && !l->name[0] && strcasecmp(av[0], "all") &&
+		    (strcasecmp(av[1], "pass") == 0 ||
+		    strcasecmp(av[1], "deny") == 0)) {
+		    while (l->next && IfaceLimitMergeable(l->next, av[1]) &&
+			    hp->bpf_prog_len < ACL_MAX_MERGELEN) {
+			strlcpy(str1, l->next->rule, sizeof(str1));
+			ParseLine(str1, av1, ACL_MAX_PARAMS, 0);
+			len = IfaceLimitProg(b, av1[0],
+			    hp->bpf_prog + hp->bpf_prog_len,
+			    ACL_MAX_MERGELEN - hp->bpf_prog_len);
+			/* Incorrect rule matches nothing, so it is just skipped. */
+			if (len >= 0) {
+			    if ((len = BpfProgMerge(hp->bpf_prog,
+				    hp->bpf_prog_len, len)) < 0)
+				break;
+			    hp->bpf_prog_len = len;
+			}
+			l = l->next;
+			Log(LG_IFACE2, ("[%s] IFACE: limit %s#%d: '%s' merged",
+			    b->name, (dir?"out":"in"), l->number, l->rule));
+		    }
+		}
 		
 		/* Prepare action */
 		p = 1;
@@ -3589,7 +3696,7 @@ IfaceSetupLimits(Bund b)
 	    /* Connect left hooks to output */
 	    for (i = 0; i < 2; i++) {
 		if (inhook[i][0] != 0) {
-		    memset(hpu, 0, sizeof(*hpu));
+		    memset(hp, 0, sizeof(*hp));
 		    strcpy(hp->thisHook, inhook[i]);
 		    hp->bpf_prog_len = MATCH_PROG_LEN;
 		    memcpy(&hp->bpf_prog, &gMatchProg,
@@ -3605,7 +3712,6 @@ IfaceSetupLimits(Bund b)
 	    }
 	}
     }
-    Freee(hpu);
 }
 
 static void
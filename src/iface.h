@@ -115,12 +115,15 @@
     SLIST_HEAD(, ifaceroute) routes;
 #ifdef USE_IPFW
     struct acl 		*tables;		/* List of IP added to tables by iface */
+    u_int		acl_seq;		/* ACLs install sequence */
 #endif
     struct u_range	self_addr;		/* Interface's IP address */
     struct u_addr	peer_addr;		/* Peer's IP address */
     struct u_addr	proxy_addr;		/* Proxied IP address */
     struct u_addr	self_ipv6_addr;
     struct u_addr	peer_ipv6_addr;
+    u_int		ip_rtseq;		/* Route queue sequence for IP */
+    u_int		ipv6_rtseq;		/* Route queue sequence for IPv6 */
     struct pppTimer	idleTimer;		/* Idle timer */
     struct pppTimer	sessionTimer;		/* Session timer */
     char		up_script[IFACE_MAX_SCRIPT];
@@ -143,6 +146,11 @@
     u_char		nfout_up:1;		/* NFOUT is up */
     u_char		mss_up:1;		/* MSS is up */
     u_char		ipacct_up:1;		/* IPACCT is up */
+#ifdef USE_IPFW
+    u_char		acls_pending:1;		/* ACLs are being installed */
+    u_char		ip_script_wait:1;	/* IP "up" script waits for ACLs */
+    u_char		ipv6_script_wait:1;	/* IPv6 "up" script waits for ACLs */
+#endif
     
     struct dodcache	dodCache;		/* Dial-on-demand cache */
     
@@ -205,8 +213,6 @@
 #endif
   extern void	IfaceSetMTU(Bund b, int mtu);
   extern void	IfaceChangeFlags(Bund b, int clear, int set);
-  extern int	IfaceChangeAddr(Bund b, int add, struct u_range *self, struct u_addr *peer);
-  extern int	IfaceSetRoute(Bund b, int cmd, struct u_range *dst, struct u_addr *gw);
 
 #ifdef USE_NG_BPF
   extern void	IfaceGetStats(Bund b, struct svcstat *stat);
@@ -18,6 +18,7 @@
 #include "ccp.h"
 #include "ecp.h"
 #include "ngfunc.h"
+#include "capture.h"
 
 /*
  * INTERNAL FUNCTIONS
@@ -41,6 +42,8 @@ InputFrame(Bund b, Link l, int proto, Mbuf bp)
     Mbuf	protoRej;
     u_int16_t	nprot;
 
+    CapturePpp(l ? l->name : b->name, CAPT_IN, proto, bp);
+
     /* Check the link */
     if (l == NULL) {
 	/* Only limited link-layer stuff allowed over the MP bundle */
@@ -0,0 +1,626 @@
+
+/*
+ * ipfwbatch.c
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "ipfwbatch.h"
+#include "util.h"
+
+#ifdef USE_IPFW
+
+#include <sys/wait.h>
+#include <paths.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  /*
+   * ipfw(8) commands are not run one by one with the giant lock held.
+   * They are collected into batches and passed to a helper process,
+   * forked at startup while our process is still small. The helper
+   * feeds each batch to a single ipfw(8) reading commands from stdin.
+   * ipfw(8) stops at the first fatal error reporting the failed line
+   * number, so the helper reports that command as failed and restarts
+   * ipfw(8) from the next one. Results are reported back per command.
+   * Replies come in the order batches were sent, so the caller waiting
+   * for its batch is called back from the reply to its last part.
+   */
+
+  #define IPFWBATCH_UNKNOWN	(-1)	/* Command result is unknown */
+
+  /* Request and reply header */
+  struct ipfwbatch_msg {
+    u_int32_t	id;
+    u_int32_t	count;		/* Number of commands */
+    u_int32_t	len;		/* Length of the data following */
+    u_int32_t	runs;		/* Number of ipfw(8) runs (reply) */
+  };
+
+  struct ipfwbatch {
+    u_int32_t		id;
+    int			log;
+    char		label[LINK_MAX_NAME];
+    u_int		count;
+    size_t		len;
+    char		*cmds;		/* NUL separated commands */
+    u_int32_t		last;		/* Id of the last part sent */
+    IpfwBatchDoneFn	done;
+    void		*arg;
+    TAILQ_ENTRY(ipfwbatch) next;
+  };
+
+  struct ipfwbatch_stats {
+    u_int64_t	batches;
+    u_int64_t	cmds;
+    u_int64_t	runs;
+    u_int64_t	failed;
+    u_int64_t	unknown;
+    u_int64_t	direct;
+  };
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static void	IpfwBatchUnquote(char *s);
+  static void	IpfwBatchSend(IpfwBatch q);
+  static void	IpfwBatchDirect(IpfwBatch q);
+  static void	IpfwBatchEvent(int type, void *arg);
+  static int	IpfwBatchReply(void);
+  static void	IpfwBatchResult(IpfwBatch q, const int32_t *res, u_int count);
+  static void	IpfwBatchClose(void);
+  static int	IpfwBatchIO(int fd, void *buf, size_t len, int wr);
+  static void	IpfwBatchHelper(int s);
+  static int	IpfwBatchExec(char *const *cmds, u_int count, int *line);
+
+/*
+ * INTERNAL VARIABLES
+ */
+
+  static int			gIpfwSock = -1;
+  static pid_t			gIpfwPid = -1;
+  static EventRef		gIpfwEvent;
+  static u_int32_t		gIpfwId;
+  static TAILQ_HEAD(ipfwbatch_head, ipfwbatch) gIpfwPending = TAILQ_HEAD_INITIALIZER(gIpfwPending);
+  static u_int			gIpfwPendingLen;
+  static struct ipfwbatch_stats	gIpfwStats;
+
+/*
+ * IpfwBatchInit()
+ *
+ * Start the helper process. On failure ipfw(8) is run directly.
+ */
+
+void
+IpfwBatchInit(void)
+{
+    int		sv[2];
+    pid_t	pid;
+
+    if (socketpair(PF_LOCAL, SOCK_STREAM, 0, sv) < 0) {
+	Perror("IPFW: Can't create helper socket");
+	return;
+    }
+    (void)fcntl(sv[0], F_SETFD, 1);
+    (void)fcntl(sv[1], F_SETFD, 1);
+
+    switch ((pid = fork())) {
+	case -1:
+	    Perror("IPFW: Can't start helper");
+	    close(sv[0]);
+	    close(sv[1]);
+	    return;
+	case 0:
+	    /* We are terminated by closing the socket. */
+	    signal(SIGINT, SIG_IGN);
+	    signal(SIGTERM, SIG_IGN);
+	    signal(SIGHUP, SIG_IGN);
+	    signal(SIGUSR1, SIG_IGN);
+	    signal(SIGUSR2, SIG_IGN);
+	    signal(SIGPIPE, SIG_IGN);
+	    close(sv[0]);
+	    IpfwBatchHelper(sv[1]);
+	    _exit(0);
+	default:
+	    break;
+    }
+    close(sv[1]);
+    gIpfwSock = sv[0];
+    gIpfwPid = pid;
+    if (EventRegister(&gIpfwEvent, EVENT_READ, gIpfwSock,
+	    EVENT_RECURRING, IpfwBatchEvent, NULL) != 0) {
+	Log(LG_ERR, ("IPFW: Can't register helper event"));
+	IpfwBatchClose();
+	return;
+    }
+    Log(LG_ALWAYS, ("IPFW: helper process %d started", (int)pid));
+}
+
+/*
+ * IpfwBatchShutdown()
+ *
+ * Wait for the helper to complete everything sent to it.
+ */
+
+void
+IpfwBatchShutdown(void)
+{
+    if (gIpfwSock < 0)
+	return;
+    EventUnRegister(&gIpfwEvent);
+    shutdown(gIpfwSock, SHUT_WR);
+    while (IpfwBatchReply() == 0)
+	;
+    IpfwBatchClose();
+}
+
+/*
+ * IpfwBatchNew()
+ */
+
+IpfwBatch
+IpfwBatchNew(int log, const char *label)
+{
+    IpfwBatch	q;
+
+    q = Malloc(MB_IPFW, sizeof(*q));
+    q->log = log;
+    strlcpy(q->label, label, sizeof(q->label));
+    q->cmds = Malloc(MB_IPFW, IPFWBATCH_MAX_LEN);
+    return (q);
+}
+
+/*
+ * IpfwBatchAdd()
+ *
+ * Add ipfw(8) command, given without the program path, to the batch.
+ */
+
+void
+IpfwBatchAdd(IpfwBatch q, const char *fmt, ...)
+{
+    char	cmd[LINE_MAX];
+    size_t	len;
+    va_list	ap;
+
+    va_start(ap, fmt);
+    vsnprintf(cmd, sizeof(cmd), fmt, ap);
+    va_end(ap);
+
+    Log(q->log, ("[%s] ipfw: %s", q->label, cmd));
+    IpfwBatchUnquote(cmd);
+    len = strlen(cmd) + 1;
+    if (q->count >= IPFWBATCH_MAX_CMDS || q->len + len > IPFWBATCH_MAX_LEN)
+	IpfwBatchSend(q);
+    memcpy(q->cmds + q->len, cmd, len);
+    q->len += len;
+    q->count++;
+}
+
+/*
+ * IpfwBatchRun()
+ *
+ * Send the rest of batch to the helper and forget about it.
+ * Results are logged as they come, "done" is called from the event
+ * loop when all the commands are completed. It is called right away,
+ * if there is nothing to wait for.
+ */
+
+void
+IpfwBatchRun(IpfwBatch q, IpfwBatchDoneFn done, void *arg)
+{
+    IpfwBatch	p;
+
+    if (q->count > 0)
+	IpfwBatchSend(q);
+    if (done != NULL) {
+	if (q->last != 0 &&
+		(p = TAILQ_LAST(&gIpfwPending, ipfwbatch_head)) != NULL &&
+		p->id == q->last) {
+	    p->done = done;
+	    p->arg = arg;
+	} else
+	    (*done)(arg);
+    }
+    Freee(q->cmds);
+    Freee(q);
+}
+
+/*
+ * IpfwBatchStat()
+ */
+
+int
+IpfwBatchStat(Context ctx, int ac, const char *const av[], const void *arg)
+{
+    (void)ac;
+    (void)av;
+    (void)arg;
+
+    Printf("IPFW helper:\r\n");
+    if (gIpfwSock >= 0)
+	Printf("\tProcess        : %d\r\n", (int)gIpfwPid);
+    else
+	Printf("\tProcess        : none, running ipfw directly\r\n");
+    Printf("\tPending batches: %u\r\n", gIpfwPendingLen);
+    Printf("\tBatches        : %llu\r\n", (unsigned long long)gIpfwStats.batches);
+    Printf("\tCommands       : %llu\r\n", (unsigned long long)gIpfwStats.cmds);
+    Printf("\tIpfw runs      : %llu\r\n", (unsigned long long)gIpfwStats.runs);
+    Printf("\tFailed         : %llu\r\n", (unsigned long long)gIpfwStats.failed);
+    Printf("\tUnknown result : %llu\r\n", (unsigned long long)gIpfwStats.unknown);
+    Printf("\tRun directly   : %llu\r\n", (unsigned long long)gIpfwStats.direct);
+    return (0);
+}
+
+/*
+ * IpfwBatchUnquote()
+ *
+ * Commands used to be run by shell, so ACLs may have shell special
+ * characters escaped or quoted. Remove that, as shell would do.
+ */
+
+static void
+IpfwBatchUnquote(char *s)
+{
+    char	*d = s;
+    char	quote = 0;
+
+    for (; *s != 0; s++) {
+	if (quote != 0 && *s == quote) {
+	    quote = 0;
+	} else if (quote == 0 && (*s == '\'' || *s == '"')) {
+	    quote = *s;
+	} else if (*s == '\\' && quote != '\'' && s[1] != 0) {
+	    *d++ = *++s;
+	} else
+	    *d++ = *s;
+    }
+    *d = 0;
+}
+
+/*
+ * IpfwBatchSend()
+ *
+ * Send collected commands to the helper and clear the batch.
+ */
+
+static void
+IpfwBatchSend(IpfwBatch q)
+{
+    struct ipfwbatch_msg	m;
+    IpfwBatch			p;
+
+    if (gIpfwSock < 0) {
+	IpfwBatchDirect(q);
+	goto done;
+    }
+
+    m.id = ++gIpfwId;
+    m.count = q->count;
+    m.len = q->len;
+    m.runs = 0;
+    if (IpfwBatchIO(gIpfwSock, &m, sizeof(m), 1) != 0 ||
+	    IpfwBatchIO(gIpfwSock, q->cmds, q->len, 1) != 0) {
+	Perror("IPFW: Can't send commands to helper");
+	IpfwBatchClose();
+	IpfwBatchDirect(q);
+	goto done;
+    }
+    gIpfwStats.batches++;
+    gIpfwStats.cmds += q->count;
+
+    /* Remember commands to report the results. */
+    p = Malloc(MB_IPFW, sizeof(*p));
+    p->id = m.id;
+    p->log = q->log;
+    strlcpy(p->label, q->label, sizeof(p->label));
+    p->count = q->count;
+    p->len = q->len;
+    p->cmds = Mdup(MB_IPFW, q->cmds, q->len);
+    TAILQ_INSERT_TAIL(&gIpfwPending, p, next);
+    gIpfwPendingLen++;
+    q->last = m.id;
+
+done:
+    q->count = 0;
+    q->len = 0;
+}
+
+/*
+ * IpfwBatchDirect()
+ *
+ * Run commands one by one, when there is no helper.
+ */
+
+static void
+IpfwBatchDirect(IpfwBatch q)
+{
+    char	*cmd;
+    u_int	k;
+
+    for (k = 0, cmd = q->cmds; k < q->count; k++, cmd += strlen(cmd) + 1) {
+	ExecCmdNosh(q->log, q->label, "%s %s", PATH_IPFW, cmd);
+	gIpfwStats.direct++;
+    }
+}
+
+/*
+ * IpfwBatchEvent()
+ */
+
+static void
+IpfwBatchEvent(int type, void *arg)
+{
+    (void)type;
+    (void)arg;
+
+    if (IpfwBatchReply() != 0) {
+	Log(LG_ERR, ("IPFW: helper process exited, running ipfw directly"));
+	IpfwBatchClose();
+    }
+}
+
+/*
+ * IpfwBatchReply()
+ *
+ * Read and process one reply from the helper.
+ */
+
+static int
+IpfwBatchReply(void)
+{
+    struct ipfwbatch_msg	m;
+    int32_t			res[IPFWBATCH_MAX_CMDS];
+    IpfwBatch			q;
+
+    if (IpfwBatchIO(gIpfwSock, &m, sizeof(m), 0) != 0)
+	return (-1);
+    if (m.count > IPFWBATCH_MAX_CMDS || m.len != m.count * sizeof(res[0]) ||
+	    IpfwBatchIO(gIpfwSock, res, m.len, 0) != 0)
+	return (-1);
+
+    /* Replies come in the same order. */
+    if ((q = TAILQ_FIRST(&gIpfwPending)) == NULL || q->id != m.id) {
+	Log(LG_ERR, ("IPFW: unexpected reply %u from helper", m.id));
+	return (-1);
+    }
+    TAILQ_REMOVE(&gIpfwPending, q, next);
+    gIpfwPendingLen--;
+    gIpfwStats.runs += m.runs;
+    IpfwBatchResult(q, res, m.count);
+    return (0);
+}
+
+/*
+ * IpfwBatchResult()
+ *
+ * Log failed commands, tell the caller and free the batch.
+ */
+
+static void
+IpfwBatchResult(IpfwBatch q, const int32_t *res, u_int count)
+{
+    char	*cmd;
+    u_int	k;
+
+    for (k = 0, cmd = q->cmds; k < q->count; k++, cmd += strlen(cmd) + 1) {
+	if (k >= count || res[k] == IPFWBATCH_UNKNOWN) {
+	    gIpfwStats.unknown++;
+	    Log(q->log|LG_ERR, ("[%s] ipfw: command \"%s\" result unknown",
+		q->label, cmd));
+	} else if (res[k] != 0) {
+	    gIpfwStats.failed++;
+	    Log(q->log|LG_ERR, ("[%s] ipfw: command \"%s\" returned %d",
+		q->label, cmd, res[k]));
+	}
+    }
+    if (q->done != NULL)
+	(*q->done)(q->arg);
+    Freee(q->cmds);
+    Freee(q);
+}
+
+/*
+ * IpfwBatchClose()
+ *
+ * Forget about the helper.
+ */
+
+static void
+IpfwBatchClose(void)
+{
+    IpfwBatch	q;
+
+    EventUnRegister(&gIpfwEvent);
+    close(gIpfwSock);
+    gIpfwSock = -1;
+    (void)waitpid(gIpfwPid, NULL, 0);
+    gIpfwPid = -1;
+    while ((q = TAILQ_FIRST(&gIpfwPending)) != NULL) {
+	TAILQ_REMOVE(&gIpfwPending, q, next);
+	IpfwBatchResult(q, NULL, 0);
+    }
+    gIpfwPendingLen = 0;
+}
+
+/*
+ * IpfwBatchIO()
+ *
+ * Read or write exactly len bytes.
+ */
+
+static int
+IpfwBatchIO(int fd, void *buf, size_t len, int wr)
+{
+    char	*p = buf;
+    ssize_t	n;
+
+    while (len > 0) {
+	n = wr ? write(fd, p, len) : read(fd, p, len);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    return (-1);
+	p += n;
+	len -= n;
+    }
+    return (0);
+}
+
+/*
+ * IpfwBatchHelper()
+ *
+ * Helper process main loop. It may be forked from a threaded process,
+ * so only system calls and static buffers are used here.
+ */
+
+static void
+IpfwBatchHelper(int s)
+{
+    static char			buf[IPFWBATCH_MAX_LEN];
+    static char			*cmds[IPFWBATCH_MAX_CMDS];
+    static int32_t		res[IPFWBATCH_MAX_CMDS];
+    struct ipfwbatch_msg	m;
+    u_int			k, start;
+    char			*cmd;
+    int				status, line;
+
+    for (;;) {
+	if (IpfwBatchIO(s, &m, sizeof(m), 0) != 0)
+	    return;
+	if (m.count > IPFWBATCH_MAX_CMDS || m.len > sizeof(buf) ||
+		IpfwBatchIO(s, buf, m.len, 0) != 0)
+	    return;
+	for (k = 0, cmd = buf; k < m.count; k++) {
+	    cmds[k] = cmd;
+	    res[k] = IPFWBATCH_UNKNOWN;
+	    cmd += strnlen(cmd, buf + m.len - cmd) + 1;
+	    if (cmd > buf + m.len)
+		return;
+	}
+
+	start = 0;
+	m.runs = 0;
+	while (start < m.count) {
+	    m.runs++;
+	    status = IpfwBatchExec(cmds + start, m.count - start, &line);
+	    if (status == 0) {
+		for (k = start; k < m.count; k++)
+		    res[k] = 0;
+		break;
+	    }
+	    /* We do not know where it stopped, leave the rest unknown. */
+	    if (line < 1 || (u_int)line > m.count - start)
+		break;
+	    for (k = start; k < start + line - 1; k++)
+		res[k] = 0;
+	    res[k] = status;
+	    start = k + 1;
+	}
+
+	m.len = m.count * sizeof(res[0]);
+	if (IpfwBatchIO(s, &m, sizeof(m), 1) != 0 ||
+		IpfwBatchIO(s, res, m.len, 1) != 0)
+	    return;
+    }
+}
+
+/*
+ * IpfwBatchExec()
+ *
+ * Run ipfw(8) over the commands. Returns its exit status and number
+ * of the failed line, if ipfw(8) reported one.
+ */
+
+static int
+IpfwBatchExec(char *const *cmds, u_int count, int *line)
+{
+    static char	err[4096];
+    int		in[2], out[2];
+    size_t	elen = 0;
+    ssize_t	n;
+    pid_t	pid;
+    int		status;
+    char	*p;
+    u_int	k;
+
+    *line = 0;
+    if (pipe(in) < 0)
+	return (IPFWBATCH_UNKNOWN);
+    if (pipe(out) < 0) {
+	close(in[0]);
+	close(in[1]);
+	return (IPFWBATCH_UNKNOWN);
+    }
+    switch ((pid = fork())) {
+	case -1:
+	    close(in[0]);
+	    close(in[1]);
+	    close(out[0]);
+	    close(out[1]);
+	    return (IPFWBATCH_UNKNOWN);
+	case 0:
+	    dup2(in[0], 0);
+	    dup2(out[1], 2);
+	    close(1);
+	    open(_PATH_DEVNULL, O_WRONLY);
+	    close(in[0]);
+	    close(in[1]);
+	    close(out[0]);
+	    close(out[1]);
+	    execl(PATH_IPFW, PATH_IPFW, "/dev/stdin", (char *)NULL);
+	    _exit(127);
+	default:
+	    break;
+    }
+    close(in[0]);
+    close(out[1]);
+
+    /* Commands are short, they fit into the pipe buffer. */
+    for (k = 0; k < count; k++) {
+	if (IpfwBatchIO(in[1], cmds[k], strlen(cmds[k]), 1) != 0 ||
+		IpfwBatchIO(in[1], "\n", 1, 1) != 0)
+	    break;
+    }
+    close(in[1]);
+
+    while ((n = read(out[0], err + elen, sizeof(err) - 1 - elen)) != 0) {
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+	elen += n;
+	if (elen == sizeof(err) - 1) {
+	    char	junk[512];
+
+	    /* Only the beginning is interesting. */
+	    while ((n = read(out[0], junk, sizeof(junk))) > 0 ||
+		    (n < 0 && errno == EINTR))
+		;
+	    break;
+	}
+    }
+    err[elen] = 0;
+    close(out[0]);
+
+    while (waitpid(pid, &status, 0) < 0) {
+	if (errno != EINTR)
+	    return (IPFWBATCH_UNKNOWN);
+    }
+    if (WIFEXITED(status))
+	status = WEXITSTATUS(status);
+    else
+	status = 128 + WTERMSIG(status);
+
+    /* ipfw(8) names itself "Line N" while processing the line N. */
+    if (status != 0 && (p = strstr(err, "Line ")) != NULL)
+	*line = strtol(p + 5, NULL, 10);
+    return (status);
+}
+
+#endif /* USE_IPFW */
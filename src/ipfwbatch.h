@@ -0,0 +1,40 @@
+
+/*
+ * ipfwbatch.h
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#ifndef _IPFWBATCH_H_
+#define _IPFWBATCH_H_
+
+#ifdef USE_IPFW
+
+/*
+ * DEFINITIONS
+ */
+
+  #define IPFWBATCH_MAX_LEN	16384	/* Max size of commands in one batch */
+  #define IPFWBATCH_MAX_CMDS	256	/* Max number of commands in one batch */
+
+  struct ipfwbatch;
+  typedef struct ipfwbatch	*IpfwBatch;
+
+  typedef void	(*IpfwBatchDoneFn)(void *arg);
+
+/*
+ * FUNCTIONS
+ */
+
+  extern void		IpfwBatchInit(void);
+  extern void		IpfwBatchShutdown(void);
+  extern IpfwBatch	IpfwBatchNew(int log, const char *label);
+  extern void		IpfwBatchAdd(IpfwBatch q, const char *fmt, ...)
+			  __printflike(2, 3);
+  extern void		IpfwBatchRun(IpfwBatch q, IpfwBatchDoneFn done,
+			  void *arg);
+  extern int		IpfwBatchStat(Context ctx, int ac, const char *const av[], const void *arg);
+
+#endif /* USE_IPFW */
+
+#endif
@@ -189,6 +189,40 @@ IPPoolStat(Context ctx, int ac, const char *const av[], const void *arg)
     return(0);
 }
 
+/*
+ * IPPoolUsage()
+ *
+ * Get usage of the n-th pool. Returns -1 if there is no such pool.
+ */
+
+int
+IPPoolUsage(int n, char *name, size_t len, int *used, int *total)
+{
+    IPPool 	p;
+    int		i;
+
+    MUTEX_LOCK(gIPPoolMutex);
+    SLIST_FOREACH(p, &gIPPools, next) {
+	if (n-- == 0)
+	    break;
+    }
+    if (p == NULL) {
+	MUTEX_UNLOCK(gIPPoolMutex);
+	return (-1);
+    }
+    strlcpy(name, p->name, len);
+    *used = *total = 0;
+    for (i = 0; i < p->size; i++) {
+	if (p->pool[i].ip.s_addr) {
+	    (*total)++;
+	    if (p->pool[i].used)
+		(*used)++;
+	}
+    }
+    MUTEX_UNLOCK(gIPPoolMutex);
+    return (0);
+}
+
 /*
  * IPPoolSetCommand()
  */
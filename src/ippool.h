@@ -29,6 +29,7 @@
 
   extern int	IPPoolGet(char *pool, struct u_addr *ip);
   extern void	IPPoolFree(char *pool, struct u_addr *ip);
+  extern int	IPPoolUsage(int n, char *name, size_t len, int *used, int *total);
   
   extern void	IPPoolInit(void);
   extern int	IPPoolStat(Context ctx, int ac, const char *const av[], const void *arg);
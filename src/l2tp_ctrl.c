@@ -48,6 +48,8 @@
 #include "l2tp_avp.h"
 #include "l2tp_ctrl.h"
 #include "ngfunc.h"
+#include "capture.h"
+#include "trace.h"
 
 #ifndef __FreeBSD__
 #define __printflike(x,y)
@@ -1267,6 +1269,7 @@ ppp_l2tp_ctrl_send(struct ppp_l2tp_ctrl *ctrl, u_int16_t session_id,
 		ppp_l2tp_ctrl_dump(ctrl, avps, "L2TP: XMIT(0x%04x) ",
 		    ntohs(session_id));
 	}
+	CaptureL2tp(ctrl->path, ctrl->config.peer_id, data, 2 + len);
 	if (NgSendData(ctrl->dsock, NG_L2TP_HOOK_CTRL, data, 2 + len) == -1)
 		goto fail;
 
@@ -1377,6 +1380,8 @@ ppp_l2tp_ctrl_do_close(void *arg)
 	struct ppp_l2tp_sess *sess;
 	struct ghash_walk walk;
 
+	TraceNone();
+
 	/* Remove event */
 	pevent_unregister(&ctrl->close_timer);
 
@@ -1451,6 +1456,8 @@ ppp_l2tp_idle_timeout(void *arg)
 {
 	struct ppp_l2tp_ctrl *const ctrl = arg;
 
+	TraceNone();
+
 	/* Remove event */
 	pevent_unregister(&ctrl->idle_timer);
 
@@ -1472,6 +1479,8 @@ ppp_l2tp_unused_timeout(void *arg)
 {
 	struct ppp_l2tp_ctrl *const ctrl = arg;
 
+	TraceNone();
+
 	assert(ctrl->active_sessions == 0);
 	assert(ctrl->state != CS_DYING);
 
@@ -1487,6 +1496,8 @@ ppp_l2tp_ctrl_death_timeout(void *arg)
 {
 	struct ppp_l2tp_ctrl *ctrl = arg;
 
+	TraceNone();
+
 	pevent_unregister(&ctrl->death_timer);
 	if (*ctrl->cb->ctrl_destroyed != NULL)
 	    (*ctrl->cb->ctrl_destroyed)(ctrl);
@@ -1673,6 +1684,8 @@ ppp_l2tp_sess_do_close(void *arg)
 	struct ppp_l2tp_sess *const sess = arg;
 	struct ppp_l2tp_ctrl *const ctrl = sess->ctrl;
 
+	TraceNone();
+
 	/* Remove event */
 	pevent_unregister(&sess->close_timer);
 
@@ -1714,6 +1727,8 @@ ppp_l2tp_sess_notify(void *arg)
 	struct ppp_l2tp_sess *const sess = arg;
 	struct ppp_l2tp_ctrl *const ctrl = sess->ctrl;
 
+	TraceNone();
+
 	pevent_unregister(&sess->notify_timer);
 	(*ctrl->cb->connected)(sess, sess->peer_avps);
 }
@@ -1726,6 +1741,8 @@ ppp_l2tp_sess_death_timeout(void *arg)
 {
 	struct ppp_l2tp_sess *sess = arg;
 
+	TraceNone();
+
 	pevent_unregister(&sess->death_timer);
 	ppp_l2tp_sess_destroy(&sess);
 }
@@ -1753,6 +1770,8 @@ ppp_l2tp_data_event(void *arg)
 	int len;
 	unsigned i, j;
 
+	TraceNone();
+
 	/* Restart idle timer */
 	pevent_unregister(&ctrl->idle_timer);
 	if (pevent_register(ctrl->ctx, &ctrl->idle_timer, 0,
@@ -1767,6 +1786,7 @@ ppp_l2tp_data_event(void *arg)
 		Perror("L2TP: error reading ctrl hook");
 		goto fail_errno;
 	}
+	CaptureL2tp(ctrl->path, ctrl->config.tunnel_id, buf, len);
 
 	/* Extract session ID */
 	memcpy(&key.config.session_id, buf, 2);
@@ -1992,6 +2012,8 @@ ppp_l2tp_ctrl_event(void *arg)
 	struct ng_mesg *const msg = &buf.msg;
 	char raddr[NG_PATHSIZ];
 
+	TraceNone();
+
 	/* Read netgraph control message */
 	if (NgRecvMsg(ctrl->csock, msg, sizeof(buf), raddr) < 0) {
 		Perror("L2TP: error reading control message");
@@ -2368,6 +2390,8 @@ ppp_l2tp_ctrl_reply_timeout(void *arg)
 {
 	struct ppp_l2tp_ctrl *const ctrl = arg;
 
+	TraceNone();
+
 	pevent_unregister(&ctrl->reply_timer);
 	Log(LOG_NOTICE, ("L2TP: reply timeout in state %s",
 	    ppp_l2tp_ctrl_state_str(ctrl->state)));
@@ -2381,6 +2405,8 @@ ppp_l2tp_sess_reply_timeout(void *arg)
 	struct ppp_l2tp_sess *const sess = arg;
 	struct ppp_l2tp_ctrl *const ctrl = sess->ctrl;
 
+	TraceNone();
+
 	pevent_unregister(&sess->reply_timer);
 	Log(LOG_NOTICE, ("L2TP: reply timeout in state %s",
 	    ppp_l2tp_sess_state_str(sess->state)));
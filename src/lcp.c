@@ -464,6 +464,7 @@ LcpNewPhase(Link l, enum lcp_phase new)
       break;
 
     case PHASE_AUTHENTICATE:
+      LinkSetupMark(l, LINK_SETUP_LCP_UP, 0);
       if (!PhysIsSync(l))
         PhysSetAccm(l, lcp->peer_accmap, lcp->want_accmap);
       AuthStart(l);
@@ -15,12 +15,17 @@
 #include "command.h"
 #include "input.h"
 #include "ngfunc.h"
+#include "sessevent.h"
+#include "sesssnap.h"
+#include "metrics.h"
+#include "trace.h"
 #include "util.h"
 
 #include <netgraph.h>
 #include <netgraph/ng_message.h>
 #include <netgraph/ng_socket.h>
 #include <netgraph/ng_tee.h>
+#include <time.h>
 
 /*
  * DEFINITIONS
@@ -54,6 +59,59 @@
 
   #define RBUF_SIZE		100
 
+  /* Time between setup milestones, ms */
+  #define LINK_SETUP_MS(t, from, to)	((int)(((t)[to] - (t)[from]) / 1000))
+
+  #define LINK_GONE_MAX		4096	/* Removed links remembered */
+
+  /* recvmmsg(2) appeared in FreeBSD 11.0 */
+#if defined(__FreeBSD__) && __FreeBSD_version >= 1100000
+  #define HAVE_RECVMMSG
+  #define LINK_RX_BATCH		32	/* Frames per receive call */
+#else
+  #define LINK_RX_BATCH		1
+#endif
+  #define LINK_RX_BUFSIZE	4096	/* Max frame size */
+  #define LINK_RX_BUDGET_MIN	32	/* Frames per data socket event */
+  #define LINK_RX_BUDGET_MAX	1024
+  #define LINK_RX_LATENCY	2000	/* Target event processing time, us */
+  #define LINK_RX_BUCKETS	6	/* Batch size histogram: 1 .. 32 */
+
+  /* Received frame in the ring */
+  struct linkrx {
+    struct sockaddr_ng	naddr;		/* Source hook */
+    u_char		*buf;
+    size_t		len;
+    int			trunc;		/* Did not fit into the buffer */
+  };
+
+  /* Data socket hook types */
+  enum {
+    LINK_RX_HOOK_LINK,
+    LINK_RX_HOOK_BYPASS,
+    LINK_RX_HOOK_MSSIN,
+    LINK_RX_HOOK_MSSOUT,
+    LINK_RX_HOOK_IPV4,
+    LINK_RX_HOOK_IPV6,
+    LINK_RX_HOOK_UNKNOWN,
+    LINK_RX_HOOKS
+  };
+
+  /* Removed link */
+  struct linkgone {
+    char	name[LINK_MAX_NAME];
+    u_int64_t	gen;
+  };
+
+  struct linkrxstat {
+    u_int64_t	frames;
+    u_int64_t	octets;
+    u_int64_t	truncated;
+    u_int64_t	unknown;		/* Unknown hook, link or bundle */
+    u_int64_t	dead;			/* Dead link or bundle */
+    u_int64_t	stale;			/* Hook of the previous user of index */
+  };
+
 /*
  * INTERNAL FUNCTIONS
  */
@@ -61,7 +119,13 @@
   static int	LinkSetCommand(Context ctx, int ac, const char *const av[], const void *arg);
   static void	LinkMsg(int type, void *cookie);
   static void	LinkNgDataEvent(int type, void *cookie);
+  static int	LinkNgRecv(void);
+  static void	LinkNgDataFrame(struct linkrx *rx);
+  static Mbuf	LinkNgFrameMbuf(const u_char *buf, size_t len);
+  static int	LinkRxHook(int type);
+  static int	LinkRxBucket(int n);
   static void	LinkReopenTimeout(void *arg);
+  static void	LinkGone(Link l);
 
 /*
  * GLOBAL VARIABLES
@@ -121,6 +185,18 @@
     { NULL, NULL, NULL, NULL, 0, NULL },
   };
 
+  const char	*gLinkPhaseNames[LINK_PHASE_NUM] = {
+    "signalling",
+    "lcp",
+    "auth_queue",
+    "auth_backend",
+    "ncp",
+    "iface",
+    "acls",
+    "scripts",
+    "total",
+  };
+
 /*
  * INTERNAL VARIABLES
  */
@@ -153,6 +229,30 @@
     int		gLinksDsock = -1;		/* Socket node data socket */
     static EventRef gLinksDataEvent;
 
+  /*
+   * Every change of a session state gets the next generation number
+   * and moves the link to the end of the changed list, so changes
+   * since any generation are found walking from the end. Removed
+   * links are remembered in a ring, if an entry newer than the asked
+   * generation was overwritten, the caller must read everything again.
+   */
+  u_int64_t			gLinkGen;
+  static TAILQ_HEAD(linkchanged, linkst) gLinkChangedList =
+				    TAILQ_HEAD_INITIALIZER(gLinkChangedList);
+  static struct linkgone	gLinkGoneRing[LINK_GONE_MAX];
+  static int			gLinkGoneNext;
+  static u_int64_t		gLinkGoneLost;	/* Newest overwritten */
+
+  /* Receive ring and statistics */
+  static u_char			gLinkRxBuf[LINK_RX_BATCH][LINK_RX_BUFSIZE];
+  static struct linkrx		gLinkRx[LINK_RX_BATCH];
+  static int			gLinkRxBudget = LINK_RX_BUDGET_MIN;
+  static struct linkrxstat	gLinkRxStats[LINK_RX_HOOKS];
+  static u_int64_t		gLinkRxBatches[LINK_RX_BUCKETS];
+  static const char		*gLinkRxHookNames[LINK_RX_HOOKS] = {
+    "link", "bypass", "mss-in", "mss-out", "ipv4", "ipv6", "unknown"
+  };
+
 int
 LinksInit(void)
 {
@@ -234,6 +334,77 @@ LinkClose(Link l)
     MsgSend(&l->msgs, MSG_CLOSE, l);
 }
 
+/*
+ * LinkSetupMark()
+ *
+ * Remember when the session reached a milestone, "when" is EventNow()
+ * or 0 for now. Only the first time counts and only after the start,
+ * which is set when the device gets a call or starts dialing. Phases
+ * completed by the milestone are added to metrics.
+ */
+
+void
+LinkSetupMark(Link l, int m, u_int64_t when)
+{
+    int		before[LINK_PHASE_NUM], after[LINK_PHASE_NUM];
+    int		k;
+
+    if (l->setup[m] != 0 ||
+	    (m != LINK_SETUP_START && l->setup[LINK_SETUP_START] == 0))
+	return;
+    LinkSetupPhases(l, before);
+    l->setup[m] = when ? when : EventNow();
+    LinkSetupPhases(l, after);
+    LinkChanged(l);
+    for (k = 0; k < LINK_PHASE_NUM; k++) {
+	if (before[k] < 0 && after[k] >= 0)
+	    MetricsSetup(k, after[k]);
+    }
+}
+
+/*
+ * LinkSetupPhases()
+ *
+ * Get duration of setup phases in ms, -1 if not complete.
+ */
+
+void
+LinkSetupPhases(Link l, int *ms)
+{
+    const u_int64_t	*const t = l->setup;
+    int			k, ncp_from, scripts_from;
+
+    for (k = 0; k < LINK_PHASE_NUM; k++)
+	ms[k] = -1;
+    if (t[LINK_SETUP_START] == 0)
+	return;
+    if (t[LINK_SETUP_PHYS_UP])
+	ms[LINK_PHASE_SIGNAL] = LINK_SETUP_MS(t, LINK_SETUP_START, LINK_SETUP_PHYS_UP);
+    if (t[LINK_SETUP_PHYS_UP] && t[LINK_SETUP_LCP_UP])
+	ms[LINK_PHASE_LCP] = LINK_SETUP_MS(t, LINK_SETUP_PHYS_UP, LINK_SETUP_LCP_UP);
+    if (t[LINK_SETUP_AUTH_START] && t[LINK_SETUP_AUTH_RUN] &&
+	    t[LINK_SETUP_AUTH_DONE] && t[LINK_SETUP_AUTH_END]) {
+	ms[LINK_PHASE_AUTH_QUEUE] =
+	    LINK_SETUP_MS(t, LINK_SETUP_AUTH_START, LINK_SETUP_AUTH_RUN) +
+	    LINK_SETUP_MS(t, LINK_SETUP_AUTH_DONE, LINK_SETUP_AUTH_END);
+	ms[LINK_PHASE_AUTH] = LINK_SETUP_MS(t, LINK_SETUP_AUTH_RUN, LINK_SETUP_AUTH_DONE);
+    }
+    ncp_from = t[LINK_SETUP_AUTH_END] ? LINK_SETUP_AUTH_END : LINK_SETUP_LCP_UP;
+    if (t[ncp_from] && t[LINK_SETUP_NCP_UP])
+	ms[LINK_PHASE_NCP] = LINK_SETUP_MS(t, ncp_from, LINK_SETUP_NCP_UP);
+    if (t[LINK_SETUP_NCP_UP] && t[LINK_SETUP_IFACE_UP])
+	ms[LINK_PHASE_IFACE] = LINK_SETUP_MS(t, LINK_SETUP_NCP_UP, LINK_SETUP_IFACE_UP);
+    if (t[LINK_SETUP_NCP_UP] && t[LINK_SETUP_ACLS])
+	ms[LINK_PHASE_ACLS] = LINK_SETUP_MS(t, LINK_SETUP_NCP_UP, LINK_SETUP_ACLS);
+    /* Up script waits for both */
+    scripts_from = t[LINK_SETUP_ACLS] > t[LINK_SETUP_IFACE_UP] ?
+	LINK_SETUP_ACLS : LINK_SETUP_IFACE_UP;
+    if (t[LINK_SETUP_IFACE_UP] && t[LINK_SETUP_READY]) {
+	ms[LINK_PHASE_SCRIPTS] = LINK_SETUP_MS(t, scripts_from, LINK_SETUP_READY);
+	ms[LINK_PHASE_TOTAL] = LINK_SETUP_MS(t, LINK_SETUP_START, LINK_SETUP_READY);
+    }
+}
+
 /*
  * LinkUp()
  */
@@ -243,6 +414,8 @@ LinkUp(Link l)
 {
     Log(LG_LINK, ("[%s] Link: UP event", l->name));
 
+    LinkChanged(l);
+    SessEventPost(SESSEV_LINK_UP, l, NULL, NULL);
     l->originate = PhysGetOriginate(l);
     Log(LG_PHYS2, ("[%s] Link: origination is %s",
 	l->name, LINK_ORIGINATION(l->originate)));
@@ -258,6 +431,9 @@ LinkDown(Link l)
 {
     Log(LG_LINK, ("[%s] Link: DOWN event", l->name));
 
+    LinkChanged(l);
+    SessEventPost(SESSEV_LINK_DOWN, l, NULL, "%s",
+	(l->downReasonValid && l->downReason) ? l->downReason : "");
     if (OPEN_STATE(l->lcp.fsm.state)) {
 	if (((l->conf.max_redial != 0) && (l->num_redial >= l->conf.max_redial)) ||
 	    gShutdownInProgress) {
@@ -325,6 +501,7 @@ LinkMsg(int type, void *arg)
 	UNREF(l);
 	return;
     }
+    TraceLink(l);
     Log(LG_LINK, ("[%s] Link: %s event", l->name, MsgName(type)));
     switch (type) {
 	case MSG_OPEN:
@@ -474,8 +651,10 @@ LinkCreate(Context ctx, int ac, const char *const av[], const void *arg)
     	    LengthenArray(&gLinks, sizeof(*gLinks), &gNumLinks, MB_LINK);
 	    
 	l->id = k;
+	l->hookgen = NgFuncHookGen();
 	gLinks[k] = l;
 	REF(l);
+	LinkChanged(l);
     }
 
     RESETREF(ctx->lnk, l);
@@ -566,6 +745,7 @@ LinkInst(Link lt, const char *name, int tmpl, int stay)
 	LengthenArray(&gLinks, sizeof(*gLinks), &gNumLinks, MB_LINK);
 
     l->id = k;
+    l->hookgen = NgFuncHookGen();
 
     if (name)
 	strlcpy(l->name, name, sizeof(l->name));
@@ -576,6 +756,8 @@ LinkInst(Link lt, const char *name, int tmpl, int stay)
 
     PhysInst(l, lt);
     LcpInst(l, lt);
+    l->genListed = 0;
+    LinkChanged(l);
 
     return (l);
 }
@@ -609,6 +791,7 @@ LinkShutdown(Link l)
 	l->bund = NULL;
     }
     gLinks[l->id] = NULL;
+    LinkGone(l);
     /* Our parent lost one children */
     if (l->parent >= 0) {
 	gChildren--;
@@ -643,6 +826,75 @@ LinkShutdown(Link l)
     CheckOneShot();
 }
 
+/*
+ * LinkChanged()
+ *
+ * Note that session state has changed.
+ */
+
+void
+LinkChanged(Link l)
+{
+    if (l->tmpl || l->dead)
+	return;
+    l->gen = ++gLinkGen;
+    if (l->genListed)
+	TAILQ_REMOVE(&gLinkChangedList, l, genList);
+    TAILQ_INSERT_TAIL(&gLinkChangedList, l, genList);
+    l->genListed = 1;
+    SessSnapChanged();
+}
+
+/*
+ * LinkGone()
+ */
+
+static void
+LinkGone(Link l)
+{
+    struct linkgone	*const g = &gLinkGoneRing[gLinkGoneNext];
+
+    SessSnapChanged();
+    if (!l->genListed)
+	return;
+    TAILQ_REMOVE(&gLinkChangedList, l, genList);
+    l->genListed = 0;
+    if (g->gen != 0)
+	gLinkGoneLost = g->gen;
+    strlcpy(g->name, l->name, sizeof(g->name));
+    g->gen = ++gLinkGen;
+    gLinkGoneNext = (gLinkGoneNext + 1) % LINK_GONE_MAX;
+}
+
+/*
+ * LinkChangesSince()
+ *
+ * Call "fn" for links changed and removed after generation "gen",
+ * newest first. Returns -1 if some removals were already forgotten.
+ */
+
+int
+LinkChangesSince(u_int64_t gen, LinkChangeFn fn, void *arg)
+{
+    Link	l;
+    int		k, i;
+
+    if (gen < gLinkGoneLost)
+	return (-1);
+    TAILQ_FOREACH_REVERSE(l, &gLinkChangedList, linkchanged, genList) {
+	if (l->gen <= gen)
+	    break;
+	(*fn)(l, NULL, l->gen, arg);
+    }
+    for (k = 1; k <= LINK_GONE_MAX; k++) {
+	i = (gLinkGoneNext - k + LINK_GONE_MAX) % LINK_GONE_MAX;
+	if (gLinkGoneRing[i].gen <= gen)
+	    break;
+	(*fn)(NULL, gLinkGoneRing[i].name, gLinkGoneRing[i].gen, arg);
+    }
+    return (0);
+}
+
 /*
  * LinkNgInit()
  *
@@ -663,7 +915,8 @@ LinkNgInit(Link l)
 
     /* Create TEE node */
     strcpy(mp.type, NG_TEE_NODE_TYPE);
-    snprintf(mp.ourhook, sizeof(mp.ourhook), "l%d", l->id);
+    NgFuncHookToken(mp.ourhook, sizeof(mp.ourhook), MPD_HOOK_LINK,
+	l->id, l->hookgen);
     strcpy(mp.peerhook, NG_TEE_HOOK_LEFT2RIGHT);
     if (NgSendMsg(gLinksCsock, ".:",
       NGM_GENERIC_COOKIE, NGM_MKPEER, &mp, sizeof(mp)) < 0) {
@@ -808,184 +1061,392 @@ LinkNgShutdown(Link l)
 
 /*
  * LinkNgDataEvent()
+ *
+ * Read available frames in batches, up to the budget. The budget grows
+ * while the socket keeps us busy for short time and shrinks when
+ * processing delays the other events too much.
  */
 
 static void
 LinkNgDataEvent(int type, void *cookie)
+{
+    struct timespec	t0, t1;
+    int			k, n, num = 0;
+    long		us;
+
+    (void)cookie;
+    (void)type;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while (num < gLinkRxBudget) {
+	if ((n = LinkNgRecv()) <= 0)
+	    break;
+	gLinkRxBatches[LinkRxBucket(n)]++;
+	for (k = 0; k < n; k++)
+	    LinkNgDataFrame(&gLinkRx[k]);
+	num += n;
+    }
+
+    /* Adjust the budget */
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    us = (t1.tv_sec - t0.tv_sec) * 1000000 + (t1.tv_nsec - t0.tv_nsec) / 1000;
+    if (us > LINK_RX_LATENCY) {
+	if (gLinkRxBudget > LINK_RX_BUDGET_MIN)
+	    gLinkRxBudget /= 2;
+    } else if (num >= gLinkRxBudget && us < LINK_RX_LATENCY / 2) {
+	/* Socket still has data and we were fast */
+	if (gLinkRxBudget < LINK_RX_BUDGET_MAX)
+	    gLinkRxBudget *= 2;
+    }
+}
+
+/*
+ * LinkNgRecv()
+ *
+ * Receive a batch of frames into the ring buffers.
+ * Returns number of frames, 0 if there is nothing to read, -1 on error.
+ */
+
+static int
+LinkNgRecv(void)
+{
+    struct linkrx	*rx;
+#ifdef HAVE_RECVMMSG
+    static struct mmsghdr	msgs[LINK_RX_BATCH];
+    static struct iovec		iov[LINK_RX_BATCH];
+    int				k, n;
+
+    for (k = 0; k < LINK_RX_BATCH; k++) {
+	iov[k].iov_base = gLinkRxBuf[k];
+	iov[k].iov_len = sizeof(gLinkRxBuf[k]);
+	memset(&msgs[k], 0, sizeof(msgs[k]));
+	msgs[k].msg_hdr.msg_name = &gLinkRx[k].naddr;
+	msgs[k].msg_hdr.msg_namelen = sizeof(gLinkRx[k].naddr);
+	msgs[k].msg_hdr.msg_iov = &iov[k];
+	msgs[k].msg_hdr.msg_iovlen = 1;
+    }
+    if ((n = recvmmsg(gLinksDsock, msgs, LINK_RX_BATCH, MSG_DONTWAIT, NULL)) < 0) {
+	if (errno != EAGAIN)
+	    Perror("Link: Link socket read error");
+	return (errno == EAGAIN ? 0 : -1);
+    }
+    for (k = 0; k < n; k++) {
+	rx = &gLinkRx[k];
+	rx->buf = gLinkRxBuf[k];
+	rx->len = msgs[k].msg_len;
+	rx->trunc = (msgs[k].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+	rx->naddr.sg_data[sizeof(rx->naddr.sg_data) - 1] = 0;
+    }
+    return (n);
+#else
+    struct msghdr	msg;
+    struct iovec	iov;
+    ssize_t		len;
+
+    rx = &gLinkRx[0];
+    iov.iov_base = gLinkRxBuf[0];
+    iov.iov_len = sizeof(gLinkRxBuf[0]);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &rx->naddr;
+    msg.msg_namelen = sizeof(rx->naddr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if ((len = recvmsg(gLinksDsock, &msg, MSG_DONTWAIT)) < 0) {
+	if (errno != EAGAIN)
+	    Perror("Link: Link socket read error");
+	return (errno == EAGAIN ? 0 : -1);
+    }
+    rx->buf = gLinkRxBuf[0];
+    rx->len = len;
+    rx->trunc = (msg.msg_flags & MSG_TRUNC) != 0;
+    rx->naddr.sg_data[sizeof(rx->naddr.sg_data) - 1] = 0;
+    return (1);
+#endif
+}
+
+/*
+ * LinkNgDataFrame()
+ *
+ * Dispatch one received frame. Frames are copied from the ring
+ * into right-sized mbufs only when they are passed further.
+ */
+
+static void
+LinkNgDataFrame(struct linkrx *rx)
 {
     Link		l;
     Bund		b;
-    u_char		*buf;
+    const u_char	*buf = rx->buf;
     u_int16_t		proto;
     unsigned		ptr;
     Mbuf		bp;
-    struct sockaddr_ng	naddr;
-    socklen_t		nsize;
-    char		*name, *rest;
-    int			id, num = 0;
-
-    (void)cookie;
-    (void)type;
+    struct linkrxstat	*st;
+    const char		*name;
+    int			type, id;
+    u_int16_t		gen;
+
+    TraceNone();
+    name = rx->naddr.sg_data;
+    type = NgFuncParseHookToken(name, &id, &gen);
+    st = &gLinkRxStats[LinkRxHook(type)];
+    st->frames++;
+    st->octets += rx->len;
+
+    if (rx->trunc) {
+	Log(LG_ERR, ("Link: Truncated frame from hook \"%s\"", name));
+	st->truncated++;
+	return;
+    }
 
-    /* Read all available packets */
-    while (1) {
-	if (num > 20)
+    switch (type) {
+    case MPD_HOOK_LINK:
+	if (id >= gNumLinks || !gLinks[id]) {
+	    Log(LG_ERR, ("Link: Packet from unexisting link \"%s\"",
+		name));
+	    st->unknown++;
+	    return;
+	}
+	if (gLinks[id]->hookgen != gen) {
+	    Log(LG_LINK, ("Link: Packet from stale hook \"%s\"", name));
+	    st->stale++;
 	    return;
-	bp = mballoc(4096);
-	buf = MBDATA(bp);
-	/* Read data */
-	nsize = sizeof(naddr);
-	if ((bp->cnt = recvfrom(gLinksDsock, buf, MBSPACE(bp), MSG_DONTWAIT, (struct sockaddr *)&naddr, &nsize)) < 0) {
+	}
+	if (gLinks[id]->dead) {
+	    Log(LG_LINK, ("Link: Packet from dead link \"%s\"", name));
+	    st->dead++;
+	    return;
+	}
+	l = gLinks[id];
+	TraceLink(l);
+
+	/* Extract protocol */
+	ptr = 0;
+	if (rx->len >= 2 && (buf[0] == 0xff) && (buf[1] == 0x03))
+	    ptr = 2;
+	proto = (ptr < rx->len) ? buf[ptr] : 0;
+	ptr++;
+	if ((proto & 0x01) == 0) {
+	    proto = (ptr < rx->len) ? ((proto << 8) + buf[ptr]) : 0;
+	    ptr++;
+	}
+
+	bp = LinkNgFrameMbuf(buf, rx->len);
+	if (rx->len <= ptr) {
+	    LogDumpBp(LG_FRAME|LG_ERR, bp,
+		"[%s] rec'd truncated %zu bytes frame from link",
+		l->name, MBLEN(bp));
 	    mbfree(bp);
-	    if (errno == EAGAIN)
-    		return;
-	    Perror("Link: Link socket read error");
+	    st->truncated++;
 	    return;
 	}
-	num++;
-
-	name = naddr.sg_data;
-	switch (name[0]) {
-	case 'l':
-	    name++;
-	    id = strtol(name, &rest, 10);
-	    if (rest[0] != 0 || !gLinks[id]) {
-    		Log(LG_ERR, ("Link: Packet from unexisting link \"%s\"",
-    		    name));
-		mbfree(bp);
-		continue;
-	    }
-	    if (gLinks[id]->dead) {
-    		Log(LG_LINK, ("Link: Packet from dead link \"%s\"", name));
-		mbfree(bp);
-		continue;
-	    }
-	    l = gLinks[id];
 
-	    /* Extract protocol */
-	    ptr = 0;
-	    if ((buf[0] == 0xff) && (buf[1] == 0x03))
-		ptr = 2;
-	    proto = buf[ptr++];
-	    if ((proto & 0x01) == 0)
-		proto = (proto << 8) + buf[ptr++];
+	/* Debugging */
+	LogDumpBp(LG_FRAME, bp,
+	    "[%s] rec'd %zu bytes frame from link proto=0x%04x",
+	    l->name, MBLEN(bp), proto);
+
+	bp = mbadj(bp, ptr);
+
+	/* Input frame */
+	InputFrame(l->bund, l, proto, bp);
+	break;
+    case MPD_HOOK_BYPASS:
+    case MPD_HOOK_MSS_IN:
+    case MPD_HOOK_MSS_OUT:
+    case MPD_HOOK_DEMAND4:
+    case MPD_HOOK_DEMAND6:
+	if (id >= gNumBundles || !gBundles[id]) {
+	    Log(LG_ERR, ("Link: Packet from unexisting bundle \"%s\"",
+		name));
+	    st->unknown++;
+	    return;
+	}
+	if (gBundles[id]->hookgen != gen) {
+	    Log(LG_LINK, ("Link: Packet from stale hook \"%s\"", name));
+	    st->stale++;
+	    return;
+	}
+	if (gBundles[id]->dead) {
+	    Log(LG_LINK, ("Link: Packet from dead bundle \"%s\"", name));
+	    st->dead++;
+	    return;
+	}
+	b = gBundles[id];
+	TraceBund(b);
 
-	    if (MBLEN(bp) <= ptr) {
+	/* A PPP frame from the bypass hook? */
+	if (type == MPD_HOOK_BYPASS) {
+	    Link		ll;
+	    u_int16_t	linkNum, lproto;
+
+	    if (rx->len <= 4) {
+		bp = LinkNgFrameMbuf(buf, rx->len);
 		LogDumpBp(LG_FRAME|LG_ERR, bp,
-    		    "[%s] rec'd truncated %zu bytes frame from link",
-    		    l->name, MBLEN(bp));
+		    "[%s] rec'd truncated %zu bytes frame",
+		    b->name, MBLEN(bp));
 		mbfree(bp);
-		continue;
+		st->truncated++;
+		return;
 	    }
 
+	    /* Extract link number and protocol */
+	    memcpy(&linkNum, buf, 2);
+	    linkNum = ntohs(linkNum);
+	    memcpy(&lproto, buf + 2, 2);
+	    lproto = ntohs(lproto);
+	    bp = LinkNgFrameMbuf(buf + 4, rx->len - 4);
+
 	    /* Debugging */
 	    LogDumpBp(LG_FRAME, bp,
-    		"[%s] rec'd %zu bytes frame from link proto=0x%04x",
-    		l->name, MBLEN(bp), proto);
-      
-	    bp = mbadj(bp, ptr);
+		"[%s] rec'd %zu bytes bypass frame link=%d proto=0x%04x",
+		b->name, MBLEN(bp), (int16_t)linkNum, lproto);
 
-	    /* Input frame */
-	    InputFrame(l->bund, l, proto, bp);
-	    break;
-	case 'b':
-	case 'i':
-	case 'o':
-	case '4':
-	case '6':
-	    name++;
-	    id = strtol(name, &rest, 10);
-	    if (rest[0] != 0 || !gBundles[id]) {
-    		Log(LG_ERR, ("Link: Packet from unexisting bundle \"%s\"",
-    		    name));
-		mbfree(bp);
-		continue;
-	    }
-	    if (gBundles[id]->dead) {
-    		Log(LG_LINK, ("Link: Packet from dead bundle \"%s\"", name));
-		mbfree(bp);
-		continue;
-	    }
-	    b = gBundles[id];
-
-	    /* A PPP frame from the bypass hook? */
-	    if (naddr.sg_data[0] == 'b') {
-    		Link		ll;
-		u_int16_t	linkNum, lproto;
-
-		if (MBLEN(bp) <= 4) {
-		    LogDumpBp(LG_FRAME|LG_ERR, bp,
-    			"[%s] rec'd truncated %zu bytes frame",
-    			b->name, MBLEN(bp));
-		    continue;
-		}
-
-		/* Extract link number and protocol */
-		bp = mbread(bp, &linkNum, 2);
-		linkNum = ntohs(linkNum);
-	        bp = mbread(bp, &lproto, 2);
-		lproto = ntohs(lproto);
-
-		/* Debugging */
-		LogDumpBp(LG_FRAME, bp,
-    		    "[%s] rec'd %zu bytes bypass frame link=%d proto=0x%04x",
-    		    b->name, MBLEN(bp), (int16_t)linkNum, lproto);
+	    /* Set link */
+	    assert(linkNum == NG_PPP_BUNDLE_LINKNUM || linkNum < NG_PPP_MAX_LINKS);
 
-		/* Set link */
-		assert(linkNum == NG_PPP_BUNDLE_LINKNUM || linkNum < NG_PPP_MAX_LINKS);
+	    if (linkNum != NG_PPP_BUNDLE_LINKNUM)
+		ll = b->links[linkNum];
+	    else
+		ll = NULL;
 
-		if (linkNum != NG_PPP_BUNDLE_LINKNUM)
-		    ll = b->links[linkNum];
-		else
-		    ll = NULL;
+	    InputFrame(b, ll, lproto, bp);
+	    return;
+	}
 
-		InputFrame(b, ll, lproto, bp);
-		continue;
-	    }
+	bp = LinkNgFrameMbuf(buf, rx->len);
 
-	    /* Debugging */
-	    LogDumpBp(LG_FRAME, bp,
-		"[%s] rec'd %zu bytes frame on %s hook", b->name, MBLEN(bp), naddr.sg_data);
+	/* Debugging */
+	LogDumpBp(LG_FRAME, bp,
+	    "[%s] rec'd %zu bytes frame on %s hook", b->name, MBLEN(bp),
+	    rx->naddr.sg_data);
 
 #ifndef USE_NG_TCPMSS
-	    /* A snooped, outgoing TCP SYN frame */
-	    if (naddr.sg_data[0] == 'o') {
-		IfaceCorrectMSS(bp, MAXMSS(b->iface.mtu));
-		naddr.sg_data[0] = 'i';
-		NgFuncWriteFrame(gLinksDsock, naddr.sg_data, b->name, bp);
-		continue;
-	    }
+	/* A snooped, outgoing TCP SYN frame */
+	if (type == MPD_HOOK_MSS_OUT) {
+	    IfaceCorrectMSS(bp, MAXMSS(b->iface.mtu));
+	    rx->naddr.sg_data[0] = MPD_HOOK_MSS_IN;
+	    NgFuncWriteFrame(gLinksDsock, rx->naddr.sg_data, b->name, bp);
+	    return;
+	}
 
-	    /* A snooped, incoming TCP SYN frame */
-	    if (naddr.sg_data[0] == 'i') {
-		IfaceCorrectMSS(bp, MAXMSS(b->iface.mtu));
-		naddr.sg_data[0] = 'o';
-		NgFuncWriteFrame(gLinksDsock, naddr.sg_data, b->name, bp);
-		continue;
-	    }
+	/* A snooped, incoming TCP SYN frame */
+	if (type == MPD_HOOK_MSS_IN) {
+	    IfaceCorrectMSS(bp, MAXMSS(b->iface.mtu));
+	    rx->naddr.sg_data[0] = MPD_HOOK_MSS_OUT;
+	    NgFuncWriteFrame(gLinksDsock, rx->naddr.sg_data, b->name, bp);
+	    return;
+	}
 #endif
 
-	    /* A snooped, outgoing IP frame */
-	    if (naddr.sg_data[0] == '4') {
-		IfaceListenInput(b, PROTO_IP, bp);
-		continue;
-	    }
-
-	    /* A snooped, outgoing IPv6 frame */
-	    if (naddr.sg_data[0] == '6') {
-		IfaceListenInput(b, PROTO_IPV6, bp);
-		continue;
-	    }
+	/* A snooped, outgoing IP frame */
+	if (type == MPD_HOOK_DEMAND4) {
+	    IfaceListenInput(b, PROTO_IP, bp);
+	    return;
+	}
 
-	    break;
-	default:
-    	    Log(LG_ERR, ("Link: Packet from unknown hook \"%s\"",
-    	        name));
-	    mbfree(bp);
+	/* A snooped, outgoing IPv6 frame */
+	if (type == MPD_HOOK_DEMAND6) {
+	    IfaceListenInput(b, PROTO_IPV6, bp);
+	    return;
 	}
+
+	mbfree(bp);
+	break;
+    default:
+	Log(LG_ERR, ("Link: Packet from unknown hook \"%s\"",
+	    name));
+	st->unknown++;
     }
 }
 
+/*
+ * LinkNgFrameMbuf()
+ */
+
+static Mbuf
+LinkNgFrameMbuf(const u_char *buf, size_t len)
+{
+    Mbuf	bp;
+
+    bp = mballoc(len);
+    memcpy(MBDATAU(bp), buf, len);
+    bp->cnt = len;
+    return (bp);
+}
+
+/*
+ * LinkRxHook()
+ *
+ * Statistics slot for the hook type.
+ */
+
+static int
+LinkRxHook(int type)
+{
+    switch (type) {
+	case MPD_HOOK_LINK:	return (LINK_RX_HOOK_LINK);
+	case MPD_HOOK_BYPASS:	return (LINK_RX_HOOK_BYPASS);
+	case MPD_HOOK_MSS_IN:	return (LINK_RX_HOOK_MSSIN);
+	case MPD_HOOK_MSS_OUT:	return (LINK_RX_HOOK_MSSOUT);
+	case MPD_HOOK_DEMAND4:	return (LINK_RX_HOOK_IPV4);
+	case MPD_HOOK_DEMAND6:	return (LINK_RX_HOOK_IPV6);
+	default:	return (LINK_RX_HOOK_UNKNOWN);
+    }
+}
+
+/*
+ * LinkRxBucket()
+ *
+ * Batch size histogram slot: 1, 2-3, 4-7, ... , LINK_RX_BATCH.
+ */
+
+static int
+LinkRxBucket(int n)
+{
+    int		k;
+
+    for (k = 0; n > 1 && k < LINK_RX_BUCKETS - 1; k++)
+	n >>= 1;
+    return (k);
+}
+
+/*
+ * LinksRxStat()
+ */
+
+int
+LinksRxStat(Context ctx, int ac, const char *const av[], const void *arg)
+{
+    struct linkrxstat	*st;
+    int			k;
+
+    (void)ac;
+    (void)av;
+    (void)arg;
+
+    Printf("Link data socket: batch %d, budget %d\r\n",
+	LINK_RX_BATCH, gLinkRxBudget);
+    Printf("Hook        Frames       Octets Truncated   Unknown   Dead  Stale\r\n");
+    for (k = 0; k < LINK_RX_HOOKS; k++) {
+	st = &gLinkRxStats[k];
+	Printf("%-8s %9llu %12llu %9llu %9llu %6llu %6llu\r\n",
+	    gLinkRxHookNames[k],
+	    (unsigned long long)st->frames, (unsigned long long)st->octets,
+	    (unsigned long long)st->truncated, (unsigned long long)st->unknown,
+	    (unsigned long long)st->dead, (unsigned long long)st->stale);
+    }
+    Printf("Batch sizes:\r\n");
+    for (k = 0; k < LINK_RX_BUCKETS; k++) {
+	if (k == LINK_RX_BUCKETS - 1)
+	    Printf("\t%4d-%-4d: %llu\r\n", 1 << k, LINK_RX_BATCH,
+		(unsigned long long)gLinkRxBatches[k]);
+	else
+	    Printf("\t%4d-%-4d: %llu\r\n", 1 << k, (2 << k) - 1,
+		(unsigned long long)gLinkRxBatches[k]);
+    }
+    return (0);
+}
+
 /*
  * LinkFind()
  *
@@ -1326,6 +1787,18 @@ LinkStat(Context ctx, int ac, const char *const av[], const void *arg)
 	if (l->state == PHYS_STATE_UP)
 	    Printf("\tSession time   : %ld seconds\r\n", (long int)(time(NULL) - l->last_up));
     }
+    if (!l->tmpl && l->setup[LINK_SETUP_START] != 0) {
+	int	ms[LINK_PHASE_NUM], k;
+
+	LinkSetupPhases(l, ms);
+	Printf("Setup times:\r\n");
+	for (k = 0; k < LINK_PHASE_NUM; k++) {
+	    if (ms[k] >= 0)
+		Printf("\t%-15s: %d ms\r\n", gLinkPhaseNames[k], ms[k]);
+	    else
+		Printf("\t%-15s: -\r\n", gLinkPhaseNames[k]);
+	}
+    }
     if (!l->tmpl) {
 	Printf("Up/Down stats:\r\n");
 	if (l->downReason && (!l->downReasonValid))
@@ -1336,7 +1809,7 @@ LinkStat(Context ctx, int ac, const char *const av[], const void *arg)
 	    Printf("\tDown Reason    : %s\r\n", l->downReason);
   
 	if (l->bund) {
-	    LinkUpdateStats(l);
+	    LinkUpdateStats(l, NGSTATS_SHOW);
 	    Printf("Traffic stats:\r\n");
 
 	    Printf("\tInput octets   : %llu\r\n", (unsigned long long)l->stats.recvOctets);
@@ -1357,12 +1830,12 @@ LinkStat(Context ctx, int ac, const char *const av[], const void *arg)
  */
 
 void
-LinkUpdateStats(Link l)
+LinkUpdateStats(Link l, int consumer)
 {
 #ifndef NG_PPP_STATS64
     struct ng_ppp_link_stat	stats;
 
-    if (NgFuncGetStats(l->bund, l->bundleIndex, &stats) != -1) {
+    if (NgStatsGet(l->bund, l->bundleIndex, consumer, &stats) != -1) {
 	l->stats.xmitFrames += abs(stats.xmitFrames - l->oldStats.xmitFrames);
 	l->stats.xmitOctets += abs(stats.xmitOctets - l->oldStats.xmitOctets);
 	l->stats.recvFrames += abs(stats.recvFrames - l->oldStats.recvFrames);
@@ -1375,7 +1848,7 @@ LinkUpdateStats(Link l)
     }
 
 #else
-    NgFuncGetStats64(l->bund, l->bundleIndex, &l->stats);
+    NgStatsGet(l->bund, l->bundleIndex, consumer, &l->stats);
 #endif
 }
 
@@ -1386,8 +1859,10 @@ LinkUpdateStats(Link l)
 void
 LinkResetStats(Link l)
 {
-    if (l->bund)
+    if (l->bund) {
 	NgFuncClrStats(l->bund, l->bundleIndex);
+	NgStatsInvalidate(l->bund, l->bundleIndex);
+    }
     memset(&l->stats, 0, sizeof(l->stats));
 #ifndef NG_PPP_STATS64
     memset(&l->oldStats, 0, sizeof(l->oldStats));
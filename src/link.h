@@ -21,6 +21,7 @@
 #include "mbuf.h"
 #include "phys.h"
 #include "vars.h"
+#include "ngstats.h"
 #include <netgraph/ng_ppp.h>
 #include <regex.h>
 
@@ -109,6 +110,36 @@
   				 (o) == LINK_ORIGINATE_REMOTE ? "remote" :  \
 				 "unknown")
 
+  /* Session setup milestones */
+  enum {
+    LINK_SETUP_START,		/* Incoming call or dial started */
+    LINK_SETUP_PHYS_UP,		/* Device up */
+    LINK_SETUP_LCP_UP,		/* LCP opened */
+    LINK_SETUP_AUTH_START,	/* Auth request started */
+    LINK_SETUP_AUTH_RUN,	/* Auth thread started */
+    LINK_SETUP_AUTH_DONE,	/* Auth backends returned */
+    LINK_SETUP_AUTH_END,	/* Auth result processed */
+    LINK_SETUP_NCP_UP,		/* First NCP of the bundle up */
+    LINK_SETUP_IFACE_UP,	/* Interface addresses and routes set */
+    LINK_SETUP_ACLS,		/* Interface ACLs installed */
+    LINK_SETUP_READY,		/* Up script done */
+    LINK_SETUP_NUM
+  };
+
+  /* Session setup phases, between milestones */
+  enum {
+    LINK_PHASE_SIGNAL,		/* Start - device up */
+    LINK_PHASE_LCP,		/* Device up - LCP opened */
+    LINK_PHASE_AUTH_QUEUE,	/* Waiting for auth thread and its result */
+    LINK_PHASE_AUTH,		/* Auth backends */
+    LINK_PHASE_NCP,		/* Auth or LCP - NCP up */
+    LINK_PHASE_IFACE,		/* NCP up - interface configured */
+    LINK_PHASE_ACLS,		/* NCP up - ACLs installed, if any */
+    LINK_PHASE_SCRIPTS,		/* Interface and ACLs done - up script done */
+    LINK_PHASE_TOTAL,		/* Start - up script done */
+    LINK_PHASE_NUM
+  };
+
   /* Total state of a link */
   struct linkst {
     char		name[LINK_MAX_NAME];	/* Human readable name */
@@ -120,6 +151,7 @@
     u_char		originate;		/* Who originated the connection */
     u_char		die;			/* LCP agreed to die */
     u_char		dead;			/* Dead flag (shutted down) */
+    u_char		trace;			/* Matched by trace selector */
     Bund		bund;			/* My bundle */
     Rep			rep;			/* Rep connected to the device */
     int			bundleIndex;		/* Link number in bundle */
@@ -127,6 +159,7 @@
     int			children;		/* Number of children */
     int			refs;			/* Number of references */
     char		hook[NG_HOOKSIZ];	/* session hook name */
+    u_int16_t		hookgen;		/* Generation of hook names */
     ng_ID_t		nodeID;			/* ID of the tee node */
     MsgHandler		msgs;			/* Link events */
     SLIST_HEAD(, linkaction) actions;
@@ -136,6 +169,10 @@
     struct lcpstate	lcp;		/* LCP state info */
     struct linkbm	bm;		/* Link bandwidth mgmt info */
     struct ng_ppp_link_stat64	stats;	/* Link statistics */
+    struct ngstats_snap	statsSnap;	/* Last ng_ppp stats read */
+    u_int64_t		gen;		/* Generation of the last change */
+    u_char		genListed;	/* Is on the changed list */
+    TAILQ_ENTRY(linkst)	genList;	/* Changed list, oldest first */
 #ifndef NG_PPP_STATS64
     struct ng_ppp_link_stat oldStats;	/* Previous stats for 64bit emulation */
 #endif
@@ -150,6 +187,7 @@
     int			bandwidth;	/* Bandwidth in bits per second */
     int			latency;	/* Latency in microseconds */
     time_t		last_up;	/* Time this link last got up */
+    u_int64_t		setup[LINK_SETUP_NUM];	/* EventNow() of milestones */
     char		msession_id[AUTH_MAX_SESSIONID]; /* a uniq msession-id */
     char		session_id[AUTH_MAX_SESSIONID];	/* a uniq session-id */
 
@@ -159,21 +197,31 @@
     struct pppTimer	openTimer;		/* Open retry timer */
   };
 
+  /* Called for each changed link, or with the name of removed one */
+  typedef void	(*LinkChangeFn)(Link l, const char *gone, u_int64_t gen,
+			  void *arg);
+
   
 /*
  * VARIABLES
  */
 
   extern const struct cmdtab	LinkSetCmds[];
+  extern const char		*gLinkPhaseNames[LINK_PHASE_NUM];
 
   extern int		gLinksCsock;		/* Socket node control socket */
   extern int		gLinksDsock;		/* Socket node data socket */
+  extern u_int64_t	gLinkGen;		/* Last session generation */
 
 /*
  * FUNCTIONS
  */
   extern int	LinksInit(void);
   extern void	LinksShutdown(void);
+  extern int	LinksRxStat(Context ctx, int ac, const char *const av[], const void *arg);
+
+  extern void	LinkSetupMark(Link l, int m, u_int64_t when);
+  extern void	LinkSetupPhases(Link l, int *ms);
 
   extern void	LinkUp(Link l);
   extern void	LinkDown(Link l);
@@ -194,8 +242,10 @@
   extern void	LinkNgShutdown(Link l);
   extern int	LinkNuke(Link link);
   extern int	LinkStat(Context ctx, int ac, const char *const av[], const void *arg);
-  extern void	LinkUpdateStats(Link l);
+  extern void	LinkUpdateStats(Link l, int consumer);
   extern void	LinkResetStats(Link l);
+  extern void	LinkChanged(Link l);
+  extern int	LinkChangesSince(u_int64_t gen, LinkChangeFn fn, void *arg);
   extern Link	LinkFind(const char *name);
   extern int	LinkCommand(Context ctx, int ac, const char *const av[], const void *arg);
   extern int	SessionCommand(Context ctx, int ac, const char *const av[], const void *arg);
@@ -24,6 +24,37 @@
   #define ROUNDUP(x,r)		(((x)%(r))?((x)+((r)-((x)%(r)))):(x))
   #define MAX_LOG_LINE		500
 
+  /*
+   * Once the writer thread is started, log lines are formatted by the
+   * caller into a bounded ring and written to syslog and consoles by
+   * the writer in batches, so callers holding gGiantMutex never wait
+   * for syslog or console output. The ring mutex is held only to copy
+   * a line in or a batch out. When the ring is full new lines are
+   * dropped. The writer can also limit lines written per second.
+   * Before the writer starts, after fork and at exit lines are written
+   * directly as before.
+   */
+
+  #define LOG_LINE		1000	/* Max line length */
+  #define LOG_RING		1024	/* Lines waiting for the writer */
+  #define LOG_BATCH		32	/* Lines written at once */
+
+  /* Queued line */
+  struct logrec
+  {
+    u_char	syslog_only;		/* From LogPrintf2() */
+    char	text[LOG_LINE];
+  };
+
+  struct logstats
+  {
+    u_int64_t	lines;
+    u_int64_t	batches;
+    u_int64_t	full;			/* Dropped, ring was full */
+    u_int64_t	limited;		/* Dropped by rate limit */
+    u_int	max_queued;
+  };
+
 /* Log option descriptor */
 
   struct logopt
@@ -33,11 +64,26 @@
     const char	*desc;
   };
 
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static int	LogOptionsCommand(Context ctx, int ac, const char *const av[],
+		    int *opts);
+  static void	LogEnqueue(int syslog_only, const char *fmt, va_list args);
+  static void	LogOutput(const struct logrec *recs, int n);
+  static void	*LogWriter(void *arg);
+  static void	LogWriterStop(void);
+  static void	LogAtForkChild(void);
+
 /*
  * GLOBAL VARIABLES
  */
 
   int	gLogOptions = LG_DEFAULT_OPT | LG_ALWAYS;
+  int	gLogRate = 0;
+  int	gLogTraceOptions = LG_TRACE_OPT;
+  __thread int	gLogTrace = 0;
 #ifdef SYSLOG_FACILITY
   char	gSysLogIdent[32];
 #endif
@@ -144,6 +190,17 @@
 
   #define NUM_LOG_LEVELS (sizeof(LogOptionList) / sizeof(*LogOptionList))
 
+  static pthread_mutex_t	gLogMutex;
+  static pthread_cond_t		gLogCond;
+  static pthread_t		gLogWriterThread;
+  static int			gLogWriterUp;
+  static int			gLogWriterStopping;	/* Mutex */
+  static int			gLogWriterWaiting;	/* Mutex */
+  static struct logrec		gLogRing[LOG_RING];	/* Mutex */
+  static u_int			gLogHead, gLogTail;	/* Mutex */
+  static struct logstats	gLogStats;		/* Mutex */
+  static struct logrec		gLogBatch[LOG_BATCH];	/* Writer only */
+
 /*
  * LogOpen()
  */
@@ -151,11 +208,26 @@
 int
 LogOpen(void)
 {
+    int	ret;
+
 #ifdef SYSLOG_FACILITY
     if (!*gSysLogIdent)
 	strcpy(gSysLogIdent, "mpd");
     openlog(gSysLogIdent, 0, LOG_DAEMON);
 #endif
+
+    if ((ret = pthread_mutex_init(&gLogMutex, NULL)) != 0 ||
+	    (ret = pthread_cond_init(&gLogCond, NULL)) != 0) {
+	Log(LG_ERR, ("Could not create log writer lock: %d", ret));
+	return(0);
+    }
+    pthread_atfork(NULL, NULL, LogAtForkChild);
+    if ((ret = pthread_create(&gLogWriterThread, NULL, LogWriter, NULL)) != 0) {
+	Log(LG_ERR, ("Could not start log writer: %d", ret));
+	return(0);
+    }
+    gLogWriterUp = 1;
+    atexit(LogWriterStop);
     return(0);
 }
 
@@ -166,23 +238,79 @@ LogOpen(void)
 void
 LogClose(void)
 {
+    LogWriterStop();
 #ifdef SYSLOG_FACILITY
     closelog();
 #endif
 }
 
+/*
+ * LogWriterStop()
+ *
+ * Let the writer drain the ring and wait for it.
+ */
+
+static void
+LogWriterStop(void)
+{
+    if (!gLogWriterUp || pthread_equal(pthread_self(), gLogWriterThread))
+	return;
+    MUTEX_LOCK(gLogMutex);
+    gLogWriterStopping = 1;
+    pthread_cond_signal(&gLogCond);
+    MUTEX_UNLOCK(gLogMutex);
+    pthread_join(gLogWriterThread, NULL);
+    gLogWriterUp = 0;
+}
+
+/*
+ * LogAtForkChild()
+ *
+ * Child has no writer thread and must not repeat parent lines.
+ */
+
+static void
+LogAtForkChild(void)
+{
+    gLogWriterUp = 0;
+    gLogHead = gLogTail = 0;
+}
+
 /*
  * LogCommand()
  */
 
 int
 LogCommand(Context ctx, int ac, const char *const av[], const void *arg)
+{
+    (void)arg;
+    return (LogOptionsCommand(ctx, ac, av, &gLogOptions));
+}
+
+/*
+ * LogTraceCommand()
+ *
+ * Options enabled for sessions matched by trace selectors.
+ */
+
+int
+LogTraceCommand(Context ctx, int ac, const char *const av[], const void *arg)
+{
+    (void)arg;
+    return (LogOptionsCommand(ctx, ac, av, &gLogTraceOptions));
+}
+
+/*
+ * LogOptionsCommand()
+ */
+
+static int
+LogOptionsCommand(Context ctx, int ac, const char *const av[], int *opts)
 {
     u_int	k;
     int		bits, add;
     const char	*s;
 
-    (void)arg;
     if (ac == 0) {
 #define LG_FMT	"    %-12s  %-10s  %s\r\n"
 
@@ -190,7 +318,7 @@ LogCommand(Context ctx, int ac, const char *const av[], const void *arg)
 	Printf(LG_FMT, "----------", "-------", "-----------");
 	for (k = 0; k < NUM_LOG_LEVELS; k++) {
     	    Printf("  " LG_FMT, LogOptionList[k].name,
-		(gLogOptions & LogOptionList[k].mask) ? "Yes" : "No",
+		(*opts & LogOptionList[k].mask) ? "Yes" : "No",
 		LogOptionList[k].desc);
 	}
 	return(0);
@@ -224,9 +352,9 @@ LogCommand(Context ctx, int ac, const char *const av[], const void *arg)
     	    }
 	}
 	if (add)
-    	    gLogOptions |= bits;
+    	    *opts |= bits;
 	else
-    	    gLogOptions &= ~bits;
+    	    *opts &= ~bits;
 	av++;
     }
     return(0);
@@ -251,21 +379,14 @@ LogPrintf(const char *fmt, ...)
 void
 vLogPrintf(const char *fmt, va_list args) NO_THREAD_SAFETY_ANALYSIS
 {
-    if (!SLIST_EMPTY(&gConsole.sessions)) {
-	char		buf[1000];
-	ConsoleSession	s;
-
-        vsnprintf(buf, sizeof(buf), fmt, args);
-#ifdef SYSLOG_FACILITY
-        syslog(LOG_INFO, "%s", buf);
-#endif
-	pthread_cleanup_push(ConsoleCancelCleanup, gConsole.lock);
-	RWLOCK_RDLOCK(gConsole.lock);
-	SLIST_FOREACH(s, &gConsole.sessions, next) {
-	    if (Enabled(&s->options, CONSOLE_LOGGING))
-		s->write(s, "%s\r\n", buf);
-	}
-	pthread_cleanup_pop(1);
+    if (gLogWriterUp) {
+	LogEnqueue(0, fmt, args);
+    } else if (!SLIST_EMPTY(&gConsole.sessions)) {
+	struct logrec	rec;
+
+	rec.syslog_only = 0;
+        vsnprintf(rec.text, sizeof(rec.text), fmt, args);
+	LogOutput(&rec, 1);
 #ifdef SYSLOG_FACILITY
     } else {
         vsyslog(LOG_INFO, fmt, args);
@@ -273,6 +394,165 @@ vLogPrintf(const char *fmt, va_list args) NO_THREAD_SAFETY_ANALYSIS
     }
 }
 
+/*
+ * LogEnqueue()
+ *
+ * Format line and queue it for the writer, never waiting for it.
+ */
+
+static void
+LogEnqueue(int syslog_only, const char *fmt, va_list args)
+{
+    char	buf[LOG_LINE];
+    u_int	queued;
+
+    vsnprintf(buf, sizeof(buf), fmt, args);
+
+    MUTEX_LOCK(gLogMutex);
+    queued = gLogHead - gLogTail;
+    if (queued >= LOG_RING) {
+	gLogStats.full++;
+    } else {
+	struct logrec	*const r = &gLogRing[gLogHead++ % LOG_RING];
+
+	r->syslog_only = syslog_only;
+	strlcpy(r->text, buf, sizeof(r->text));
+	if (++queued > gLogStats.max_queued)
+	    gLogStats.max_queued = queued;
+	if (gLogWriterWaiting)
+	    pthread_cond_signal(&gLogCond);
+    }
+    MUTEX_UNLOCK(gLogMutex);
+}
+
+/*
+ * LogOutput()
+ *
+ * Write lines to syslog and consoles with logging enabled.
+ */
+
+static void
+LogOutput(const struct logrec *recs, int n) NO_THREAD_SAFETY_ANALYSIS
+{
+    ConsoleSession	s;
+    int			k;
+
+#ifdef SYSLOG_FACILITY
+    for (k = 0; k < n; k++)
+	syslog(LOG_INFO, "%s", recs[k].text);
+#endif
+    if (SLIST_EMPTY(&gConsole.sessions))
+	return;
+    pthread_cleanup_push(ConsoleCancelCleanup, gConsole.lock);
+    RWLOCK_RDLOCK(gConsole.lock);
+    SLIST_FOREACH(s, &gConsole.sessions, next) {
+	if (!Enabled(&s->options, CONSOLE_LOGGING))
+	    continue;
+	for (k = 0; k < n; k++) {
+	    if (!recs[k].syslog_only)
+		s->write(s, "%s\r\n", recs[k].text);
+	}
+    }
+    pthread_cleanup_pop(1);
+}
+
+/*
+ * LogWriter()
+ *
+ * Writer thread. Lines over the rate limit are dropped, the number
+ * of lines dropped is reported once a second.
+ */
+
+static void *
+LogWriter(void *arg)
+{
+    struct logrec	note;
+    time_t		now, window = 0;
+    u_int64_t		full, lastFull = 0;
+    int			k, n, lines = 0, limited = 0;
+
+    (void)arg;
+    note.syslog_only = 0;
+    for (;;) {
+	MUTEX_LOCK(gLogMutex);
+	while (gLogHead == gLogTail && !gLogWriterStopping) {
+	    gLogWriterWaiting = 1;
+	    pthread_cond_wait(&gLogCond, &gLogMutex);
+	    gLogWriterWaiting = 0;
+	}
+	if (gLogHead == gLogTail) {
+	    MUTEX_UNLOCK(gLogMutex);
+	    break;
+	}
+	for (n = 0; n < LOG_BATCH && gLogTail != gLogHead; n++)
+	    gLogBatch[n] = gLogRing[gLogTail++ % LOG_RING];
+	gLogStats.lines += n;
+	gLogStats.batches++;
+	full = gLogStats.full;
+	MUTEX_UNLOCK(gLogMutex);
+
+	now = time(NULL);
+	if (now != window) {
+	    if (limited || full != lastFull) {
+		snprintf(note.text, sizeof(note.text),
+		    "Log: %d lines over rate limit, %llu lost on full queue",
+		    limited, (unsigned long long)(full - lastFull));
+		LogOutput(&note, 1);
+	    }
+	    window = now;
+	    lines = limited = 0;
+	    lastFull = full;
+	}
+	if (gLogRate > 0 && lines + n > gLogRate) {
+	    k = (lines < gLogRate) ? gLogRate - lines : 0;
+	    limited += n - k;
+	    MUTEX_LOCK(gLogMutex);
+	    gLogStats.limited += n - k;
+	    MUTEX_UNLOCK(gLogMutex);
+	    n = k;
+	}
+	lines += n;
+	if (n > 0)
+	    LogOutput(gLogBatch, n);
+    }
+    return (NULL);
+}
+
+/*
+ * LogStat()
+ */
+
+int
+LogStat(Context ctx, int ac, const char *const av[], const void *arg)
+{
+    struct logstats	st;
+    u_int		queued;
+
+    (void)ac;
+    (void)av;
+    (void)arg;
+
+    if (!gLogWriterUp) {
+	Printf("Log writer is not running\r\n");
+	return (0);
+    }
+    MUTEX_LOCK(gLogMutex);
+    st = gLogStats;
+    queued = gLogHead - gLogTail;
+    MUTEX_UNLOCK(gLogMutex);
+
+    Printf("Log writer:\r\n");
+    Printf("\tRate limit     : %d lines/s%s\r\n", gLogRate,
+	gLogRate > 0 ? "" : " (unlimited)");
+    Printf("\tQueued         : %u of %d\r\n", queued, LOG_RING);
+    Printf("\tMax queued     : %u\r\n", st.max_queued);
+    Printf("\tLines          : %llu\r\n", (unsigned long long)st.lines);
+    Printf("\tBatches        : %llu\r\n", (unsigned long long)st.batches);
+    Printf("\tQueue full     : %llu\r\n", (unsigned long long)st.full);
+    Printf("\tRate limited   : %llu\r\n", (unsigned long long)st.limited);
+    return (0);
+}
+
 /*
  * LogPrintf2()
  *
@@ -285,8 +565,11 @@ LogPrintf2(const char *fmt, ...)
     va_list       args;
 
     va_start(args, fmt);
+    if (gLogWriterUp)
+	LogEnqueue(1, fmt, args);
 #ifdef SYSLOG_FACILITY
-    vsyslog(LOG_INFO, fmt, args);
+    else
+	vsyslog(LOG_INFO, fmt, args);
 #endif
     va_end(args);
 }
@@ -113,23 +113,44 @@
 			        | LG_PHYS		\
 				)
 
+/* Default options for traced sessions */
+
+  #define LG_TRACE_OPT		(LG_DEFAULT_OPT		\
+				| LG_BUND2		\
+				| LG_CHAT2		\
+				| LG_IFACE2		\
+				| LG_LCP2		\
+				| LG_AUTH2		\
+				| LG_IPCP2		\
+				| LG_IPV6CP2		\
+				| LG_CCP2		\
+				| LG_ECP2		\
+				| LG_ECHO		\
+				| LG_PHYS2		\
+				| LG_PHYS3		\
+				| LG_RADIUS2		\
+				)
+
+  /* Options enabled for the session being processed by this thread */
+  #define LogEnabled(lev)	((gLogOptions | gLogTrace) & (lev))
+
   #define Log(lev, args)	do {				\
-				  if (gLogOptions & (lev))	\
+				  if (LogEnabled(lev))	\
 				    LogPrintf args;		\
 				} while (0)
 
   #define Log2(lev, args)	do {				\
-				  if (gLogOptions & (lev))	\
+				  if (LogEnabled(lev))	\
 				    LogPrintf2 args;		\
 				} while (0)
 
   #define LogDumpBuf(lev, buf, len, fmt, args...) do {		\
-				  if (gLogOptions & (lev))	\
+				  if (LogEnabled(lev))	\
 				    LogDumpBuf2(buf, len, fmt, ##args);	\
 				} while (0)
 
   #define LogDumpBp(lev, bp, fmt, args...) do {			\
-				  if (gLogOptions & (lev))	\
+				  if (LogEnabled(lev))	\
 				    LogDumpBp2(bp, fmt, ##args);\
 				} while (0)
 
@@ -138,6 +159,9 @@
  */
 
   extern int	gLogOptions;
+  extern int	gLogRate;		/* Max lines per second, 0 - no limit */
+  extern int	gLogTraceOptions;	/* Options for traced sessions */
+  extern __thread int	gLogTrace;	/* Trace options of current session */
 #ifdef SYSLOG_FACILITY
   extern char	gSysLogIdent[32];
 #endif
@@ -152,6 +176,8 @@
   extern void	vLogPrintf(const char *fmt, va_list args);
   extern void	LogPrintf2(const char *fmt, ...) __printflike(1, 2);
   extern int	LogCommand(Context ctx, int ac, const char *const av[], const void *arg);
+  extern int	LogTraceCommand(Context ctx, int ac, const char *const av[], const void *arg);
+  extern int	LogStat(Context ctx, int ac, const char *const av[], const void *arg);
   extern void	LogDumpBuf2(const u_char *buf, int len,
 			const char *fmt, ...) __printflike(3, 4);
   extern void	LogDumpBp2(Mbuf bp, const char *fmt, ...)
@@ -22,6 +22,17 @@
 #include "ngfunc.h"
 #include "util.h"
 #include "ippool.h"
+#include "rtqueue.h"
+#include "ngstats.h"
+#include "metrics.h"
+#include "sessevent.h"
+#include "sesssnap.h"
+#include "capture.h"
+#include "bpfcache.h"
+#ifdef USE_IPFW
+#include "ipfwbatch.h"
+#endif
+#include "spawn.h"
 #ifdef CCP_MPPC
 #include "ccp_mppc.h"
 #endif
@@ -247,6 +258,14 @@ main(int ac, char *av[])
     /* Do some initialization */
     MpSetDiscrim();
     IPPoolInit();
+    RtQueueInit();
+    NgStatsInit();
+    MetricsInit();
+    SessEventInit();
+    SessSnapInit();
+#ifdef USE_NG_BPF
+    BpfCacheInit();
+#endif
 #ifdef CCP_MPPC
     MppcTestCap();
 #endif
@@ -276,6 +295,12 @@ main(int ac, char *av[])
       EVENT_RECURRING, SignalHandler, NULL) != 0)
 	exit(EX_UNAVAILABLE);
 
+    /* Start helper processes while we are small */
+#ifdef USE_IPFW
+    IpfwBatchInit();
+#endif
+    SpawnInit();
+
     /* Register for some common fatal signals so we can exit cleanly */
     signal(SIGINT, SendSignal);
     signal(SIGTERM, SendSignal);
@@ -387,6 +412,10 @@ DoExit(int code)
     if (code != EX_TERMINATE)	/* kludge to avoid double shutdown */
 	CloseIfaces();
 
+    /* Do not leave addresses and routes behind */
+    RtQueueShutdown();
+
+    NgStatsShutdown();
     NgFuncShutdownGlobal();
 
     /* Blow away all netgraph nodes */
@@ -414,6 +443,12 @@ DoExit(int code)
     EcpsShutdown();
     CcpsShutdown();
     LinksShutdown();
+#ifdef USE_IPFW
+    IpfwBatchShutdown();
+#endif
+    SpawnShutdown();
+    CaptureShutdown();
+    SessSnapShutdown();
 
     /* Remove our PID file and exit */
     ConsoleShutdown(&gConsole);
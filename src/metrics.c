@@ -0,0 +1,833 @@
+
+/*
+ * metrics.c
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "metrics.h"
+#include "fsm.h"
+#include "phys.h"
+#include "ippool.h"
+#include "util.h"
+#ifndef NOWEB
+#include "web.h"
+#endif
+
+#include <time.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  /*
+   * Metrics are exported in Prometheus text format. Web server threads
+   * must never wait for gGiantMutex to serve them, so the event loop
+   * publishes a snapshot of everything every gMetricsPeriod seconds.
+   * Readers only take a reference to the current snapshot under the
+   * small metrics mutex. Counters updated from other threads (RADIUS)
+   * are protected by the same mutex.
+   */
+
+  #define METRICS_MAX_TYPES	16
+
+  /* Auth backends */
+  enum {
+    METRICS_AUTH_RADIUS,
+    METRICS_AUTH_INTERNAL,
+    METRICS_AUTH_EXTERNAL,
+    METRICS_AUTH_SYSTEM,
+    METRICS_AUTH_PAM,
+    METRICS_AUTH_OPIE,
+    METRICS_AUTH_OTHER,
+    METRICS_AUTH_NUM
+  };
+
+  /* Auth results */
+  enum {
+    METRICS_AUTH_SUCCESS,
+    METRICS_AUTH_FAIL,
+    METRICS_AUTH_UNDEF,
+    METRICS_AUTH_RES_NUM
+  };
+
+  /* Latency histogram, upper bounds in ms */
+  static const u_int	gMetricsBuckets[] = {
+    5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000
+  };
+  #define METRICS_BUCKETS	(sizeof(gMetricsBuckets) / sizeof(*gMetricsBuckets))
+
+  struct metrics_hist {
+    u_int64_t	bucket[METRICS_BUCKETS + 1];	/* Last is +Inf */
+    u_int64_t	sum;				/* ms */
+    u_int64_t	count;
+  };
+
+  struct metrics_auth {
+    struct metrics_hist	latency;
+    u_int64_t		results[METRICS_AUTH_RES_NUM];
+  };
+
+  struct metrics_radius {
+    struct metrics_hist	latency;
+    u_int64_t		results[METRICS_RAD_RES_NUM];
+  };
+
+  /* Per session values */
+  struct metrics_sess {
+    char		link[LINK_MAX_NAME];
+    char		bund[LINK_MAX_NAME];
+    char		iface[IFNAMSIZ];
+    char		user[AUTH_MAX_AUTHNAME];
+    const char		*type;
+    u_int		uptime;
+    u_int64_t		in_octets;
+    u_int64_t		out_octets;
+    u_int64_t		in_frames;
+    u_int64_t		out_frames;
+  };
+
+  struct metrics_snap {
+    int			refs;
+    char		*text;		/* Global series, from open_memstream() */
+    size_t		len;
+    struct metrics_sess	*sess;
+    int			nsess;
+  };
+  typedef struct metrics_snap	*MetricsSnap;
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static void		MetricsUpdate(void *arg);
+  static void		MetricsGlobal(FILE *f);
+  static int		MetricsSessions(struct metrics_sess **sessp);
+  static void		MetricsSessWrite(FILE *f, MetricsSnap s, int off, int lim);
+  static void		MetricsRelease(MetricsSnap s);
+  static void		MetricsHistAdd(struct metrics_hist *h, u_int ms);
+  static void		MetricsHistWrite(FILE *f, const char *name,
+			  const char *labels, const struct metrics_hist *h);
+  static void		MetricsEvHistWrite(FILE *f, const char *name,
+			  const char *labels, const struct evstat_hist *h);
+  static void		MetricsLabel(FILE *f, const char *s);
+#if !defined(NOWEB) && defined(NOLIBPDEL)
+  static void		MetricsWeb(FILE *f);
+  static void		MetricsWebHist(FILE *f, const char *name,
+			  const struct http_server_hist *h);
+#endif
+  static u_int64_t	MetricsNow(void);
+
+/*
+ * GLOBAL VARIABLES
+ */
+
+  int	gMetricsPeriod = METRICS_DFL_PERIOD;
+  int	gMetricsSessions = 0;
+
+/*
+ * INTERNAL VARIABLES
+ */
+
+  static const char	*gMetricsAuthNames[METRICS_AUTH_NUM] = {
+    "radius", "internal", "external", "system", "pam", "opie", "other"
+  };
+  static const char	*gMetricsAuthResNames[METRICS_AUTH_RES_NUM] = {
+    "success", "fail", "undef"
+  };
+  static const char	*gMetricsRadNames[METRICS_RAD_NUM] = {
+    "auth", "acct"
+  };
+  static const char	*gMetricsRadResNames[METRICS_RAD_RES_NUM] = {
+    "accept", "reject", "challenge", "response", "failed"
+  };
+
+  static pthread_mutex_t	gMetricsMutex;
+  static MetricsSnap		gMetricsSnap;
+  static struct pppTimer	gMetricsTimer;
+  static u_int64_t		gMetricsLast;
+  static u_int			gMetricsLag;		/* Event loop lag, ms */
+  static u_int			gMetricsLagMax;
+  static struct metrics_auth	gMetricsAuth[METRICS_AUTH_NUM];
+  static struct metrics_radius	gMetricsRadius[METRICS_RAD_NUM];	/* Mutex */
+  static struct metrics_hist	gMetricsSetup[LINK_PHASE_NUM];
+
+/*
+ * MetricsInit()
+ */
+
+void
+MetricsInit(void)
+{
+    int	ret;
+
+    if ((ret = pthread_mutex_init(&gMetricsMutex, NULL)) != 0) {
+	Log(LG_ERR, ("Could not create metrics mutex: %d", ret));
+	exit(EX_UNAVAILABLE);
+    }
+}
+
+/*
+ * MetricsStart()
+ *
+ * Start publishing snapshots.
+ */
+
+void
+MetricsStart(void)
+{
+    TimerStop(&gMetricsTimer);
+    TimerInit(&gMetricsTimer, "Metrics", gMetricsPeriod * SECONDS,
+	MetricsUpdate, NULL);
+    TimerStartRecurring(&gMetricsTimer);
+    gMetricsLast = 0;
+    MetricsUpdate(NULL);
+}
+
+/*
+ * MetricsStop()
+ */
+
+void
+MetricsStop(void)
+{
+    MetricsSnap	s;
+
+    TimerStop(&gMetricsTimer);
+    MUTEX_LOCK(gMetricsMutex);
+    s = gMetricsSnap;
+    gMetricsSnap = NULL;
+    MUTEX_UNLOCK(gMetricsMutex);
+    if (s != NULL)
+	MetricsRelease(s);
+}
+
+/*
+ * MetricsAuth()
+ *
+ * Account finished authentication. Called from the event loop.
+ */
+
+void
+MetricsAuth(int authentic, int status, u_int ms)
+{
+    struct metrics_auth	*a;
+
+    switch (authentic) {
+	case AUTH_CONF_RADIUS_AUTH:
+	    a = &gMetricsAuth[METRICS_AUTH_RADIUS];
+	    break;
+	case AUTH_CONF_INTERNAL:
+	    a = &gMetricsAuth[METRICS_AUTH_INTERNAL];
+	    break;
+	case AUTH_CONF_EXT_AUTH:
+	    a = &gMetricsAuth[METRICS_AUTH_EXTERNAL];
+	    break;
+	case AUTH_CONF_SYSTEM_AUTH:
+	    a = &gMetricsAuth[METRICS_AUTH_SYSTEM];
+	    break;
+	case AUTH_CONF_PAM_AUTH:
+	    a = &gMetricsAuth[METRICS_AUTH_PAM];
+	    break;
+	case AUTH_CONF_OPIE:
+	    a = &gMetricsAuth[METRICS_AUTH_OPIE];
+	    break;
+	default:
+	    a = &gMetricsAuth[METRICS_AUTH_OTHER];
+	    break;
+    }
+    MetricsHistAdd(&a->latency, ms);
+    if (status == AUTH_STATUS_SUCCESS)
+	a->results[METRICS_AUTH_SUCCESS]++;
+    else if (status == AUTH_STATUS_FAIL)
+	a->results[METRICS_AUTH_FAIL]++;
+    else
+	a->results[METRICS_AUTH_UNDEF]++;
+}
+
+/*
+ * MetricsSetup()
+ *
+ * Account session setup phase. Called from the event loop.
+ */
+
+void
+MetricsSetup(int phase, u_int ms)
+{
+    MetricsHistAdd(&gMetricsSetup[phase], ms);
+}
+
+/*
+ * MetricsRadius()
+ *
+ * Account RADIUS request. Called from auth threads.
+ */
+
+void
+MetricsRadius(int kind, int result, u_int ms)
+{
+    MUTEX_LOCK(gMetricsMutex);
+    MetricsHistAdd(&gMetricsRadius[kind].latency, ms);
+    gMetricsRadius[kind].results[result]++;
+    MUTEX_UNLOCK(gMetricsMutex);
+}
+
+/*
+ * MetricsWrite()
+ *
+ * Write current snapshot. Called from web server threads.
+ * Query may contain "sessions", "offset={n}" and "limit={n}".
+ */
+
+void
+MetricsWrite(FILE *f, const char *query)
+{
+    MetricsSnap	s;
+    char	*buf, *tmp, *arg;
+    int		sessions = 0, off = 0, lim = METRICS_PAGE;
+
+    tmp = buf = Mstrdup(MB_WEB, query);
+    while ((arg = strsep(&tmp, "&")) != NULL) {
+	if (strcmp(arg, "sessions") == 0 || strcmp(arg, "sessions=1") == 0)
+	    sessions = 1;
+	else if (strncmp(arg, "offset=", 7) == 0)
+	    off = atoi(arg + 7);
+	else if (strncmp(arg, "limit=", 6) == 0)
+	    lim = atoi(arg + 6);
+    }
+    Freee(buf);
+    if (off < 0)
+	off = 0;
+    if (lim <= 0 || lim > METRICS_MAX_PAGE)
+	lim = METRICS_MAX_PAGE;
+
+    MUTEX_LOCK(gMetricsMutex);
+    if ((s = gMetricsSnap) != NULL)
+	s->refs++;
+    MUTEX_UNLOCK(gMetricsMutex);
+    if (s == NULL)
+	return;
+
+    fwrite(s->text, 1, s->len, f);
+    if (sessions)
+	MetricsSessWrite(f, s, off, lim);
+    MetricsRelease(s);
+}
+
+/*
+ * MetricsRelease()
+ */
+
+static void
+MetricsRelease(MetricsSnap s)
+{
+    int	refs;
+
+    MUTEX_LOCK(gMetricsMutex);
+    refs = --s->refs;
+    MUTEX_UNLOCK(gMetricsMutex);
+    if (refs > 0)
+	return;
+    free(s->text);
+    if (s->sess != NULL)
+	Freee(s->sess);
+    Freee(s);
+}
+
+/*
+ * MetricsUpdate()
+ *
+ * Build and publish new snapshot. Called from the event loop.
+ */
+
+static void
+MetricsUpdate(void *arg)
+{
+    MetricsSnap	s, old;
+    FILE	*f;
+    u_int64_t	now = MetricsNow();
+
+    (void)arg;
+
+    /* We are late by as much as the event loop was busy */
+    if (gMetricsLast != 0) {
+	u_int64_t	due = gMetricsLast + (u_int64_t)gMetricsPeriod * 1000;
+
+	gMetricsLag = (now > due) ? now - due : 0;
+	if (gMetricsLag > gMetricsLagMax)
+	    gMetricsLagMax = gMetricsLag;
+    }
+    gMetricsLast = now;
+
+    s = Malloc(MB_WEB, sizeof(*s));
+    if ((f = open_memstream(&s->text, &s->len)) == NULL) {
+	Perror("Metrics: can't open memory stream");
+	Freee(s);
+	return;
+    }
+    MetricsGlobal(f);
+    if (fclose(f) != 0) {
+	Perror("Metrics: can't build snapshot");
+	free(s->text);
+	Freee(s);
+	return;
+    }
+    if (gMetricsSessions)
+	s->nsess = MetricsSessions(&s->sess);
+    s->refs = 1;
+
+    MUTEX_LOCK(gMetricsMutex);
+    old = gMetricsSnap;
+    gMetricsSnap = s;
+    MUTEX_UNLOCK(gMetricsMutex);
+    if (old != NULL)
+	MetricsRelease(old);
+}
+
+/*
+ * MetricsGlobal()
+ */
+
+static void
+MetricsGlobal(FILE *f)
+{
+    struct metrics_radius	rad[METRICS_RAD_NUM];
+    struct typed_mem_stats	mem;
+    struct evstat_hist		lag, wait;
+    const struct evstat		*e;
+    u_int	links[METRICS_MAX_TYPES][PHYS_STATE_UP + 1];
+    u_int	lcp[ST_OPENED + 1];
+    u_int	bunds = 0, bunds_up = 0;
+    char	labels[64];
+    char	name[LINK_MAX_NAME];
+    int		k, j, used, total;
+    Link	l;
+    Bund	b;
+
+    /* Sessions */
+    memset(links, 0, sizeof(links));
+    memset(lcp, 0, sizeof(lcp));
+    for (k = 0; k < gNumLinks; k++) {
+	if ((l = gLinks[k]) == NULL || l->tmpl)
+	    continue;
+	for (j = 0; j < METRICS_MAX_TYPES && gPhysTypes[j] != NULL &&
+		gPhysTypes[j] != l->type; j++)
+	    ;
+	if (j < METRICS_MAX_TYPES && gPhysTypes[j] != NULL &&
+		l->state <= PHYS_STATE_UP)
+	    links[j][l->state]++;
+	if (l->lcp.fsm.state <= ST_OPENED)
+	    lcp[l->lcp.fsm.state]++;
+    }
+    for (k = 0; k < gNumBundles; k++) {
+	if ((b = gBundles[k]) == NULL || b->tmpl)
+	    continue;
+	bunds++;
+	if (b->n_up > 0)
+	    bunds_up++;
+    }
+
+    fprintf(f, "# HELP mpd_links Links by device type and state.\n");
+    fprintf(f, "# TYPE mpd_links gauge\n");
+    for (j = 0; j < METRICS_MAX_TYPES && gPhysTypes[j] != NULL; j++) {
+	for (k = 0; k <= PHYS_STATE_UP; k++) {
+	    fprintf(f, "mpd_links{type=\"%s\",state=\"%s\"} %u\n",
+		gPhysTypes[j]->name, gPhysStateNames[k], links[j][k]);
+	}
+    }
+    fprintf(f, "# HELP mpd_links_lcp Links by LCP state.\n");
+    fprintf(f, "# TYPE mpd_links_lcp gauge\n");
+    for (k = 0; k <= ST_OPENED; k++) {
+	fprintf(f, "mpd_links_lcp{state=\"%s\"} %u\n",
+	    FsmStateName(k), lcp[k]);
+    }
+    fprintf(f, "# HELP mpd_bundles Bundles.\n");
+    fprintf(f, "# TYPE mpd_bundles gauge\n");
+    fprintf(f, "mpd_bundles %u\n", bunds);
+    fprintf(f, "# HELP mpd_bundles_up Bundles with links joined.\n");
+    fprintf(f, "# TYPE mpd_bundles_up gauge\n");
+    fprintf(f, "mpd_bundles_up %u\n", bunds_up);
+
+    /* Auth */
+    fprintf(f, "# HELP mpd_auth_total Finished authentications.\n");
+    fprintf(f, "# TYPE mpd_auth_total counter\n");
+    for (k = 0; k < METRICS_AUTH_NUM; k++) {
+	for (j = 0; j < METRICS_AUTH_RES_NUM; j++) {
+	    fprintf(f, "mpd_auth_total{backend=\"%s\",result=\"%s\"} %llu\n",
+		gMetricsAuthNames[k], gMetricsAuthResNames[j],
+		(unsigned long long)gMetricsAuth[k].results[j]);
+	}
+    }
+    fprintf(f, "# HELP mpd_auth_duration_seconds Authentication latency.\n");
+    fprintf(f, "# TYPE mpd_auth_duration_seconds histogram\n");
+    for (k = 0; k < METRICS_AUTH_NUM; k++) {
+	snprintf(labels, sizeof(labels), "backend=\"%s\"", gMetricsAuthNames[k]);
+	MetricsHistWrite(f, "mpd_auth_duration_seconds", labels,
+	    &gMetricsAuth[k].latency);
+    }
+
+    /* RADIUS */
+    MUTEX_LOCK(gMetricsMutex);
+    memcpy(rad, gMetricsRadius, sizeof(rad));
+    MUTEX_UNLOCK(gMetricsMutex);
+    fprintf(f, "# HELP mpd_radius_requests_total RADIUS requests by result.\n");
+    fprintf(f, "# TYPE mpd_radius_requests_total counter\n");
+    for (k = 0; k < METRICS_RAD_NUM; k++) {
+	for (j = 0; j < METRICS_RAD_RES_NUM; j++) {
+	    fprintf(f, "mpd_radius_requests_total{kind=\"%s\",result=\"%s\"} %llu\n",
+		gMetricsRadNames[k], gMetricsRadResNames[j],
+		(unsigned long long)rad[k].results[j]);
+	}
+    }
+    fprintf(f, "# HELP mpd_radius_duration_seconds RADIUS request latency.\n");
+    fprintf(f, "# TYPE mpd_radius_duration_seconds histogram\n");
+    for (k = 0; k < METRICS_RAD_NUM; k++) {
+	snprintf(labels, sizeof(labels), "kind=\"%s\"", gMetricsRadNames[k]);
+	MetricsHistWrite(f, "mpd_radius_duration_seconds", labels,
+	    &rad[k].latency);
+    }
+
+    /* Session setup */
+    fprintf(f, "# HELP mpd_session_setup_seconds Session setup time by phase.\n");
+    fprintf(f, "# TYPE mpd_session_setup_seconds histogram\n");
+    for (k = 0; k < LINK_PHASE_NUM; k++) {
+	snprintf(labels, sizeof(labels), "phase=\"%s\"", gLinkPhaseNames[k]);
+	MetricsHistWrite(f, "mpd_session_setup_seconds", labels,
+	    &gMetricsSetup[k]);
+    }
+
+    /* Event loop */
+    fprintf(f, "# HELP mpd_msg_queue_length Internal message queue length.\n");
+    fprintf(f, "# TYPE mpd_msg_queue_length gauge\n");
+    fprintf(f, "mpd_msg_queue_length %d\n", MsgQueueLen());
+    fprintf(f, "# HELP mpd_overload_percent Share of new calls rejected.\n");
+    fprintf(f, "# TYPE mpd_overload_percent gauge\n");
+    fprintf(f, "mpd_overload_percent %d\n", gOverload);
+    fprintf(f, "# HELP mpd_event_loop_lag_seconds Timer delay at last snapshot.\n");
+    fprintf(f, "# TYPE mpd_event_loop_lag_seconds gauge\n");
+    fprintf(f, "mpd_event_loop_lag_seconds %.3f\n", gMetricsLag / 1000.0);
+    fprintf(f, "# HELP mpd_event_loop_lag_max_seconds Max timer delay.\n");
+    fprintf(f, "# TYPE mpd_event_loop_lag_max_seconds gauge\n");
+    fprintf(f, "mpd_event_loop_lag_max_seconds %.3f\n", gMetricsLagMax / 1000.0);
+    EventStatLoop(&lag, &wait);
+    fprintf(f, "# HELP mpd_event_poll_wait_seconds Event loop poll(2) wait time.\n");
+    fprintf(f, "# TYPE mpd_event_poll_wait_seconds histogram\n");
+    MetricsEvHistWrite(f, "mpd_event_poll_wait_seconds", "", &wait);
+    fprintf(f, "# HELP mpd_event_timer_lag_seconds Timer run delay after deadline.\n");
+    fprintf(f, "# TYPE mpd_event_timer_lag_seconds histogram\n");
+    MetricsEvHistWrite(f, "mpd_event_timer_lag_seconds", "", &lag);
+    fprintf(f, "# HELP mpd_event_handler_seconds Event and timer handler run time.\n");
+    fprintf(f, "# TYPE mpd_event_handler_seconds histogram\n");
+    for (k = 0; (e = EventStatGet(k)) != NULL; k++) {
+	char	hlabels[128];
+	char	*p = hlabels;
+	const char	*c;
+
+	/* Names come from the code, escape just in case */
+	p += sprintf(p, "kind=\"%s\",handler=\"", e->timer ? "timer" : "event");
+	for (c = e->name; *c && p < hlabels + sizeof(hlabels) - 4; c++) {
+	    if (*c == '\\' || *c == '"')
+		*p++ = '\\';
+	    *p++ = *c;
+	}
+	strcpy(p, "\"");
+	MetricsEvHistWrite(f, "mpd_event_handler_seconds", hlabels, &e->lat);
+    }
+
+#if !defined(NOWEB) && defined(NOLIBPDEL)
+    /* Web server */
+    MetricsWeb(f);
+#endif
+
+    /* IP pools */
+    fprintf(f, "# HELP mpd_ippool_addresses IP pool addresses.\n");
+    fprintf(f, "# TYPE mpd_ippool_addresses gauge\n");
+    for (k = 0; IPPoolUsage(k, name, sizeof(name), &used, &total) == 0; k++) {
+	fprintf(f, "mpd_ippool_addresses{pool=");
+	MetricsLabel(f, name);
+	fprintf(f, ",state=\"used\"} %d\n", used);
+	fprintf(f, "mpd_ippool_addresses{pool=");
+	MetricsLabel(f, name);
+	fprintf(f, ",state=\"free\"} %d\n", total - used);
+    }
+
+    /* Memory */
+    if (typed_mem_usage(&mem) == 0) {
+	fprintf(f, "# HELP mpd_memory_bytes Memory allocated by type.\n");
+	fprintf(f, "# TYPE mpd_memory_bytes gauge\n");
+	for (k = 0; k < (int)mem.length; k++) {
+	    fprintf(f, "mpd_memory_bytes{type=");
+	    MetricsLabel(f, mem.elems[k].type);
+	    fprintf(f, "} %lu\n", (u_long)mem.elems[k].bytes);
+	}
+	fprintf(f, "# HELP mpd_memory_allocations Memory blocks allocated by type.\n");
+	fprintf(f, "# TYPE mpd_memory_allocations gauge\n");
+	for (k = 0; k < (int)mem.length; k++) {
+	    fprintf(f, "mpd_memory_allocations{type=");
+	    MetricsLabel(f, mem.elems[k].type);
+	    fprintf(f, "} %u\n", (u_int)mem.elems[k].allocs);
+	}
+	structs_free(&typed_mem_stats_type, NULL, &mem);
+    }
+}
+
+/*
+ * MetricsSessions()
+ *
+ * Collect values of links joined to bundles.
+ */
+
+static int
+MetricsSessions(struct metrics_sess **sessp)
+{
+    struct metrics_sess	*sess, *p;
+    time_t		now = time(NULL);
+    int			k, n = 0;
+    Link		l;
+
+    for (k = 0; k < gNumLinks; k++) {
+	if ((l = gLinks[k]) != NULL && l->bund != NULL && l->joined_bund)
+	    n++;
+    }
+    *sessp = NULL;
+    if (n == 0)
+	return (0);
+    p = sess = Malloc(MB_WEB, n * sizeof(*sess));
+    for (k = 0; k < gNumLinks && p < sess + n; k++) {
+	if ((l = gLinks[k]) == NULL || l->bund == NULL || !l->joined_bund)
+	    continue;
+	strlcpy(p->link, l->name, sizeof(p->link));
+	strlcpy(p->bund, l->bund->name, sizeof(p->bund));
+	strlcpy(p->iface, l->bund->iface.ifname, sizeof(p->iface));
+	strlcpy(p->user, l->lcp.auth.params.authname, sizeof(p->user));
+	p->type = l->type ? l->type->name : "";
+	p->uptime = now - l->last_up;
+	/* Latest swept counters are fresher than l->stats */
+	if (l->statsSnap.time != 0) {
+	    p->in_octets = l->statsSnap.stats.recvOctets;
+	    p->out_octets = l->statsSnap.stats.xmitOctets;
+	    p->in_frames = l->statsSnap.stats.recvFrames;
+	    p->out_frames = l->statsSnap.stats.xmitFrames;
+	} else {
+	    p->in_octets = l->stats.recvOctets;
+	    p->out_octets = l->stats.xmitOctets;
+	    p->in_frames = l->stats.recvFrames;
+	    p->out_frames = l->stats.xmitFrames;
+	}
+	p++;
+    }
+    *sessp = sess;
+    return (p - sess);
+}
+
+/*
+ * MetricsSessWrite()
+ */
+
+static void
+MetricsSessWrite(FILE *f, MetricsSnap s, int off, int lim)
+{
+    static const char	*names[] = {
+	"mpd_session_uptime_seconds",
+	"mpd_session_input_octets_total",
+	"mpd_session_output_octets_total",
+	"mpd_session_input_frames_total",
+	"mpd_session_output_frames_total",
+    };
+    struct metrics_sess	*p;
+    int			k, end;
+
+    fprintf(f, "# HELP mpd_sessions Sessions available for paging.\n");
+    fprintf(f, "# TYPE mpd_sessions gauge\n");
+    fprintf(f, "mpd_sessions %d\n", s->nsess);
+    end = (off + lim < s->nsess) ? off + lim : s->nsess;
+    for (k = 0; k < (int)(sizeof(names) / sizeof(*names)); k++) {
+	fprintf(f, "# TYPE %s %s\n", names[k], k ? "counter" : "gauge");
+	for (p = s->sess + off; p < s->sess + end; p++) {
+	    u_int64_t	v;
+
+	    switch (k) {
+		case 0: v = p->uptime; break;
+		case 1: v = p->in_octets; break;
+		case 2: v = p->out_octets; break;
+		case 3: v = p->in_frames; break;
+		default: v = p->out_frames; break;
+	    }
+	    fprintf(f, "%s{link=", names[k]);
+	    MetricsLabel(f, p->link);
+	    fprintf(f, ",bundle=");
+	    MetricsLabel(f, p->bund);
+	    fprintf(f, ",iface=");
+	    MetricsLabel(f, p->iface);
+	    fprintf(f, ",user=");
+	    MetricsLabel(f, p->user);
+	    fprintf(f, ",type=\"%s\"} %llu\n", p->type, (unsigned long long)v);
+	}
+    }
+}
+
+/*
+ * MetricsHistAdd()
+ */
+
+static void
+MetricsHistAdd(struct metrics_hist *h, u_int ms)
+{
+    u_int	k;
+
+    for (k = 0; k < METRICS_BUCKETS && ms > gMetricsBuckets[k]; k++)
+	;
+    h->bucket[k]++;
+    h->sum += ms;
+    h->count++;
+}
+
+/*
+ * MetricsHistWrite()
+ */
+
+static void
+MetricsHistWrite(FILE *f, const char *name, const char *labels,
+	const struct metrics_hist *h)
+{
+    u_int64_t	cum = 0;
+    u_int	k;
+
+    for (k = 0; k < METRICS_BUCKETS; k++) {
+	cum += h->bucket[k];
+	fprintf(f, "%s_bucket{%s,le=\"%.3f\"} %llu\n", name, labels,
+	    gMetricsBuckets[k] / 1000.0, (unsigned long long)cum);
+    }
+    fprintf(f, "%s_bucket{%s,le=\"+Inf\"} %llu\n", name, labels,
+	(unsigned long long)h->count);
+    fprintf(f, "%s_sum{%s} %.3f\n", name, labels, h->sum / 1000.0);
+    fprintf(f, "%s_count{%s} %llu\n", name, labels,
+	(unsigned long long)h->count);
+}
+
+/*
+ * MetricsEvHistWrite()
+ *
+ * Write event loop histogram, its buckets are powers of 2 usec.
+ */
+
+static void
+MetricsEvHistWrite(FILE *f, const char *name, const char *labels,
+	const struct evstat_hist *h)
+{
+    const char	*sep = labels[0] ? "," : "";
+    u_int64_t	cum = 0;
+    int		k;
+
+    for (k = 0; k < EVSTAT_BUCKETS - 1; k++) {
+	cum += h->bucket[k];
+	fprintf(f, "%s_bucket{%s%sle=\"%g\"} %llu\n", name, labels, sep,
+	    ((u_int64_t)1 << k) / 1e6, (unsigned long long)cum);
+    }
+    fprintf(f, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep,
+	(unsigned long long)h->count);
+    fprintf(f, "%s_sum{%s} %.6f\n", name, labels, h->sum / 1e6);
+    fprintf(f, "%s_count{%s} %llu\n", name, labels,
+	(unsigned long long)h->count);
+}
+
+#if !defined(NOWEB) && defined(NOLIBPDEL)
+/*
+ * MetricsWeb()
+ *
+ * Web server connections, workers and request times. The server has
+ * its own mutex, so this does not wait for requests being served.
+ */
+
+static void
+MetricsWeb(FILE *f)
+{
+    struct http_server_stats	st;
+
+    if (WebServerStats(&st) != 0)
+	return;
+    fprintf(f, "# HELP mpd_web_connections Web server open connections.\n");
+    fprintf(f, "# TYPE mpd_web_connections gauge\n");
+    fprintf(f, "mpd_web_connections{state=\"idle\"} %u\n", st.num_idle);
+    fprintf(f, "mpd_web_connections{state=\"waiting\"} %u\n", st.num_ready);
+    fprintf(f, "mpd_web_connections{state=\"active\"} %u\n",
+	st.num_conn - st.num_idle - st.num_ready);
+    fprintf(f, "# HELP mpd_web_workers Web server worker threads.\n");
+    fprintf(f, "# TYPE mpd_web_workers gauge\n");
+    fprintf(f, "mpd_web_workers{state=\"busy\"} %u\n", st.busy_workers);
+    fprintf(f, "mpd_web_workers{state=\"idle\"} %u\n",
+	st.num_workers - st.busy_workers);
+    fprintf(f, "# HELP mpd_web_streams Web event streams, out of the worker pool.\n");
+    fprintf(f, "# TYPE mpd_web_streams gauge\n");
+    fprintf(f, "mpd_web_streams %u\n", st.num_streams);
+    fprintf(f, "# HELP mpd_web_streams_refused_total Web event streams refused at max-streams.\n");
+    fprintf(f, "# TYPE mpd_web_streams_refused_total counter\n");
+    fprintf(f, "mpd_web_streams_refused_total %llu\n",
+	(unsigned long long)st.streams_refused);
+    fprintf(f, "# HELP mpd_web_accepted_total Web connections accepted.\n");
+    fprintf(f, "# TYPE mpd_web_accepted_total counter\n");
+    fprintf(f, "mpd_web_accepted_total %llu\n", (unsigned long long)st.accepted);
+    fprintf(f, "# HELP mpd_web_idle_closed_total Web connections closed by idle timeout.\n");
+    fprintf(f, "# TYPE mpd_web_idle_closed_total counter\n");
+    fprintf(f, "mpd_web_idle_closed_total %llu\n",
+	(unsigned long long)st.idle_closed);
+    fprintf(f, "# HELP mpd_web_request_seconds Web request time, read to sent.\n");
+    fprintf(f, "# TYPE mpd_web_request_seconds histogram\n");
+    MetricsWebHist(f, "mpd_web_request_seconds", &st.service);
+    fprintf(f, "# HELP mpd_web_queue_wait_seconds Web request wait for a worker.\n");
+    fprintf(f, "# TYPE mpd_web_queue_wait_seconds histogram\n");
+    MetricsWebHist(f, "mpd_web_queue_wait_seconds", &st.wait);
+}
+
+/*
+ * MetricsWebHist()
+ *
+ * Server histograms have the same buckets as event statistics.
+ */
+
+static void
+MetricsWebHist(FILE *f, const char *name, const struct http_server_hist *h)
+{
+    struct evstat_hist	eh;
+    int			k;
+
+    memset(&eh, 0, sizeof(eh));
+    for (k = 0; k < HTTP_SERVER_HIST_BUCKETS && k < EVSTAT_BUCKETS; k++)
+	eh.bucket[k] = h->bucket[k];
+    eh.count = h->count;
+    eh.sum = h->sum;
+    eh.max = h->max;
+    MetricsEvHistWrite(f, name, "", &eh);
+}
+#endif
+
+/*
+ * MetricsLabel()
+ *
+ * Write quoted label value.
+ */
+
+static void
+MetricsLabel(FILE *f, const char *s)
+{
+    putc('"', f);
+    for (; *s; s++) {
+	if (*s == '\\' || *s == '"')
+	    fprintf(f, "\\%c", *s);
+	else if (*s == '\n')
+	    fprintf(f, "\\n");
+	else
+	    putc(*s, f);
+    }
+    putc('"', f);
+}
+
+static u_int64_t
+MetricsNow(void)
+{
+    struct timespec	ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((u_int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
@@ -0,0 +1,58 @@
+
+/*
+ * metrics.h
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include "defs.h"
+#include <stdio.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  #define METRICS_DFL_PERIOD	5	/* Snapshot period, seconds */
+  #define METRICS_PAGE		1000	/* Default sessions per page */
+  #define METRICS_MAX_PAGE	10000
+
+  /* RADIUS request kinds */
+  enum {
+    METRICS_RAD_AUTH,
+    METRICS_RAD_ACCT,
+    METRICS_RAD_NUM
+  };
+
+  /* RADIUS request results */
+  enum {
+    METRICS_RAD_ACCEPT,
+    METRICS_RAD_REJECT,
+    METRICS_RAD_CHALLENGE,
+    METRICS_RAD_RESPONSE,
+    METRICS_RAD_FAILED,
+    METRICS_RAD_RES_NUM
+  };
+
+/*
+ * VARIABLES
+ */
+
+  extern int	gMetricsPeriod;		/* Snapshot period, seconds */
+  extern int	gMetricsSessions;	/* Collect per session series */
+
+/*
+ * FUNCTIONS
+ */
+
+  extern void	MetricsInit(void);
+  extern void	MetricsStart(void);
+  extern void	MetricsStop(void);
+  extern void	MetricsAuth(int authentic, int status, u_int ms);
+  extern void	MetricsSetup(int phase, u_int ms);
+  extern void	MetricsRadius(int kind, int result, u_int ms);
+  extern void	MetricsWrite(FILE *f, const char *query);
+
+#endif
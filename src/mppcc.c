@@ -0,0 +1,302 @@
+
+/*
+ * mppcc.c
+ *
+ * MPPC (RFC 2118) compressor and decompressor, used when there is
+ * no ng_mppc in the system.
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "defs.h"
+
+#if defined(CCP_MPPC) && !defined(USE_NG_MPPC)
+
+#include "mppcc.h"
+
+/*
+ * DEFINITIONS
+ */
+
+  #define MPPC_MIN_MATCH	3
+  #define MPPC_MAX_MATCH	(MPPC_HIST_LEN - 1)
+  #define MPPC_MAX_OFFSET	(MPPC_HIST_LEN - 1)
+
+  #define MPPC_HASH(p)	\
+	((((p)[0] << 9) ^ ((p)[1] << 4) ^ (p)[2]) & (MPPC_HASH_SIZE - 1))
+
+  /* Bit writer, most significant bit first */
+  #define PUTBITS(v, n)	do {					\
+	acc = (acc << (n)) | (v);				\
+	nbits += (n);						\
+	while (nbits >= 8) {					\
+	    nbits -= 8;						\
+	    *wp++ = (u_char)(acc >> nbits);			\
+	}							\
+  } while (0)
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static u_char	*PutOffset(u_char *wp, u_int32_t *accp, int *nbitsp, int off);
+  static u_char	*PutLength(u_char *wp, u_int32_t *accp, int *nbitsp, int len);
+
+/*
+ * MppccReset()
+ *
+ * Forget history. Old hash entries are harmless, every candidate
+ * match is checked against the data itself.
+ */
+
+void
+MppccReset(MppcHist h)
+{
+    h->pos = 0;
+}
+
+/*
+ * MppccCompress()
+ *
+ * Compress "len" bytes into "dst", which must have room for len + 8
+ * bytes. Returns compressed length, or -1 if the data doesn't shrink.
+ * In that case history is reset and data must be sent as is, flushed.
+ * "restart" is set when the data was put at the front of the history.
+ */
+
+int
+MppccCompress(MppcHist h, const u_char *src, int len, u_char *dst, int *restart)
+{
+    u_char		*const hist = h->hist;
+    u_char		*wp = dst;
+    u_char		*const wlim = dst + len;
+    u_int32_t		acc = 0;
+    int			nbits = 0;
+    int			i, end;
+
+    if (len <= 0 || len > MPPC_HIST_LEN) {
+	h->pos = 0;
+	return (-1);
+    }
+    if (h->pos + len > MPPC_HIST_LEN) {
+	h->pos = 0;
+	*restart = 1;
+    } else if (h->pos == 0)
+	*restart = 1;
+
+    i = h->pos;
+    end = i + len;
+    memcpy(hist + i, src, len);
+
+    while (i < end) {
+	if (wp >= wlim) {
+	    h->pos = 0;
+	    return (-1);
+	}
+	if (end - i >= MPPC_MIN_MATCH) {
+	    const u_int	k = MPPC_HASH(hist + i);
+	    const int	p = h->hash[k];
+
+	    h->hash[k] = i;
+	    if (p < i && i - p <= MPPC_MAX_OFFSET &&
+		    hist[p] == hist[i] && hist[p + 1] == hist[i + 1] &&
+		    hist[p + 2] == hist[i + 2]) {
+		int	m = MPPC_MIN_MATCH;
+		int	j;
+
+		while (i + m < end && m < MPPC_MAX_MATCH &&
+			hist[p + m] == hist[i + m])
+		    m++;
+		wp = PutOffset(wp, &acc, &nbits, i - p);
+		wp = PutLength(wp, &acc, &nbits, m);
+		for (j = 1; j < m && i + j + MPPC_MIN_MATCH <= end; j++)
+		    h->hash[MPPC_HASH(hist + i + j)] = i + j;
+		i += m;
+		continue;
+	    }
+	}
+	if (hist[i] < 0x80)
+	    PUTBITS(hist[i], 8);
+	else
+	    PUTBITS(0x100 | (hist[i] & 0x7f), 9);
+	i++;
+    }
+
+    /* Pad last byte with zero bits */
+    if (nbits > 0)
+	*wp++ = (u_char)(acc << (8 - nbits));
+    if (wp >= wlim) {
+	h->pos = 0;
+	return (-1);
+    }
+
+    h->pos = end;
+    return (wp - dst);
+}
+
+/*
+ * PutOffset()
+ */
+
+static u_char *
+PutOffset(u_char *wp, u_int32_t *accp, int *nbitsp, int off)
+{
+    u_int32_t	acc = *accp;
+    int		nbits = *nbitsp;
+
+    if (off < 64)
+	PUTBITS(0x3c0 | off, 10);
+    else if (off < 320)
+	PUTBITS(0xe00 | (off - 64), 12);
+    else
+	PUTBITS(0xc000 | (off - 320), 16);
+    *accp = acc;
+    *nbitsp = nbits;
+    return (wp);
+}
+
+/*
+ * PutLength()
+ *
+ * Length 3 is a single zero bit, otherwise k ones, a zero and k+1
+ * low bits for lengths from 2^(k+1) to 2^(k+2)-1.
+ */
+
+static u_char *
+PutLength(u_char *wp, u_int32_t *accp, int *nbitsp, int len)
+{
+    u_int32_t	acc = *accp;
+    int		nbits = *nbitsp;
+    int		k;
+
+    if (len == 3)
+	PUTBITS(0, 1);
+    else {
+	for (k = 1; (len >> (k + 2)) != 0; k++)
+	    ;
+	/* Prefix: k ones followed by a zero */
+	PUTBITS(((1 << k) - 1) << 1, k + 1);
+	PUTBITS(len & ((1 << (k + 1)) - 1), k + 1);
+    }
+    *accp = acc;
+    *nbitsp = nbits;
+    return (wp);
+}
+
+/*
+ * MppccDecompress()
+ *
+ * Decompress "len" bytes into the history. On success "dst" points
+ * to the result inside the history and its length is returned.
+ * Returns -1 if the data is broken.
+ */
+
+int
+MppccDecompress(MppcHist h, const u_char *src, int len, int flags, u_char **dst)
+{
+    u_char		*const hist = h->hist;
+    const u_char	*rp = src;
+    u_int32_t		acc = 0;	/* Next bits, left aligned */
+    int			nbits = 0;	/* Valid bits in acc */
+    int			left = len * 8;	/* Bits not yet consumed */
+    int			start, pos;
+
+    if (flags & (MPPCC_FLUSHED | MPPCC_RESTART))
+	h->pos = 0;
+    start = pos = h->pos;
+
+/* Make sure "n" bits are in acc, fail if the data ends */
+#define NEED(n)	do {						\
+	if (left < (n))						\
+	    goto fail;						\
+	while (nbits < (n)) {					\
+	    acc |= (u_int32_t)*rp++ << (24 - nbits);		\
+	    nbits += 8;						\
+	}							\
+  } while (0)
+#define PEEK(n)	(acc >> (32 - (n)))
+#define SKIP(n)	do { acc <<= (n); nbits -= (n); left -= (n); } while (0)
+
+    /* Less than 8 bits left is padding */
+    while (left >= 8) {
+	int	off, mlen, k;
+
+	NEED(8);
+	if (PEEK(1) == 0) {
+	    /* Literal below 0x80 */
+	    if (pos >= MPPC_HIST_LEN)
+		goto fail;
+	    hist[pos++] = PEEK(8);
+	    SKIP(8);
+	    continue;
+	}
+	if (PEEK(2) == 2) {
+	    /* Literal from 0x80 */
+	    NEED(9);
+	    if (pos >= MPPC_HIST_LEN)
+		goto fail;
+	    hist[pos++] = 0x80 | (PEEK(9) & 0x7f);
+	    SKIP(9);
+	    continue;
+	}
+
+	/* Copy tuple: offset first */
+	if (PEEK(3) == 6) {
+	    NEED(16);
+	    off = (PEEK(16) & 0x1fff) + 320;
+	    SKIP(16);
+	} else if (PEEK(4) == 14) {
+	    NEED(12);
+	    off = (PEEK(12) & 0xff) + 64;
+	    SKIP(12);
+	} else {
+	    NEED(10);
+	    off = PEEK(10) & 0x3f;
+	    SKIP(10);
+	}
+
+	/* Then length */
+	for (k = 0; ; k++) {
+	    NEED(1);
+	    if (PEEK(1) == 0)
+		break;
+	    SKIP(1);
+	    if (k >= 11)
+		goto fail;
+	}
+	SKIP(1);
+	if (k == 0)
+	    mlen = 3;
+	else {
+	    NEED(k + 1);
+	    mlen = (1 << (k + 1)) | PEEK(k + 1);
+	    SKIP(k + 1);
+	}
+
+	if (off == 0 || off > pos || pos + mlen > MPPC_HIST_LEN)
+	    goto fail;
+	/* Overlapping copy must go byte by byte */
+	{
+	    const u_char	*cp = hist + pos - off;
+	    u_char		*const dp = hist + pos;
+	    int			j;
+
+	    for (j = 0; j < mlen; j++)
+		dp[j] = cp[j];
+	}
+	pos += mlen;
+    }
+#undef NEED
+#undef PEEK
+#undef SKIP
+
+    h->pos = pos;
+    *dst = hist + start;
+    return (pos - start);
+
+fail:
+    h->pos = 0;
+    return (-1);
+}
+
+#endif /* CCP_MPPC && !USE_NG_MPPC */
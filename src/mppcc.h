@@ -0,0 +1,47 @@
+
+/*
+ * mppcc.h
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#ifndef _MPPCC_H_
+#define _MPPCC_H_
+
+#include <sys/types.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  #define MPPC_HIST_LEN		8192	/* History buffer size (RFC 2118) */
+  #define MPPC_HASH_BITS	13
+  #define MPPC_HASH_SIZE	(1 << MPPC_HASH_BITS)
+
+  /*
+   * One direction of MPPC history. Only data written since the last
+   * restart is referenced, so a restart never has to clear anything.
+   */
+  struct mppchist {
+    u_char	hist[MPPC_HIST_LEN];	/* History buffer */
+    int		pos;			/* Current position in history */
+    u_int16_t	hash[MPPC_HASH_SIZE];	/* Last position of 3-byte strings */
+  };
+  typedef struct mppchist	*MppcHist;
+
+/*
+ * FUNCTIONS
+ */
+
+  extern void	MppccReset(MppcHist h);
+  extern int	MppccCompress(MppcHist h, const u_char *src, int len,
+		  u_char *dst, int *restart);
+  extern int	MppccDecompress(MppcHist h, const u_char *src, int len,
+		  int flags, u_char **dst);
+
+  /* Flags for MppccDecompress() */
+  #define MPPCC_FLUSHED		0x01	/* History was flushed */
+  #define MPPCC_RESTART		0x02	/* Packet is at history front */
+
+#endif
+
@@ -9,6 +9,7 @@
 
 #include "ppp.h"
 #include "msg.h"
+#include "trace.h"
 
 /*
  * DEFINITIONS
@@ -113,6 +114,7 @@ MsgEvent(int type, void *cookie)
     while (msgqueuet != msgqueueh) {
 	Log(LG_EVENTS, ("EVENT: Message %d to %s received",
 	    msgqueue[msgqueuet].type, msgqueue[msgqueuet].dbg));
+	TraceNone();
 	(*(msgqueue[msgqueuet].func))(msgqueue[msgqueuet].type, msgqueue[msgqueuet].arg);
 	Log(LG_EVENTS, ("EVENT: Message %d to %s processed",
 	    msgqueue[msgqueuet].type, msgqueue[msgqueuet].dbg));
@@ -153,6 +155,16 @@ MsgSend(MsgHandler *m, int type, void *arg)
     Log(LG_EVENTS, ("EVENT: Message %d to %s sent", type, m->dbg));
 }
 
+/*
+ * MsgQueueLen()
+ */
+
+int
+MsgQueueLen(void)
+{
+    return (QUEUELEN());
+}
+
 /*
  * MsgName()
  */
@@ -56,6 +56,7 @@
   extern void		MsgUnRegister(MsgHandler *m);
   extern void		MsgSend(MsgHandler *m, int type, void *arg);
   extern const char	*MsgName(int msg);
+  extern int		MsgQueueLen(void);
 
 #endif
 
@@ -191,6 +191,35 @@ DesEncrypt(const u_char *clear, u_char *key0, u_char *cypher)
 #endif
 }
 
+/*
+ * MsoftGetKey()
+ *
+ * GetNewKeyFromSHA() of RFC 3079: new key from start key "h" and
+ * current key "h2", stored back into "h2".
+ */
+
+void
+MsoftGetKey(const u_char *h, u_char *h2, int len)
+{
+  static const u_char	pad1[40] = { 0 };
+  static const u_char	pad2[40] = {
+    0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2,
+    0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2,
+    0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2,
+    0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2,
+  };
+  SHA_CTX	c;
+  u_char	hash[20];
+
+  SHA1_Init(&c);
+  SHA1_Update(&c, h, len);
+  SHA1_Update(&c, pad1, sizeof(pad1));
+  SHA1_Update(&c, h2, len);
+  SHA1_Update(&c, pad2, sizeof(pad2));
+  SHA1_Final(hash, &c);
+  memcpy(h2, hash, len);
+}
+
 /*
  * MsoftGetStartKey()
  */
@@ -16,6 +16,7 @@
 #include "ppp.h"
 #include "bund.h"
 #include "ngfunc.h"
+#include "capture.h"
 #include "input.h"
 #include "ccp.h"
 #include "netgraph.h"
@@ -139,6 +140,7 @@
 #endif
   
   static int	gNgStatSock=0;
+  static u_int16_t	gNgHookGen = 0;
 
 
 #ifdef USE_NG_NETFLOW
@@ -543,6 +545,9 @@ NgFuncWritePppFrame(Bund b, int linkNum, int proto, Mbuf bp)
 {
     u_int16_t	temp;
 
+    CapturePpp((linkNum < NG_PPP_MAX_LINKS && b->links[linkNum]) ?
+	b->links[linkNum]->name : b->name, CAPT_OUT, proto, bp);
+
     /* Prepend ppp node bypass header */
     temp = htons(linkNum);
     bp = mbcopyback(bp, -4, &temp, 2);
@@ -567,6 +572,20 @@ NgFuncWritePppFrame(Bund b, int linkNum, int proto, Mbuf bp)
     return NgFuncWriteFrame(gLinksDsock, b->hook, b->name, bp);
 }
 
+/*
+ * NgFuncHookGen()
+ *
+ * Get generation for the hooks of the new link or bundle.
+ */
+
+u_int16_t
+NgFuncHookGen(void)
+{
+    if (++gNgHookGen == 0)
+	gNgHookGen++;
+    return (gNgHookGen);
+}
+
 /*
  * NgFuncWritePppFrameLink()
  *
@@ -581,6 +600,7 @@ NgFuncWritePppFrameLink(Link l, int proto, Mbuf bp)
     if (l->joined_bund) {
 	return (NgFuncWritePppFrame(l->bund, l->bundleIndex, proto, bp));
     }
+    CapturePpp(l->name, CAPT_OUT, proto, bp);
 
     /* Prepend framing */
     temp = htons(0xff03);
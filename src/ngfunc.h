@@ -30,6 +30,21 @@
   #define MPD_HOOK_TCPMSS_OUT	"tcpmss-out"
   #endif
 
+  /*
+   * Hooks of the link data socket node are named by a type character,
+   * the link or bundle index and the generation, in fixed width hex,
+   * e.g. "l00001a03f2". The generation rejects frames from stale hooks
+   * after the index was reused.
+   */
+  #define MPD_HOOK_LINK		'l'	/* Link tee node */
+  #define MPD_HOOK_BYPASS	'b'	/* Bundle ppp node bypass */
+  #define MPD_HOOK_MSS_IN	'i'	/* Incoming TCP SYN */
+  #define MPD_HOOK_MSS_OUT	'o'	/* Outgoing TCP SYN */
+  #define MPD_HOOK_DEMAND4	'4'	/* Dial-on-demand IPv4 */
+  #define MPD_HOOK_DEMAND6	'6'	/* Dial-on-demand IPv6 */
+
+  #define MPD_HOOK_TOKEN_LEN	11
+
   #define BPF_HOOK_PPP		"ppp"
   #define BPF_HOOK_IFACE	"iface"
   #define BPF_HOOK_MPD		"mpd"
@@ -71,6 +86,7 @@
   extern int	NgFuncWritePppFrame(Bund b, int linkNum, int proto, Mbuf bp);
   extern int	NgFuncWritePppFrameLink(Link l, int proto, Mbuf bp);
   extern int	NgFuncWriteFrame(int dsock, const char *hookname, const char *label, Mbuf bp);
+  extern u_int16_t	NgFuncHookGen(void);
   extern int	NgFuncClrStats(Bund b, u_int16_t linkNum);
 #ifndef NG_PPP_STATS64
   extern int	NgFuncGetStats(Bund b, u_int16_t linkNum,
@@ -99,5 +115,55 @@
   extern int	NgFuncCreateIface(Bund b, char *buf, int max);
   extern ng_ID_t	NgGetNodeID(int csock, const char *path);
 
+/*
+ * INLINE FUNCTIONS
+ */
+
+/*
+ * NgFuncHookToken()
+ *
+ * Make link data socket hook name.
+ */
+
+static __inline void
+NgFuncHookToken(char *buf, size_t size, int type, int id, u_int16_t gen)
+{
+    snprintf(buf, size, "%c%06x%04x", type, id & 0xffffff, gen);
+}
+
+/*
+ * NgFuncParseHookToken()
+ *
+ * Decode link data socket hook name. It is done for every received
+ * frame, so it is inlined into the dispatcher.
+ * Returns hook type or -1 if the name is not a valid token.
+ */
+
+static __inline int
+NgFuncParseHookToken(const char *name, int *id, u_int16_t *gen)
+{
+    u_int	v = 0;
+    int		k, d;
+
+    for (k = 1; k < MPD_HOOK_TOKEN_LEN; k++) {
+	d = name[k];
+	if (d >= '0' && d <= '9')
+	    d -= '0';
+	else if (d >= 'a' && d <= 'f')
+	    d -= 'a' - 10;
+	else
+	    return (-1);
+	v = (v << 4) | d;
+	if (k == 6) {
+	    *id = v;
+	    v = 0;
+	}
+    }
+    if (name[MPD_HOOK_TOKEN_LEN] != 0)
+	return (-1);
+    *gen = v;
+    return ((u_char)name[0]);
+}
+
 #endif
 
@@ -0,0 +1,519 @@
+
+/*
+ * ngstats.c
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "ngfunc.h"
+#include "ngstats.h"
+#include "util.h"
+
+#include <netgraph.h>
+#include <time.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  /*
+   * Every consumer of ng_ppp link statistics used to ask the node with
+   * a synchronous query of its own. Instead a periodic sweep walks all
+   * bundles and sends statistics requests for the bundle and all its
+   * joined links on a separate socket, keeping up to NGSTATS_WINDOW
+   * of them outstanding. Replies are matched to requests by token in
+   * the event loop and stored as per link snapshots. A consumer uses
+   * the snapshot if it is not older than the max age configured for
+   * that consumer, otherwise it falls back to the direct query, which
+   * updates the snapshot too. Consumers take deltas between calls, so
+   * none is given the same snapshot twice: if it was not refreshed
+   * since the last call of that consumer, it is queried directly.
+   *
+   * Requests reference bundles only by index and node ID, as the
+   * bundle may go away meanwhile, and carry the snapshot generation.
+   * Clearing the counters and the direct query both bump it, so a
+   * reply never replaces newer counters with older ones.
+   */
+
+  #define NGSTATS_WINDOW	64	/* Max outstanding requests */
+  #define NGSTATS_DFL_PERIOD	5	/* Default sweep period, seconds */
+
+  /* Outstanding request */
+  struct ngstats_req {
+    int		token;
+    int		bund;		/* Bundle index in gBundles */
+    ng_ID_t	node;
+    u_int16_t	linkNum;
+    u_int	gen;
+  };
+
+  struct ngstats_stats {
+    u_int64_t	sweeps;
+    u_int64_t	overruns;	/* Sweep still running on the next period */
+    u_int64_t	requests;
+    u_int64_t	replies;
+    u_int64_t	errors;
+    u_int64_t	lost;		/* Requests never answered */
+    u_int64_t	stale;		/* Replies for bundles gone or superseded */
+    u_int64_t	hits[NGSTATS_NUM];
+    u_int64_t	direct[NGSTATS_NUM];
+    u_int	last_requests;
+    u_int	last_time;	/* Last sweep duration, ms */
+  };
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static void			NgStatsTimeout(void *arg);
+  static void			NgStatsFill(void);
+  static int			NgStatsNext(int *bund, u_int16_t *linkNum);
+  static void			NgStatsEvent(int type, void *arg);
+  static struct ngstats_snap	*NgStatsSnap(Bund b, u_int16_t linkNum);
+  static u_int64_t		NgStatsNow(void);
+
+/*
+ * GLOBAL VARIABLES
+ */
+
+  int		gNgStatsPeriod = NGSTATS_DFL_PERIOD;
+
+  /* A sweep period, so the consumers running as often as the sweep
+     or less use its snapshots only, those running more often query
+     directly between sweeps. Idle timeout may be short, accounting
+     and commands want exact data. */
+  int		gNgStatsMaxAge[NGSTATS_NUM] = {
+    NGSTATS_DFL_PERIOD,	/* echo */
+    NGSTATS_DFL_PERIOD,	/* bm */
+    0,			/* idle */
+    30,			/* update */
+    0,			/* acct */
+    0,			/* show */
+  };
+
+/*
+ * INTERNAL VARIABLES
+ */
+
+  static const char	*gNgStatsConsumers[NGSTATS_NUM] = {
+    "echo",
+    "bm",
+    "idle",
+    "update",
+    "acct",
+    "show",
+  };
+
+  static int			gNgStatsSock = -1;
+  static EventRef		gNgStatsEvent;
+  static struct pppTimer	gNgStatsTimer;
+  static struct ngstats_req	gNgStatsReqs[NGSTATS_WINDOW];
+  static int			gNgStatsPending;
+  static int			gNgStatsRunning;	/* Sweep in progress */
+  static int			gNgStatsBund;		/* Sweep position */
+  static int			gNgStatsLink;
+  static u_int64_t		gNgStatsStarted;
+  static u_int64_t		gNgStatsActive;		/* Last reply time */
+  static u_int			gNgStatsGen;
+  static struct ngstats_stats	gNgStatsStats;
+
+/*
+ * NgStatsInit()
+ */
+
+void
+NgStatsInit(void)
+{
+    char	name[NG_NODESIZ];
+
+    snprintf(name, sizeof(name), "mpd%d-sweep", gPid);
+    if (NgMkSockNode(name, &gNgStatsSock, NULL) < 0) {
+	Perror("NGSTATS: can't create %s node", NG_SOCKET_NODE_TYPE);
+	gNgStatsSock = -1;
+	return;
+    }
+    (void)fcntl(gNgStatsSock, F_SETFD, 1);
+    (void)fcntl(gNgStatsSock, F_SETFL, O_NONBLOCK);
+    if (EventRegister(&gNgStatsEvent, EVENT_READ, gNgStatsSock,
+	    EVENT_RECURRING, NgStatsEvent, NULL) != 0) {
+	Log(LG_ERR, ("NGSTATS: can't register event"));
+	close(gNgStatsSock);
+	gNgStatsSock = -1;
+	return;
+    }
+    NgStatsSetPeriod(gNgStatsPeriod);
+}
+
+/*
+ * NgStatsShutdown()
+ */
+
+void
+NgStatsShutdown(void)
+{
+    TimerStop(&gNgStatsTimer);
+    if (gNgStatsSock >= 0) {
+	EventUnRegister(&gNgStatsEvent);
+	close(gNgStatsSock);
+	gNgStatsSock = -1;
+    }
+    gNgStatsPending = 0;
+    gNgStatsRunning = 0;
+}
+
+/*
+ * NgStatsSetPeriod()
+ *
+ * Zero period disables sweeping, consumers then read snapshots
+ * left by each other only.
+ */
+
+void
+NgStatsSetPeriod(int period)
+{
+    gNgStatsPeriod = period;
+    TimerStop(&gNgStatsTimer);
+    if (period <= 0 || gNgStatsSock < 0)
+	return;
+    TimerInit(&gNgStatsTimer, "NgStats", period * SECONDS,
+	NgStatsTimeout, NULL);
+    TimerStartRecurring(&gNgStatsTimer);
+}
+
+/*
+ * NgStatsConsumer()
+ */
+
+int
+NgStatsConsumer(const char *name)
+{
+    int		k;
+
+    for (k = 0; k < NGSTATS_NUM; k++) {
+	if (strcasecmp(name, gNgStatsConsumers[k]) == 0)
+	    return (k);
+    }
+    return (-1);
+}
+
+/*
+ * NgStatsConsumerName()
+ */
+
+const char *
+NgStatsConsumerName(int consumer)
+{
+    return (gNgStatsConsumers[consumer]);
+}
+
+/*
+ * NgStatsGet()
+ *
+ * Get link or whole bundle statistics no older than
+ * allowed for the consumer.
+ */
+
+int
+NgStatsGet(Bund b, u_int16_t linkNum, int consumer, NgLinkStat *statp)
+{
+    struct ngstats_snap	*const snap = NgStatsSnap(b, linkNum);
+    u_int64_t		now = NgStatsNow();
+    NgLinkStat		stats;
+
+    if (snap != NULL && snap->time != 0 && snap->node == b->nodeID &&
+	    snap->linkNum == linkNum && snap->time != snap->used[consumer] &&
+	    now - snap->time <= (u_int64_t)gNgStatsMaxAge[consumer] * 1000) {
+	gNgStatsStats.hits[consumer]++;
+	snap->used[consumer] = snap->time;
+	*statp = snap->stats;
+	return (0);
+    }
+
+    gNgStatsStats.direct[consumer]++;
+#ifndef NG_PPP_STATS64
+    if (NgFuncGetStats(b, linkNum, &stats) < 0)
+#else
+    if (NgFuncGetStats64(b, linkNum, &stats) < 0)
+#endif
+	return (-1);
+    if (snap != NULL) {
+	snap->stats = stats;
+	snap->time = now;
+	snap->node = b->nodeID;
+	snap->linkNum = linkNum;
+	snap->used[consumer] = now;
+	/* Requests already sent would bring older counters */
+	snap->gen = ++gNgStatsGen;
+    }
+    *statp = stats;
+    return (0);
+}
+
+/*
+ * NgStatsInvalidate()
+ *
+ * Forget snapshot after counters were cleared.
+ */
+
+void
+NgStatsInvalidate(Bund b, u_int16_t linkNum)
+{
+    struct ngstats_snap	*const snap = NgStatsSnap(b, linkNum);
+
+    if (snap != NULL) {
+	snap->time = 0;
+	snap->gen = ++gNgStatsGen;
+    }
+}
+
+/*
+ * NgStatsSnap()
+ */
+
+static struct ngstats_snap *
+NgStatsSnap(Bund b, u_int16_t linkNum)
+{
+    if (linkNum == NG_PPP_BUNDLE_LINKNUM)
+	return (&b->statsSnap);
+    if (linkNum < NG_PPP_MAX_LINKS && b->links[linkNum] != NULL)
+	return (&b->links[linkNum]->statsSnap);
+    return (NULL);
+}
+
+/*
+ * NgStatsTimeout()
+ *
+ * Start the sweep.
+ */
+
+static void
+NgStatsTimeout(void *arg)
+{
+    u_int64_t	now = NgStatsNow();
+
+    (void)arg;
+
+    if (gNgStatsRunning) {
+	if (now - gNgStatsActive < (u_int64_t)gNgStatsPeriod * 1000) {
+	    gNgStatsStats.overruns++;
+	    return;
+	}
+	/* Replies stopped coming, forget them and go on */
+	if (gNgStatsPending > 0) {
+	    Log(LG_ERR, ("NGSTATS: %d requests not answered",
+		gNgStatsPending));
+	    gNgStatsStats.lost += gNgStatsPending;
+	    gNgStatsPending = 0;
+	}
+	gNgStatsActive = now;
+	NgStatsFill();
+	return;
+    }
+    gNgStatsRunning = 1;
+    gNgStatsBund = 0;
+    gNgStatsLink = -1;
+    gNgStatsStarted = gNgStatsActive = now;
+    gNgStatsStats.last_requests = 0;
+    NgStatsFill();
+}
+
+/*
+ * NgStatsFill()
+ *
+ * Send requests until window is full or sweep is done.
+ */
+
+static void
+NgStatsFill(void)
+{
+    struct ngstats_req	*req;
+    char		path[NG_PATHSIZ];
+    int			bund, token;
+    u_int16_t		linkNum;
+    Bund		b;
+
+    while (gNgStatsPending < NGSTATS_WINDOW &&
+	    NgStatsNext(&bund, &linkNum)) {
+	b = gBundles[bund];
+	snprintf(path, sizeof(path), "[%x]:", b->nodeID);
+#ifndef NG_PPP_STATS64
+	token = NgSendMsg(gNgStatsSock, path, NGM_PPP_COOKIE,
+	    NGM_PPP_GET_LINK_STATS, &linkNum, sizeof(linkNum));
+#else
+	token = NgSendMsg(gNgStatsSock, path, NGM_PPP_COOKIE,
+	    NGM_PPP_GET_LINK_STATS64, &linkNum, sizeof(linkNum));
+#endif
+	if (token < 0) {
+	    gNgStatsStats.errors++;
+	    if (errno == ENOBUFS) {
+		/* Socket buffer is full, retry after some replies */
+		gNgStatsLink--;
+		break;
+	    }
+	    continue;
+	}
+	gNgStatsStats.requests++;
+	gNgStatsStats.last_requests++;
+	req = &gNgStatsReqs[gNgStatsPending++];
+	req->token = token;
+	req->bund = bund;
+	req->node = b->nodeID;
+	req->linkNum = linkNum;
+	req->gen = NgStatsSnap(b, linkNum)->gen;
+    }
+
+    if (gNgStatsRunning && gNgStatsPending == 0 &&
+	    gNgStatsBund >= gNumBundles) {
+	gNgStatsRunning = 0;
+	gNgStatsStats.sweeps++;
+	gNgStatsStats.last_time = NgStatsNow() - gNgStatsStarted;
+    }
+}
+
+/*
+ * NgStatsNext()
+ *
+ * Advance sweep position to the next bundle or joined link.
+ * Link position -1 stands for the bundle itself.
+ */
+
+static int
+NgStatsNext(int *bund, u_int16_t *linkNum)
+{
+    Bund	b;
+
+    if (!gNgStatsRunning)
+	return (0);
+    for (; gNgStatsBund < gNumBundles; gNgStatsBund++, gNgStatsLink = -1) {
+	b = gBundles[gNgStatsBund];
+	if (b == NULL || b->tmpl || b->dead || b->nodeID == 0 ||
+		b->n_up == 0)
+	    continue;
+	if (gNgStatsLink < 0) {
+	    gNgStatsLink = 0;
+	    *bund = gNgStatsBund;
+	    *linkNum = NG_PPP_BUNDLE_LINKNUM;
+	    return (1);
+	}
+	for (; gNgStatsLink < NG_PPP_MAX_LINKS; gNgStatsLink++) {
+	    if (b->links[gNgStatsLink] != NULL &&
+		    b->links[gNgStatsLink]->joined_bund) {
+		*bund = gNgStatsBund;
+		*linkNum = gNgStatsLink++;
+		return (1);
+	    }
+	}
+    }
+    return (0);
+}
+
+/*
+ * NgStatsEvent()
+ *
+ * Read all replies available and store snapshots.
+ */
+
+static void
+NgStatsEvent(int type, void *arg)
+{
+    union {
+	u_char		buf[sizeof(struct ng_mesg) + sizeof(NgLinkStat)];
+	struct ng_mesg	reply;
+    }			u;
+    struct ngstats_snap	*snap;
+    struct ngstats_req	req;
+    u_int64_t		now;
+    Bund		b;
+    int			k;
+
+    (void)type;
+    (void)arg;
+
+    now = NgStatsNow();
+    while (NgRecvMsg(gNgStatsSock, &u.reply, sizeof(u), NULL) >= 0) {
+	for (k = 0; k < gNgStatsPending; k++) {
+	    if (gNgStatsReqs[k].token == (int)u.reply.header.token)
+		break;
+	}
+	if (k == gNgStatsPending) {
+	    /* Reply to request we gave up on */
+	    gNgStatsStats.stale++;
+	    continue;
+	}
+	req = gNgStatsReqs[k];
+	gNgStatsReqs[k] = gNgStatsReqs[--gNgStatsPending];
+	gNgStatsStats.replies++;
+	gNgStatsActive = now;
+
+	if (u.reply.header.arglen < sizeof(NgLinkStat)) {
+	    gNgStatsStats.errors++;
+	    continue;
+	}
+	if (req.bund >= gNumBundles || (b = gBundles[req.bund]) == NULL ||
+		b->nodeID != req.node ||
+		(snap = NgStatsSnap(b, req.linkNum)) == NULL ||
+		snap->gen != req.gen) {
+	    gNgStatsStats.stale++;
+	    continue;
+	}
+	memcpy(&snap->stats, u.reply.data, sizeof(snap->stats));
+	snap->time = now;
+	snap->node = req.node;
+	snap->linkNum = req.linkNum;
+    }
+    if (errno != EAGAIN)
+	Perror("NGSTATS: can't read reply");
+    NgStatsFill();
+}
+
+/*
+ * NgStatsStat()
+ */
+
+int
+NgStatsStat(Context ctx, int ac, const char *const av[], const void *arg)
+{
+    int		k;
+
+    (void)ac;
+    (void)av;
+    (void)arg;
+
+    Printf("Statistics collector:\r\n");
+    if (gNgStatsSock < 0)
+	Printf("\tSweep period   : not available\r\n");
+    else if (gNgStatsPeriod > 0)
+	Printf("\tSweep period   : %d seconds\r\n", gNgStatsPeriod);
+    else
+	Printf("\tSweep period   : disabled\r\n");
+    Printf("\tRunning        : %s\r\n", gNgStatsRunning ? "yes" : "no");
+    Printf("\tOutstanding    : %d\r\n", gNgStatsPending);
+    Printf("\tSweeps         : %llu\r\n", (unsigned long long)gNgStatsStats.sweeps);
+    Printf("\tOverruns       : %llu\r\n", (unsigned long long)gNgStatsStats.overruns);
+    Printf("\tLast sweep     : %u requests, %u ms\r\n",
+	gNgStatsStats.last_requests, gNgStatsStats.last_time);
+    Printf("\tRequests       : %llu\r\n", (unsigned long long)gNgStatsStats.requests);
+    Printf("\tReplies        : %llu\r\n", (unsigned long long)gNgStatsStats.replies);
+    Printf("\tErrors         : %llu\r\n", (unsigned long long)gNgStatsStats.errors);
+    Printf("\tLost           : %llu\r\n", (unsigned long long)gNgStatsStats.lost);
+    Printf("\tStale          : %llu\r\n", (unsigned long long)gNgStatsStats.stale);
+    Printf("Consumers:\r\n");
+    Printf("\tName\tMax age\tCached\tDirect\r\n");
+    for (k = 0; k < NGSTATS_NUM; k++) {
+	Printf("\t%s\t%d\t%llu\t%llu\r\n", gNgStatsConsumers[k],
+	    gNgStatsMaxAge[k],
+	    (unsigned long long)gNgStatsStats.hits[k],
+	    (unsigned long long)gNgStatsStats.direct[k]);
+    }
+    return (0);
+}
+
+static u_int64_t
+NgStatsNow(void)
+{
+    struct timespec	ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((u_int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
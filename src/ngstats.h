@@ -0,0 +1,69 @@
+
+/*
+ * ngstats.h
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#ifndef _NGSTATS_H_
+#define _NGSTATS_H_
+
+#include "defs.h"
+#include <sys/types.h>
+#include <netgraph/ng_message.h>
+#include <netgraph/ng_ppp.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  /* Consumers of ng_ppp statistics, each with its own max snapshot age */
+  enum {
+    NGSTATS_ECHO,		/* LCP echo link quality check */
+    NGSTATS_BM,			/* Bandwidth management */
+    NGSTATS_IDLE,		/* Interface idle timeout */
+    NGSTATS_UPDATE,		/* 32bit counters overflow protection */
+    NGSTATS_ACCT,		/* Accounting */
+    NGSTATS_SHOW,		/* Status commands */
+    NGSTATS_NUM
+  };
+
+#ifndef NG_PPP_STATS64
+  typedef struct ng_ppp_link_stat	NgLinkStat;
+#else
+  typedef struct ng_ppp_link_stat64	NgLinkStat;
+#endif
+
+  /* Cached statistics of one ng_ppp link or the whole bundle */
+  struct ngstats_snap {
+    NgLinkStat		stats;
+    u_int64_t		time;		/* When taken, ms; zero if not valid */
+    ng_ID_t		node;		/* ng_ppp node ID */
+    u_int16_t		linkNum;	/* Link number in the node */
+    u_int		gen;		/* Bumped on clear and direct query */
+    u_int64_t		used[NGSTATS_NUM];	/* Time of snapshot last
+						   given to the consumer */
+  };
+
+/*
+ * VARIABLES
+ */
+
+  extern int	gNgStatsPeriod;			/* Sweep period, seconds */
+  extern int	gNgStatsMaxAge[NGSTATS_NUM];	/* Max snapshot age, seconds */
+
+/*
+ * FUNCTIONS
+ */
+
+  extern void		NgStatsInit(void);
+  extern void		NgStatsShutdown(void);
+  extern void		NgStatsSetPeriod(int period);
+  extern int		NgStatsConsumer(const char *name);
+  extern const char	*NgStatsConsumerName(int consumer);
+  extern int		NgStatsGet(Bund b, u_int16_t linkNum, int consumer,
+			  NgLinkStat *statp);
+  extern void		NgStatsInvalidate(Bund b, u_int16_t linkNum);
+  extern int		NgStatsStat(Context ctx, int ac, const char *const av[], const void *arg);
+
+#endif
@@ -11,6 +11,7 @@
 #include "msg.h"
 #include "link.h"
 #include "devices.h"
+#include "trace.h"
 #include "util.h"
 
 #include <netgraph/ng_tee.h>
@@ -147,8 +148,11 @@ PhysClose(Link l)
 void
 PhysUp(Link l)
 {
+    TraceLinkUpdate(l, NULL);
+    TraceLink(l);
     Log(LG_PHYS2, ("[%s] device: UP event", l->name));
     l->last_up = time(NULL);
+    LinkSetupMark(l, LINK_SETUP_PHYS_UP, 0);
     if (!l->rep) {
 	LinkUp(l);
     } else {
@@ -163,6 +167,7 @@ PhysUp(Link l)
 void
 PhysDown(Link l, const char *reason, const char *details)
 {
+    TraceLink(l);
     Log(LG_PHYS2, ("[%s] device: DOWN event", l->name));
     if (!l->rep) {
 	RecordLinkUpDownReason(NULL, l, 0, reason, details);
@@ -184,6 +189,10 @@ PhysIncoming(Link l)
 {
     const char	*rept;
     
+    TraceLinkUpdate(l, NULL);
+    TraceLink(l);
+    memset(l->setup, 0, sizeof(l->setup));
+    LinkSetupMark(l, LINK_SETUP_START, 0);
     rept = LinkMatchAction(l, 1, NULL);
     if (rept) {
 	if (strcmp(rept,"##DROP##") == 0) {
@@ -590,6 +599,7 @@ PhysMsg(int type, void *arg)
 	UNREF(l);
 	return;
     }
+    TraceLink(l);
     Log(LG_PHYS2, ("[%s] device: %s event",
 	l->name, MsgName(type)));
     switch (type) {
@@ -599,6 +609,11 @@ PhysMsg(int type, void *arg)
 	    PhysUp(l);
 	    break;
 	}
+	if (l->state == PHYS_STATE_DOWN) {
+	    /* Dialing out, incoming calls start in PhysIncoming() */
+	    memset(l->setup, 0, sizeof(l->setup));
+	    LinkSetupMark(l, LINK_SETUP_START, 0);
+	}
         (*l->type->open)(l);
         break;
     case MSG_CLOSE:
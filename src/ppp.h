@@ -60,6 +60,7 @@
 
 #include "defs.h"
 #include "msg.h"
+#include "giant.h"
 
 /*
  * DEFINITIONS
@@ -85,11 +86,27 @@
 
 #endif /* __clang__ */
 
-  /* Giant Mutex handling */
-  #define GIANT_MUTEX_LOCK()	assert(pthread_mutex_lock(&gGiantMutex) == 0)
-  #define GIANT_MUTEX_UNLOCK()	assert(pthread_mutex_unlock(&gGiantMutex) == 0)
+  /* Giant Mutex handling, profiled by site if enabled */
+  #define GIANT_MUTEX_LOCK()	do {					\
+				    if (gGiantProf)			\
+					GiantProfLock(__FILE__, __LINE__); \
+				    else				\
+					assert(pthread_mutex_lock(&gGiantMutex) == 0); \
+				} while (0)
+  #define GIANT_MUTEX_UNLOCK()	do {					\
+				    if (gGiantHolder)			\
+					GiantProfUnlock();		\
+				    else				\
+					assert(pthread_mutex_unlock(&gGiantMutex) == 0); \
+				} while (0)
 
-  #define MUTEX_LOCK(m)		assert(pthread_mutex_lock(&m) == 0)
+  #define MUTEX_LOCK(m)		do {					\
+				    if (gGiantProf)			\
+					GiantProfMutex(&(m), #m,	\
+					    __FILE__, __LINE__);	\
+				    else				\
+					assert(pthread_mutex_lock(&(m)) == 0); \
+				} while (0)
   #define MUTEX_UNLOCK(m)	assert(pthread_mutex_unlock(&m) == 0)
 
   #define RWLOCK_RDLOCK(m)	assert(pthread_rwlock_rdlock(&m) == 0)
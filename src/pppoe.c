@@ -11,6 +11,7 @@
 #include "pppoe.h"
 #include "ngfunc.h"
 #include "log.h"
+#include "capture.h"
 #include "util.h"
 
 #include <paths.h>
@@ -1274,6 +1275,7 @@ PppoeListenEvent(int type, void *arg)
 	}
 
 	session = rhook + 7;
+	CapturePppoe(PIf->ifnodepath, response, sz);
 
 	if ((size_t)sz < sizeof(struct pppoe_full_hdr)) {
 		Log(LG_PHYS, ("Incoming truncated PPPoE connection request via %s for "
@@ -1319,7 +1321,7 @@ PppoeListenEvent(int type, void *arg)
 	    "service \"%s\" from %s", PIf->ifnodepath, real_session,
 	    ether_ntoa((const struct ether_addr *)&wh->eh.ether_shost)));
 
-	if (gLogOptions & LG_PHYS3)
+	if (LogEnabled(LG_PHYS3))
 	    print_tags(ph);
 
 	if (gShutdownInProgress) {
@@ -1904,7 +1904,7 @@ PptpCtrlDump(int level, int type, void *msg)
   char		line[DUMP_MAX_BUF];
   int		off;
 
-  if (!(gLogOptions & level))
+  if (!LogEnabled(level))
     return;
   for (*line = off = 0; field->name; off += field->length, field++) {
     u_char	*data = (u_char *) msg + off;
@@ -27,6 +27,7 @@
 #ifdef PHYSTYPE_NG_SOCKET
 #include "ng.h"
 #endif
+#include "metrics.h"
 #include "util.h"
 
 #include <sys/types.h>
@@ -45,6 +46,8 @@
   static int	RadiusPutAcct(AuthData auth);
   static int	RadiusGetParams(AuthData auth, int eap_proxy);
   static int	RadiusSendRequest(AuthData auth);
+  static void	RadiusMetrics(AuthData auth, const struct timespec *t0,
+		  int result);
   static void	RadiusLogError(AuthData auth, const char *errmsg);
 
 /* Set menu options */
@@ -1284,14 +1287,17 @@ RadiusSendRequest(AuthData auth)
 {
     struct timeval	timelimit;
     struct timeval	tv;
+    struct timespec	t0;
     int 		fd, n;
 
     Log(LG_RADIUS2, ("[%s] RADIUS: Send request for user '%s'", 
 	auth->info.lnkname, auth->params.authname));
+    clock_gettime(CLOCK_MONOTONIC, &t0);
     n = rad_init_send_request(auth->radius.handle, &fd, &tv);
     if (n != 0) {
 	Log(LG_ERR|LG_RADIUS, ("[%s] RADIUS: rad_init_send_request failed: %d %s",
 	    auth->info.lnkname, n, rad_strerror(auth->radius.handle)));
+	RadiusMetrics(auth, &t0, METRICS_RAD_FAILED);
 	return (RAD_NACK);
     }
 
@@ -1310,6 +1316,7 @@ RadiusSendRequest(AuthData auth)
 	if (n == -1) {
 	    Log(LG_ERR|LG_RADIUS, ("[%s] RADIUS: poll failed %s",
 	        auth->info.lnkname, strerror(errno)));
+	    RadiusMetrics(auth, &t0, METRICS_RAD_FAILED);
 	    return (RAD_NACK);
 	}
 
@@ -1337,40 +1344,63 @@ RadiusSendRequest(AuthData auth)
     	    Log(LG_RADIUS, ("[%s] RADIUS: Rec'd RAD_ACCESS_ACCEPT for user '%s'", 
     		auth->info.lnkname, auth->params.authname));
     	    auth->status = AUTH_STATUS_SUCCESS;
+	    RadiusMetrics(auth, &t0, METRICS_RAD_ACCEPT);
     	    break;
 
 	case RAD_ACCESS_CHALLENGE:
     	    Log(LG_RADIUS, ("[%s] RADIUS: Rec'd RAD_ACCESS_CHALLENGE for user '%s'", 
     		auth->info.lnkname, auth->params.authname));
+	    RadiusMetrics(auth, &t0, METRICS_RAD_CHALLENGE);
     	    break;
 
 	case RAD_ACCESS_REJECT:
     	    Log(LG_RADIUS, ("[%s] RADIUS: Rec'd RAD_ACCESS_REJECT for user '%s'", 
     		auth->info.lnkname, auth->params.authname));
     	    auth->status = AUTH_STATUS_FAIL;
+	    RadiusMetrics(auth, &t0, METRICS_RAD_REJECT);
     	    break;
 
 	case RAD_ACCOUNTING_RESPONSE:
     	    Log(auth->acct_type != AUTH_ACCT_UPDATE ? LG_RADIUS : LG_RADIUS2,
 		("[%s] RADIUS: Rec'd RAD_ACCOUNTING_RESPONSE for user '%s'", 
     		auth->info.lnkname, auth->params.authname));
+	    RadiusMetrics(auth, &t0, METRICS_RAD_RESPONSE);
     	    break;
 
 	case -1:
     	    Log(LG_RADIUS, ("[%s] RADIUS: rad_send_request for user '%s' failed: %s",
     		auth->info.lnkname, auth->params.authname,
 		rad_strerror(auth->radius.handle)));
+	    RadiusMetrics(auth, &t0, METRICS_RAD_FAILED);
     	    return (RAD_NACK);
       
 	default:
     	    Log(LG_ERR|LG_RADIUS, ("[%s] RADIUS: rad_send_request: unexpected return value: %d", 
     		auth->info.lnkname, n));
+	    RadiusMetrics(auth, &t0, METRICS_RAD_FAILED);
     	    return (RAD_NACK);
     }
 
     return (RadiusGetParams(auth, n == RAD_ACCESS_CHALLENGE));
 }
 
+/*
+ * RadiusMetrics()
+ *
+ * Account finished request, accounting ones have acct_type set.
+ */
+
+static void
+RadiusMetrics(AuthData auth, const struct timespec *t0, int result)
+{
+    struct timespec	t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    MetricsRadius(auth->acct_type ? METRICS_RAD_ACCT : METRICS_RAD_AUTH,
+	result, (t1.tv_sec - t0->tv_sec) * 1000 +
+	(t1.tv_nsec - t0->tv_nsec) / 1000000);
+}
+
 static int
 RadiusGetParams(AuthData auth, int eap_proxy)
 {
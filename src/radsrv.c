@@ -9,6 +9,7 @@
 
 #include "ppp.h"
 #include "radsrv.h"
+#include "sessevent.h"
 #include "util.h"
 
 #include <stdint.h>
@@ -586,6 +587,7 @@ RadsrvEvent(int type, void *cookie)
 			IfaceIpv6IfaceUp(B, 1);
 		    IfaceUp(B, 1);
 		}
+		SessEventPost(SESSEV_COA, L, B, NULL);
 	    }
 	}
     }
@@ -0,0 +1,684 @@
+
+/*
+ * rtqueue.c
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "iface.h"
+#include "rtqueue.h"
+#include "util.h"
+
+#include <sys/sockio.h>
+#include <net/if.h>
+#include <net/if_var.h>
+#include <net/route.h>
+#include <netinet/in_var.h>
+#include <netinet6/nd6.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  /*
+   * Interface addresses and routes are not programmed directly from
+   * the event handlers. Operations are queued in order and executed
+   * in batches by a separate thread on persistent sockets. Results
+   * are processed back in the event loop, where operations may be
+   * referenced only by bundle index and interface address family
+   * sequence number, as the bundle may change or go away meanwhile.
+   *
+   * Operation pending in queue is dropped together with the opposite
+   * one queued later for the same interface, address and gateway,
+   * so quickly reconnecting sessions do not touch the kernel at all.
+   */
+
+  enum {
+    RTOP_ADDR_ADD,
+    RTOP_ADDR_DEL,
+    RTOP_ROUTE_ADD,
+    RTOP_ROUTE_DEL,
+    RTOP_DONE
+  };
+
+  struct rtop {
+    int			type;
+    int			bund;		/* Bundle index in gBundles */
+    u_int		seq;		/* Address family up sequence */
+    int			af;		/* Address family */
+    char		bname[LINK_MAX_NAME];
+    char		ifname[IFNAMSIZ];
+    u_int		ifindex;
+    struct u_range	dst;		/* Address or route destination */
+    struct u_addr	gw;		/* Peer address or gateway */
+    u_char		nogw;		/* No peer address or gateway */
+    int			rtseq;		/* Routing message sequence */
+    int			error;		/* Operation failed */
+    RtQueueDoneFn	done;
+    STAILQ_ENTRY(rtop)	next;
+  };
+  typedef struct rtop	*RtOp;
+
+  STAILQ_HEAD(rtop_head, rtop);
+
+  struct rtbatch {
+    struct rtop_head	ops;
+    u_int		len;
+  };
+  typedef struct rtbatch	*RtBatch;
+
+  struct rtqueue_stats {
+    u_int64_t	queued;
+    u_int64_t	coalesced;
+    u_int64_t	batches;
+    u_int64_t	executed;
+    u_int64_t	failed;
+    u_int	max_batch;
+  };
+
+  struct rtmsg {
+    struct rt_msghdr m_rtm;
+    char m_space[256];
+  };
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static RtOp		RtQueueOp(Bund b, u_int seq, int type, int af);
+  static void		RtQueuePut(RtOp op, int opposite);
+  static void		RtQueueStart(void *arg);
+  static void		RtQueueRun(void *arg);
+  static void		RtQueueFinish(void *arg, int was_canceled);
+  static Bund		RtQueueBund(RtOp op);
+  static void		RtQueueExec(RtOp op);
+  static int		RtQueueSocket(int *s, int domain, int type);
+  static int		RtQueueChangeAddr(RtOp op);
+  static int		RtQueueSetRoute(RtOp op);
+  static size_t		memcpy_roundup(char *cp, const void *data, size_t len);
+
+/*
+ * INTERNAL VARIABLES
+ */
+
+  static struct rtop_head	gRtPending;
+  static u_int			gRtPendingLen;
+  static u_int			gRtRunningLen;
+  static struct paction		*gRtAction;
+  static struct pppTimer	gRtTimer;
+  static u_int			gRtSeq;
+  static struct rtqueue_stats	gRtStats;
+
+  /* Sockets are used only with this mutex held. */
+  static pthread_mutex_t	gRtExecMutex;
+  static int			gRtSock = -1;
+  static int			gRtInetSock = -1;
+  static int			gRtInet6Sock = -1;
+
+/*
+ * RtQueueInit()
+ */
+
+void
+RtQueueInit(void)
+{
+    int ret = pthread_mutex_init(&gRtExecMutex, NULL);
+    if (ret != 0) {
+	Log(LG_ERR, ("Could not create route queue mutex: %d", ret));
+	exit(EX_UNAVAILABLE);
+    }
+    STAILQ_INIT(&gRtPending);
+    TimerInit(&gRtTimer, "RtQueue", 0, RtQueueStart, NULL);
+}
+
+/*
+ * RtQueueShutdown()
+ *
+ * Execute operations still pending synchronously, so that nothing
+ * is left behind on exit.
+ */
+
+void
+RtQueueShutdown(void)
+{
+    RtOp	op;
+
+    MUTEX_LOCK(gRtExecMutex);
+    while ((op = STAILQ_FIRST(&gRtPending)) != NULL) {
+	STAILQ_REMOVE_HEAD(&gRtPending, next);
+	if (op->type != RTOP_DONE)
+	    RtQueueExec(op);
+	Freee(op);
+    }
+    gRtPendingLen = 0;
+    MUTEX_UNLOCK(gRtExecMutex);
+}
+
+/*
+ * RtQueueNewSeq()
+ *
+ * Get a new sequence number for the interface address family going up.
+ * Results of operations queued with an old sequence number are ignored.
+ */
+
+u_int
+RtQueueNewSeq(void)
+{
+    return (++gRtSeq);
+}
+
+/*
+ * RtQueueAddr()
+ *
+ * Queue adding or removing address of the bundle interface.
+ */
+
+void
+RtQueueAddr(Bund b, u_int seq, int add, struct u_range *self,
+	struct u_addr *peer)
+{
+    RtOp	op;
+
+    op = RtQueueOp(b, seq, add ? RTOP_ADDR_ADD : RTOP_ADDR_DEL,
+	self->addr.family);
+    u_rangecopy(self, &op->dst);
+    if (peer != NULL)
+	u_addrcopy(peer, &op->gw);
+    else
+	op->nogw = 1;
+    RtQueuePut(op, add ? RTOP_ADDR_DEL : RTOP_ADDR_ADD);
+}
+
+/*
+ * RtQueueRoute()
+ *
+ * Queue adding or deleting route via the bundle interface.
+ */
+
+void
+RtQueueRoute(Bund b, u_int seq, int cmd, struct u_range *dst,
+	struct u_addr *gw)
+{
+    RtOp	op;
+
+    op = RtQueueOp(b, seq, (cmd == RTM_ADD) ? RTOP_ROUTE_ADD : RTOP_ROUTE_DEL,
+	u_rangefamily(dst));
+    op->rtseq = ++gRouteSeq;
+    u_rangecopy(dst, &op->dst);
+    if (gw != NULL)
+	u_addrcopy(gw, &op->gw);
+    else
+	op->nogw = 1;
+    RtQueuePut(op, (cmd == RTM_ADD) ? RTOP_ROUTE_DEL : RTOP_ROUTE_ADD);
+}
+
+/*
+ * RtQueueDone()
+ *
+ * Queue a call of fn after operations queued so far.
+ */
+
+void
+RtQueueDone(Bund b, u_int seq, int af, RtQueueDoneFn fn)
+{
+    RtOp	op;
+
+    op = RtQueueOp(b, seq, RTOP_DONE, af);
+    op->done = fn;
+    RtQueuePut(op, -1);
+}
+
+/*
+ * RtQueueFlush()
+ *
+ * Schedule execution of queued operations. Everything queued until
+ * the event loop gets to it, or while the previous batch is running,
+ * is executed in one batch.
+ */
+
+void
+RtQueueFlush(void)
+{
+    if (!TimerStarted(&gRtTimer))
+	TimerStart(&gRtTimer);
+}
+
+/*
+ * RtQueueStat()
+ */
+
+int
+RtQueueStat(Context ctx, int ac, const char *const av[], const void *arg)
+{
+    (void)ac;
+    (void)av;
+    (void)arg;
+
+    Printf("Route queue:\r\n");
+    Printf("\tPending        : %u\r\n", gRtPendingLen);
+    Printf("\tRunning        : %u\r\n", gRtRunningLen);
+    Printf("\tQueued         : %llu\r\n", (unsigned long long)gRtStats.queued);
+    Printf("\tCoalesced      : %llu\r\n", (unsigned long long)gRtStats.coalesced);
+    Printf("\tBatches        : %llu\r\n", (unsigned long long)gRtStats.batches);
+    Printf("\tLargest batch  : %u\r\n", gRtStats.max_batch);
+    Printf("\tExecuted       : %llu\r\n", (unsigned long long)gRtStats.executed);
+    Printf("\tFailed         : %llu\r\n", (unsigned long long)gRtStats.failed);
+    return (0);
+}
+
+/*
+ * RtQueueOp()
+ */
+
+static RtOp
+RtQueueOp(Bund b, u_int seq, int type, int af)
+{
+    RtOp	op;
+
+    op = Malloc(MB_IFACE, sizeof(*op));
+    op->type = type;
+    op->bund = b->id;
+    op->seq = seq;
+    op->af = af;
+    strlcpy(op->bname, b->name, sizeof(op->bname));
+    strlcpy(op->ifname, b->iface.ifname, sizeof(op->ifname));
+    op->ifindex = b->iface.ifindex;
+    return (op);
+}
+
+/*
+ * RtQueuePut()
+ *
+ * Append operation to the pending queue, or drop it together with
+ * the pending opposite one.
+ */
+
+static void
+RtQueuePut(RtOp op, int opposite)
+{
+    RtOp	o;
+
+    gRtStats.queued++;
+    STAILQ_FOREACH(o, &gRtPending, next) {
+	if (o->type == opposite && o->af == op->af &&
+		strcmp(o->ifname, op->ifname) == 0 &&
+		u_rangecompare(&o->dst, &op->dst) == 0 &&
+		o->nogw == op->nogw &&
+		(op->nogw || u_addrcompare(&o->gw, &op->gw) == 0))
+	    break;
+    }
+    if (o != NULL) {
+	char	buf[48];
+
+	Log(LG_IFACE2, ("[%s] IFACE: %s %s coalesced on %s",
+	    op->bname, (op->type == RTOP_ADDR_ADD || op->type == RTOP_ADDR_DEL) ?
+	    "Address" : "Route", u_rangetoa(&op->dst, buf, sizeof(buf)),
+	    op->ifname));
+	STAILQ_REMOVE(&gRtPending, o, rtop, next);
+	gRtPendingLen--;
+	gRtStats.coalesced += 2;
+	Freee(o);
+	Freee(op);
+	return;
+    }
+    STAILQ_INSERT_TAIL(&gRtPending, op, next);
+    gRtPendingLen++;
+}
+
+/*
+ * RtQueueStart()
+ *
+ * Pass all pending operations to the new thread.
+ */
+
+static void
+RtQueueStart(void *arg)
+{
+    RtBatch	batch;
+
+    (void)arg;
+    if (gRtAction != NULL || STAILQ_EMPTY(&gRtPending))
+	return;
+
+    batch = Malloc(MB_IFACE, sizeof(*batch));
+    STAILQ_INIT(&batch->ops);
+    STAILQ_CONCAT(&batch->ops, &gRtPending);
+    batch->len = gRtPendingLen;
+    gRtPendingLen = 0;
+
+    if (paction_start(&gRtAction, &gGiantMutex, RtQueueRun,
+	    RtQueueFinish, batch) == -1) {
+	Perror("IFACE: Couldn't start route queue thread");
+	/* Do it here, better late then never. */
+	RtQueueRun(batch);
+	RtQueueFinish(batch, 0);
+	return;
+    }
+    gRtRunningLen = batch->len;
+    gRtStats.batches++;
+    if (batch->len > gRtStats.max_batch)
+	gRtStats.max_batch = batch->len;
+}
+
+/*
+ * RtQueueRun()
+ *
+ * Route queue thread, called from a paction.
+ * NOTE: Thread safety is needed here
+ */
+
+static void
+RtQueueRun(void *arg)
+{
+    RtBatch	const batch = (RtBatch)arg;
+    RtOp	op;
+
+    MUTEX_LOCK(gRtExecMutex);
+    STAILQ_FOREACH(op, &batch->ops, next) {
+	if (op->type != RTOP_DONE)
+	    RtQueueExec(op);
+    }
+    MUTEX_UNLOCK(gRtExecMutex);
+}
+
+/*
+ * RtQueueFinish()
+ *
+ * Process results of the batch in the event loop.
+ */
+
+static void
+RtQueueFinish(void *arg, int was_canceled)
+{
+    RtBatch	const batch = (RtBatch)arg;
+    RtOp	op, o;
+    Bund	b;
+    IfaceRoute	r;
+    int		failed;
+
+    gRtRunningLen = 0;
+    STAILQ_FOREACH(op, &batch->ops, next) {
+	if (was_canceled)
+	    break;
+	if (op->type != RTOP_DONE) {
+	    gRtStats.executed++;
+	    if (op->error)
+		gRtStats.failed++;
+	}
+	if ((b = RtQueueBund(op)) == NULL)
+	    continue;
+	switch (op->type) {
+	    case RTOP_ROUTE_ADD:
+		if (!op->error)
+		    break;
+		SLIST_FOREACH(r, &b->iface.routes, next) {
+		    if (u_rangecompare(&r->dest, &op->dst) == 0)
+			r->ok = 0;
+		}
+		SLIST_FOREACH(r, &b->params.routes, next) {
+		    if (u_rangecompare(&r->dest, &op->dst) == 0)
+			r->ok = 0;
+		}
+		break;
+	    case RTOP_DONE:
+		/* Address is queued in the same batch before us. */
+		failed = 0;
+		for (o = STAILQ_FIRST(&batch->ops); o != op;
+			o = STAILQ_NEXT(o, next)) {
+		    if (o->type == RTOP_ADDR_ADD && o->error &&
+			    o->bund == op->bund && o->seq == op->seq)
+			failed = 1;
+		}
+		/* This may queue and flush more operations. */
+		(*op->done)(b, failed);
+		break;
+	}
+    }
+    while ((op = STAILQ_FIRST(&batch->ops)) != NULL) {
+	STAILQ_REMOVE_HEAD(&batch->ops, next);
+	Freee(op);
+    }
+    Freee(batch);
+
+    if (!was_canceled && !STAILQ_EMPTY(&gRtPending))
+	RtQueueFlush();
+}
+
+/*
+ * RtQueueBund()
+ *
+ * Get the bundle, if operation result is still of interest for it.
+ */
+
+static Bund
+RtQueueBund(RtOp op)
+{
+    Bund	b;
+
+    if (op->bund < 0 || op->bund >= gNumBundles ||
+	    (b = gBundles[op->bund]) == NULL)
+	return (NULL);
+    if ((op->af == AF_INET6 ? b->iface.ipv6_rtseq : b->iface.ip_rtseq) !=
+	    op->seq)
+	return (NULL);
+    return (b);
+}
+
+/*
+ * RtQueueExec()
+ *
+ * Called with exec mutex held.
+ */
+
+static void
+RtQueueExec(RtOp op)
+{
+    int		res;
+
+    if (op->type == RTOP_ADDR_ADD || op->type == RTOP_ADDR_DEL)
+	res = RtQueueChangeAddr(op);
+    else
+	res = RtQueueSetRoute(op);
+    op->error = (res != 0);
+}
+
+static int
+RtQueueSocket(int *s, int domain, int type)
+{
+    if (*s >= 0)
+	return (*s);
+    if ((*s = socket(domain, type, 0)) < 0)
+	return (-1);
+    (void)fcntl(*s, F_SETFD, 1);
+    /* We do not want to read back routing messages. */
+    if (domain == PF_ROUTE)
+	shutdown(*s, SHUT_RD);
+    return (*s);
+}
+
+#if defined(__KAME__) && !defined(NOINET6)
+static void
+add_scope(struct sockaddr *sa, int ifindex)
+{
+  struct sockaddr_in6 *sa6;
+
+  if (sa->sa_family != AF_INET6)
+    return;
+  sa6 = (struct sockaddr_in6 *)(void *)sa;
+  if (!IN6_IS_ADDR_LINKLOCAL(&sa6->sin6_addr) &&
+      !IN6_IS_ADDR_MC_LINKLOCAL(&sa6->sin6_addr))
+    return;
+  if (sa6->sin6_addr.__u6_addr.__u6_addr16[1] != 0)
+    return;
+  sa6->sin6_addr.__u6_addr.__u6_addr16[1] = htons(ifindex);
+}
+#endif
+
+static int
+RtQueueChangeAddr(RtOp op)
+{
+    struct ifaliasreq ifra;
+    struct in6_aliasreq ifra6;
+    struct sockaddr_in *me4, *msk4, *peer4;
+    struct sockaddr_storage ssself, sspeer, ssmsk;
+    int add = (op->type == RTOP_ADDR_ADD);
+    int res = 0;
+    int s;
+    char buf[48], buf1[48];
+
+    Log(LG_IFACE2, ("[%s] IFACE: %s address %s->%s %s %s",
+	op->bname, add?"Add":"Remove", u_rangetoa(&op->dst, buf, sizeof(buf)),
+	((!op->nogw)?u_addrtoa(&op->gw, buf1, sizeof(buf1)):""),
+	add?"to":"from", op->ifname));
+
+    u_rangetosockaddrs(&op->dst, &ssself, &ssmsk);
+    if (!op->nogw)
+	u_addrtosockaddr(&op->gw, 0, &sspeer);
+
+    switch (op->af) {
+      case AF_INET:
+	if ((s = RtQueueSocket(&gRtInetSock, PF_INET, SOCK_DGRAM)) < 0) {
+	    Perror("[%s] IFACE: Can't get socket to change interface address", op->bname);
+	    return (s);
+	}
+	memset(&ifra, '\0', sizeof(ifra));
+	strlcpy(ifra.ifra_name, op->ifname, sizeof(ifra.ifra_name));
+
+	me4 = (struct sockaddr_in *)(void *)&ifra.ifra_addr;
+	memcpy(me4, &ssself, sizeof(*me4));
+
+	msk4 = (struct sockaddr_in *)(void *)&ifra.ifra_mask;
+	memcpy(msk4, &ssmsk, sizeof(*msk4));
+
+	peer4 = (struct sockaddr_in *)(void *)&ifra.ifra_broadaddr;
+	if (op->nogw || op->gw.family == AF_UNSPEC) {
+    	    peer4->sin_family = AF_INET;
+    	    peer4->sin_len = sizeof(*peer4);
+    	    peer4->sin_addr.s_addr = INADDR_NONE;
+	} else
+    	    memcpy(peer4, &sspeer, sizeof(*peer4));
+
+	res = ioctl(s, add?SIOCAIFADDR:SIOCDIFADDR, &ifra);
+	if (res == -1) {
+	    Perror("[%s] IFACE: %s IPv4 address %s %s failed",
+		op->bname, add?"Adding":"Removing", add?"to":"from", op->ifname);
+	}
+	break;
+
+      case AF_INET6:
+	if ((s = RtQueueSocket(&gRtInet6Sock, PF_INET6, SOCK_DGRAM)) < 0) {
+	    Perror("[%s] IFACE: Can't get socket to change interface address", op->bname);
+	    return (s);
+	}
+	memset(&ifra6, '\0', sizeof(ifra6));
+	strlcpy(ifra6.ifra_name, op->ifname, sizeof(ifra6.ifra_name));
+
+	memcpy(&ifra6.ifra_addr, &ssself, sizeof(ifra6.ifra_addr));
+	memcpy(&ifra6.ifra_prefixmask, &ssmsk, sizeof(ifra6.ifra_prefixmask));
+	if (op->nogw || op->gw.family == AF_UNSPEC)
+    	    ifra6.ifra_dstaddr.sin6_family = AF_UNSPEC;
+	else if (memcmp(&((struct sockaddr_in6 *)&ssmsk)->sin6_addr, &in6mask128,
+		    sizeof(in6mask128)) == 0)
+    	    memcpy(&ifra6.ifra_dstaddr, &sspeer, sizeof(ifra6.ifra_dstaddr));
+	ifra6.ifra_lifetime.ia6t_vltime = ND6_INFINITE_LIFETIME;
+	ifra6.ifra_lifetime.ia6t_pltime = ND6_INFINITE_LIFETIME;
+
+	res = ioctl(s, add?SIOCAIFADDR_IN6:SIOCDIFADDR_IN6, &ifra6);
+	if (res == -1) {
+		if (add && errno == EEXIST) {
+			/* this can happen if the kernel has already automatically added
+			   the same link-local address - ignore the error */
+			res = 0;
+		} else {
+			Perror("[%s] IFACE: %s IPv6 address %s %s failed",
+				op->bname, add?"Adding":"Removing", add?"to":"from", op->ifname);
+		}
+	}
+	break;
+
+      default:
+        res = -1;
+	break;
+    }
+    return (res);
+}
+
+static size_t
+memcpy_roundup(char *cp, const void *data, size_t len)
+{
+  size_t padlen;
+
+#define ROUNDUP(x) ((x) ? (1 + (((x) - 1) | (sizeof(long) - 1))) : sizeof(long))
+  padlen = ROUNDUP(len);
+  memcpy(cp, data, len);
+  if (padlen > len)
+    memset(cp + len, '\0', padlen - len);
+
+  return padlen;
+}
+
+static int
+RtQueueSetRoute(RtOp op)
+{
+    struct rtmsg rtmes;
+    int s, nb, wb;
+    char *cp;
+    int cmd = (op->type == RTOP_ROUTE_ADD ? RTM_ADD : RTM_DELETE);
+    const char *cmdstr = (cmd == RTM_ADD ? "Add" : "Delete");
+    struct sockaddr_storage sadst, samask, sagw;
+    char buf[48], buf1[48];
+
+    if ((s = RtQueueSocket(&gRtSock, PF_ROUTE, SOCK_RAW)) < 0) {
+	Perror("[%s] IFACE: Can't get route socket", op->bname);
+	return (-1);
+    }
+    memset(&rtmes, '\0', sizeof(rtmes));
+    rtmes.m_rtm.rtm_version = RTM_VERSION;
+    rtmes.m_rtm.rtm_type = cmd;
+    rtmes.m_rtm.rtm_addrs = RTA_DST;
+    rtmes.m_rtm.rtm_seq = op->rtseq;
+    rtmes.m_rtm.rtm_pid = gPid;
+    rtmes.m_rtm.rtm_flags = RTF_UP | RTF_GATEWAY | RTF_STATIC;
+
+    u_rangetosockaddrs(&op->dst, &sadst, &samask);
+#if defined(__KAME__) && !defined(NOINET6)
+    add_scope((struct sockaddr *)&sadst, op->ifindex);
+#endif
+
+    cp = rtmes.m_space;
+    cp += memcpy_roundup(cp, &sadst, sadst.ss_len);
+    if (!op->nogw) {
+	u_addrtosockaddr(&op->gw, 0, &sagw);
+#if defined(__KAME__) && !defined(NOINET6)
+	add_scope((struct sockaddr *)&sagw, op->ifindex);
+#endif
+    	cp += memcpy_roundup(cp, &sagw, sagw.ss_len);
+    	rtmes.m_rtm.rtm_addrs |= RTA_GATEWAY;
+    } else if (cmd == RTM_ADD) {
+    	Log(LG_ERR, ("[%s] IfaceSetRoute: gw is not set\n", op->bname));
+    	return (-1);
+    }
+
+    if (u_rangehost(&op->dst)) {
+	rtmes.m_rtm.rtm_flags |= RTF_HOST;
+    } else {
+	cp += memcpy_roundup(cp, &samask, samask.ss_len);
+	rtmes.m_rtm.rtm_addrs |= RTA_NETMASK;
+    }
+
+    nb = cp - (char *)&rtmes;
+    rtmes.m_rtm.rtm_msglen = nb;
+    wb = write(s, &rtmes, nb);
+    if (wb < 0) {
+    	Log(LG_ERR, ("[%s] IFACE: %s route %s %s failed: %s",
+	    op->bname, cmdstr, u_rangetoa(&op->dst, buf, sizeof(buf)),
+	    ((!op->nogw)?u_addrtoa(&op->gw, buf1, sizeof(buf1)):""),
+	    (rtmes.m_rtm.rtm_errno != 0)?strerror(rtmes.m_rtm.rtm_errno):strerror(errno)));
+	return (-1);
+    }
+    Log(LG_IFACE2, ("[%s] IFACE: %s route %s %s",
+	    op->bname, cmdstr, u_rangetoa(&op->dst, buf, sizeof(buf)),
+	    ((!op->nogw)?u_addrtoa(&op->gw, buf1, sizeof(buf1)):"")));
+    return (0);
+}
@@ -0,0 +1,41 @@
+
+/*
+ * rtqueue.h
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#ifndef _RTQUEUE_H_
+#define _RTQUEUE_H_
+
+#include <sys/types.h>
+#include <net/route.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  /*
+   * Called from the event loop when all operations queued before it
+   * for the same interface address family are done, unless the family
+   * went down or up again in between. Failed is set if adding of the
+   * interface address failed.
+   */
+  typedef void	(*RtQueueDoneFn)(Bund b, int failed);
+
+/*
+ * FUNCTIONS
+ */
+
+  extern void	RtQueueInit(void);
+  extern void	RtQueueShutdown(void);
+  extern u_int	RtQueueNewSeq(void);
+  extern void	RtQueueAddr(Bund b, u_int seq, int add, struct u_range *self,
+		  struct u_addr *peer);
+  extern void	RtQueueRoute(Bund b, u_int seq, int cmd, struct u_range *dst,
+		  struct u_addr *gw);
+  extern void	RtQueueDone(Bund b, u_int seq, int af, RtQueueDoneFn fn);
+  extern void	RtQueueFlush(void);
+  extern int	RtQueueStat(Context ctx, int ac, const char *const av[], const void *arg);
+
+#endif
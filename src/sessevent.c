@@ -0,0 +1,272 @@
+
+/*
+ * sessevent.c
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "sessevent.h"
+#include "util.h"
+
+#include <time.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  /*
+   * Session lifecycle events are posted from the event loop into a
+   * bounded ring. Each event gets the next sequence number, which is
+   * also the resume cursor of subscribers. Posting never waits for
+   * subscribers: a slow one finds its events overwritten, skips to
+   * the oldest kept and gets the number of dropped events. The ring
+   * mutex is only held to copy events in and out.
+   */
+
+  #define SESSEV_MAX_SHOW	32	/* Subscribers listed by show */
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static void	SessEventCleanup(void *arg);
+
+/*
+ * INTERNAL VARIABLES
+ */
+
+  static const char	*gSessEvNames[SESSEV_NUM] = {
+    "link-up",
+    "link-down",
+    "auth-success",
+    "auth-fail",
+    "bundle-join",
+    "bundle-leave",
+    "ncp-up",
+    "ncp-down",
+    "coa",
+  };
+
+  static pthread_mutex_t	gSessEvMutex;
+  static pthread_cond_t		gSessEvCond;
+  static struct sessevent	gSessEvRing[SESSEV_RING];	/* Mutex */
+  static u_int64_t		gSessEvNext = 1;		/* Mutex */
+  static u_int64_t		gSessEvPosted[SESSEV_NUM];	/* Mutex */
+  static SLIST_HEAD(, sessevsub) gSessEvSubs =			/* Mutex */
+				    SLIST_HEAD_INITIALIZER(gSessEvSubs);
+
+/*
+ * SessEventInit()
+ */
+
+void
+SessEventInit(void)
+{
+    int	ret;
+
+    if ((ret = pthread_mutex_init(&gSessEvMutex, NULL)) != 0) {
+	Log(LG_ERR, ("Could not create session events mutex: %d", ret));
+	exit(EX_UNAVAILABLE);
+    }
+    if ((ret = pthread_cond_init(&gSessEvCond, NULL)) != 0) {
+	Log(LG_ERR, ("Could not create session events condition: %d", ret));
+	exit(EX_UNAVAILABLE);
+    }
+}
+
+/*
+ * SessEventPost()
+ *
+ * Post event about link or, if it is NULL, about bundle.
+ */
+
+void
+SessEventPost(int type, Link l, Bund b, const char *fmt, ...)
+{
+    struct sessevent	ev;
+    va_list		args;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.time = time(NULL);
+    ev.type = type;
+    if (l != NULL) {
+	strlcpy(ev.link, l->name, sizeof(ev.link));
+	strlcpy(ev.user, l->lcp.auth.params.authname, sizeof(ev.user));
+	if (b == NULL)
+	    b = l->bund;
+    }
+    if (b != NULL) {
+	strlcpy(ev.bundle, b->name, sizeof(ev.bundle));
+	if (ev.user[0] == '\0')
+	    strlcpy(ev.user, b->params.authname, sizeof(ev.user));
+    }
+    if (fmt != NULL) {
+	va_start(args, fmt);
+	vsnprintf(ev.info, sizeof(ev.info), fmt, args);
+	va_end(args);
+    }
+
+    MUTEX_LOCK(gSessEvMutex);
+    ev.id = gSessEvNext++;
+    gSessEvRing[ev.id % SESSEV_RING] = ev;
+    gSessEvPosted[type]++;
+    if (!SLIST_EMPTY(&gSessEvSubs))
+	pthread_cond_broadcast(&gSessEvCond);
+    MUTEX_UNLOCK(gSessEvMutex);
+}
+
+/*
+ * SessEventName()
+ */
+
+const char *
+SessEventName(int type)
+{
+    return (gSessEvNames[type]);
+}
+
+/*
+ * SessEventSubscribe()
+ *
+ * Zero cursor means only events posted from now on.
+ */
+
+void
+SessEventSubscribe(SessEvSub s, u_int64_t cursor)
+{
+    MUTEX_LOCK(gSessEvMutex);
+    s->cursor = (cursor == 0 || cursor > gSessEvNext) ? gSessEvNext : cursor;
+    s->sent = 0;
+    s->dropped = 0;
+    SLIST_INSERT_HEAD(&gSessEvSubs, s, next);
+    MUTEX_UNLOCK(gSessEvMutex);
+}
+
+/*
+ * SessEventUnsubscribe()
+ */
+
+void
+SessEventUnsubscribe(SessEvSub s)
+{
+    MUTEX_LOCK(gSessEvMutex);
+    SLIST_REMOVE(&gSessEvSubs, s, sessevsub, next);
+    MUTEX_UNLOCK(gSessEvMutex);
+}
+
+/*
+ * SessEventRead()
+ *
+ * Copy up to "max" events from the subscriber cursor. "lost" is set
+ * to the number of events overwritten before they were read.
+ */
+
+int
+SessEventRead(SessEvSub s, struct sessevent *evs, int max, u_int64_t *lost)
+{
+    u_int64_t	oldest;
+    int		n;
+
+    MUTEX_LOCK(gSessEvMutex);
+    oldest = gSessEvNext > SESSEV_RING ? gSessEvNext - SESSEV_RING : 1;
+    *lost = 0;
+    if (s->cursor < oldest) {
+	*lost = oldest - s->cursor;
+	s->dropped += *lost;
+	s->cursor = oldest;
+    }
+    for (n = 0; n < max && s->cursor < gSessEvNext; n++)
+	evs[n] = gSessEvRing[s->cursor++ % SESSEV_RING];
+    s->sent += n;
+    MUTEX_UNLOCK(gSessEvMutex);
+    return (n);
+}
+
+/*
+ * SessEventWait()
+ *
+ * Wait up to "secs" for new events. Returns non-zero if there are any.
+ */
+
+int
+SessEventWait(SessEvSub s, int secs)
+{
+    struct timespec	ts;
+    int			ready;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += secs;
+
+    MUTEX_LOCK(gSessEvMutex);
+    pthread_cleanup_push(SessEventCleanup, NULL);
+    while (s->cursor >= gSessEvNext) {
+	if (pthread_cond_timedwait(&gSessEvCond, &gSessEvMutex, &ts) != 0)
+	    break;
+    }
+    ready = (s->cursor < gSessEvNext);
+    pthread_cleanup_pop(0);
+    MUTEX_UNLOCK(gSessEvMutex);
+    return (ready);
+}
+
+/*
+ * SessEventCleanup()
+ *
+ * Web thread canceled while waiting.
+ */
+
+static void
+SessEventCleanup(void *arg) NO_THREAD_SAFETY_ANALYSIS
+{
+    (void)arg;
+    MUTEX_UNLOCK(gSessEvMutex);
+}
+
+/*
+ * SessEventStat()
+ */
+
+int
+SessEventStat(Context ctx, int ac, const char *const av[], const void *arg)
+{
+    struct sessevsub	subs[SESSEV_MAX_SHOW];
+    u_int64_t		posted[SESSEV_NUM], last;
+    SessEvSub		s;
+    int			k, n = 0, more = 0;
+
+    (void)ac;
+    (void)av;
+    (void)arg;
+
+    /* Copy, so console output does not hold posting */
+    MUTEX_LOCK(gSessEvMutex);
+    last = gSessEvNext - 1;
+    memcpy(posted, gSessEvPosted, sizeof(posted));
+    SLIST_FOREACH(s, &gSessEvSubs, next) {
+	if (n < SESSEV_MAX_SHOW)
+	    subs[n++] = *s;
+	else
+	    more++;
+    }
+    MUTEX_UNLOCK(gSessEvMutex);
+
+    Printf("Session events:\r\n");
+    Printf("\tRing size      : %d\r\n", SESSEV_RING);
+    Printf("\tLast event     : %llu\r\n", (unsigned long long)last);
+    for (k = 0; k < SESSEV_NUM; k++) {
+	Printf("\t%-15s: %llu\r\n", gSessEvNames[k],
+	    (unsigned long long)posted[k]);
+    }
+    Printf("Subscribers:\r\n");
+    Printf("\tPeer\tCursor\tSent\tDropped\r\n");
+    for (k = 0; k < n; k++) {
+	Printf("\t%s\t%llu\t%llu\t%llu\r\n", subs[k].peer,
+	    (unsigned long long)subs[k].cursor,
+	    (unsigned long long)subs[k].sent,
+	    (unsigned long long)subs[k].dropped);
+    }
+    if (more)
+	Printf("\t... and %d more\r\n", more);
+    return (0);
+}
@@ -0,0 +1,69 @@
+
+/*
+ * sessevent.h
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#ifndef _SESSEVENT_H_
+#define _SESSEVENT_H_
+
+#include "defs.h"
+#include <sys/queue.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  #define SESSEV_RING		4096	/* Events kept for subscribers */
+
+  /* Session lifecycle events */
+  enum {
+    SESSEV_LINK_UP,
+    SESSEV_LINK_DOWN,
+    SESSEV_AUTH_SUCCESS,
+    SESSEV_AUTH_FAIL,
+    SESSEV_BUND_JOIN,
+    SESSEV_BUND_LEAVE,
+    SESSEV_NCP_UP,
+    SESSEV_NCP_DOWN,
+    SESSEV_COA,
+    SESSEV_NUM
+  };
+
+  struct sessevent {
+    u_int64_t		id;		/* Sequence number, from 1 */
+    time_t		time;
+    int			type;
+    char		link[LINK_MAX_NAME];
+    char		bundle[LINK_MAX_NAME];
+    char		user[AUTH_MAX_AUTHNAME];
+    char		info[64];	/* Reason, protocol, address */
+  };
+
+  /* Subscriber reading the ring */
+  struct sessevsub {
+    char		peer[64];	/* Who is reading */
+    u_int64_t		cursor;		/* Next event to read */
+    u_int64_t		sent;
+    u_int64_t		dropped;	/* Overwritten before read */
+    SLIST_ENTRY(sessevsub)	next;
+  };
+  typedef struct sessevsub	*SessEvSub;
+
+/*
+ * FUNCTIONS
+ */
+
+  extern void		SessEventInit(void);
+  extern void		SessEventPost(int type, Link l, Bund b,
+			  const char *fmt, ...) __printflike(4, 5);
+  extern const char	*SessEventName(int type);
+  extern void		SessEventSubscribe(SessEvSub s, u_int64_t cursor);
+  extern void		SessEventUnsubscribe(SessEvSub s);
+  extern int		SessEventRead(SessEvSub s, struct sessevent *evs,
+			  int max, u_int64_t *lost);
+  extern int		SessEventWait(SessEvSub s, int secs);
+  extern int		SessEventStat(Context ctx, int ac, const char *const av[], const void *arg);
+
+#endif
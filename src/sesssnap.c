@@ -0,0 +1,502 @@
+
+/*
+ * sesssnap.c
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "sesssnap.h"
+#include "util.h"
+
+/*
+ * DEFINITIONS
+ */
+
+  /*
+   * Session summaries for show commands and web pages, which should
+   * not wait for gGiantMutex. The event loop publishes an immutable
+   * table of link records shortly after a session changes, and every
+   * SESSSNAP_PERIOD for the counters. Only records of links changed
+   * since the previous table are built again, the rest are shared by
+   * both tables.
+   *
+   * Readers only take a reference to the current table under the small
+   * snapshot mutex. A table released by its last reader is put on the
+   * retired list, and the event loop frees it and drops its records on
+   * the next publish, so record references are only ever touched under
+   * gGiantMutex.
+   */
+
+  struct sessstat {
+    u_int64_t		published;
+    u_int64_t		built;		/* Link records built */
+    u_int64_t		shared;		/* Link records reused */
+    u_int		last_usec;	/* Last publish took */
+    u_int		max_usec;
+  };
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static void			SessSnapTimeout(void *arg);
+  static int			SessSnapStale(const struct sesslink *r, Link l);
+  static int			SessSnapSame(const struct sesslink *r1,
+				  const struct sesslink *r2);
+  static struct sesslink	*SessSnapBuild(Link l);
+  static void			SessSnapBund(struct sessbund *s, Bund b);
+  static void			SessSnapRep(struct sessrep *s, Rep r);
+  static void			SessSnapUnref(SessTab t);
+  static void			SessSnapReap(void);
+
+/*
+ * INTERNAL VARIABLES
+ */
+
+  static pthread_mutex_t	gSessSnapMutex;
+  static SessTab		gSessSnapCur;			/* Mutex */
+  static SLIST_HEAD(, sesstab)	gSessSnapRetired =		/* Mutex */
+				    SLIST_HEAD_INITIALIZER(gSessSnapRetired);
+  static int			gSessSnapReaders;		/* Mutex */
+  static u_int64_t		gSessSnapState;
+  static struct sessstat	gSessSnapStat;
+  static struct pppTimer	gSessSnapTimer;
+  static struct pppTimer	gSessSnapRefresh;
+
+/*
+ * SessSnapInit()
+ */
+
+void
+SessSnapInit(void)
+{
+    int	ret;
+
+    if ((ret = pthread_mutex_init(&gSessSnapMutex, NULL)) != 0) {
+	Log(LG_ERR, ("Could not create session snapshot mutex: %d", ret));
+	exit(EX_UNAVAILABLE);
+    }
+    TimerInit(&gSessSnapTimer, "SessSnap", SESSSNAP_DELAY,
+	SessSnapTimeout, NULL);
+    TimerInit(&gSessSnapRefresh, "SessSnapRefresh", SESSSNAP_PERIOD * SECONDS,
+	SessSnapTimeout, NULL);
+    TimerStartRecurring(&gSessSnapRefresh);
+    SessSnapUpdate();
+}
+
+/*
+ * SessSnapShutdown()
+ */
+
+void
+SessSnapShutdown(void)
+{
+    SessTab	t;
+
+    TimerStop(&gSessSnapTimer);
+    TimerStop(&gSessSnapRefresh);
+    MUTEX_LOCK(gSessSnapMutex);
+    if ((t = gSessSnapCur) != NULL)
+	SessSnapUnref(t);
+    gSessSnapCur = NULL;
+    MUTEX_UNLOCK(gSessSnapMutex);
+    SessSnapReap();
+}
+
+/*
+ * SessSnapChanged()
+ *
+ * Some session has changed, publish soon. Changes within the delay
+ * are published together.
+ */
+
+void
+SessSnapChanged(void)
+{
+    if (!TimerStarted(&gSessSnapTimer))
+	TimerStart(&gSessSnapTimer);
+}
+
+/*
+ * SessSnapTimeout()
+ */
+
+static void
+SessSnapTimeout(void *arg)
+{
+    (void)arg;
+
+    SessSnapUpdate();
+}
+
+/*
+ * SessSnapUpdate()
+ *
+ * Build and publish new table. Called with gGiantMutex held, from
+ * the event loop or by show commands wanting the latest state.
+ */
+
+void
+SessSnapUpdate(void)
+{
+    SessTab		t, old;
+    struct sesslink	*r, *o;
+    Link		l;
+    Bund		b;
+    Rep			p;
+    u_int64_t		start = EventNow();
+    u_int		usec;
+    int			k, changed;
+
+    TimerStop(&gSessSnapTimer);
+    old = gSessSnapCur;		/* Only changed here */
+
+    t = Malloc(MB_LINK, sizeof(*t));
+    t->refs = 1;
+    t->gen = gLinkGen;
+    t->nlinks = gNumLinks;
+    if (t->nlinks > 0)
+	t->links = Malloc(MB_LINK, t->nlinks * sizeof(*t->links));
+    changed = (old == NULL || old->nlinks != t->nlinks ||
+	old->nbunds != gNumBundles || old->nreps != gNumReps);
+    for (k = 0; k < t->nlinks; k++) {
+	o = (old != NULL && k < old->nlinks) ? old->links[k] : NULL;
+	if ((l = gLinks[k]) == NULL) {
+	    if (o != NULL)
+		changed = 1;
+	    continue;
+	}
+	if (o == NULL || SessSnapStale(o, l)) {
+	    r = SessSnapBuild(l);
+	    if (o == NULL || !SessSnapSame(o, r))
+		changed = 1;
+	    gSessSnapStat.built++;
+	} else {
+	    r = o;
+	    gSessSnapStat.shared++;
+	}
+	r->refs++;
+	t->links[k] = r;
+    }
+    t->nbunds = gNumBundles;
+    if (t->nbunds > 0)
+	t->bunds = Malloc(MB_LINK, t->nbunds * sizeof(*t->bunds));
+    for (k = 0; k < t->nbunds; k++) {
+	if ((b = gBundles[k]) != NULL)
+	    SessSnapBund(&t->bunds[k], b);
+    }
+    t->nreps = gNumReps;
+    if (t->nreps > 0)
+	t->reps = Malloc(MB_LINK, t->nreps * sizeof(*t->reps));
+    for (k = 0; k < t->nreps; k++) {
+	if ((p = gReps[k]) != NULL)
+	    SessSnapRep(&t->reps[k], p);
+    }
+
+    /* Entries are built into zeroed memory, so compare them whole */
+    if (!changed && ((t->nbunds > 0 &&
+	    memcmp(t->bunds, old->bunds, t->nbunds * sizeof(*t->bunds)) != 0) ||
+	    (t->nreps > 0 &&
+	    memcmp(t->reps, old->reps, t->nreps * sizeof(*t->reps)) != 0)))
+	changed = 1;
+    t->state = changed ? ++gSessSnapState : gSessSnapState;
+
+    MUTEX_LOCK(gSessSnapMutex);
+    gSessSnapCur = t;
+    if (old != NULL)
+	SessSnapUnref(old);
+    MUTEX_UNLOCK(gSessSnapMutex);
+    SessSnapReap();
+
+    usec = EventNow() - start;
+    gSessSnapStat.published++;
+    gSessSnapStat.last_usec = usec;
+    if (usec > gSessSnapStat.max_usec)
+	gSessSnapStat.max_usec = usec;
+}
+
+/*
+ * SessSnapGet()
+ *
+ * Get reference to the current table, NULL if none yet.
+ * Called from any thread.
+ */
+
+SessTab
+SessSnapGet(void)
+{
+    SessTab	t;
+
+    MUTEX_LOCK(gSessSnapMutex);
+    if ((t = gSessSnapCur) != NULL) {
+	t->refs++;
+	gSessSnapReaders++;
+    }
+    MUTEX_UNLOCK(gSessSnapMutex);
+    return (t);
+}
+
+/*
+ * SessSnapLink()
+ *
+ * Get link record by index in gLinks.
+ */
+
+SessLink
+SessSnapLink(SessTab t, int id)
+{
+    if (id < 0 || id >= t->nlinks)
+	return (NULL);
+    return (t->links[id]);
+}
+
+/*
+ * SessSnapRelease()
+ *
+ * Drop reference taken by SessSnapGet(). Called from any thread.
+ */
+
+void
+SessSnapRelease(SessTab t)
+{
+    MUTEX_LOCK(gSessSnapMutex);
+    gSessSnapReaders--;
+    SessSnapUnref(t);
+    MUTEX_UNLOCK(gSessSnapMutex);
+}
+
+/*
+ * SessSnapUnref()
+ *
+ * Last reference retires the table, its records are dropped later
+ * by the event loop. Called with the snapshot mutex held.
+ */
+
+static void
+SessSnapUnref(SessTab t)
+{
+    if (--t->refs == 0)
+	SLIST_INSERT_HEAD(&gSessSnapRetired, t, next);
+}
+
+/*
+ * SessSnapReap()
+ *
+ * Free retired tables. Called with gGiantMutex held.
+ */
+
+static void
+SessSnapReap(void)
+{
+    SLIST_HEAD(, sesstab)	list;
+    SessTab			t;
+    int				k;
+
+    SLIST_INIT(&list);
+    MUTEX_LOCK(gSessSnapMutex);
+    SLIST_SWAP(&list, &gSessSnapRetired, sesstab);
+    MUTEX_UNLOCK(gSessSnapMutex);
+
+    while ((t = SLIST_FIRST(&list)) != NULL) {
+	SLIST_REMOVE_HEAD(&list, next);
+	for (k = 0; k < t->nlinks; k++) {
+	    if (t->links[k] != NULL && --t->links[k]->refs == 0)
+		Freee(t->links[k]);
+	}
+	if (t->links != NULL)
+	    Freee(t->links);
+	if (t->bunds != NULL)
+	    Freee(t->bunds);
+	if (t->reps != NULL)
+	    Freee(t->reps);
+	Freee(t);
+    }
+}
+
+/*
+ * SessSnapStale()
+ *
+ * Check whether link record must be built again. Not everything
+ * shown calls LinkChanged(), so also compare what changes alone.
+ */
+
+static int
+SessSnapStale(const struct sesslink *r, Link l)
+{
+    return (r->src != l || r->gen != l->gen || l->tmpl ||
+	r->state != l->state || r->lcp != l->lcp.fsm.state ||
+	r->stats_time != l->statsSnap.time ||
+	r->bund != (l->bund ? l->bund->id : -1) ||
+	r->rep != (l->rep ? l->rep->id : -1));
+}
+
+/*
+ * SessSnapSame()
+ *
+ * Check whether rebuilt record shows the same but the counters.
+ */
+
+static int
+SessSnapSame(const struct sesslink *r1, const struct sesslink *r2)
+{
+    struct sesslink	a, b;
+
+    memcpy(&a, r1, sizeof(a));
+    memcpy(&b, r2, sizeof(b));
+    a.refs = b.refs = 0;
+    a.stats_time = b.stats_time = 0;
+    a.in_octets = b.in_octets = 0;
+    a.out_octets = b.out_octets = 0;
+    a.in_frames = b.in_frames = 0;
+    a.out_frames = b.out_frames = 0;
+    return (memcmp(&a, &b, sizeof(a)) == 0);
+}
+
+/*
+ * SessSnapBuild()
+ */
+
+static struct sesslink *
+SessSnapBuild(Link l)
+{
+    struct sesslink	*r;
+    Bund		const b = l->bund;
+    char		buf[64], buf2[64];
+
+    r = Malloc(MB_LINK, sizeof(*r));
+    r->id = l->id;
+    r->gen = l->gen;
+    r->stats_time = l->statsSnap.time;
+    r->src = l;
+    r->tmpl = l->tmpl;
+    r->state = l->state;
+    r->lcp = l->lcp.fsm.state;
+    r->bund = b ? b->id : -1;
+    r->rep = l->rep ? l->rep->id : -1;
+    r->last_up = l->last_up;
+    strlcpy(r->name, l->name, sizeof(r->name));
+    r->type = l->type ? l->type->name : "";
+    strlcpy(r->user, l->lcp.auth.params.authname, sizeof(r->user));
+    strlcpy(r->session_id, l->session_id, sizeof(r->session_id));
+    PhysGetPeerAddr(l, r->peer, sizeof(r->peer));
+    PhysGetSelfName(l, r->self, sizeof(r->self));
+    if (l->state != PHYS_STATE_DOWN) {
+	r->originate = PhysGetOriginate(l);
+	PhysGetCallingNum(l, buf, sizeof(buf));
+	PhysGetCalledNum(l, buf2, sizeof(buf2));
+	if (r->originate == LINK_ORIGINATE_REMOTE) {
+	    strlcpy(r->calling, buf, sizeof(r->calling));
+	    strlcpy(r->called, buf2, sizeof(r->called));
+	} else {
+	    strlcpy(r->calling, buf2, sizeof(r->calling));
+	    strlcpy(r->called, buf, sizeof(r->called));
+	}
+    }
+    if (b != NULL) {
+	strlcpy(r->bundle, b->name, sizeof(r->bundle));
+	strlcpy(r->iface, b->iface.ifname, sizeof(r->iface));
+	strlcpy(r->msession_id, b->msession_id, sizeof(r->msession_id));
+	u_addrtoa(&b->iface.peer_addr, r->iface_peer, sizeof(r->iface_peer));
+	inet_ntop(AF_INET, &b->ipcp.peer_addr, r->ipcp_ip,
+	    sizeof(r->ipcp_ip));
+	r->ipcp = b->ipcp.fsm.state;
+    }
+    /* Latest swept counters are fresher than l->stats */
+    if (l->statsSnap.time != 0) {
+	r->in_octets = l->statsSnap.stats.recvOctets;
+	r->out_octets = l->statsSnap.stats.xmitOctets;
+	r->in_frames = l->statsSnap.stats.recvFrames;
+	r->out_frames = l->statsSnap.stats.xmitFrames;
+    } else {
+	r->in_octets = l->stats.recvOctets;
+	r->out_octets = l->stats.xmitOctets;
+	r->in_frames = l->stats.recvFrames;
+	r->out_frames = l->stats.xmitFrames;
+    }
+    LinkSetupPhases(l, r->setup);
+    return (r);
+}
+
+/*
+ * SessSnapBund()
+ */
+
+static void
+SessSnapBund(struct sessbund *s, Bund b)
+{
+    int		k;
+
+    s->valid = 1;
+    s->tmpl = b->tmpl;
+    s->up = b->iface.up;
+    strlcpy(s->name, b->name, sizeof(s->name));
+    strlcpy(s->iface, b->iface.ifname, sizeof(s->iface));
+    s->ipcp = b->ipcp.fsm.state;
+    s->ipv6cp = b->ipv6cp.fsm.state;
+    s->ccp = b->ccp.fsm.state;
+    s->ecp = b->ecp.fsm.state;
+    s->n_links = b->n_links;
+    for (k = 0; k < NG_PPP_MAX_LINKS; k++)
+	s->links[k] = b->links[k] ? b->links[k]->id : -1;
+}
+
+/*
+ * SessSnapRep()
+ */
+
+static void
+SessSnapRep(struct sessrep *s, Rep r)
+{
+    int		k;
+
+    s->valid = 1;
+    s->p_up = r->p_up;
+    strlcpy(s->name, r->name, sizeof(s->name));
+    for (k = 0; k < 2; k++)
+	s->links[k] = r->links[k] ? r->links[k]->id : -1;
+}
+
+/*
+ * SessSnapStat()
+ */
+
+int
+SessSnapStat(Context ctx, int ac, const char *const av[], const void *arg)
+{
+    SessTab		t;
+    struct sessstat	st = gSessSnapStat;
+    int			readers, retired = 0, links = 0, k;
+
+    (void)ac;
+    (void)av;
+    (void)arg;
+
+    MUTEX_LOCK(gSessSnapMutex);
+    readers = gSessSnapReaders;
+    SLIST_FOREACH(t, &gSessSnapRetired, next)
+	retired++;
+    MUTEX_UNLOCK(gSessSnapMutex);
+    t = SessSnapGet();
+
+    Printf("Session snapshot:\r\n");
+    if (t != NULL) {
+	for (k = 0; k < t->nlinks; k++) {
+	    if (t->links[k] != NULL)
+		links++;
+	}
+	Printf("\tGeneration     : %llu\r\n", (unsigned long long)t->gen);
+	Printf("\tState          : %llu\r\n", (unsigned long long)t->state);
+	Printf("\tLinks          : %d\r\n", links);
+    }
+    Printf("\tPublished      : %llu\r\n", (unsigned long long)st.published);
+    Printf("\tRecords built  : %llu\r\n", (unsigned long long)st.built);
+    Printf("\tRecords shared : %llu\r\n", (unsigned long long)st.shared);
+    Printf("\tLast publish   : %u us\r\n", st.last_usec);
+    Printf("\tMax publish    : %u us\r\n", st.max_usec);
+    Printf("\tReaders        : %d\r\n", readers);
+    Printf("\tRetired tables : %d\r\n", retired);
+    if (t != NULL)
+	SessSnapRelease(t);
+    return (0);
+}
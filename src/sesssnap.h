@@ -0,0 +1,112 @@
+
+/*
+ * sesssnap.h
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#ifndef _SESSSNAP_H_
+#define _SESSSNAP_H_
+
+#include "defs.h"
+#include "fsm.h"
+#include <sys/queue.h>
+#include <netinet/in.h>
+#include <net/if.h>
+#include <netgraph/ng_ppp.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  #define SESSSNAP_DELAY	100	/* Publish after change, ms */
+  #define SESSSNAP_PERIOD	1	/* Refresh counters, seconds */
+
+  /* Link record, never changed after publishing */
+  struct sesslink {
+    int			refs;		/* Tables holding it, gGiantMutex */
+    int			id;		/* Index in gLinks */
+    u_int64_t		gen;		/* LinkChanged() generation */
+    u_int64_t		stats_time;	/* Counters taken, ms */
+    const void		*src;		/* Link built from, never followed */
+    u_char		tmpl;
+    u_char		originate;	/* LINK_ORIGINATE_* */
+    int			state;		/* PHYS_STATE_* */
+    enum fsm_state	lcp;
+    int			bund;		/* Index in gBundles or -1 */
+    int			rep;		/* Index in gReps or -1 */
+    time_t		last_up;
+    char		name[LINK_MAX_NAME];
+    const char		*type;
+    char		user[AUTH_MAX_AUTHNAME];
+    char		session_id[AUTH_MAX_SESSIONID];
+    char		peer[64];	/* Device peer address */
+    char		self[64];	/* Device self name */
+    char		calling[64];
+    char		called[64];
+    char		bundle[LINK_MAX_NAME];
+    char		iface[IFNAMSIZ];
+    char		msession_id[AUTH_MAX_SESSIONID];
+    char		iface_peer[64];	/* Interface peer address */
+    char		ipcp_ip[INET_ADDRSTRLEN];
+    enum fsm_state	ipcp;
+    u_int64_t		in_octets;
+    u_int64_t		out_octets;
+    u_int64_t		in_frames;
+    u_int64_t		out_frames;
+    int			setup[LINK_PHASE_NUM];	/* ms, -1 if not done */
+  };
+  typedef const struct sesslink	*SessLink;
+
+  /* Bundle and repeater entries, copied on every publish */
+  struct sessbund {
+    u_char		valid;
+    u_char		tmpl;
+    u_char		up;		/* Interface up */
+    char		name[LINK_MAX_NAME];
+    char		iface[IFNAMSIZ];
+    enum fsm_state	ipcp;
+    enum fsm_state	ipv6cp;
+    enum fsm_state	ccp;
+    enum fsm_state	ecp;
+    int			n_links;
+    int			links[NG_PPP_MAX_LINKS];	/* Index in gLinks or -1 */
+  };
+
+  struct sessrep {
+    u_char		valid;
+    u_char		p_up;
+    char		name[LINK_MAX_NAME];
+    int			links[2];	/* Index in gLinks or -1 */
+  };
+
+  /* Published table, never changed after publishing */
+  struct sesstab {
+    int			refs;		/* Mutex */
+    u_int64_t		gen;		/* gLinkGen when built */
+    u_int64_t		state;		/* Changes with all but counters */
+    int			nlinks;
+    struct sesslink	**links;	/* By index in gLinks, may be NULL */
+    int			nbunds;
+    struct sessbund	*bunds;		/* By index in gBundles */
+    int			nreps;
+    struct sessrep	*reps;		/* By index in gReps */
+    SLIST_ENTRY(sesstab)	next;	/* Retired, Mutex */
+  };
+  typedef struct sesstab	*SessTab;
+
+/*
+ * FUNCTIONS
+ */
+
+  extern void		SessSnapInit(void);
+  extern void		SessSnapShutdown(void);
+  extern void		SessSnapChanged(void);
+  extern void		SessSnapUpdate(void);
+  extern SessTab	SessSnapGet(void);
+  extern SessLink	SessSnapLink(SessTab t, int id);
+  extern void		SessSnapRelease(SessTab t);
+  extern int		SessSnapStat(Context ctx, int ac, const char *const av[], const void *arg);
+
+#endif
+
@@ -0,0 +1,592 @@
+
+/*
+ * spawn.c
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "spawn.h"
+#include "util.h"
+
+#include <sys/wait.h>
+#include <paths.h>
+#include <poll.h>
+#include <spawn.h>
+#include <time.h>
+
+extern char	**environ;
+
+/*
+ * DEFINITIONS
+ */
+
+  /*
+   * Scripts are not run with system() from the event handlers.
+   * A small spawn server is forked at startup. It starts commands with
+   * posix_spawn(), enforces timeouts and reports exit status back.
+   * We queue commands here, limiting the number of instances of each
+   * script running at once and keeping commands with the same label
+   * (bundle) in order, and report completion through the message queue.
+   */
+
+  #define SPAWN_KILL_WAIT	2	/* Seconds between SIGTERM and SIGKILL */
+  #define SPAWN_POLL		100	/* Server poll interval, ms */
+
+  /* Request and reply header */
+  struct spawn_msg {
+    u_int32_t	id;
+    int32_t	value;		/* Timeout (request) or status (reply) */
+    u_int32_t	len;		/* Length of the command following */
+  };
+
+  struct spawnreq {
+    u_int32_t		id;
+    int			log;
+    char		label[LINK_MAX_NAME];
+    char		*cmd;
+    size_t		slen;		/* Length of the script name */
+    int			status;
+    SpawnDoneFn		fn;
+    void		*arg;
+    TAILQ_ENTRY(spawnreq) next;
+  };
+  typedef struct spawnreq	*SpawnReq;
+
+  TAILQ_HEAD(spawnreq_head, spawnreq);
+
+  struct spawn_stats {
+    u_int64_t	started;
+    u_int64_t	failed;
+    u_int64_t	timeouts;
+  };
+
+  /* Spawn server child */
+  struct spawn_child {
+    pid_t	pid;
+    u_int32_t	id;
+    time_t	deadline;
+    int		killed;
+  };
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static void	SpawnKick(void);
+  static int	SpawnBlocked(SpawnReq r);
+  static void	SpawnSend(SpawnReq r);
+  static void	SpawnComplete(SpawnReq r, int status);
+  static void	SpawnMsg(int type, void *arg);
+  static void	SpawnEvent(int type, void *arg);
+  static int	SpawnReply(void);
+  static void	SpawnClose(void);
+  static int	SpawnIO(int fd, void *buf, size_t len, int wr);
+  static void	SpawnServer(int s);
+  static time_t	SpawnNow(void);
+
+/*
+ * GLOBAL VARIABLES
+ */
+
+  int		gSpawnLimit = 0;
+  int		gSpawnTimeout = 0;
+
+/*
+ * INTERNAL VARIABLES
+ */
+
+  static int			gSpawnSock = -1;
+  static pid_t			gSpawnPid = -1;
+  static EventRef		gSpawnEvent;
+  static MsgHandler		gSpawnMsg;
+  static u_int32_t		gSpawnId;
+  static struct spawnreq_head	gSpawnQueue = TAILQ_HEAD_INITIALIZER(gSpawnQueue);
+  static struct spawnreq_head	gSpawnRunning = TAILQ_HEAD_INITIALIZER(gSpawnRunning);
+  static u_int			gSpawnQueueLen;
+  static u_int			gSpawnRunningLen;
+  static struct spawn_stats	gSpawnStats;
+
+/*
+ * SpawnInit()
+ *
+ * Start the spawn server. On failure commands are run with system().
+ */
+
+void
+SpawnInit(void)
+{
+    int		sv[2];
+    pid_t	pid;
+
+    MsgRegister(&gSpawnMsg, SpawnMsg);
+
+    if (socketpair(PF_LOCAL, SOCK_STREAM, 0, sv) < 0) {
+	Perror("SPAWN: Can't create server socket");
+	return;
+    }
+    (void)fcntl(sv[0], F_SETFD, 1);
+    (void)fcntl(sv[1], F_SETFD, 1);
+
+    switch ((pid = fork())) {
+	case -1:
+	    Perror("SPAWN: Can't start server");
+	    close(sv[0]);
+	    close(sv[1]);
+	    return;
+	case 0:
+	    /* We are terminated by closing the socket. */
+	    signal(SIGINT, SIG_IGN);
+	    signal(SIGTERM, SIG_IGN);
+	    signal(SIGHUP, SIG_IGN);
+	    signal(SIGUSR1, SIG_IGN);
+	    signal(SIGUSR2, SIG_IGN);
+	    signal(SIGPIPE, SIG_IGN);
+	    close(sv[0]);
+	    SpawnServer(sv[1]);
+	    _exit(0);
+	default:
+	    break;
+    }
+    close(sv[1]);
+    gSpawnSock = sv[0];
+    gSpawnPid = pid;
+    if (EventRegister(&gSpawnEvent, EVENT_READ, gSpawnSock,
+	    EVENT_RECURRING, SpawnEvent, NULL) != 0) {
+	Log(LG_ERR, ("SPAWN: Can't register server event"));
+	SpawnClose();
+	return;
+    }
+    Log(LG_ALWAYS, ("SPAWN: server process %d started", (int)pid));
+}
+
+/*
+ * SpawnShutdown()
+ *
+ * Run all queued commands and wait for them to complete.
+ */
+
+void
+SpawnShutdown(void)
+{
+    EventUnRegister(&gSpawnEvent);
+    while (!TAILQ_EMPTY(&gSpawnQueue) || !TAILQ_EMPTY(&gSpawnRunning)) {
+	SpawnKick();
+	if (!TAILQ_EMPTY(&gSpawnRunning) && SpawnReply() != 0)
+	    SpawnClose();
+    }
+    if (gSpawnSock >= 0) {
+	shutdown(gSpawnSock, SHUT_WR);
+	SpawnClose();
+    }
+}
+
+/*
+ * SpawnRun()
+ *
+ * Queue shell command. Completion function, if any, is called
+ * from the message queue with the command exit status.
+ */
+
+void
+SpawnRun(int log, const char *label, SpawnDoneFn fn, void *arg,
+	const char *fmt, ...)
+{
+    char	cmd[LINE_MAX];
+    SpawnReq	r;
+    va_list	ap;
+
+    va_start(ap, fmt);
+    vsnprintf(cmd, sizeof(cmd), fmt, ap);
+    va_end(ap);
+
+    Log(log, ("[%s] system: %s", label, cmd));
+
+    r = Malloc(MB_UTIL, sizeof(*r));
+    r->log = log;
+    strlcpy(r->label, label, sizeof(r->label));
+    r->cmd = Mstrdup(MB_UTIL, cmd);
+    r->slen = strcspn(cmd, " \t");
+    r->fn = fn;
+    r->arg = arg;
+    TAILQ_INSERT_TAIL(&gSpawnQueue, r, next);
+    gSpawnQueueLen++;
+    SpawnKick();
+}
+
+/*
+ * SpawnStat()
+ */
+
+int
+SpawnStat(Context ctx, int ac, const char *const av[], const void *arg)
+{
+    SpawnReq	r;
+
+    (void)ac;
+    (void)av;
+    (void)arg;
+
+    Printf("Spawn server:\r\n");
+    if (gSpawnSock >= 0)
+	Printf("\tProcess        : %d\r\n", (int)gSpawnPid);
+    else
+	Printf("\tProcess        : none, using system()\r\n");
+    Printf("\tScript limit   : %d\r\n", gSpawnLimit);
+    Printf("\tScript timeout : %d\r\n", gSpawnTimeout);
+    Printf("\tQueued         : %u\r\n", gSpawnQueueLen);
+    Printf("\tRunning        : %u\r\n", gSpawnRunningLen);
+    Printf("\tStarted        : %llu\r\n", (unsigned long long)gSpawnStats.started);
+    Printf("\tFailed         : %llu\r\n", (unsigned long long)gSpawnStats.failed);
+    Printf("\tTimed out      : %llu\r\n", (unsigned long long)gSpawnStats.timeouts);
+    if (!TAILQ_EMPTY(&gSpawnRunning)) {
+	Printf("Running commands:\r\n");
+	TAILQ_FOREACH(r, &gSpawnRunning, next)
+	    Printf("\t[%s] %s\r\n", r->label, r->cmd);
+    }
+    if (!TAILQ_EMPTY(&gSpawnQueue)) {
+	Printf("Queued commands:\r\n");
+	TAILQ_FOREACH(r, &gSpawnQueue, next)
+	    Printf("\t[%s] %s\r\n", r->label, r->cmd);
+    }
+    return (0);
+}
+
+/*
+ * SpawnKick()
+ *
+ * Start queued commands that are allowed to run.
+ */
+
+static void
+SpawnKick(void)
+{
+    SpawnReq	r, rn;
+
+    TAILQ_FOREACH_SAFE(r, &gSpawnQueue, next, rn) {
+	if (gSpawnRunningLen >= SPAWN_MAX_RUNNING)
+	    break;
+	if (SpawnBlocked(r))
+	    continue;
+	TAILQ_REMOVE(&gSpawnQueue, r, next);
+	gSpawnQueueLen--;
+	SpawnSend(r);
+    }
+}
+
+/*
+ * SpawnBlocked()
+ *
+ * Command waits for earlier one with the same label,
+ * or for the running instances of the same script.
+ */
+
+static int
+SpawnBlocked(SpawnReq r)
+{
+    SpawnReq	o;
+    int		count = 0;
+
+    TAILQ_FOREACH(o, &gSpawnQueue, next) {
+	if (o == r)
+	    break;
+	if (strcmp(o->label, r->label) == 0)
+	    return (1);
+    }
+    TAILQ_FOREACH(o, &gSpawnRunning, next) {
+	if (strcmp(o->label, r->label) == 0)
+	    return (1);
+	if (o->slen == r->slen && strncmp(o->cmd, r->cmd, r->slen) == 0)
+	    count++;
+    }
+    return (gSpawnLimit > 0 && count >= gSpawnLimit);
+}
+
+/*
+ * SpawnSend()
+ *
+ * Pass command to the spawn server.
+ */
+
+static void
+SpawnSend(SpawnReq r)
+{
+    struct spawn_msg	m;
+    char		buf[LINE_MAX + 32];
+    int			status;
+
+    gSpawnStats.started++;
+    if (gSpawnSock >= 0) {
+	m.id = r->id = ++gSpawnId;
+	m.value = gSpawnTimeout;
+	m.len = strlen(r->cmd) + 1;
+	if (SpawnIO(gSpawnSock, &m, sizeof(m), 1) == 0 &&
+		SpawnIO(gSpawnSock, r->cmd, m.len, 1) == 0) {
+	    TAILQ_INSERT_TAIL(&gSpawnRunning, r, next);
+	    gSpawnRunningLen++;
+	    return;
+	}
+	Perror("SPAWN: Can't send command to server");
+	SpawnClose();
+    }
+
+    /* No server, do it the old way. */
+    snprintf(buf, sizeof(buf), "%s >%s 2>&1", r->cmd, _PATH_DEVNULL);
+    if ((status = system(buf)) == -1)
+	status = SPAWN_ERROR;
+    else if (WIFEXITED(status))
+	status = WEXITSTATUS(status);
+    else
+	status = 128 + WTERMSIG(status);
+    SpawnComplete(r, status);
+}
+
+/*
+ * SpawnComplete()
+ */
+
+static void
+SpawnComplete(SpawnReq r, int status)
+{
+    r->status = status;
+    if (status == SPAWN_TIMEOUT) {
+	gSpawnStats.timeouts++;
+	Log(r->log|LG_ERR, ("[%s] system: command \"%s\" timed out",
+	    r->label, r->cmd));
+    } else if (status != 0) {
+	gSpawnStats.failed++;
+	Log(r->log|LG_ERR, ("[%s] system: command \"%s\" returned %d",
+	    r->label, r->cmd, status));
+    }
+    MsgSend(&gSpawnMsg, status, r);
+}
+
+/*
+ * SpawnMsg()
+ *
+ * Message queue handler, type is the exit status.
+ */
+
+static void
+SpawnMsg(int type, void *arg)
+{
+    SpawnReq	const r = (SpawnReq)arg;
+
+    if (r->fn != NULL)
+	(*r->fn)(r->arg, type);
+    Freee(r->cmd);
+    Freee(r);
+}
+
+/*
+ * SpawnEvent()
+ */
+
+static void
+SpawnEvent(int type, void *arg)
+{
+    (void)type;
+    (void)arg;
+
+    if (SpawnReply() != 0) {
+	Log(LG_ERR, ("SPAWN: server process exited, using system()"));
+	SpawnClose();
+    }
+    SpawnKick();
+}
+
+/*
+ * SpawnReply()
+ *
+ * Read and process one reply from the spawn server.
+ */
+
+static int
+SpawnReply(void)
+{
+    struct spawn_msg	m;
+    SpawnReq		r;
+
+    if (SpawnIO(gSpawnSock, &m, sizeof(m), 0) != 0)
+	return (-1);
+    TAILQ_FOREACH(r, &gSpawnRunning, next) {
+	if (r->id == m.id)
+	    break;
+    }
+    if (r == NULL) {
+	Log(LG_ERR, ("SPAWN: unexpected reply %u from server", m.id));
+	return (-1);
+    }
+    TAILQ_REMOVE(&gSpawnRunning, r, next);
+    gSpawnRunningLen--;
+    SpawnComplete(r, m.value);
+    return (0);
+}
+
+/*
+ * SpawnClose()
+ *
+ * Forget about the spawn server.
+ */
+
+static void
+SpawnClose(void)
+{
+    SpawnReq	r;
+
+    EventUnRegister(&gSpawnEvent);
+    close(gSpawnSock);
+    gSpawnSock = -1;
+    (void)waitpid(gSpawnPid, NULL, 0);
+    gSpawnPid = -1;
+    while ((r = TAILQ_FIRST(&gSpawnRunning)) != NULL) {
+	TAILQ_REMOVE(&gSpawnRunning, r, next);
+	SpawnComplete(r, SPAWN_ERROR);
+    }
+    gSpawnRunningLen = 0;
+}
+
+/*
+ * SpawnIO()
+ *
+ * Read or write exactly len bytes.
+ */
+
+static int
+SpawnIO(int fd, void *buf, size_t len, int wr)
+{
+    char	*p = buf;
+    ssize_t	n;
+
+    while (len > 0) {
+	n = wr ? write(fd, p, len) : read(fd, p, len);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    return (-1);
+	p += n;
+	len -= n;
+    }
+    return (0);
+}
+
+/*
+ * SpawnServer()
+ *
+ * Spawn server main loop. It may be forked from a threaded process,
+ * so only system calls and static buffers are used here.
+ */
+
+static void
+SpawnServer(int s)
+{
+    static struct spawn_child	ch[SPAWN_MAX_RUNNING];
+    static char			cmd[LINE_MAX];
+    struct spawn_msg		m;
+    struct pollfd		pfd;
+    posix_spawn_file_actions_t	fa;
+    posix_spawnattr_t		sa;
+    sigset_t			sigs;
+    char			*argv[4];
+    int				nch = 0, eof = 0;
+    int				k, status;
+    pid_t			pid;
+    time_t			now;
+
+    /* Scripts get stdio on /dev/null, own process group, default signals */
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addopen(&fa, 0, _PATH_DEVNULL, O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&fa, 1, _PATH_DEVNULL, O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&fa, 2, _PATH_DEVNULL, O_WRONLY, 0);
+    posix_spawnattr_init(&sa);
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGHUP);
+    sigaddset(&sigs, SIGUSR1);
+    sigaddset(&sigs, SIGUSR2);
+    sigaddset(&sigs, SIGPIPE);
+    posix_spawnattr_setsigdefault(&sa, &sigs);
+    sigemptyset(&sigs);
+    posix_spawnattr_setsigmask(&sa, &sigs);
+    posix_spawnattr_setpgroup(&sa, 0);
+    posix_spawnattr_setflags(&sa, POSIX_SPAWN_SETSIGDEF |
+	POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETPGROUP);
+
+    while (!eof || nch > 0) {
+	pfd.fd = s;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (poll(&pfd, eof ? 0 : 1, nch > 0 ? SPAWN_POLL : INFTIM) < 0 &&
+		errno != EINTR)
+	    return;
+
+	/* New command */
+	if (!eof && (pfd.revents & (POLLIN | POLLHUP))) {
+	    if (SpawnIO(s, &m, sizeof(m), 0) != 0) {
+		eof = 1;
+	    } else if (m.len == 0 || m.len > sizeof(cmd) ||
+		    SpawnIO(s, cmd, m.len, 0) != 0) {
+		return;
+	    } else {
+		cmd[m.len - 1] = 0;
+		argv[0] = __DECONST(char *, "sh");
+		argv[1] = __DECONST(char *, "-c");
+		argv[2] = cmd;
+		argv[3] = NULL;
+		if (nch >= SPAWN_MAX_RUNNING ||
+			posix_spawn(&pid, _PATH_BSHELL, &fa, &sa, argv,
+			    environ) != 0) {
+		    m.value = SPAWN_ERROR;
+		    m.len = 0;
+		    if (SpawnIO(s, &m, sizeof(m), 1) != 0)
+			return;
+		} else {
+		    ch[nch].pid = pid;
+		    ch[nch].id = m.id;
+		    ch[nch].deadline = (m.value > 0) ? SpawnNow() + m.value : 0;
+		    ch[nch].killed = 0;
+		    nch++;
+		}
+	    }
+	}
+
+	/* Completed commands */
+	while (nch > 0 && (pid = waitpid(-1, &status, WNOHANG)) > 0) {
+	    for (k = 0; k < nch && ch[k].pid != pid; k++)
+		;
+	    if (k == nch)
+		continue;
+	    m.id = ch[k].id;
+	    if (ch[k].killed)
+		m.value = SPAWN_TIMEOUT;
+	    else if (WIFEXITED(status))
+		m.value = WEXITSTATUS(status);
+	    else
+		m.value = 128 + WTERMSIG(status);
+	    m.len = 0;
+	    ch[k] = ch[--nch];
+	    if (SpawnIO(s, &m, sizeof(m), 1) != 0)
+		eof = 1;
+	}
+
+	/* Timeouts, the whole process group is killed */
+	now = SpawnNow();
+	for (k = 0; k < nch; k++) {
+	    if (ch[k].deadline == 0 || now < ch[k].deadline)
+		continue;
+	    kill(-ch[k].pid, ch[k].killed ? SIGKILL : SIGTERM);
+	    ch[k].killed = 1;
+	    ch[k].deadline = now + SPAWN_KILL_WAIT;
+	}
+    }
+}
+
+static time_t
+SpawnNow(void)
+{
+    struct timespec	ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec);
+}
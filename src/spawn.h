@@ -0,0 +1,43 @@
+
+/*
+ * spawn.h
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#ifndef _SPAWN_H_
+#define _SPAWN_H_
+
+/*
+ * DEFINITIONS
+ */
+
+  #define SPAWN_ERROR		(-1)	/* Command could not be started */
+  #define SPAWN_TIMEOUT		(-2)	/* Command killed on timeout */
+
+  #define SPAWN_MAX_RUNNING	256	/* Max commands running at once */
+
+  /*
+   * Called from the message queue when the command completes with
+   * its exit status, 128 + signal number or one of the above.
+   */
+  typedef void	(*SpawnDoneFn)(void *arg, int status);
+
+/*
+ * VARIABLES
+ */
+
+  extern int	gSpawnLimit;		/* Instances of each script at once */
+  extern int	gSpawnTimeout;		/* Script timeout, seconds */
+
+/*
+ * FUNCTIONS
+ */
+
+  extern void	SpawnInit(void);
+  extern void	SpawnShutdown(void);
+  extern void	SpawnRun(int log, const char *label, SpawnDoneFn fn, void *arg,
+		  const char *fmt, ...) __printflike(5, 6);
+  extern int	SpawnStat(Context ctx, int ac, const char *const av[], const void *arg);
+
+#endif
@@ -0,0 +1,339 @@
+
+/*
+ * batch_bench.c
+ *
+ * Time the same commands sent to a running mpd through the web
+ * /bincmd, one request per command and then as one posted batch.
+ * Commands are read from the file given, one per line as for the
+ * "batch" command, or else are "show version" repeated.
+ *
+ * Usage: batch_bench [-a user:password] [-n count] [-f file]
+ *		[ip [port]]
+ *
+ * It does nothing if no mpd listens there, so "make bench" can
+ * run it anyway.
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "batch.h"
+#include "console.h"
+#include "tests.h"
+
+/*
+ * DEFINITIONS
+ */
+
+  #define BENCH_COUNT		1000
+  #define BENCH_COMMAND		"show version"
+  #define BENCH_MAX_BODY	(64 * 1024 * 1024)
+
+  /* Connection to mpd */
+  struct benchconn {
+    struct sockaddr_in	sin;
+    char		auth[256];	/* Authorization header or empty */
+    FILE		*in;
+    FILE		*out;
+  };
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static int	BenchConnect(struct benchconn *c);
+  static void	BenchClose(struct benchconn *c);
+  static char	*BenchRequest(struct benchconn *c, const char *method,
+		  const char *uri, const char *body, size_t blen);
+  static char	*BenchScript(const char *file, int count);
+  static void	BenchEncode(char *dst, const char *src);
+  static void	BenchBase64(char *dst, const char *src);
+
+int
+main(int ac, char **av)
+{
+    struct benchconn	c;
+    char		uri[3 * MAX_CONSOLE_LINE + 16];
+    char		cred[128];
+    const char		*file = NULL, *p;
+    char		*script, *copy, *line, *tmp, *reply;
+    u_int64_t		start, single, batch;
+    int			count = BENCH_COUNT, ok = 0, failed = 0;
+    int			bok = 0, bfailed = 0, ch;
+
+    memset(&c, 0, sizeof(c));
+    while ((ch = getopt(ac, av, "a:f:n:")) != -1) {
+	switch (ch) {
+	    case 'a':
+		if (strlen(optarg) > 90)
+		    goto usage;
+		BenchBase64(cred, optarg);
+		snprintf(c.auth, sizeof(c.auth),
+		    "Authorization: Basic %s\r\n", cred);
+		break;
+	    case 'f':
+		file = optarg;
+		break;
+	    case 'n':
+		count = atoi(optarg);
+		break;
+	    default:
+		goto usage;
+	}
+    }
+    ac -= optind;
+    av += optind;
+    if (ac > 2 || count <= 0)
+	goto usage;
+    c.sin.sin_family = AF_INET;
+    c.sin.sin_port = htons(ac > 1 ? atoi(av[1]) : DEFAULT_WEB_PORT);
+    if (inet_pton(AF_INET, ac > 0 ? av[0] : DEFAULT_WEB_IP,
+	    &c.sin.sin_addr) != 1)
+	goto usage;
+    signal(SIGPIPE, SIG_IGN);
+
+    if (BenchConnect(&c) < 0) {
+	printf("batch_bench: no mpd web at %s:%d, skipped\n",
+	    inet_ntoa(c.sin.sin_addr), ntohs(c.sin.sin_port));
+	return (0);
+    }
+    if ((script = BenchScript(file, count)) == NULL) {
+	BenchClose(&c);
+	return (1);
+    }
+
+    /* One keep-alive GET per command, as tools do now */
+    start = TestNow();
+    tmp = copy = Mstrdup(MB_CMD, script);
+    while ((line = strsep(&tmp, "\n")) != NULL) {
+	line += strspn(line, " \t");
+	if (*line == '\0' || *line == '#')
+	    continue;
+	if (strlen(line) >= MAX_CONSOLE_LINE) {
+	    failed++;
+	    continue;
+	}
+	strlcpy(uri, "/bincmd?", sizeof(uri));
+	BenchEncode(uri + strlen(uri), line);
+	if ((reply = BenchRequest(&c, "GET", uri, NULL, 0)) == NULL) {
+	    fprintf(stderr, "batch_bench: request failed\n");
+	    return (1);
+	}
+	/* Output of the command comes first */
+	if (strstr(reply, "RESULT: 0 ") != NULL)
+	    ok++;
+	else
+	    failed++;
+	Freee(reply);
+    }
+    Freee(copy);
+    single = TestNow() - start;
+
+    /* All at once */
+    start = TestNow();
+    if ((reply = BenchRequest(&c, "POST", "/bincmd", script,
+	    strlen(script))) == NULL) {
+	fprintf(stderr, "batch_bench: request failed\n");
+	return (1);
+    }
+    batch = TestNow() - start;
+    if ((p = strstr(reply, "\"ok\": ")) != NULL)
+	bok = atoi(p + 6);
+    if ((p = strstr(reply, "\"failed\": ")) != NULL)
+	bfailed = atoi(p + 10);
+    Freee(reply);
+
+    printf("per command %6d commands (%d failed) %9.3f s  %8.0f cmd/s\n",
+	ok + failed, failed, single / 1e6,
+	(ok + failed) * 1e6 / (single ? single : 1));
+    printf("batch       %6d commands (%d failed) %9.3f s  %8.0f cmd/s\n",
+	bok + bfailed, bfailed, batch / 1e6,
+	(bok + bfailed) * 1e6 / (batch ? batch : 1));
+
+    Freee(script);
+    BenchClose(&c);
+    return (0);
+
+usage:
+    fprintf(stderr, "usage: batch_bench [-a user:password] [-n count]"
+	" [-f file] [ip [port]]\n");
+    return (1);
+}
+
+/*
+ * BenchScript()
+ *
+ * Commands of the file, or the default one count times.
+ */
+
+static char *
+BenchScript(const char *file, int count)
+{
+    char	*script;
+    FILE	*fp;
+    size_t	len;
+    int		k;
+
+    if (file == NULL) {
+	len = count * (sizeof(BENCH_COMMAND));
+	script = Malloc(MB_CMD, len + 1);
+	for (k = 0; k < count; k++) {
+	    memcpy(script + k * sizeof(BENCH_COMMAND), BENCH_COMMAND,
+		sizeof(BENCH_COMMAND) - 1);
+	    script[(k + 1) * sizeof(BENCH_COMMAND) - 1] = '\n';
+	}
+	return (script);
+    }
+    if ((fp = fopen(file, "r")) == NULL) {
+	fprintf(stderr, "%s: %s\n", file, strerror(errno));
+	return (NULL);
+    }
+    script = Malloc(MB_CMD, BATCH_MAX_SCRIPT + 1);
+    len = fread(script, 1, BATCH_MAX_SCRIPT + 1, fp);
+    fclose(fp);
+    if (len > BATCH_MAX_SCRIPT) {
+	fprintf(stderr, "%s: larger than %d bytes\n", file, BATCH_MAX_SCRIPT);
+	Freee(script);
+	return (NULL);
+    }
+    script[len] = '\0';
+    return (script);
+}
+
+/*
+ * BenchConnect()
+ */
+
+static int
+BenchConnect(struct benchconn *c)
+{
+    int		s;
+
+    if ((s = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+	return (-1);
+    if (connect(s, (struct sockaddr *)&c->sin, sizeof(c->sin)) < 0) {
+	close(s);
+	return (-1);
+    }
+    c->in = fdopen(s, "r");
+    c->out = fdopen(dup(s), "w");
+    return (0);
+}
+
+/*
+ * BenchClose()
+ */
+
+static void
+BenchClose(struct benchconn *c)
+{
+    if (c->out != NULL)
+	fclose(c->out);
+    if (c->in != NULL)
+	fclose(c->in);
+    c->in = c->out = NULL;
+}
+
+/*
+ * BenchRequest()
+ *
+ * Send request and return the reply body, NUL terminated. Connects
+ * again if mpd has closed the connection.
+ */
+
+static char *
+BenchRequest(struct benchconn *c, const char *method, const char *uri,
+    const char *body, size_t blen)
+{
+    char	line[256], *reply;
+    int		clen = -1, retry;
+
+    for (retry = 0; retry < 2; retry++) {
+	if (c->in == NULL && BenchConnect(c) < 0)
+	    return (NULL);
+	fprintf(c->out, "%s %s HTTP/1.1\r\nHost: localhost\r\n%s"
+	    "Connection: keep-alive\r\n", method, uri, c->auth);
+	if (body != NULL) {
+	    fprintf(c->out, "Content-Length: %zu\r\n\r\n", blen);
+	    fwrite(body, 1, blen, c->out);
+	} else
+	    fprintf(c->out, "\r\n");
+	if (fflush(c->out) == 0 &&
+		fgets(line, sizeof(line), c->in) != NULL)
+	    break;
+	BenchClose(c);
+    }
+    if (c->in == NULL)
+	return (NULL);
+    if (strncmp(line, "HTTP/1.", 7) != 0 || strncmp(line + 9, "200", 3)) {
+	fprintf(stderr, "batch_bench: %s", line);
+	return (NULL);
+    }
+    while (fgets(line, sizeof(line), c->in) != NULL && strcmp(line, "\r\n")) {
+	if (strncasecmp(line, "Content-Length:", 15) == 0)
+	    clen = atoi(line + 15);
+    }
+    if (clen < 0 || clen > BENCH_MAX_BODY)
+	return (NULL);
+    reply = Malloc(MB_CMD, clen + 1);
+    if (fread(reply, 1, clen, c->in) != (size_t)clen) {
+	Freee(reply);
+	return (NULL);
+    }
+    reply[clen] = '\0';
+    return (reply);
+}
+
+/*
+ * BenchEncode()
+ *
+ * URL encode command, dst must have room for three times its length.
+ */
+
+static void
+BenchEncode(char *dst, const char *src)
+{
+    static const char	hex[] = "0123456789ABCDEF";
+
+    for (; *src != '\0' && *src != '\r'; src++) {
+	if (isalnum((u_char)*src) || strchr("-_.~", *src) != NULL)
+	    *dst++ = *src;
+	else {
+	    *dst++ = '%';
+	    *dst++ = hex[(u_char)*src >> 4];
+	    *dst++ = hex[(u_char)*src & 0x0f];
+	}
+    }
+    *dst = '\0';
+}
+
+/*
+ * BenchBase64()
+ */
+
+static void
+BenchBase64(char *dst, const char *src)
+{
+    static const char	b64[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t		len = strlen(src);
+    u_int32_t		v;
+
+    for (; len >= 3; src += 3, len -= 3) {
+	v = ((u_char)src[0] << 16) | ((u_char)src[1] << 8) | (u_char)src[2];
+	*dst++ = b64[v >> 18];
+	*dst++ = b64[(v >> 12) & 0x3f];
+	*dst++ = b64[(v >> 6) & 0x3f];
+	*dst++ = b64[v & 0x3f];
+    }
+    if (len > 0) {
+	v = (u_char)src[0] << 16;
+	if (len > 1)
+	    v |= (u_char)src[1] << 8;
+	*dst++ = b64[v >> 18];
+	*dst++ = b64[(v >> 12) & 0x3f];
+	*dst++ = len > 1 ? b64[(v >> 6) & 0x3f] : '=';
+	*dst++ = '=';
+    }
+    *dst = '\0';
+}
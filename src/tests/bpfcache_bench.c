@@ -0,0 +1,126 @@
+
+/*
+ * bpfcache_bench.c
+ *
+ * Time compiling limit filters of 10000 sessions with the compiled
+ * programs cache enabled and disabled.
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "bpfcache.h"
+#include "console.h"
+#include "tests.h"
+
+/*
+ * DEFINITIONS
+ */
+
+  #define BENCH_SESSIONS	10000
+  #define BENCH_PROGLEN		4096
+
+  /*
+   * Limits of typical sessions, as IfaceLimitProg() builds them from
+   * "set global filter" rules: most sessions share few tariff plans.
+   * Every tenth session also gets its own filter from RADIUS, which
+   * never hits the cache.
+   */
+  static const char	*gBenchFilters[] = {
+    "( dst net 10.0.0.0/8 ) || ( ( dst net 172.16.0.0/12 ) || "
+	"( ( dst net 192.168.0.0/16 ) ) ) ",
+    "( not ( dst net 10.0.0.0/8 ) ) && ( ( not ( dst net 192.0.2.0/24 ) ) ) ",
+    "( src net 198.51.100.0/24 and tcp port 80 ) || "
+	"( ( src net 203.0.113.0/24 and udp port 53 ) ) ",
+    "( tcp dst port 25 or tcp dst port 465 or tcp dst port 587 ) ",
+    "( udp and ( port 500 or port 4500 ) ) || ( ( proto 50 ) ) ",
+    "( dst host 192.0.2.1 or dst host 192.0.2.2 or dst host 192.0.2.3 ) ",
+  };
+  #define BENCH_FILTERS		(sizeof(gBenchFilters) / sizeof(*gBenchFilters))
+  #define BENCH_PER_SESSION	4
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static u_int64_t	BenchRun(u_int size, struct bpf_insn *prog);
+  static void		BenchWrite(ConsoleSession cs, const char *fmt, ...);
+  static void		BenchWriteV(ConsoleSession cs, const char *fmt,
+			  va_list vl);
+
+int
+main(void)
+{
+    struct console_session	cs;
+    struct bpf_insn		*prog;
+    u_int64_t			cached, uncached;
+
+    memset(&cs, 0, sizeof(cs));
+    cs.write = BenchWrite;
+    cs.writev = BenchWriteV;
+    cs.context.cs = &cs;
+
+    prog = Malloc(MB_ACL, BENCH_PROGLEN * sizeof(*prog));
+    BpfCacheInit();
+
+    /* Cache statistics are cumulative, so they are shown after each run */
+    uncached = BenchRun(0, prog);
+    BpfCacheStat(&cs.context, 0, NULL, NULL);
+    cached = BenchRun(BPFCACHE_DEFAULT_SIZE, prog);
+    BpfCacheStat(&cs.context, 0, NULL, NULL);
+    printf("%d sessions, %d limits each: uncached %llu ms, cached %llu ms\n",
+	BENCH_SESSIONS, BENCH_PER_SESSION,
+	(unsigned long long)uncached / 1000,
+	(unsigned long long)cached / 1000);
+    Freee(prog);
+    return (0);
+}
+
+/*
+ * BenchRun()
+ */
+
+static u_int64_t
+BenchRun(u_int size, struct bpf_insn *prog)
+{
+    char	own[128];
+    u_int32_t	seed = 1;
+    u_int64_t	start;
+    int		k, j;
+
+    BpfCacheSetSize(size);
+    BpfCacheFlush();
+    start = TestNow();
+    for (k = 0; k < BENCH_SESSIONS; k++) {
+	for (j = 0; j < BENCH_PER_SESSION; j++) {
+	    if (BpfCacheCompile(gBenchFilters[TestRandom(&seed) % BENCH_FILTERS],
+		    (u_int)-1, 0xffffff00, prog, BENCH_PROGLEN) < 0) {
+		fprintf(stderr, "compilation failed\n");
+		exit(1);
+	    }
+	}
+	if (k % 10 == 0) {
+	    snprintf(own, sizeof(own), "( dst host 100.64.%d.%d ) ",
+		k / 256, k % 256);
+	    BpfCacheCompile(own, (u_int)-1, 0xffffff00, prog, BENCH_PROGLEN);
+	}
+    }
+    return (TestNow() - start);
+}
+
+static void
+BenchWrite(ConsoleSession cs, const char *fmt, ...)
+{
+    va_list	vl;
+
+    va_start(vl, fmt);
+    BenchWriteV(cs, fmt, vl);
+    va_end(vl);
+}
+
+static void
+BenchWriteV(ConsoleSession cs, const char *fmt, va_list vl)
+{
+    (void)cs;
+    vprintf(fmt, vl);
+}
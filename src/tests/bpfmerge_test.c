@@ -0,0 +1,342 @@
+
+/*
+ * bpfmerge_test.c
+ *
+ * Check that limits merged into one BPF program by BpfProgMerge()
+ * classify packets the same way as the chain of separate programs.
+ * Packets come from a deterministic synthetic corpus, and from the
+ * pcap files given as arguments.
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "bpfcache.h"
+#include "tests.h"
+
+#include <pcap.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  #define TEST_PACKETS		200000
+  #define TEST_MAX_RULES	16
+
+  /* Limit rule, as "set iface limit" takes it */
+  struct testrule {
+    const char		*expr;
+    const char		*action;	/* "pass" and "deny" are merged */
+  };
+
+  /* Program of one rule or of several merged ones */
+  struct testprog {
+    struct bpf_insn	insns[BPF_MAXINSNS];
+    int			len;
+    const char		*action;
+  };
+
+  struct testset {
+    struct testprog	chain[TEST_MAX_RULES];
+    int			nchain;
+    struct testprog	merged[TEST_MAX_RULES];
+    int			nmerged;
+  };
+
+  /* Rule lists ending with NULL expression */
+  static const struct testrule	gTestRules[][TEST_MAX_RULES] = {
+    {
+	{ "dst net 10.0.0.0/8", "pass" },
+	{ "dst net 172.16.0.0/12", "pass" },
+	{ "dst net 192.168.0.0/16", "pass" },
+	{ "tcp dst port 25", "deny" },
+	{ "udp and port 53", "pass" },
+	{ "", "shape" },
+	{ NULL, NULL }
+    },
+    {
+	{ "not dst net 192.0.2.0/24", "deny" },
+	{ "src net 198.51.100.0/24 and tcp port 80", "deny" },
+	{ "src net 203.0.113.0/24 or proto 50", "deny" },
+	{ "dst host 192.0.2.1", "shape" },
+	{ "dst host 192.0.2.2 or dst host 192.0.2.3", "pass" },
+	{ "tcp dst port 443", "pass" },
+	{ NULL, NULL }
+    },
+    {
+	{ "tcp dst port 25 or tcp dst port 465 or tcp dst port 587", "deny" },
+	{ "udp and ( port 500 or port 4500 )", "deny" },
+	{ "proto 50", "deny" },
+	{ "dst net 100.64.0.0/10", "deny" },
+	{ "( src net 10.0.0.0/8 ) && ( not ( dst net 10.0.0.0/8 ) )", "pass" },
+	{ NULL, NULL }
+    },
+  };
+  #define TEST_SETS	(sizeof(gTestRules) / sizeof(*gTestRules))
+
+  /* Addresses the packets are built from, so that the rules match */
+  static const u_int32_t	gTestAddrs[] = {
+    0x0a000001, 0x0a7f0203, 0xac100001, 0xac1fffff, 0xc0a80101,
+    0xc0000201, 0xc0000202, 0xc0000203, 0xc00002fe, 0xc6336401,
+    0xcb007105, 0x64400001, 0x647f0001, 0x08080808, 0x01020304,
+  };
+  #define TEST_ADDRS	(sizeof(gTestAddrs) / sizeof(*gTestAddrs))
+
+  static const u_int16_t	gTestPorts[] = {
+    25, 53, 80, 443, 465, 500, 587, 4500, 8080, 1024,
+  };
+  #define TEST_PORTS	(sizeof(gTestPorts) / sizeof(*gTestPorts))
+
+  static const u_char		gTestProtos[] = { 6, 17, 1, 50, 6, 17 };
+  #define TEST_PROTOS	(sizeof(gTestProtos) / sizeof(*gTestProtos))
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static void		TestBuild(struct testset *t, const struct testrule *r);
+  static void		TestProg(struct testprog *p, const char *expr,
+			  struct bpf_insn *insns, u_int maxlen);
+  static const char	*TestClassify(const struct testprog *p, int num,
+			  const u_char *pkt, u_int len);
+  static int		TestPacket(struct testset *sets, const u_char *pkt,
+			  u_int len);
+  static u_int		TestSynth(u_char *pkt, u_int32_t *seed);
+  static int		TestPcap(struct testset *sets, const char *file);
+
+/*
+ * INTERNAL VARIABLES
+ */
+
+  static u_int64_t	gTestPackets;
+  static u_int64_t	gTestMatched;
+
+int
+main(int ac, char *av[])
+{
+    struct testset	*sets;
+    u_char		pkt[128];
+    u_int32_t		seed = 1;
+    u_int		k;
+    int			i;
+
+    BpfCacheInit();
+    sets = Malloc(MB_ACL, TEST_SETS * sizeof(*sets));
+    for (k = 0; k < TEST_SETS; k++) {
+	TestBuild(&sets[k], gTestRules[k]);
+	TEST_CHECK(sets[k].nmerged < sets[k].nchain);
+    }
+
+    for (k = 0; k < TEST_PACKETS; k++)
+	TEST_CHECK(TestPacket(sets, pkt, TestSynth(pkt, &seed)));
+    for (i = 1; i < ac; i++)
+	TEST_CHECK(TestPcap(sets, av[i]) == 0);
+
+    printf("%llu packets, %llu matched by some rule\n",
+	(unsigned long long)gTestPackets, (unsigned long long)gTestMatched);
+    Freee(sets);
+    return (TestDone("bpfmerge_test"));
+}
+
+/*
+ * TestBuild()
+ *
+ * Compile rules one by one for the chain, and merge them the way
+ * IfaceSetupLimits() does.
+ */
+
+static void
+TestBuild(struct testset *t, const struct testrule *r)
+{
+    struct testprog	*m;
+    int			k, len;
+
+    for (k = 0; r[k].expr != NULL; k++) {
+	TestProg(&t->chain[t->nchain], r[k].expr,
+	    t->chain[t->nchain].insns, BPF_MAXINSNS);
+	t->chain[t->nchain++].action = r[k].action;
+    }
+
+    for (k = 0; r[k].expr != NULL; k++) {
+	m = &t->merged[t->nmerged++];
+	TestProg(m, r[k].expr, m->insns, BPF_MAXINSNS);
+	m->action = r[k].action;
+	if (strcmp(r[k].action, "pass") && strcmp(r[k].action, "deny"))
+	    continue;
+	while (r[k + 1].expr != NULL &&
+		strcmp(r[k + 1].action, m->action) == 0 &&
+		m->len < BPF_MAXINSNS) {
+	    len = BpfCacheCompile(r[k + 1].expr, (u_int)-1, 0xffffff00,
+		m->insns + m->len, BPF_MAXINSNS - m->len);
+	    TEST_CHECK(len > 0);
+	    if ((len = BpfProgMerge(m->insns, m->len, len)) < 0)
+		break;
+	    m->len = len;
+	    k++;
+	}
+    }
+}
+
+/*
+ * TestProg()
+ *
+ * Empty expression is "all", as in IfaceLimitProg().
+ */
+
+static void
+TestProg(struct testprog *p, const char *expr, struct bpf_insn *insns,
+	u_int maxlen)
+{
+    static const struct bpf_insn	all = BPF_STMT(BPF_RET+BPF_K, (u_int)-1);
+
+    if (*expr == '\0') {
+	insns[0] = all;
+	p->len = 1;
+	return;
+    }
+    p->len = BpfCacheCompile(expr, (u_int)-1, 0xffffff00, insns, maxlen);
+    if (p->len <= 0 || (u_int)p->len > maxlen) {
+	fprintf(stderr, "can not compile \"%s\"\n", expr);
+	exit(1);
+    }
+}
+
+/*
+ * TestClassify()
+ *
+ * Action of the first matching program, like chained ng_bpf hooks.
+ */
+
+static const char *
+TestClassify(const struct testprog *p, int num, const u_char *pkt, u_int len)
+{
+    int		k;
+
+    for (k = 0; k < num; k++) {
+	if (bpf_filter(p[k].insns, pkt, len, len) != 0)
+	    return (p[k].action);
+    }
+    return (NULL);
+}
+
+/*
+ * TestPacket()
+ *
+ * Returns zero if merged and chained programs disagree.
+ */
+
+static int
+TestPacket(struct testset *sets, const u_char *pkt, u_int len)
+{
+    const char	*a1, *a2;
+    u_int	k;
+
+    gTestPackets++;
+    for (k = 0; k < TEST_SETS; k++) {
+	a1 = TestClassify(sets[k].chain, sets[k].nchain, pkt, len);
+	a2 = TestClassify(sets[k].merged, sets[k].nmerged, pkt, len);
+	if (a1 != NULL)
+	    gTestMatched++;
+	if ((a1 == NULL) != (a2 == NULL) ||
+		(a1 != NULL && strcmp(a1, a2) != 0)) {
+	    fprintf(stderr, "set %u: chained \"%s\", merged \"%s\"\n", k,
+		a1 ? a1 : "none", a2 ? a2 : "none");
+	    return (0);
+	}
+    }
+    return (1);
+}
+
+/*
+ * TestSynth()
+ *
+ * Build IPv4 packet, with options sometimes, and return its length.
+ */
+
+static u_int
+TestSynth(u_char *pkt, u_int32_t *seed)
+{
+    u_int32_t	src, dst;
+    u_int	hlen, len;
+    u_char	proto;
+
+    hlen = (TestRandom(seed) % 4 == 0) ? 24 : 20;
+    proto = gTestProtos[TestRandom(seed) % TEST_PROTOS];
+    src = gTestAddrs[TestRandom(seed) % TEST_ADDRS];
+    dst = gTestAddrs[TestRandom(seed) % TEST_ADDRS];
+    if (TestRandom(seed) % 8 == 0)
+	dst ^= TestRandom(seed) & 0xffff;
+    len = hlen + 20;
+
+    memset(pkt, 0, len);
+    pkt[0] = 0x40 | (hlen / 4);
+    pkt[2] = len >> 8;
+    pkt[3] = len & 0xff;
+    pkt[8] = 64;
+    pkt[9] = proto;
+    pkt[12] = src >> 24; pkt[13] = src >> 16; pkt[14] = src >> 8; pkt[15] = src;
+    pkt[16] = dst >> 24; pkt[17] = dst >> 16; pkt[18] = dst >> 8; pkt[19] = dst;
+    if (proto == 6 || proto == 17) {
+	u_int16_t	sport = gTestPorts[TestRandom(seed) % TEST_PORTS];
+	u_int16_t	dport = gTestPorts[TestRandom(seed) % TEST_PORTS];
+
+	pkt[hlen] = sport >> 8;
+	pkt[hlen + 1] = sport & 0xff;
+	pkt[hlen + 2] = dport >> 8;
+	pkt[hlen + 3] = dport & 0xff;
+    }
+    return (len);
+}
+
+/*
+ * TestPcap()
+ *
+ * Run IPv4 packets of the capture file through the programs.
+ */
+
+static int
+TestPcap(struct testset *sets, const char *file)
+{
+    char		errbuf[PCAP_ERRBUF_SIZE];
+    pcap_t		*p;
+    struct pcap_pkthdr	*h;
+    const u_char	*data;
+    u_int		skip;
+    int			ret, failed = 0;
+
+    if ((p = pcap_open_offline(file, errbuf)) == NULL) {
+	fprintf(stderr, "%s: %s\n", file, errbuf);
+	return (-1);
+    }
+    switch (pcap_datalink(p)) {
+	case DLT_RAW:
+	    skip = 0;
+	    break;
+	case DLT_NULL:
+	case DLT_LOOP:
+	    skip = 4;
+	    break;
+	case DLT_EN10MB:
+	    skip = 14;
+	    break;
+	default:
+	    fprintf(stderr, "%s: unsupported link type %d\n", file,
+		pcap_datalink(p));
+	    pcap_close(p);
+	    return (-1);
+    }
+    while ((ret = pcap_next_ex(p, &h, &data)) == 1) {
+	if (h->caplen <= skip || (data[skip] >> 4) != 4)
+	    continue;
+	if (skip == 14 && (data[12] != 0x08 || data[13] != 0x00))
+	    continue;
+	if (!TestPacket(sets, data + skip, h->caplen - skip))
+	    failed++;
+    }
+    if (ret == -1) {
+	fprintf(stderr, "%s: %s\n", file, pcap_geterr(p));
+	failed++;
+    }
+    pcap_close(p);
+    return (failed ? -1 : 0);
+}
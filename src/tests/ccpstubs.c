@@ -0,0 +1,84 @@
+
+/*
+ * ccpstubs.c
+ *
+ * What the compression and encryption modules need from ccp.c,
+ * ecp.c, fsm.c and util.c, for their tests and benchmarks.
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "tests.h"
+
+/*
+ * GLOBAL VARIABLES
+ */
+
+  int		gTestResetReqs;
+
+/*
+ * CcpSendResetReq()
+ *
+ * Only counted, the tests resynchronize the peers themselves.
+ */
+
+void
+CcpSendResetReq(Bund b)
+{
+    (void)b;
+    gTestResetReqs++;
+}
+
+/*
+ * Crc16()
+ *
+ * Bit by bit, as in RFC 1662 section C.2, rather than the table
+ * driven version from util.c, to check the frames against.
+ */
+
+u_short
+Crc16(u_short crc, u_char *cp, int len)
+{
+    int		k;
+
+    while (len--) {
+	crc ^= *cp++;
+	for (k = 0; k < 8; k++)
+	    crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+    }
+    return (crc);
+}
+
+u_char *
+FsmConfValue(u_char *cp, int ty, int len, const void *data)
+{
+    *cp++ = ty;
+    *cp++ = len + 2;
+    if (len > 0) {
+	memcpy(cp, data, len);
+	cp += len;
+    }
+    return (cp);
+}
+
+void
+FsmAck(Fsm fp, const struct fsmoption *opt)
+{
+    (void)fp;
+    (void)opt;
+}
+
+void
+FsmRej(Fsm fp, const struct fsmoption *opt)
+{
+    (void)fp;
+    (void)opt;
+}
+
+void
+FsmNak(Fsm fp, const struct fsmoption *opt)
+{
+    (void)fp;
+    (void)opt;
+}
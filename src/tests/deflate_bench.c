@@ -0,0 +1,270 @@
+
+/*
+ * deflate_bench.c
+ *
+ * Time userland Deflate compression and decompression and report
+ * the ratio, at levels 1, 6 and 9. The payloads are taken from the
+ * pcap files given as arguments, as PPP frames of IP, or else from
+ * frames of text, random and already compressed data.
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "ccp.h"
+#include "tests.h"
+
+#include <pcap.h>
+#include <zlib.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  #define BENCH_FRAME		1500
+  #define BENCH_BATCH		1000	/* Frames prepared at once */
+  #define BENCH_BYTES		(16 * 1024 * 1024)	/* Per run */
+  #define BENCH_MAX_POOL	65536	/* Frames kept from a capture */
+
+  /* Payloads to compress, one after another */
+  struct benchpool {
+    u_char	*data;
+    int		*len;
+    int		count;
+  };
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static void	BenchRun(const char *name, struct benchpool *pool, int level);
+  static void	BenchLevels(const char *name, struct benchpool *pool);
+  static void	BenchAdd(struct benchpool *pool, u_int16_t proto,
+		  const u_char *data, int len);
+  static int	BenchPcap(struct benchpool *pool, const char *file);
+  static int	BenchSynthetic(void);
+
+int
+main(int ac, char **av)
+{
+    struct benchpool	pool;
+    int			k;
+
+    if (ac < 2)
+	return (BenchSynthetic());
+    for (k = 1; k < ac; k++) {
+	memset(&pool, 0, sizeof(pool));
+	if (BenchPcap(&pool, av[k]) == 0) {
+	    if (pool.count > 0)
+		BenchLevels(av[k], &pool);
+	    else
+		fprintf(stderr, "%s: no IP packets\n", av[k]);
+	}
+	Freee(pool.data);
+	Freee(pool.len);
+    }
+    return (0);
+}
+
+/*
+ * BenchSynthetic()
+ *
+ * Full size frames of text, random and gzip'ed text.
+ */
+
+static int
+BenchSynthetic(void)
+{
+    static u_char	frame[BENCH_FRAME];
+    static u_char	text[32 * 1024];
+    static u_char	gz[2 * sizeof(text)];
+    struct benchpool	pool;
+    uLongf		gzlen;
+    u_int32_t		seed = 1;
+    int			k, kind;
+
+    for (kind = TEST_DATA_TEXT; kind <= TEST_DATA_RANDOM; kind++) {
+	memset(&pool, 0, sizeof(pool));
+	for (k = 0; k < 1024; k++) {
+	    TestFill(frame, sizeof(frame), kind, &seed);
+	    BenchAdd(&pool, PROTO_IP, frame, sizeof(frame) - 2);
+	}
+	BenchLevels(kind == TEST_DATA_TEXT ? "text" : "random", &pool);
+	Freee(pool.data);
+	Freee(pool.len);
+    }
+
+    memset(&pool, 0, sizeof(pool));
+    for (k = 0; k < 1024; k++) {
+	TestFill(text, sizeof(text), TEST_DATA_TEXT, &seed);
+	gzlen = sizeof(gz);
+	if (compress2(gz, &gzlen, text, sizeof(text), 6) != Z_OK ||
+		gzlen < BENCH_FRAME) {
+	    fprintf(stderr, "deflate_bench: can't gzip\n");
+	    return (1);
+	}
+	BenchAdd(&pool, PROTO_IP, gz, BENCH_FRAME - 2);
+    }
+    BenchLevels("compressed", &pool);
+    Freee(pool.data);
+    Freee(pool.len);
+    return (0);
+}
+
+/*
+ * BenchPcap()
+ *
+ * IPv4 and IPv6 packets of the capture file, as they would be sent
+ * over PPP.
+ */
+
+static int
+BenchPcap(struct benchpool *pool, const char *file)
+{
+    char		errbuf[PCAP_ERRBUF_SIZE];
+    pcap_t		*p;
+    struct pcap_pkthdr	*h;
+    const u_char	*data;
+    u_int		skip;
+    int			ret, len;
+
+    if ((p = pcap_open_offline(file, errbuf)) == NULL) {
+	fprintf(stderr, "%s: %s\n", file, errbuf);
+	return (-1);
+    }
+    switch (pcap_datalink(p)) {
+	case DLT_RAW:
+	    skip = 0;
+	    break;
+	case DLT_NULL:
+	case DLT_LOOP:
+	    skip = 4;
+	    break;
+	case DLT_EN10MB:
+	    skip = 14;
+	    break;
+	default:
+	    fprintf(stderr, "%s: unsupported link type %d\n", file,
+		pcap_datalink(p));
+	    pcap_close(p);
+	    return (-1);
+    }
+    while ((ret = pcap_next_ex(p, &h, &data)) == 1
+	    && pool->count < BENCH_MAX_POOL) {
+	if (h->caplen <= skip)
+	    continue;
+	len = MIN(h->caplen - skip, BENCH_FRAME - 2);
+	switch (data[skip] >> 4) {
+	    case 4:
+		BenchAdd(pool, PROTO_IP, data + skip, len);
+		break;
+	    case 6:
+		BenchAdd(pool, PROTO_IPV6, data + skip, len);
+		break;
+	}
+    }
+    if (ret == -1) {
+	fprintf(stderr, "%s: %s\n", file, pcap_geterr(p));
+	pcap_close(p);
+	return (-1);
+    }
+    pcap_close(p);
+    return (0);
+}
+
+/*
+ * BenchAdd()
+ *
+ * Append a frame with the protocol field in front.
+ */
+
+static void
+BenchAdd(struct benchpool *pool, u_int16_t proto, const u_char *data, int len)
+{
+    u_char	*frame;
+    void	*old;
+
+    if (pool->count % 1024 == 0) {
+	old = pool->data;
+	pool->data = Mdup2(MB_COMP, old, pool->count * BENCH_FRAME,
+	    (pool->count + 1024) * BENCH_FRAME);
+	Freee(old);
+	old = pool->len;
+	pool->len = Mdup2(MB_COMP, old, pool->count * sizeof(*pool->len),
+	    (pool->count + 1024) * sizeof(*pool->len));
+	Freee(old);
+    }
+    frame = pool->data + pool->count * BENCH_FRAME;
+    frame[0] = proto >> 8;
+    frame[1] = proto & 0xff;
+    memcpy(frame + 2, data, len);
+    pool->len[pool->count++] = len + 2;
+}
+
+/*
+ * BenchLevels()
+ */
+
+static void
+BenchLevels(const char *name, struct benchpool *pool)
+{
+    BenchRun(name, pool, 1);
+    BenchRun(name, pool, 6);
+    BenchRun(name, pool, 9);
+}
+
+/*
+ * BenchRun()
+ *
+ * Through the whole pool, as many times as it takes.
+ */
+
+static void
+BenchRun(const char *name, struct benchpool *pool, int level)
+{
+    static Mbuf		frames[BENCH_BATCH];
+    static int		lens[BENCH_BATCH];
+    struct bundle	*tx, *rx;
+    u_int64_t		start, ctime = 0, dtime = 0, in = 0, out = 0;
+    int			k, n = 0;
+
+    tx = Malloc(MB_BUND, sizeof(*tx));
+    rx = Malloc(MB_BUND, sizeof(*rx));
+    tx->ccp.deflate.conf.window = DEFLATE_MAX_WINDOW;
+    tx->ccp.deflate.conf.level = level;
+    (*gCompDeflateInfo.Configure)(tx);
+    (*gCompDeflateInfo.Init)(tx, COMP_DIR_XMIT);
+    (*gCompDeflateInfo.Init)(rx, COMP_DIR_RECV);
+
+    while (in < BENCH_BYTES) {
+	for (k = 0; k < BENCH_BATCH; k++, n = (n + 1) % pool->count) {
+	    lens[k] = pool->len[n];
+	    frames[k] = mballoc(lens[k]);
+	    memcpy(MBDATAU(frames[k]), pool->data + n * BENCH_FRAME, lens[k]);
+	    frames[k]->cnt = lens[k];
+	    in += lens[k];
+	}
+	start = TestNow();
+	for (k = 0; k < BENCH_BATCH; k++)
+	    frames[k] = (*gCompDeflateInfo.Compress)(tx, frames[k]);
+	ctime += TestNow() - start;
+	for (k = 0; k < BENCH_BATCH; k++)
+	    out += MBLEN(frames[k]);
+	start = TestNow();
+	for (k = 0; k < BENCH_BATCH; k++)
+	    frames[k] = (*gCompDeflateInfo.Decompress)(rx, frames[k]);
+	dtime += TestNow() - start;
+	for (k = 0; k < BENCH_BATCH; k++) {
+	    assert(frames[k] != NULL && MBLEN(frames[k]) == (size_t)lens[k]);
+	    mbfree(frames[k]);
+	}
+    }
+    printf("deflate %-10s level %d  ratio %5.1f%%  compress %7.1f MB/s"
+	"  decompress %7.1f MB/s\n", name, level, 100.0 * out / in,
+	(double)in / (ctime ? ctime : 1), (double)in / (dtime ? dtime : 1));
+
+    (*gCompDeflateInfo.Cleanup)(tx, COMP_DIR_XMIT);
+    (*gCompDeflateInfo.Cleanup)(rx, COMP_DIR_RECV);
+    Freee(tx);
+    Freee(rx);
+}
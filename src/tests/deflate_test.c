@@ -0,0 +1,292 @@
+
+/*
+ * deflate_test.c
+ *
+ * Send frames through userland Deflate and check them with a plain
+ * zlib peer on the other side, in both directions, for all window
+ * sizes. Also lost frames and the reset exchange.
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "ccp.h"
+#include "tests.h"
+
+/*
+ * DEFINITIONS
+ */
+
+  #define TEST_FRAMES		1000
+  #define TEST_MAX_FRAME	1600
+
+  /* The other side of the link, RFC 1979 section 2 */
+  struct testpeer {
+    z_stream	zs;
+    u_int16_t	seq;
+  };
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static void	TestWindow(int window, int level);
+  static int	TestSend(Bund tx, struct testpeer *peer, const u_char *frame,
+		  int len);
+  static int	TestRecv(Bund rx, struct testpeer *peer, const u_char *frame,
+		  int len);
+  static void	TestLost(Bund tx, Bund rx);
+  static int	TestFrame(u_char *frame, u_int32_t *seed, int k);
+  static Mbuf	TestMbuf(const u_char *data, int len);
+
+/*
+ * INTERNAL VARIABLES
+ */
+
+  static const u_char	gTail[] = { 0x00, 0x00, 0xff, 0xff };
+
+int
+main(void)
+{
+    int		window;
+
+    for (window = DEFLATE_MIN_WINDOW; window <= DEFLATE_MAX_WINDOW; window++)
+	TestWindow(window, DEFLATE_DEF_LEVEL);
+    TestWindow(DEFLATE_MAX_WINDOW, 0);
+    TestWindow(DEFLATE_MAX_WINDOW, 1);
+    TestWindow(DEFLATE_MAX_WINDOW, 9);
+    return (TestDone("deflate_test"));
+}
+
+/*
+ * TestWindow()
+ *
+ * Our compressor to a zlib inflater, and a zlib deflater, as a peer
+ * with the same window would send, to our decompressor.
+ */
+
+static void
+TestWindow(int window, int level)
+{
+    const struct comptype	*ct = &gCompDeflateInfo;
+    struct testpeer	rpeer, tpeer;
+    struct bundle	*tx, *rx;
+    u_char		frame[TEST_MAX_FRAME];
+    u_int32_t		seed = window * 10 + level;
+    int			k, len;
+
+    tx = Malloc(MB_BUND, sizeof(*tx));
+    rx = Malloc(MB_BUND, sizeof(*rx));
+    tx->ccp.deflate.conf.window = window;
+    tx->ccp.deflate.conf.level = level;
+    TEST_CHECK((*ct->Configure)(tx) == 0);
+    TEST_CHECK((*ct->Init)(tx, COMP_DIR_XMIT) == 0);
+    TEST_CHECK((*ct->Init)(rx, COMP_DIR_RECV) == 0);
+
+    memset(&rpeer, 0, sizeof(rpeer));
+    memset(&tpeer, 0, sizeof(tpeer));
+    TEST_CHECK(inflateInit2(&rpeer.zs, -window) == Z_OK);
+    TEST_CHECK(deflateInit2(&tpeer.zs, Z_BEST_COMPRESSION, Z_DEFLATED,
+	-window, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+
+    for (k = 0; k < TEST_FRAMES; k++) {
+	len = TestFrame(frame, &seed, k);
+	if (!TestSend(tx, &rpeer, frame, len) ||
+		!TestRecv(rx, &tpeer, frame, len)) {
+	    printf("window %d, level %d, frame %d, length %d\n",
+		window, level, k, len);
+	    break;
+	}
+    }
+    TEST_CHECK(gTestResetReqs == 0);
+
+    /* Level 0 only stores, so there is nothing compressed to lose */
+    if (level != 0) {
+	TEST_CHECK(rpeer.seq > TEST_FRAMES / 2);
+	TestLost(tx, rx);
+	gTestResetReqs = 0;
+    }
+
+    inflateEnd(&rpeer.zs);
+    deflateEnd(&tpeer.zs);
+    (*ct->Cleanup)(tx, COMP_DIR_XMIT);
+    (*ct->Cleanup)(rx, COMP_DIR_RECV);
+    Freee(tx);
+    Freee(rx);
+}
+
+/*
+ * TestSend()
+ *
+ * Compress frame and decode it as the peer would. Returns zero
+ * on mismatch.
+ */
+
+static int
+TestSend(Bund tx, struct testpeer *peer, const u_char *frame, int len)
+{
+    u_char	out[TEST_MAX_FRAME], stored[5];
+    const u_char	*data;
+    Mbuf	bp;
+    int		dlen, ok = 1;
+
+    bp = (*gCompDeflateInfo.Compress)(tx, TestMbuf(frame, len));
+    TEST_CHECK(bp != NULL);
+    if (bp == NULL)
+	return (0);
+    data = MBDATAU(bp);
+    dlen = MBLEN(bp);
+    if (dlen >= 4 && ((data[0] << 8) | data[1]) == PROTO_COMPD) {
+	TEST_CHECK(((data[2] << 8) | data[3]) == peer->seq);
+	peer->seq++;
+	peer->zs.next_in = (u_char *)data + 4;
+	peer->zs.avail_in = dlen - 4;
+	peer->zs.next_out = out;
+	peer->zs.avail_out = sizeof(out);
+	TEST_CHECK(inflate(&peer->zs, Z_SYNC_FLUSH) == Z_OK);
+	peer->zs.next_in = (u_char *)gTail;
+	peer->zs.avail_in = sizeof(gTail);
+	inflate(&peer->zs, Z_SYNC_FLUSH);
+	if (sizeof(out) - peer->zs.avail_out != (size_t)len - 1 ||
+		memcmp(out, frame + 1, len - 1) != 0) {
+	    TEST_CHECK(!"peer inflates the frame");
+	    ok = 0;
+	}
+    } else {
+	/* Sent as is, the peer puts it into the history */
+	if (dlen != len || memcmp(data, frame, len) != 0) {
+	    TEST_CHECK(!"uncompressed frame sent as is");
+	    ok = 0;
+	}
+	stored[0] = 0x00;
+	stored[1] = (len - 1) & 0xff;
+	stored[2] = (len - 1) >> 8;
+	stored[3] = ~stored[1];
+	stored[4] = ~stored[2];
+	peer->zs.next_in = stored;
+	peer->zs.avail_in = sizeof(stored);
+	peer->zs.next_out = out;
+	peer->zs.avail_out = sizeof(out);
+	inflate(&peer->zs, Z_SYNC_FLUSH);
+	peer->zs.next_in = (u_char *)frame + 1;
+	peer->zs.avail_in = len - 1;
+	inflate(&peer->zs, Z_SYNC_FLUSH);
+	TEST_CHECK(peer->zs.avail_in == 0);
+    }
+    mbfree(bp);
+    return (ok);
+}
+
+/*
+ * TestRecv()
+ *
+ * Peer compresses the frame, or sends it as is if it does not
+ * shrink, and we decompress it. Returns zero on mismatch.
+ */
+
+static int
+TestRecv(Bund rx, struct testpeer *peer, const u_char *frame, int len)
+{
+    u_char	out[2 * TEST_MAX_FRAME];
+    Mbuf	bp;
+    int		clen, ok = 1;
+
+    peer->zs.next_in = (u_char *)frame + 1;
+    peer->zs.avail_in = len - 1;
+    peer->zs.next_out = out + 4;
+    peer->zs.avail_out = sizeof(out) - 4;
+    TEST_CHECK(deflate(&peer->zs, Z_SYNC_FLUSH) == Z_OK);
+    clen = sizeof(out) - 4 - peer->zs.avail_out - sizeof(gTail);
+    TEST_CHECK(memcmp(out + 4 + clen, gTail, sizeof(gTail)) == 0);
+    if (4 + clen < len) {
+	out[0] = PROTO_COMPD >> 8;
+	out[1] = PROTO_COMPD & 0xff;
+	out[2] = peer->seq >> 8;
+	out[3] = peer->seq & 0xff;
+	peer->seq++;
+	bp = TestMbuf(out, 4 + clen);
+    } else
+	bp = TestMbuf(frame, len);
+    bp = (*gCompDeflateInfo.Decompress)(rx, bp);
+    TEST_CHECK(bp != NULL);
+    if (bp == NULL)
+	return (0);
+    if (MBLEN(bp) != (size_t)len || memcmp(MBDATAU(bp), frame, len) != 0) {
+	TEST_CHECK(!"decompressed frame matches the original");
+	ok = 0;
+    }
+    mbfree(bp);
+    return (ok);
+}
+
+/*
+ * TestLost()
+ *
+ * Frame after a lost one is dropped and a reset is requested. After
+ * Reset-Request and Reset-Ack both sides start over.
+ */
+
+static void
+TestLost(Bund tx, Bund rx)
+{
+    const struct comptype	*ct = &gCompDeflateInfo;
+    u_char		frame[TEST_MAX_FRAME];
+    u_int32_t		seed = 7;
+    Mbuf		bp;
+    int			k, len, noAck = 0;
+
+    len = TestFrame(frame, &seed, 0);
+    mbfree((*ct->Compress)(tx, TestMbuf(frame, len)));
+    bp = (*ct->Compress)(tx, TestMbuf(frame, len));
+    TEST_CHECK(MBDATAU(bp)[1] == (PROTO_COMPD & 0xff));
+    TEST_CHECK((*ct->Decompress)(rx, bp) == NULL);
+    TEST_CHECK(gTestResetReqs == 1);
+
+    TEST_CHECK((*ct->RecvResetReq)(tx, 1, NULL, &noAck) == NULL);
+    (*ct->RecvResetAck)(rx, 1, NULL);
+    for (k = 0; k < 50; k++) {
+	len = TestFrame(frame, &seed, k);
+	bp = (*ct->Compress)(tx, TestMbuf(frame, len));
+	bp = (*ct->Decompress)(rx, bp);
+	TEST_CHECK(bp != NULL && MBLEN(bp) == (size_t)len &&
+	    memcmp(MBDATAU(bp), frame, len) == 0);
+	if (bp == NULL)
+	    break;
+	mbfree(bp);
+    }
+    TEST_CHECK(gTestResetReqs == 1);
+}
+
+/*
+ * TestFrame()
+ *
+ * PPP frame with the protocol field, mostly IP with text in it.
+ */
+
+static int
+TestFrame(u_char *frame, u_int32_t *seed, int k)
+{
+    int		len;
+
+    len = 3 + TestRandom(seed) % 1500;
+    frame[0] = 0x00;
+    frame[1] = (k % 7 == 6) ? 0x57 : 0x21;
+    TestFill(frame + 2, len - 2, (k % 5 == 4) ? TEST_DATA_RANDOM :
+	(k % 5 == 3) ? TEST_DATA_ZERO : TEST_DATA_TEXT, seed);
+    return (len);
+}
+
+/*
+ * TestMbuf()
+ */
+
+static Mbuf
+TestMbuf(const u_char *data, int len)
+{
+    Mbuf	bp;
+
+    bp = mballoc(len);
+    memcpy(MBDATAU(bp), data, len);
+    bp->cnt = len;
+    return (bp);
+}
@@ -0,0 +1,106 @@
+
+/*
+ * des_bench.c
+ *
+ * Time DESE-bis encryption and decryption of frames of typical
+ * sizes, with the OpenSSL EVP cipher and with DES_ncbc_encrypt().
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "ecp.h"
+#include "tests.h"
+
+/*
+ * DEFINITIONS
+ */
+
+  #define BENCH_BYTES		(16 * 1024 * 1024)	/* Per run */
+  #define BENCH_BATCH		1000
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static void	BenchRun(int len, int evp);
+
+int
+main(void)
+{
+    static const int	lens[] = { 40, 64, 576, 1400, 1500 };
+    DES_cblock		key = { 0 };
+    EVP_CIPHER_CTX	*ctx;
+    unsigned		k;
+
+    if ((ctx = DesCbcNew(&key, TRUE)) == NULL)
+	printf("des_bench: no DES in OpenSSL EVP\n");
+    for (k = 0; k < sizeof(lens) / sizeof(*lens); k++) {
+	if (ctx != NULL)
+	    BenchRun(lens[k], 1);
+	BenchRun(lens[k], 0);
+    }
+    EVP_CIPHER_CTX_free(ctx);
+    return (0);
+}
+
+/*
+ * BenchRun()
+ */
+
+static void
+BenchRun(int len, int evp)
+{
+    static Mbuf		frames[BENCH_BATCH];
+    const struct enctype	*et = &gDeseBisEncType;
+    struct bundle	*tx, *rx;
+    u_char		data[2048];
+    u_int32_t		seed = 1;
+    u_int64_t		start, etime = 0, dtime = 0, bytes = 0;
+    int			k;
+
+    tx = Malloc(MB_BUND, sizeof(*tx));
+    rx = Malloc(MB_BUND, sizeof(*rx));
+    strlcpy(tx->ecp.key, "0123456789abcdef", sizeof(tx->ecp.key));
+    strlcpy(rx->ecp.key, "0123456789abcdef", sizeof(rx->ecp.key));
+    (*et->Configure)(tx);
+    (*et->Configure)(rx);
+    (*et->Init)(tx, ECP_DIR_XMIT);
+    (*et->Init)(rx, ECP_DIR_RECV);
+    if (!evp) {
+	EVP_CIPHER_CTX_free(tx->ecp.desebis.xmit_ctx);
+	EVP_CIPHER_CTX_free(rx->ecp.desebis.recv_ctx);
+	tx->ecp.desebis.xmit_ctx = NULL;
+	rx->ecp.desebis.recv_ctx = NULL;
+    }
+    TestFill(data, len, TEST_DATA_RANDOM, &seed);
+
+    while (bytes < BENCH_BYTES) {
+	for (k = 0; k < BENCH_BATCH; k++) {
+	    frames[k] = mballoc(len);
+	    memcpy(MBDATAU(frames[k]), data, len);
+	    frames[k]->cnt = len;
+	}
+	start = TestNow();
+	for (k = 0; k < BENCH_BATCH; k++)
+	    frames[k] = (*et->Encrypt)(tx, frames[k]);
+	etime += TestNow() - start;
+	start = TestNow();
+	for (k = 0; k < BENCH_BATCH; k++)
+	    frames[k] = (*et->Decrypt)(rx, frames[k]);
+	dtime += TestNow() - start;
+	for (k = 0; k < BENCH_BATCH; k++) {
+	    assert(frames[k] != NULL && MBLEN(frames[k]) == (size_t)len);
+	    mbfree(frames[k]);
+	}
+	bytes += BENCH_BATCH * len;
+    }
+    printf("dese-bis %-4s %4d bytes  encrypt %6.1f MB/s  decrypt %6.1f MB/s\n",
+	evp ? "evp" : "des", len, (double)bytes / (etime ? etime : 1),
+	(double)bytes / (dtime ? dtime : 1));
+
+    (*et->Cleanup)(tx, ECP_DIR_XMIT);
+    (*et->Cleanup)(rx, ECP_DIR_RECV);
+    Freee(tx);
+    Freee(rx);
+}
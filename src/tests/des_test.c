@@ -0,0 +1,264 @@
+
+/*
+ * des_test.c
+ *
+ * Known answer tests of the DESE and DESE-bis CBC, with the OpenSSL
+ * EVP cipher and with DES_ncbc_encrypt(), and frames of both sent
+ * through the encrypt and decrypt functions.
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "ecp.h"
+#include "tests.h"
+
+/*
+ * DEFINITIONS
+ */
+
+  #define TEST_FRAMES		2000
+  #define TEST_MAX_FRAME	1600
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static void	TestKnownAnswer(int evp);
+  static void	TestFrames(const struct enctype *et, int evp);
+  static void	TestBackend(Bund b, int evp);
+  static void	RefCbc(DES_cblock *key, DES_cblock *ivec,
+		  const u_char *in, u_char *out, int len);
+
+/*
+ * INTERNAL VARIABLES
+ */
+
+  /* FIPS 81, appendix C, CBC mode example */
+  static DES_cblock		gKey =
+    { 0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef };
+  static const DES_cblock	gIvec =
+    { 0x12, 0x34, 0x56, 0x78, 0x90, 0xab, 0xcd, 0xef };
+  static const u_char		gPlain[] = "Now is the time for all ";
+  static const u_char		gCypher[24] = {
+    0xe5, 0xc7, 0xcd, 0xde, 0x87, 0x2b, 0xf2, 0x7c,
+    0x43, 0xe9, 0x34, 0x00, 0x8c, 0x38, 0x9c, 0x0f,
+    0x68, 0x37, 0x88, 0x49, 0x9a, 0x7c, 0x05, 0xf6,
+  };
+
+int
+main(void)
+{
+    EVP_CIPHER_CTX	*ctx;
+    int			evp;
+
+    /* OpenSSL without DES in EVP gets the fallback tested only */
+    if ((ctx = DesCbcNew(&gKey, TRUE)) != NULL) {
+	EVP_CIPHER_CTX_free(ctx);
+	evp = 1;
+    } else {
+	printf("des_test: no DES in OpenSSL EVP\n");
+	evp = 0;
+    }
+    for (; evp >= 0; evp--) {
+	TestKnownAnswer(evp);
+	TestFrames(&gDeseEncType, evp);
+	TestFrames(&gDeseBisEncType, evp);
+    }
+    return (TestDone("des_test"));
+}
+
+/*
+ * TestKnownAnswer()
+ *
+ * Whole message at once and in frames of 8 and 16 bytes, as the
+ * chain goes on across frames.
+ */
+
+static void
+TestKnownAnswer(int evp)
+{
+    EVP_CIPHER_CTX	*ectx = NULL, *dctx = NULL;
+    DES_key_schedule	ks;
+    DES_cblock		ivec;
+    u_char		buf[sizeof(gCypher)];
+
+    DES_set_key_unchecked(&gKey, &ks);
+    if (evp) {
+	ectx = DesCbcNew(&gKey, TRUE);
+	dctx = DesCbcNew(&gKey, FALSE);
+	TEST_CHECK(ectx != NULL && dctx != NULL);
+    }
+
+    memcpy(buf, gPlain, sizeof(buf));
+    memcpy(ivec, gIvec, sizeof(ivec));
+    DesCbc(ectx, &ks, buf, sizeof(buf), &ivec, TRUE);
+    TEST_CHECK(memcmp(buf, gCypher, sizeof(buf)) == 0);
+    TEST_CHECK(memcmp(ivec, gCypher + 16, 8) == 0);
+
+    memcpy(ivec, gIvec, sizeof(ivec));
+    DesCbc(dctx, &ks, buf, 8, &ivec, FALSE);
+    DesCbc(dctx, &ks, buf + 8, 16, &ivec, FALSE);
+    TEST_CHECK(memcmp(buf, gPlain, sizeof(buf)) == 0);
+    TEST_CHECK(memcmp(ivec, gCypher + 16, 8) == 0);
+
+    memcpy(ivec, gIvec, sizeof(ivec));
+    DesCbc(ectx, &ks, buf, 16, &ivec, TRUE);
+    DesCbc(ectx, &ks, buf + 16, 8, &ivec, TRUE);
+    TEST_CHECK(memcmp(buf, gCypher, sizeof(buf)) == 0);
+
+    /* Empty frame leaves the chain alone */
+    DesCbc(ectx, &ks, buf, 0, &ivec, TRUE);
+    TEST_CHECK(memcmp(ivec, gCypher + 16, 8) == 0);
+
+    EVP_CIPHER_CTX_free(ectx);
+    EVP_CIPHER_CTX_free(dctx);
+}
+
+/*
+ * TestFrames()
+ *
+ * Frames of all lengths, compared with CBC built from DES ECB,
+ * decrypted back, and one of them lost on the way.
+ */
+
+static void
+TestFrames(const struct enctype *et, int evp)
+{
+    const int		bis = (et == &gDeseBisEncType);
+    struct bundle	*tx, *rx;
+    DesInfo		des;
+    DeseBisInfo		desebis;
+    DES_cblock		*txivec, *rxivec, ivec, key;
+    u_char		data[TEST_MAX_FRAME], expect[TEST_MAX_FRAME + 16];
+    u_int32_t		seed = 1;
+    Mbuf		bp;
+    int			k, len, padlen, clen;
+
+    tx = Malloc(MB_BUND, sizeof(*tx));
+    rx = Malloc(MB_BUND, sizeof(*rx));
+    strlcpy(tx->ecp.key, "0123456789abcdef", sizeof(tx->ecp.key));
+    strlcpy(rx->ecp.key, "0123456789abcdef", sizeof(rx->ecp.key));
+    (*et->Configure)(tx);
+    (*et->Configure)(rx);
+    TEST_CHECK((*et->Init)(tx, ECP_DIR_XMIT) == 0);
+    TEST_CHECK((*et->Init)(rx, ECP_DIR_RECV) == 0);
+    TestBackend(tx, evp);
+    TestBackend(rx, evp);
+
+    /* The nonces are exchanged in Configure-Requests */
+    des = &tx->ecp.des;
+    desebis = &tx->ecp.desebis;
+    txivec = bis ? &desebis->xmit_ivec : &des->xmit_ivec;
+    rxivec = bis ? &rx->ecp.desebis.recv_ivec : &rx->ecp.des.recv_ivec;
+    memcpy(key, bis ? desebis->key : des->key, sizeof(key));
+    memcpy(*txivec, gIvec, sizeof(*txivec));
+    memcpy(*rxivec, gIvec, sizeof(*rxivec));
+    memcpy(ivec, gIvec, sizeof(ivec));
+
+    for (k = 0; k < TEST_FRAMES; k++) {
+	len = 1 + (k < 40 ? k : (int)(TestRandom(&seed) % 1500));
+	TestFill(data, len, k & 1 ? TEST_DATA_RANDOM : TEST_DATA_TEXT,
+	    &seed);
+
+	/* Expected frame: sequence number and the padded plaintext */
+	if (bis) {
+	    padlen = roundup2(len + 1, 8) - len;
+	    if (padlen > 7 && (data[len - 1] == 0 || data[len - 1] > 8))
+		padlen -= 8;
+	} else
+	    padlen = roundup2(len, 8) - len;
+	clen = len + padlen;
+	expect[0] = k >> 8;
+	expect[1] = k & 0xff;
+	memcpy(expect + 2, data, len);
+	for (padlen = 0; len + padlen < clen; padlen++)
+	    expect[2 + len + padlen] = bis ? padlen + 1 : 0;
+	RefCbc(&key, &ivec, expect + 2, expect + 2, clen);
+
+	bp = mballoc(len);
+	if (k & 2)
+	    bp->offset = 0;		/* No room to encrypt in place */
+	memcpy(MBDATAU(bp), data, len);
+	bp->cnt = len;
+	bp = (*et->Encrypt)(tx, bp);
+	TEST_CHECK(bp != NULL && MBLEN(bp) == (size_t)(2 + clen));
+	if (bp == NULL || MBLEN(bp) != (size_t)(2 + clen))
+	    break;
+	TEST_CHECK(memcmp(MBDATAU(bp), expect, 2 + clen) == 0);
+	TEST_CHECK(memcmp(*txivec, ivec, sizeof(ivec)) == 0);
+
+	/* Lost frame, the next one resynchronizes */
+	if (k == TEST_FRAMES / 2) {
+	    mbfree(bp);
+	    continue;
+	}
+	bp = (*et->Decrypt)(rx, bp);
+	if (k == TEST_FRAMES / 2 + 1) {
+	    TEST_CHECK(bp == NULL);
+	    continue;
+	}
+	TEST_CHECK(bp != NULL);
+	if (bp == NULL)
+	    break;
+	if (MBLEN(bp) != (size_t)(bis ? len : clen) ||
+		memcmp(MBDATAU(bp), data, len) != 0) {
+	    TEST_CHECK(!"decrypted frame matches the original");
+	    printf("frame %d, length %d\n", k, len);
+	    mbfree(bp);
+	    break;
+	}
+	mbfree(bp);
+    }
+
+    (*et->Cleanup)(tx, ECP_DIR_XMIT);
+    (*et->Cleanup)(rx, ECP_DIR_RECV);
+    Freee(tx);
+    Freee(rx);
+}
+
+/*
+ * TestBackend()
+ *
+ * Drop the EVP contexts to test DES_ncbc_encrypt().
+ */
+
+static void
+TestBackend(Bund b, int evp)
+{
+    EVP_CIPHER_CTX	**ctx[] = {
+	&b->ecp.des.xmit_ctx, &b->ecp.des.recv_ctx,
+	&b->ecp.desebis.xmit_ctx, &b->ecp.desebis.recv_ctx,
+    };
+    unsigned		k;
+
+    if (evp)
+	return;
+    for (k = 0; k < sizeof(ctx) / sizeof(*ctx); k++) {
+	EVP_CIPHER_CTX_free(*ctx[k]);
+	*ctx[k] = NULL;
+    }
+}
+
+/*
+ * RefCbc()
+ *
+ * CBC mode from single block encryption, FIPS 81 section 4.
+ */
+
+static void
+RefCbc(DES_cblock *key, DES_cblock *ivec, const u_char *in,
+	u_char *out, int len)
+{
+    DES_key_schedule	ks;
+    DES_cblock		block;
+    int			k, j;
+
+    DES_set_key_unchecked(key, &ks);
+    for (k = 0; k < len; k += 8) {
+	for (j = 0; j < 8; j++)
+	    block[j] = in[k + j] ^ (*ivec)[j];
+	DES_ecb_encrypt(&block, (DES_cblock *)(out + k), &ks, DES_ENCRYPT);
+	memcpy(*ivec, out + k, 8);
+    }
+}
@@ -0,0 +1,167 @@
+
+/*
+ * hookdispatch_bench.c
+ *
+ * Time finding the link or bundle of 1M frames received on the link
+ * data socket, by hook name: the fixed width tokens, and the decimal
+ * names parsed by strtol(), as they used to be.
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "ngfunc.h"
+#include "tests.h"
+
+/*
+ * DEFINITIONS
+ */
+
+  #define BENCH_FRAMES		1000000
+  #define BENCH_LINKS		10000
+  #define BENCH_NAMES		4096	/* Distinct hooks frames come from */
+
+  /* Hook name of a frame, in both styles */
+  struct benchname {
+    char	token[NG_HOOKSIZ];
+    char	decimal[NG_HOOKSIZ];
+  };
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static void		*BenchToken(const char *name);
+  static void		*BenchDecimal(const char *name);
+
+/*
+ * GLOBAL VARIABLES
+ */
+
+  Link		*gLinks;
+  Bund		*gBundles;
+  int		gNumLinks;
+  int		gNumBundles;
+
+int
+main(void)
+{
+    static const char	types[] = { MPD_HOOK_LINK, MPD_HOOK_LINK,
+				    MPD_HOOK_LINK, MPD_HOOK_BYPASS,
+				    MPD_HOOK_DEMAND4, MPD_HOOK_MSS_IN };
+    struct benchname	*names;
+    u_int32_t		seed = 1;
+    u_int64_t		start, token, decimal;
+    uintptr_t		sum1, sum2;
+    void		*p1, *p2;
+    int			k, id, type;
+
+    gNumLinks = gNumBundles = BENCH_LINKS;
+    gLinks = Malloc(MB_LINK, BENCH_LINKS * sizeof(*gLinks));
+    gBundles = Malloc(MB_BUND, BENCH_LINKS * sizeof(*gBundles));
+    for (k = 0; k < BENCH_LINKS; k++) {
+	gLinks[k] = Malloc(MB_LINK, sizeof(**gLinks));
+	gLinks[k]->hookgen = (u_int16_t)(k + 1);
+	gBundles[k] = Malloc(MB_BUND, sizeof(**gBundles));
+	gBundles[k]->hookgen = (u_int16_t)(k + 1);
+    }
+
+    names = Malloc(MB_LINK, BENCH_NAMES * sizeof(*names));
+    for (k = 0; k < BENCH_NAMES; k++) {
+	type = types[TestRandom(&seed) % sizeof(types)];
+	id = TestRandom(&seed) % BENCH_LINKS;
+	NgFuncHookToken(names[k].token, sizeof(names[k].token), type, id,
+	    type == MPD_HOOK_LINK ? gLinks[id]->hookgen :
+	    gBundles[id]->hookgen);
+	snprintf(names[k].decimal, sizeof(names[k].decimal), "%c%d",
+	    type, id);
+	/* Both must find the same link or bundle */
+	p1 = BenchToken(names[k].token);
+	p2 = BenchDecimal(names[k].decimal);
+	TEST_CHECK(p1 != NULL && p1 == p2);
+    }
+
+    /* Sums keep the compiler from skipping lookups */
+    start = TestNow();
+    for (k = 0, sum1 = 0; k < BENCH_FRAMES; k++)
+	sum1 += (uintptr_t)BenchToken(names[k % BENCH_NAMES].token);
+    token = TestNow() - start;
+
+    start = TestNow();
+    for (k = 0, sum2 = 0; k < BENCH_FRAMES; k++)
+	sum2 += (uintptr_t)BenchDecimal(names[k % BENCH_NAMES].decimal);
+    decimal = TestNow() - start;
+    TEST_CHECK(sum1 == sum2);
+
+    printf("%d frames: tokens %llu us (%.1f ns/frame), "
+	"strtol() %llu us (%.1f ns/frame)\n", BENCH_FRAMES,
+	(unsigned long long)token, token * 1000.0 / BENCH_FRAMES,
+	(unsigned long long)decimal, decimal * 1000.0 / BENCH_FRAMES);
+    return (TestDone("hookdispatch_bench"));
+}
+
+/*
+ * BenchToken()
+ *
+ * Lookup done by LinkNgDataFrame().
+ */
+
+static void *
+BenchToken(const char *name)
+{
+    u_int16_t	gen = 0;
+    int		id = -1;
+
+    switch (NgFuncParseHookToken(name, &id, &gen)) {
+	case MPD_HOOK_LINK:
+	    if (id >= gNumLinks || !gLinks[id] || gLinks[id]->hookgen != gen ||
+		    gLinks[id]->dead)
+		return (NULL);
+	    return (gLinks[id]);
+	case MPD_HOOK_BYPASS:
+	case MPD_HOOK_MSS_IN:
+	case MPD_HOOK_MSS_OUT:
+	case MPD_HOOK_DEMAND4:
+	case MPD_HOOK_DEMAND6:
+	    if (id >= gNumBundles || !gBundles[id] ||
+		    gBundles[id]->hookgen != gen || gBundles[id]->dead)
+		return (NULL);
+	    return (gBundles[id]);
+	default:
+	    return (NULL);
+    }
+}
+
+/*
+ * BenchDecimal()
+ *
+ * Lookup done before hook names were tokens.
+ */
+
+static void *
+BenchDecimal(const char *name)
+{
+    char	*rest;
+    int		id;
+
+    switch (name[0]) {
+	case 'l':
+	    id = strtol(name + 1, &rest, 10);
+	    if (rest[0] != 0 || id < 0 || id >= gNumLinks || !gLinks[id] ||
+		    gLinks[id]->dead)
+		return (NULL);
+	    return (gLinks[id]);
+	case 'b':
+	case 'i':
+	case 'o':
+	case '4':
+	case '6':
+	    id = strtol(name + 1, &rest, 10);
+	    if (rest[0] != 0 || id < 0 || id >= gNumBundles ||
+		    !gBundles[id] || gBundles[id]->dead)
+		return (NULL);
+	    return (gBundles[id]);
+	default:
+	    return (NULL);
+    }
+}
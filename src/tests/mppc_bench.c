@@ -0,0 +1,114 @@
+
+/*
+ * mppc_bench.c
+ *
+ * Time userland MPPC and MPPE on one core, for each key length and
+ * mode, with frames of typical sizes.
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "ccp.h"
+#include "tests.h"
+
+/*
+ * DEFINITIONS
+ */
+
+  #define BENCH_BYTES		(16 * 1024 * 1024)	/* Per run */
+  #define BENCH_BATCH		1000
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static void	BenchRun(const char *name, u_int32_t bits, int len, int kind);
+
+int
+main(void)
+{
+    static const struct {
+	const char	*name;
+	u_int32_t	bits;
+    }			modes[] = {
+	{ "e40",		MPPE_40 },
+	{ "e128",		MPPE_128 },
+	{ "e128 stateless",	MPPE_128 | MPPE_STATELESS },
+	{ "mppc",		MPPC_BIT },
+	{ "mppc e128",		MPPC_BIT | MPPE_128 },
+    };
+    static const int	lens[] = { 64, 576, 1500 };
+    unsigned		k, j;
+
+    for (k = 0; k < sizeof(modes) / sizeof(*modes); k++) {
+	for (j = 0; j < sizeof(lens) / sizeof(*lens); j++) {
+	    BenchRun(modes[k].name, modes[k].bits, lens[j], TEST_DATA_TEXT);
+	    if (modes[k].bits & MPPC_BIT)
+		BenchRun(modes[k].name, modes[k].bits, lens[j],
+		    TEST_DATA_RANDOM);
+	}
+    }
+    return (0);
+}
+
+/*
+ * BenchRun()
+ */
+
+static void
+BenchRun(const char *name, u_int32_t bits, int len, int kind)
+{
+    static Mbuf		frames[BENCH_BATCH];
+    static u_char	data[BENCH_BATCH][1500];
+    const struct comptype	*ct = &gCompMppcInfo;
+    struct bundle	*tx, *rx;
+    u_int32_t		seed = 1;
+    u_int64_t		start, ctime = 0, dtime = 0, in = 0, out = 0;
+    int			k;
+
+    tx = Malloc(MB_BUND, sizeof(*tx));
+    rx = Malloc(MB_BUND, sizeof(*rx));
+    tx->params.msoft.chap_alg = rx->params.msoft.chap_alg = CHAP_ALG_MSOFTv2;
+    tx->params.msoft.has_keys = rx->params.msoft.has_keys = 1;
+    memset(tx->params.msoft.xmit_key, 0x5a, MPPE_KEY_LEN);
+    memset(rx->params.msoft.recv_key, 0x5a, MPPE_KEY_LEN);
+    tx->ccp.mppc.xmit_bits = bits;
+    rx->ccp.mppc.recv_bits = bits;
+    (*ct->Init)(tx, COMP_DIR_XMIT);
+    (*ct->Init)(rx, COMP_DIR_RECV);
+    for (k = 0; k < BENCH_BATCH; k++)
+	TestFill(data[k], len, kind, &seed);
+
+    while (in < BENCH_BYTES) {
+	for (k = 0; k < BENCH_BATCH; k++) {
+	    frames[k] = mballoc(len);
+	    memcpy(MBDATAU(frames[k]), data[k], len);
+	    frames[k]->cnt = len;
+	}
+	start = TestNow();
+	for (k = 0; k < BENCH_BATCH; k++)
+	    frames[k] = (*ct->Compress)(tx, frames[k]);
+	ctime += TestNow() - start;
+	for (k = 0; k < BENCH_BATCH; k++)
+	    out += MBLEN(frames[k]);
+	start = TestNow();
+	for (k = 0; k < BENCH_BATCH; k++)
+	    frames[k] = (*ct->Decompress)(rx, frames[k]);
+	dtime += TestNow() - start;
+	for (k = 0; k < BENCH_BATCH; k++) {
+	    assert(frames[k] != NULL && MBLEN(frames[k]) == (size_t)len);
+	    mbfree(frames[k]);
+	}
+	in += BENCH_BATCH * len;
+    }
+    printf("%-14s %-6s %4d bytes  ratio %5.1f%%  xmit %7.1f MB/s"
+	"  recv %7.1f MB/s\n", name, kind == TEST_DATA_TEXT ? "text" : "random",
+	len, 100.0 * out / in, (double)in / (ctime ? ctime : 1),
+	(double)in / (dtime ? dtime : 1));
+
+    (*ct->Cleanup)(tx, COMP_DIR_XMIT);
+    (*ct->Cleanup)(rx, COMP_DIR_RECV);
+    Freee(tx);
+    Freee(rx);
+}
@@ -0,0 +1,502 @@
+
+/*
+ * mppc_test.c
+ *
+ * Userland MPPC and MPPE against the RFC 3079 sample keys and frames,
+ * MPPC streams built by hand, and frames of all key lengths and modes
+ * checked with a reference RC4 and key change, with lost frames.
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "ccp.h"
+#include "tests.h"
+
+#include <openssl/sha.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  #define TEST_FRAMES		3000	/* Past a dozen key changes */
+  #define TEST_MAX_FRAME	1600
+
+  /* Textbook RC4, for reference */
+  struct refrc4 {
+    u_char	s[256];
+    u_char	i, j;
+  };
+
+  /* What the peer knows about one direction */
+  struct refdir {
+    u_int32_t		bits;
+    u_char		key0[MPPE_KEY_LEN];
+    u_char		key[MPPE_KEY_LEN];
+    struct refrc4	rc4;
+  };
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static void	TestRc4(void);
+  static void	TestSample(u_int32_t bits, const u_char *startKey,
+		  const u_char *sessKey, const u_char *cypher);
+  static void	TestCodec(void);
+  static void	TestFrames(u_int32_t bits);
+  static int	TestRef(struct refdir *r, u_int16_t cc, Mbuf bp,
+		  const u_char *data, int len);
+  static Bund	TestBund(u_int32_t bits, int originate);
+  static void	TestPutBits(u_char *buf, int *nbits, u_int32_t v, int n);
+
+  static void	RefRc4Init(struct refrc4 *r, const u_char *key, int len);
+  static void	RefRc4(struct refrc4 *r, u_char *data, int len);
+  static void	RefNewKey(struct refdir *r, int initial);
+
+/*
+ * INTERNAL VARIABLES
+ */
+
+  /* RFC 3079 section 3.5.3, MS-CHAPv2 with "User" and "clientPass" */
+  static const u_char	gPasswordHashHash[16] = {
+    0x41, 0xc0, 0x0c, 0x58, 0x4b, 0xd2, 0xd9, 0x1c,
+    0x40, 0x17, 0xa2, 0xa1, 0x2f, 0xa5, 0x9f, 0x3f,
+  };
+  static const u_char	gNtResponse[24] = {
+    0x82, 0x30, 0x9e, 0xcd, 0x8d, 0x70, 0x8b, 0x5e,
+    0xa0, 0x8f, 0xaa, 0x39, 0x81, 0xcd, 0x83, 0x54,
+    0x42, 0x33, 0x11, 0x4a, 0x3d, 0x85, 0xd6, 0xdf,
+  };
+  static const u_char	gSendStartKey[16] = {
+    0x8b, 0x7c, 0xdc, 0x14, 0x9b, 0x99, 0x3a, 0x1b,
+    0xa1, 0x18, 0xcb, 0x15, 0x3f, 0x56, 0xdc, 0xcb,
+  };
+  static const u_char	gSendSessionKey40[8] = {
+    0xd1, 0x26, 0x9e, 0xc4, 0x9f, 0xa6, 0x2e, 0x3e,
+  };
+  static const u_char	gSendSessionKey128[16] = {
+    0x40, 0x5c, 0xb2, 0x24, 0x7a, 0x79, 0x56, 0xe6,
+    0xe2, 0x11, 0x00, 0x7a, 0xe2, 0x7b, 0x22, 0xd4,
+  };
+  static const u_char	gPlain[12] = "test message";
+  static const u_char	gCypher40[12] = {
+    0x92, 0x91, 0x37, 0x91, 0x7e, 0x58, 0x03, 0xd6, 0x68, 0xd7, 0x58, 0x98,
+  };
+  static const u_char	gCypher128[12] = {
+    0x81, 0x84, 0x83, 0x17, 0xdf, 0x68, 0x84, 0x62, 0x72, 0xfb, 0x5a, 0xbe,
+  };
+
+int
+main(void)
+{
+    static const u_int32_t	modes[] = {
+	MPPC_BIT,
+	MPPE_40, MPPE_56, MPPE_128,
+	MPPE_40 | MPPE_STATELESS, MPPE_56 | MPPE_STATELESS,
+	MPPE_128 | MPPE_STATELESS,
+	MPPC_BIT | MPPE_128, MPPC_BIT | MPPE_128 | MPPE_STATELESS,
+    };
+    unsigned	k;
+
+    TestRc4();
+    TestSample(MPPE_40, gSendStartKey, gSendSessionKey40, gCypher40);
+    TestSample(MPPE_128, gSendStartKey, gSendSessionKey128, gCypher128);
+    TestCodec();
+    for (k = 0; k < sizeof(modes) / sizeof(*modes); k++)
+	TestFrames(modes[k]);
+    return (TestDone("mppc_test"));
+}
+
+/*
+ * TestRc4()
+ *
+ * The reference RC4 against the usual samples.
+ */
+
+static void
+TestRc4(void)
+{
+    static const struct {
+	const char	*key, *plain;
+	u_char		cypher[16];
+    }			vec[] = {
+	{ "Key", "Plaintext",
+	  { 0xbb, 0xf3, 0x16, 0xe8, 0xd9, 0x40, 0xaf, 0x0a, 0xd3 } },
+	{ "Wiki", "pedia",
+	  { 0x10, 0x21, 0xbf, 0x04, 0x20 } },
+	{ "Secret", "Attack at dawn",
+	  { 0x45, 0xa0, 0x1f, 0x64, 0x5f, 0xc3, 0x5b, 0x38,
+	    0x35, 0x52, 0x54, 0x4b, 0x9b, 0xf5 } },
+    };
+    struct refrc4	r;
+    u_char		buf[16];
+    unsigned		k;
+    int			len;
+
+    for (k = 0; k < sizeof(vec) / sizeof(*vec); k++) {
+	len = strlen(vec[k].plain);
+	memcpy(buf, vec[k].plain, len);
+	RefRc4Init(&r, (const u_char *)vec[k].key, strlen(vec[k].key));
+	RefRc4(&r, buf, len);
+	TEST_CHECK(memcmp(buf, vec[k].cypher, len) == 0);
+    }
+}
+
+/*
+ * TestSample()
+ *
+ * Server side keys from the MS-CHAPv2 exchange, first frame sent,
+ * and the client receiving it.
+ */
+
+static void
+TestSample(u_int32_t bits, const u_char *startKey, const u_char *sessKey,
+	const u_char *cypher)
+{
+    const struct comptype	*ct = &gCompMppcInfo;
+    const int		keylen = (bits & MPPE_128) ? 16 : 8;
+    struct bundle	*srv, *cli;
+    Mbuf		bp;
+
+    srv = TestBund(bits, LINK_ORIGINATE_REMOTE);
+    cli = TestBund(bits, LINK_ORIGINATE_LOCAL);
+    TEST_CHECK((*ct->Init)(srv, COMP_DIR_XMIT) == 0);
+    TEST_CHECK((*ct->Init)(cli, COMP_DIR_RECV) == 0);
+    TEST_CHECK(memcmp(srv->ccp.mppc.xmit_key0, startKey, keylen) == 0);
+    TEST_CHECK(memcmp(cli->ccp.mppc.recv_key0, startKey, keylen) == 0);
+    TEST_CHECK(memcmp(srv->ccp.mppc.xmit.key, sessKey, keylen) == 0);
+
+    bp = mballoc(sizeof(gPlain));
+    memcpy(MBDATAU(bp), gPlain, sizeof(gPlain));
+    bp->cnt = sizeof(gPlain);
+    bp = (*ct->Compress)(srv, bp);
+    TEST_CHECK(bp != NULL && MBLEN(bp) == 2 + sizeof(gPlain));
+    if (bp != NULL && MBLEN(bp) == 2 + sizeof(gPlain)) {
+	TEST_CHECK(MBDATAU(bp)[0] == 0x10 && MBDATAU(bp)[1] == 0x00);
+	TEST_CHECK(memcmp(MBDATAU(bp) + 2, cypher, sizeof(gPlain)) == 0);
+    }
+    bp = (*ct->Decompress)(cli, bp);
+    TEST_CHECK(bp != NULL && MBLEN(bp) == sizeof(gPlain) &&
+	memcmp(MBDATAU(bp), gPlain, sizeof(gPlain)) == 0);
+    mbfree(bp);
+
+    (*ct->Cleanup)(srv, COMP_DIR_XMIT);
+    (*ct->Cleanup)(cli, COMP_DIR_RECV);
+    Freee(srv);
+    Freee(cli);
+}
+
+/*
+ * TestCodec()
+ *
+ * MPPC streams of RFC 2118 section 4 written bit by bit: what the
+ * compressor must produce, and all three offset encodings decoded.
+ */
+
+static void
+TestCodec(void)
+{
+    static const u_char	abc[] = { 0x61, 0x62, 0x63, 0xf0, 0xf1 };
+    static const u_char	ff[] = { 0xbf, 0xf8, 0x20 };
+    struct mppchist	*h;
+    u_char		data[512], out[600], *plain;
+    int			k, len, nbits, restart;
+
+    h = Malloc(MB_COMP, sizeof(*h));
+
+    /* Three literals, then offset 3 and length 9 */
+    restart = 0;
+    len = MppccCompress(h, (const u_char *)"abcabcabcabc", 12, out, &restart);
+    TEST_CHECK(restart == 1);
+    TEST_CHECK(len == sizeof(abc) && memcmp(out, abc, len) == 0);
+
+    /* Literal from 0x80, then offset 1 and length 3, zero padding */
+    MppccReset(h);
+    memset(data, 0xff, 4);
+    len = MppccCompress(h, data, 4, out, &restart);
+    TEST_CHECK(len == sizeof(ff) && memcmp(out, ff, len) == 0);
+
+    len = MppccDecompress(h, abc, sizeof(abc), MPPCC_FLUSHED, &plain);
+    TEST_CHECK(len == 12 && memcmp(plain, "abcabcabcabc", 12) == 0);
+
+    /* 400 literals, then offsets of 10, 12 and 16 bits */
+    nbits = 0;
+    memset(out, 0, sizeof(out));
+    for (k = 0; k < 400; k++) {
+	data[k] = (k * 37) ^ (k >> 3);
+	if (data[k] < 0x80)
+	    TestPutBits(out, &nbits, data[k], 8);
+	else
+	    TestPutBits(out, &nbits, 0x100 | (data[k] & 0x7f), 9);
+    }
+    TestPutBits(out, &nbits, 0x3c0 | 5, 10);		/* Offset 5 */
+    TestPutBits(out, &nbits, 0, 1);			/* Length 3 */
+    memcpy(data + k, data + k - 5, 3);
+    k += 3;
+    TestPutBits(out, &nbits, 0xe00 | (100 - 64), 12);	/* Offset 100 */
+    TestPutBits(out, &nbits, 0x2, 2);			/* Length 4-7 */
+    TestPutBits(out, &nbits, 6 & 3, 2);			/* Length 6 */
+    memcpy(data + k, data + k - 100, 6);
+    k += 6;
+    TestPutBits(out, &nbits, 0xc000 | (400 - 320), 16);	/* Offset 400 */
+    TestPutBits(out, &nbits, 0x6, 3);			/* Length 8-15 */
+    TestPutBits(out, &nbits, 10 & 7, 3);		/* Length 10 */
+    memcpy(data + k, data + k - 400, 10);
+    k += 10;
+    len = MppccDecompress(h, out, (nbits + 7) / 8, MPPCC_RESTART, &plain);
+    TEST_CHECK(len == k && memcmp(plain, data, k) == 0);
+
+    /* Offset beyond the data received so far */
+    nbits = 0;
+    memset(out, 0, sizeof(out));
+    TestPutBits(out, &nbits, 'a', 8);
+    TestPutBits(out, &nbits, 0x3c0 | 2, 10);
+    TestPutBits(out, &nbits, 0, 1);
+    TEST_CHECK(MppccDecompress(h, out, (nbits + 7) / 8, MPPCC_FLUSHED,
+	&plain) == -1);
+
+    Freee(h);
+}
+
+/*
+ * TestFrames()
+ *
+ * Frames of all lengths both ways, each checked with the reference
+ * when only encrypted. A single frame is lost, then five up to the
+ * key change at coherency count 1023, each time before a text frame
+ * that is sent compressed.
+ */
+
+static void
+TestFrames(u_int32_t bits)
+{
+    const struct comptype	*ct = &gCompMppcInfo;
+    const int		stateless = (bits & MPPE_STATELESS) != 0;
+    struct bundle	*tx, *rx;
+    struct refdir	ref;
+    u_char		data[TEST_MAX_FRAME];
+    u_int32_t		seed = bits;
+    Mbuf		bp;
+    int			k, len, lost = 0, noAck, flush = 0;
+
+    tx = TestBund(bits, LINK_ORIGINATE_LOCAL);
+    rx = TestBund(bits, LINK_ORIGINATE_REMOTE);
+    TEST_CHECK((*ct->Init)(tx, COMP_DIR_XMIT) == 0);
+    TEST_CHECK((*ct->Init)(rx, COMP_DIR_RECV) == 0);
+    memset(&ref, 0, sizeof(ref));
+    ref.bits = bits;
+    memcpy(ref.key0, tx->ccp.mppc.xmit_key0, sizeof(ref.key0));
+    RefNewKey(&ref, 1);
+    gTestResetReqs = 0;
+
+    for (k = 0; k < TEST_FRAMES; k++) {
+	len = 1 + (k < 40 ? k : (int)(TestRandom(&seed) % 1500));
+	TestFill(data, len, (k % 3 == 2) ? TEST_DATA_RANDOM : TEST_DATA_TEXT,
+	    &seed);
+	bp = mballoc(len);
+	if (k & 4)
+	    bp->offset = 0;		/* No room for the header */
+	memcpy(MBDATAU(bp), data, len);
+	bp->cnt = len;
+	bp = (*ct->Compress)(tx, bp);
+	TEST_CHECK(bp != NULL);
+	if (bp == NULL)
+	    break;
+	if (!(bits & MPPC_BIT) && !TestRef(&ref, k & 0x0fff, bp, data, len)) {
+	    printf("bits 0x%x, frame %d, length %d\n", bits, k, len);
+	    mbfree(bp);
+	    break;
+	}
+
+	if (k == 999 || (k >= 1019 && k <= 1023)) {
+	    mbfree(bp);
+	    lost++;
+	    continue;
+	}
+	/* Flushed frames, as incompressible ones are, resync by themselves */
+	if (MBDATAU(bp)[0] & 0x80)
+	    lost = 0;
+	bp = (*ct->Decompress)(rx, bp);
+	if (lost) {
+	    /* Dropped until the peer hears ResetReq and flushes */
+	    TEST_CHECK(bp == NULL);
+	    TEST_CHECK(gTestResetReqs == 1);
+	    TEST_CHECK((*ct->RecvResetReq)(tx, 0, NULL, &noAck) == NULL);
+	    TEST_CHECK(noAck);
+	    gTestResetReqs = 0;
+	    lost = 0;
+	    flush++;
+	    continue;
+	}
+	lost = 0;
+	TEST_CHECK(bp != NULL);
+	if (bp == NULL)
+	    break;
+	if (MBLEN(bp) != (size_t)len || memcmp(MBDATAU(bp), data, len) != 0) {
+	    TEST_CHECK(!"decompressed frame matches the original");
+	    printf("bits 0x%x, frame %d, length %d\n", bits, k, len);
+	    mbfree(bp);
+	    break;
+	}
+	mbfree(bp);
+    }
+    TEST_CHECK(gTestResetReqs == 0);
+    TEST_CHECK(flush == (stateless ? 0 : 2));
+    if (bits & MPPE_BITS) {
+	TEST_CHECK(tx->ccp.mppc.xmit.stats.Rekeys ==
+	    (stateless ? TEST_FRAMES : TEST_FRAMES / 256));
+    }
+
+    (*ct->Cleanup)(tx, COMP_DIR_XMIT);
+    (*ct->Cleanup)(rx, COMP_DIR_RECV);
+    Freee(tx);
+    Freee(rx);
+}
+
+/*
+ * TestRef()
+ *
+ * Decrypt the frame as the peer would, RFC 3078 section 7.
+ */
+
+static int
+TestRef(struct refdir *r, u_int16_t cc, Mbuf bp, const u_char *data, int len)
+{
+    const u_char	*in = MBDATAU(bp);
+    const int		keylen = (r->bits & MPPE_128) ? 16 : 8;
+    u_char		buf[TEST_MAX_FRAME];
+    u_int16_t		header;
+
+    if (MBLEN(bp) != (size_t)(2 + len))
+	return (0);
+    header = (in[0] << 8) | in[1];
+    if ((header & 0x0fff) != cc || (header & 0x2000) != 0 ||
+	    !(header & 0x1000) == !!(r->bits & MPPE_BITS))
+	return (0);
+    if ((r->bits & MPPE_STATELESS) && !(header & 0x8000))
+	return (0);
+    memcpy(buf, in + 2, len);
+    if (r->bits & MPPE_BITS) {
+	if ((r->bits & MPPE_STATELESS) || (cc & 0xff) == 0xff)
+	    RefNewKey(r, 0);
+	else if (header & 0x8000)
+	    RefRc4Init(&r->rc4, r->key, keylen);
+	RefRc4(&r->rc4, buf, len);
+    }
+    return (memcmp(buf, data, len) == 0);
+}
+
+/*
+ * TestBund()
+ *
+ * Bundle after MS-CHAPv2 with the RFC 3079 sample.
+ */
+
+static Bund
+TestBund(u_int32_t bits, int originate)
+{
+    Bund	b;
+
+    b = Malloc(MB_BUND, sizeof(*b));
+    b->originate = originate;
+    b->params.msoft.chap_alg = CHAP_ALG_MSOFTv2;
+    memcpy(b->params.msoft.nt_hash_hash, gPasswordHashHash,
+	sizeof(gPasswordHashHash));
+    memcpy(b->params.msoft.ntResp, gNtResponse, sizeof(gNtResponse));
+    b->ccp.mppc.xmit_bits = bits;
+    b->ccp.mppc.recv_bits = bits;
+    return (b);
+}
+
+/*
+ * TestPutBits()
+ */
+
+static void
+TestPutBits(u_char *buf, int *nbits, u_int32_t v, int n)
+{
+    while (n-- > 0) {
+	if ((v >> n) & 1)
+	    buf[*nbits / 8] |= 0x80 >> (*nbits % 8);
+	(*nbits)++;
+    }
+}
+
+/*
+ * RefRc4Init()
+ */
+
+static void
+RefRc4Init(struct refrc4 *r, const u_char *key, int len)
+{
+    u_char	t;
+    int		k, j;
+
+    for (k = 0; k < 256; k++)
+	r->s[k] = k;
+    for (k = j = 0; k < 256; k++) {
+	j = (j + r->s[k] + key[k % len]) & 0xff;
+	t = r->s[k];
+	r->s[k] = r->s[j];
+	r->s[j] = t;
+    }
+    r->i = r->j = 0;
+}
+
+/*
+ * RefRc4()
+ */
+
+static void
+RefRc4(struct refrc4 *r, u_char *data, int len)
+{
+    u_char	t;
+
+    while (len-- > 0) {
+	r->i++;
+	r->j += r->s[r->i];
+	t = r->s[r->i];
+	r->s[r->i] = r->s[r->j];
+	r->s[r->j] = t;
+	*data++ ^= r->s[(u_char)(r->s[r->i] + r->s[r->j])];
+    }
+}
+
+/*
+ * RefNewKey()
+ *
+ * GetNewKeyFromSHA() of RFC 3079 section 3.3, the key encrypted
+ * with itself unless it is the initial one, and the 40 or 56 bit
+ * salt.
+ */
+
+static void
+RefNewKey(struct refdir *r, int initial)
+{
+    const int		keylen = (r->bits & MPPE_128) ? 16 : 8;
+    u_char		pad[40];
+    u_char		hash[SHA_DIGEST_LENGTH];
+    SHA_CTX		c;
+
+    if (initial)
+	memcpy(r->key, r->key0, keylen);
+    SHA1_Init(&c);
+    SHA1_Update(&c, r->key0, keylen);
+    memset(pad, 0x00, sizeof(pad));
+    SHA1_Update(&c, pad, sizeof(pad));
+    SHA1_Update(&c, r->key, keylen);
+    memset(pad, 0xf2, sizeof(pad));
+    SHA1_Update(&c, pad, sizeof(pad));
+    SHA1_Final(hash, &c);
+    memcpy(r->key, hash, keylen);
+    if (!initial) {
+	RefRc4Init(&r->rc4, r->key, keylen);
+	RefRc4(&r->rc4, r->key, keylen);
+    }
+    if (r->bits & MPPE_40)
+	memcpy(r->key, "\xd1\x26\x9e", 3);
+    else if (r->bits & MPPE_56)
+	r->key[0] = 0xd1;
+    RefRc4Init(&r->rc4, r->key, keylen);
+}
@@ -0,0 +1,115 @@
+
+/*
+ * pred1_bench.c
+ *
+ * Time userland Predictor-1 compression and decompression of full
+ * size frames of text, random and already compressed (gzip'ed text,
+ * as downloads are) data.
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "ccp.h"
+#include "tests.h"
+
+#include <zlib.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  #define BENCH_FRAME		1500
+  #define BENCH_BATCH		1000	/* Frames prepared at once */
+  #define BENCH_BATCHES		40
+  #define BENCH_POOL		1024	/* Distinct payloads, more than
+					   the guess table remembers */
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static void	BenchRun(const char *name, u_char *pool);
+
+int
+main(void)
+{
+    static u_char	pool[BENCH_POOL * BENCH_FRAME];
+    static u_char	text[32 * 1024];
+    static u_char	gz[2 * sizeof(text)];
+    uLongf		gzlen;
+    u_int32_t		seed = 1;
+    int			k;
+
+    for (k = 0; k < BENCH_POOL; k++)
+	TestFill(pool + k * BENCH_FRAME, BENCH_FRAME, TEST_DATA_TEXT, &seed);
+    BenchRun("text", pool);
+
+    for (k = 0; k < BENCH_POOL; k++)
+	TestFill(pool + k * BENCH_FRAME, BENCH_FRAME, TEST_DATA_RANDOM, &seed);
+    BenchRun("random", pool);
+
+    for (k = 0; k < BENCH_POOL; k++) {
+	TestFill(text, sizeof(text), TEST_DATA_TEXT, &seed);
+	gzlen = sizeof(gz);
+	if (compress2(gz, &gzlen, text, sizeof(text), 6) != Z_OK ||
+		gzlen < BENCH_FRAME) {
+	    fprintf(stderr, "pred1_bench: can't gzip\n");
+	    return (1);
+	}
+	memcpy(pool + k * BENCH_FRAME, gz, BENCH_FRAME);
+    }
+    BenchRun("compressed", pool);
+    return (0);
+}
+
+/*
+ * BenchRun()
+ */
+
+static void
+BenchRun(const char *name, u_char *pool)
+{
+    static Mbuf		frames[BENCH_BATCH];
+    struct bundle	*tx, *rx;
+    u_int64_t		start, ctime = 0, dtime = 0, in = 0, out = 0;
+    int			k, n;
+
+    tx = Malloc(MB_BUND, sizeof(*tx));
+    rx = Malloc(MB_BUND, sizeof(*rx));
+    (*gCompPred1Info.Init)(tx, COMP_DIR_XMIT);
+    (*gCompPred1Info.Init)(rx, COMP_DIR_RECV);
+
+    for (n = 0; n < BENCH_BATCHES; n++) {
+	for (k = 0; k < BENCH_BATCH; k++) {
+	    frames[k] = mballoc(BENCH_FRAME);
+	    memcpy(MBDATAU(frames[k]),
+		pool + ((n * BENCH_BATCH + k) % BENCH_POOL) * BENCH_FRAME,
+		BENCH_FRAME);
+	    frames[k]->cnt = BENCH_FRAME;
+	}
+	start = TestNow();
+	for (k = 0; k < BENCH_BATCH; k++)
+	    frames[k] = (*gCompPred1Info.Compress)(tx, frames[k]);
+	ctime += TestNow() - start;
+	for (k = 0; k < BENCH_BATCH; k++)
+	    out += MBLEN(frames[k]);
+	start = TestNow();
+	for (k = 0; k < BENCH_BATCH; k++)
+	    frames[k] = (*gCompPred1Info.Decompress)(rx, frames[k]);
+	dtime += TestNow() - start;
+	for (k = 0; k < BENCH_BATCH; k++) {
+	    assert(frames[k] != NULL && MBLEN(frames[k]) == BENCH_FRAME);
+	    mbfree(frames[k]);
+	}
+	in += BENCH_BATCH * BENCH_FRAME;
+    }
+    printf("pred1 %-10s  ratio %5.1f%%  compress %7.1f MB/s"
+	"  decompress %7.1f MB/s\n", name, 100.0 * out / in,
+	(double)in / (ctime ? ctime : 1), (double)in / (dtime ? dtime : 1));
+
+    (*gCompPred1Info.Cleanup)(tx, COMP_DIR_XMIT);
+    (*gCompPred1Info.Cleanup)(rx, COMP_DIR_RECV);
+    Freee(tx);
+    Freee(rx);
+}
@@ -0,0 +1,223 @@
+
+/*
+ * pred1_test.c
+ *
+ * Check userland Predictor-1 frames against a plain byte by byte
+ * compressor, as in RFC 1978, and that they decompress back, also
+ * across resets and after damaged frames.
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "ccp.h"
+#include "util.h"
+#include "tests.h"
+
+/*
+ * DEFINITIONS
+ */
+
+  #define TEST_FRAMES		3000
+  #define TEST_MAX_FRAME	1600
+
+  /* Reference compressor state */
+  struct refpred1 {
+    u_char	table[PRED1_TABLE_SIZE];
+    u_short	hash;
+  };
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static Mbuf	TestMbuf(const u_char *data, int len, int tight);
+  static int	TestRoundTrip(Bund tx, Bund rx, struct refpred1 *ref,
+		  const u_char *data, int len, int tight);
+  static int	RefFrame(struct refpred1 *ref, const u_char *data, int len,
+		  u_char *out);
+  static int	RefCompress(struct refpred1 *ref, const u_char *src,
+		  u_char *dst, int len);
+
+int
+main(void)
+{
+    static const int	lens[] = { 1, 2, 7, 8, 9, 15, 16, 17, 64, 1500 };
+    static struct refpred1	ref;
+    const struct comptype	*ct = &gCompPred1Info;
+    u_char		data[TEST_MAX_FRAME];
+    u_int32_t		seed = 1;
+    struct bundle	*tx, *rx;
+    Mbuf		bp;
+    int			k, len, kind, noAck, resets;
+
+    tx = Malloc(MB_BUND, sizeof(*tx));
+    rx = Malloc(MB_BUND, sizeof(*rx));
+    strlcpy(tx->name, "tx", sizeof(tx->name));
+    strlcpy(rx->name, "rx", sizeof(rx->name));
+    TEST_CHECK((*ct->Init)(tx, COMP_DIR_XMIT) == 0);
+    TEST_CHECK((*ct->Init)(rx, COMP_DIR_RECV) == 0);
+
+    /* Lengths around the 8 byte groups, then mixed traffic */
+    for (k = 0; k < TEST_FRAMES; k++) {
+	if (k < (int)(sizeof(lens) / sizeof(*lens)))
+	    len = lens[k];
+	else
+	    len = 1 + TestRandom(&seed) % 1500;
+	kind = (k % 5 == 4) ? TEST_DATA_RANDOM :
+	    (k % 5 == 3) ? TEST_DATA_ZERO : TEST_DATA_TEXT;
+	TestFill(data, len, kind, &seed);
+	if (!TestRoundTrip(tx, rx, &ref, data, len, k & 1)) {
+	    printf("frame %d, length %d, kind %d\n", k, len, kind);
+	    break;
+	}
+    }
+    TEST_CHECK(gTestResetReqs == 0);
+
+    /* A damaged frame is dropped and asks for a reset */
+    TestFill(data, 1000, TEST_DATA_TEXT, &seed);
+    bp = (*ct->Compress)(tx, TestMbuf(data, 1000, 0));
+    TEST_CHECK(MBDATAU(bp)[0] & 0x80);
+    MBDATAU(bp)[MBLEN(bp) / 2] ^= 0x10;
+    resets = gTestResetReqs;
+    TEST_CHECK((*ct->Decompress)(rx, bp) == NULL);
+    TEST_CHECK(gTestResetReqs == resets + 1);
+
+    /* Our CCP sends the Reset-Request, the peer answers */
+    noAck = 0;
+    TEST_CHECK((*ct->SendResetReq)(rx) == NULL);
+    TEST_CHECK((*ct->RecvResetReq)(tx, 1, NULL, &noAck) == NULL);
+    (*ct->RecvResetAck)(rx, 1, NULL);
+    memset(&ref, 0, sizeof(ref));
+    for (k = 0; k < 100; k++) {
+	len = 1 + TestRandom(&seed) % 1500;
+	TestFill(data, len, TEST_DATA_TEXT, &seed);
+	if (!TestRoundTrip(tx, rx, &ref, data, len, k & 1))
+	    break;
+    }
+
+    /* Short frame and uncompressed frame longer than it is */
+    resets = gTestResetReqs;
+    TEST_CHECK((*ct->Decompress)(rx, TestMbuf(data, 3, 0)) == NULL);
+    data[0] = 0x01;
+    data[1] = 0x00;
+    TEST_CHECK((*ct->Decompress)(rx, TestMbuf(data, 100, 0)) == NULL);
+    TEST_CHECK(gTestResetReqs == resets + 2);
+
+    (*ct->Cleanup)(tx, COMP_DIR_XMIT);
+    (*ct->Cleanup)(rx, COMP_DIR_RECV);
+    Freee(tx);
+    Freee(rx);
+    return (TestDone("pred1_test"));
+}
+
+/*
+ * TestMbuf()
+ *
+ * Frame as it comes from the bundle, without room for the
+ * Predictor-1 header if tight.
+ */
+
+static Mbuf
+TestMbuf(const u_char *data, int len, int tight)
+{
+    Mbuf	bp;
+
+    bp = mballoc(len);
+    if (tight)
+	bp->offset = 0;
+    memcpy(MBDATAU(bp), data, len);
+    bp->cnt = len;
+    return (bp);
+}
+
+/*
+ * TestRoundTrip()
+ *
+ * Compress frame, compare with the reference, decompress and compare
+ * with the original. Returns zero on mismatch.
+ */
+
+static int
+TestRoundTrip(Bund tx, Bund rx, struct refpred1 *ref, const u_char *data,
+	int len, int tight)
+{
+    u_char	expect[2 * TEST_MAX_FRAME];
+    Mbuf	bp;
+    int		elen, ok = 1;
+
+    elen = RefFrame(ref, data, len, expect);
+    bp = (*gCompPred1Info.Compress)(tx, TestMbuf(data, len, tight));
+    TEST_CHECK(bp != NULL);
+    if (bp == NULL)
+	return (0);
+    if (MBLEN(bp) != (size_t)elen || memcmp(MBDATAU(bp), expect, elen)) {
+	TEST_CHECK(!"compressed frame matches the reference");
+	ok = 0;
+    }
+    bp = (*gCompPred1Info.Decompress)(rx, bp);
+    TEST_CHECK(bp != NULL);
+    if (bp == NULL)
+	return (0);
+    if (MBLEN(bp) != (size_t)len || memcmp(MBDATAU(bp), data, len)) {
+	TEST_CHECK(!"decompressed frame matches the original");
+	ok = 0;
+    }
+    mbfree(bp);
+    return (ok);
+}
+
+/*
+ * RefFrame()
+ *
+ * Build Predictor-1 frame: length, data and FCS, RFC 1978 section 3.
+ */
+
+static int
+RefFrame(struct refpred1 *ref, const u_char *data, int len, u_char *out)
+{
+    u_int16_t	fcs;
+    int		clen, n;
+
+    out[0] = (len >> 8) & 0x7f;
+    out[1] = len & 0xff;
+    fcs = Crc16(PPP_INITFCS, out, 2);
+    fcs = ~Crc16(fcs, (u_char *)data, len);
+    clen = RefCompress(ref, data, out + 2, len);
+    if (clen < len) {
+	out[0] |= 0x80;
+	n = 2 + clen;
+    } else {
+	memcpy(out + 2, data, len);
+	n = 2 + len;
+    }
+    out[n++] = fcs & 0xff;
+    out[n++] = fcs >> 8;
+    return (n);
+}
+
+/*
+ * RefCompress()
+ */
+
+static int
+RefCompress(struct refpred1 *ref, const u_char *src, u_char *dst, int len)
+{
+    u_char	*start = dst, *flagp;
+    int		k;
+
+    while (len > 0) {
+	flagp = dst++;
+	*flagp = 0;
+	for (k = 0; k < 8 && len > 0; k++, len--) {
+	    if (ref->table[ref->hash] == *src)
+		*flagp |= 1 << k;
+	    else {
+		ref->table[ref->hash] = *src;
+		*dst++ = *src;
+	    }
+	    ref->hash = (ref->hash << 4) ^ *src++;
+	}
+    }
+    return (dst - start);
+}
@@ -0,0 +1,201 @@
+
+/*
+ * stubs.c
+ *
+ * Daemon globals and functions the tests link against instead of
+ * main.c, log.c and giant.c.
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "log.h"
+#include "giant.h"
+#include "tests.h"
+
+/*
+ * GLOBAL VARIABLES
+ */
+
+  int			gLogOptions = 0;
+  __thread int		gLogTrace = 0;
+  int			gGiantProf = 0;
+  struct giantsite	*gGiantHolder = NULL;
+  pthread_mutex_t	gGiantMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * INTERNAL VARIABLES
+ */
+
+  static int		gTestsFailed;
+
+void
+LogPrintf(const char *fmt, ...)
+{
+    va_list	args;
+
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+void
+LogPrintf2(const char *fmt, ...)
+{
+    va_list	args;
+
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+void
+Perror(const char *fmt, ...)
+{
+    va_list	args;
+    int		e = errno;
+
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fprintf(stderr, ": %s\n", strerror(e));
+}
+
+void
+DoExit(int code)
+{
+    exit(code);
+}
+
+void
+DoAssert(const char *file, int line, const char *x)
+{
+    fprintf(stderr, "ASSERT \"%s\" failed: file \"%s\", line %d\n",
+	x, file, line);
+    abort();
+}
+
+void
+GiantProfLock(const char *file, int line)
+{
+    (void)file;
+    (void)line;
+}
+
+void
+GiantProfUnlock(void)
+{
+}
+
+void
+GiantProfMutex(pthread_mutex_t *m, const char *name, const char *file,
+	int line)
+{
+    (void)name;
+    (void)file;
+    (void)line;
+    assert(pthread_mutex_lock(m) == 0);
+}
+
+/*
+ * TestCheck()
+ *
+ * Count and report failed checks, see TEST_CHECK().
+ */
+
+void
+TestCheck(int ok, const char *file, int line, const char *what)
+{
+    if (ok)
+	return;
+    fprintf(stderr, "%s:%d: check \"%s\" failed\n", file, line, what);
+    gTestsFailed++;
+}
+
+/*
+ * TestDone()
+ *
+ * Exit status of the test program.
+ */
+
+int
+TestDone(const char *name)
+{
+    if (gTestsFailed) {
+	printf("%s: %d checks FAILED\n", name, gTestsFailed);
+	return (1);
+    }
+    printf("%s: ok\n", name);
+    return (0);
+}
+
+/*
+ * TestNow()
+ *
+ * Monotonic microseconds, for benchmarks.
+ */
+
+u_int64_t
+TestNow(void)
+{
+    struct timespec	ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((u_int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+/*
+ * TestRandom()
+ *
+ * Deterministic pseudo random numbers, so runs can be compared.
+ */
+
+u_int32_t
+TestRandom(u_int32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return (*seed >> 1);
+}
+
+/*
+ * TestFill()
+ *
+ * Fill frame payload of the given kind.
+ */
+
+void
+TestFill(u_char *buf, int len, int kind, u_int32_t *seed)
+{
+    static const char	*words[] = {
+	"<div class=\"item\">", "</div>\n", "<a href=\"/news/", "\">",
+	"</a>", "HTTP/1.1 200 OK\r\n", "Content-Type: text/html\r\n",
+	"Content-Length: ", "\r\n", "the ", "of ", "and ", "session ",
+	"traffic ", "limit ", "bundle ", "link ", "<span>", "</span>",
+	"GET /index.html HTTP/1.1\r\nHost: www.example.com\r\n",
+    };
+    const char		*w;
+    int			k, n;
+
+    switch (kind) {
+	case TEST_DATA_TEXT:
+	    for (k = 0; k < len; ) {
+		if (TestRandom(seed) % 4 == 0) {
+		    buf[k++] = '0' + TestRandom(seed) % 10;
+		    continue;
+		}
+		w = words[TestRandom(seed) % (sizeof(words) / sizeof(*words))];
+		for (n = 0; w[n] != '\0' && k < len; n++)
+		    buf[k++] = w[n];
+	    }
+	    break;
+	case TEST_DATA_RANDOM:
+	    for (k = 0; k < len; k++)
+		buf[k] = TestRandom(seed) >> 23;	/* Low bits repeat soon */
+	    break;
+	default:
+	    memset(buf, 0, len);
+	    break;
+    }
+}
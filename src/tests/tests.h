@@ -0,0 +1,44 @@
+
+/*
+ * tests.h
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#ifndef _TESTS_H_
+#define _TESTS_H_
+
+#include <sys/types.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  #define TEST_CHECK(e)		TestCheck((e) != 0, __FILE__, __LINE__, #e)
+
+  /* Payloads for TestFill() */
+  enum {
+    TEST_DATA_TEXT,		/* Markup and headers, compresses well */
+    TEST_DATA_RANDOM,		/* Does not compress at all */
+    TEST_DATA_ZERO
+  };
+
+/*
+ * VARIABLES
+ */
+
+  extern int		gTestResetReqs;		/* CcpSendResetReq() calls */
+
+/*
+ * FUNCTIONS
+ */
+
+  extern void		TestCheck(int ok, const char *file, int line,
+			  const char *what);
+  extern int		TestDone(const char *name);
+  extern u_int64_t	TestNow(void);
+  extern u_int32_t	TestRandom(u_int32_t *seed);
+  extern void		TestFill(u_char *buf, int len, int kind,
+			  u_int32_t *seed);
+
+#endif
@@ -0,0 +1,420 @@
+
+/*
+ * webload_bench.c
+ *
+ * Hammer the web server with keep-alive clients asking for /json and
+ * /metrics in turn, while idle connections are parked next to them,
+ * and report the client and server side latency. The servlet answers
+ * with bodies of the size of a few hundred sessions, as web.c would.
+ * Event streams, more than there are workers, stay open meanwhile and
+ * must not keep the requests waiting; one over the limit is refused.
+ *
+ * Usage: webload_bench [clients [requests]]
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "web.h"
+#include "tests.h"
+
+/*
+ * DEFINITIONS
+ */
+
+  #define BENCH_PORT		15006
+  #define BENCH_CLIENTS		50
+  #define BENCH_REQUESTS	200	/* Per client */
+  #define BENCH_IDLE_CONN	20	/* Connected, never asking */
+  #define BENCH_WORKERS		8
+  #define BENCH_STREAMS		DEFAULT_WEB_STREAMS	/* Open all along */
+  #define BENCH_STREAM_TICK	100000	/* usec */
+  #define BENCH_CLIENT_TIMEOUT	10	/* Seconds a reply may take */
+  #define BENCH_IDLE_TIMEOUT	2
+  #define BENCH_SESSIONS	300	/* Listed in the bodies */
+
+  /* One client thread */
+  struct benchclient {
+    pthread_t	tid;
+    int		requests;
+    int		ok;
+    int		fail;
+    u_int64_t	sum;		/* usec */
+    u_int64_t	max;		/* usec */
+  };
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static int	BenchServletRun(struct http_servlet *servlet,
+		  struct http_request *req, struct http_response *resp);
+  static void	BenchServletDestroy(struct http_servlet *servlet);
+  static void	BenchStream(struct http_response *resp);
+  static void	*BenchClient(void *arg);
+  static int	BenchConnect(void);
+  static int	BenchOpenStream(int *sp);
+  static int	BenchRequest(FILE *in, FILE *out, const char *path);
+  static void	BenchLog(int sev, const char *fmt, ...);
+
+/*
+ * INTERNAL VARIABLES
+ */
+
+  static char	*gBenchJson;
+  static char	*gBenchMetrics;
+
+int
+main(int ac, char **av)
+{
+    struct pevent_ctx		*ctx;
+    struct http_server		*srv;
+    struct http_servlet		servlet;
+    struct http_server_stats	st;
+    struct benchclient		*clients;
+    struct in_addr		ip;
+    int				idle[BENCH_IDLE_CONN];
+    int				streams[BENCH_STREAMS];
+    int				nclients, nrequests, k, ok = 0, fail = 0;
+    int				status, extra;
+    u_int64_t			start, elapsed, sum = 0, max = 0;
+    size_t			len;
+    FILE			*fp;
+
+    nclients = ac > 1 ? atoi(av[1]) : BENCH_CLIENTS;
+    nrequests = ac > 2 ? atoi(av[2]) : BENCH_REQUESTS;
+    if (nclients <= 0 || nrequests <= 0) {
+	fprintf(stderr, "usage: webload_bench [clients [requests]]\n");
+	return (1);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Bodies, built once */
+    fp = open_memstream(&gBenchJson, &len);
+    fprintf(fp, "{\"sessions\":[");
+    for (k = 0; k < BENCH_SESSIONS; k++) {
+	fprintf(fp, "%s{\"link\":\"L%d\",\"bundle\":\"B%d\",\"iface\":\"ng%d\","
+	    "\"user\":\"user%d\",\"ip\":\"10.0.%d.%d\",\"state\":\"OPENED\","
+	    "\"in\":%d,\"out\":%d}", k ? "," : "", k, k, k, k,
+	    k / 256, k % 256, k * 1013, k * 2027);
+    }
+    fprintf(fp, "]}\n");
+    fclose(fp);
+    fp = open_memstream(&gBenchMetrics, &len);
+    fprintf(fp, "# TYPE mpd_session_octets_total counter\n");
+    for (k = 0; k < BENCH_SESSIONS; k++) {
+	fprintf(fp, "mpd_session_octets_total{link=\"L%d\",dir=\"in\"} %d\n"
+	    "mpd_session_octets_total{link=\"L%d\",dir=\"out\"} %d\n",
+	    k, k * 1013, k, k * 2027);
+    }
+    fclose(fp);
+
+    if ((ctx = pevent_ctx_create(MB_WEB, NULL)) == NULL) {
+	perror("pevent_ctx_create");
+	return (1);
+    }
+    ip.s_addr = htonl(INADDR_LOOPBACK);
+    if ((srv = http_server_start(ctx, ip, BENCH_PORT, NULL, "mpd",
+	    BenchLog)) == NULL) {
+	perror("http_server_start");
+	return (1);
+    }
+    http_server_set_limits(srv, DEFAULT_WEB_MAX_CONN, BENCH_WORKERS,
+	BENCH_STREAMS, BENCH_IDLE_TIMEOUT);
+    memset(&servlet, 0, sizeof(servlet));
+    servlet.run = BenchServletRun;
+    servlet.destroy = BenchServletDestroy;
+    http_server_register_servlet(srv, &servlet, NULL, ".*", 10);
+
+    /* These must not take workers from the clients */
+    for (k = 0; k < BENCH_IDLE_CONN; k++)
+	idle[k] = BenchConnect();
+
+    /* Neither must these, and one more is too many */
+    for (k = 0; k < BENCH_STREAMS; k++) {
+	if ((status = BenchOpenStream(&streams[k])) != 200) {
+	    fprintf(stderr, "webload_bench: stream %d: status %d\n",
+		k, status);
+	    fail++;
+	}
+    }
+    if ((status = BenchOpenStream(&extra)) != 503) {
+	fprintf(stderr, "webload_bench: stream over the limit: status %d\n",
+	    status);
+	fail++;
+    }
+    if (extra >= 0)
+	close(extra);
+
+    clients = Malloc(MB_WEB, nclients * sizeof(*clients));
+    start = TestNow();
+    for (k = 0; k < nclients; k++) {
+	clients[k].requests = nrequests;
+	if (pthread_create(&clients[k].tid, NULL, BenchClient,
+		&clients[k]) != 0) {
+	    perror("pthread_create");
+	    return (1);
+	}
+    }
+    for (k = 0; k < nclients; k++) {
+	pthread_join(clients[k].tid, NULL);
+	ok += clients[k].ok;
+	fail += clients[k].fail;
+	sum += clients[k].sum;
+	max = MAX(max, clients[k].max);
+    }
+    elapsed = TestNow() - start;
+    Freee(clients);
+
+    http_server_get_stats(srv, &st);
+    printf("webload %d clients x %d requests: ok %d, failed %d,"
+	" %.0f req/s\n", nclients, nrequests, ok, fail,
+	ok * 1e6 / (elapsed ? elapsed : 1));
+    printf("  client latency avg %llu us, max %llu us\n",
+	(unsigned long long)(ok ? sum / ok : 0), (unsigned long long)max);
+    printf("  server service avg %llu us, max %llu us; wait avg %llu us,"
+	" max %llu us\n",
+	(unsigned long long)(st.service.count ?
+	    st.service.sum / st.service.count : 0),
+	(unsigned long long)st.service.max,
+	(unsigned long long)(st.wait.count ? st.wait.sum / st.wait.count : 0),
+	(unsigned long long)st.wait.max);
+    printf("  accepted %llu, open %u, idle %u, workers %u of %u\n",
+	(unsigned long long)st.accepted, st.num_conn, st.num_idle,
+	st.num_workers, st.max_workers);
+    printf("  streams %u of %u, refused %llu\n", st.num_streams,
+	st.max_streams, (unsigned long long)st.streams_refused);
+    if (st.num_workers > BENCH_WORKERS || st.num_streams != BENCH_STREAMS) {
+	fprintf(stderr, "webload_bench: streams counted as workers\n");
+	fail++;
+    }
+    for (k = 0; k < BENCH_STREAMS; k++) {
+	if (streams[k] >= 0)
+	    close(streams[k]);
+    }
+
+    /* Parked connections are closed when idle too long */
+    sleep(BENCH_IDLE_TIMEOUT + 2);
+    http_server_get_stats(srv, &st);
+    printf("  after %ds idle: open %u, closed by idle timeout %llu\n",
+	BENCH_IDLE_TIMEOUT + 2, st.num_conn,
+	(unsigned long long)st.idle_closed);
+    if (st.idle_closed < BENCH_IDLE_CONN) {
+	fprintf(stderr, "webload_bench: idle connections left open\n");
+	fail++;
+    }
+
+    for (k = 0; k < BENCH_IDLE_CONN; k++) {
+	if (idle[k] >= 0)
+	    close(idle[k]);
+    }
+    http_server_stop(&srv);
+    pevent_ctx_destroy(&ctx);
+    free(gBenchJson);
+    free(gBenchMetrics);
+    return (fail != 0);
+}
+
+/*
+ * BenchServletRun()
+ */
+
+static int
+BenchServletRun(struct http_servlet *servlet, struct http_request *req,
+    struct http_response *resp)
+{
+    const char	*path;
+    FILE	*f;
+
+    (void)servlet;
+    if ((path = http_request_get_path(req)) == NULL ||
+	    (f = http_response_get_output(resp, 1)) == NULL)
+	return (0);
+    if (strcmp(path, "/events") == 0)
+	BenchStream(resp);
+    else if (strcmp(path, "/json") == 0) {
+	http_response_set_header(resp, 0, "Content-Type", "application/json");
+	fputs(gBenchJson, f);
+    } else if (strcmp(path, "/metrics") == 0) {
+	http_response_set_header(resp, 0, "Content-Type",
+	    "text/plain; version=0.0.4");
+	fputs(gBenchMetrics, f);
+    } else {
+	http_response_send_error(resp, HTTP_STATUS_NOT_FOUND, NULL);
+    }
+    return (1);
+}
+
+static void
+BenchServletDestroy(struct http_servlet *servlet)
+{
+    (void)servlet;
+}
+
+/*
+ * BenchStream()
+ *
+ * Keep-alive comments, as web.c sends between events, until the
+ * client goes away.
+ */
+
+static void
+BenchStream(struct http_response *resp)
+{
+    FILE	*f;
+
+    if (http_server_stream(resp) == -1) {
+	http_response_send_error(resp, HTTP_STATUS_SERVICE_UNAVAILABLE, NULL);
+	return;
+    }
+    if ((f = http_response_get_output(resp, 1)) == NULL)
+	return;
+    http_response_set_header(resp, 0, "Content-Type", "text/event-stream");
+    http_response_send_headers(resp, 1);
+    while (fprintf(f, ": keepalive\n\n") > 0 && fflush(f) == 0)
+	usleep(BENCH_STREAM_TICK);
+}
+
+/*
+ * BenchClient()
+ *
+ * Requests one after another on a single connection.
+ */
+
+static void *
+BenchClient(void *arg)
+{
+    struct benchclient	*c = arg;
+    u_int64_t		start, t;
+    FILE		*in, *out;
+    int			s, k;
+
+    if ((s = BenchConnect()) < 0) {
+	c->fail++;
+	return (NULL);
+    }
+    in = fdopen(s, "r");
+    out = fdopen(dup(s), "w");
+    for (k = 0; k < c->requests; k++) {
+	start = TestNow();
+	if (BenchRequest(in, out, (k & 1) ? "/metrics" : "/json") != 0) {
+	    c->fail++;
+	    break;
+	}
+	t = TestNow() - start;
+	c->ok++;
+	c->sum += t;
+	c->max = MAX(c->max, t);
+    }
+    fclose(out);
+    fclose(in);
+    return (NULL);
+}
+
+/*
+ * BenchConnect()
+ */
+
+static int
+BenchConnect(void)
+{
+    struct sockaddr_in	sin;
+    struct timeval	tv;
+    int			s;
+
+    if ((s = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+	return (-1);
+    /* A request left waiting fails instead of hanging the bench */
+    tv.tv_sec = BENCH_CLIENT_TIMEOUT;
+    tv.tv_usec = 0;
+    (void)setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(BENCH_PORT);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(s, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+	close(s);
+	return (-1);
+    }
+    return (s);
+}
+
+/*
+ * BenchOpenStream()
+ *
+ * Ask for /events and return the reply status, or -1. The connection
+ * is left open, its headers and comments are never read.
+ */
+
+static int
+BenchOpenStream(int *sp)
+{
+    static const char	req[] = "GET /events HTTP/1.1\r\n"
+			    "Host: localhost\r\n\r\n";
+    char		line[16];
+    int			n, len = 0;
+
+    if ((*sp = BenchConnect()) < 0)
+	return (-1);
+    if (write(*sp, req, sizeof(req) - 1) != sizeof(req) - 1)
+	return (-1);
+    /* "HTTP/1.1 200 " */
+    while (len < 13) {
+	if ((n = read(*sp, line + len, 13 - len)) <= 0)
+	    return (-1);
+	len += n;
+    }
+    line[len] = '\0';
+    return (strncmp(line, "HTTP/1.", 7) == 0 ? atoi(line + 9) : -1);
+}
+
+/*
+ * BenchRequest()
+ *
+ * Send a keep-alive GET and read the whole reply. Returns -1 if it
+ * is not a 200 with a body of the announced length.
+ */
+
+static int
+BenchRequest(FILE *in, FILE *out, const char *path)
+{
+    char	line[256], body[4096];
+    int		clen = -1, n;
+
+    fprintf(out, "GET %s HTTP/1.1\r\nHost: localhost\r\n"
+	"Connection: keep-alive\r\n\r\n", path);
+    if (fflush(out) != 0)
+	return (-1);
+    if (fgets(line, sizeof(line), in) == NULL ||
+	    strncmp(line, "HTTP/1.1 200 ", 13) != 0)
+	return (-1);
+    while (fgets(line, sizeof(line), in) != NULL && strcmp(line, "\r\n")) {
+	if (strncasecmp(line, "Content-Length:", 15) == 0)
+	    clen = atoi(line + 15);
+    }
+    if (clen < 0)
+	return (-1);
+    while (clen > 0) {
+	n = fread(body, 1, MIN(clen, (int)sizeof(body)), in);
+	if (n <= 0)
+	    return (-1);
+	clen -= n;
+    }
+    return (0);
+}
+
+/*
+ * BenchLog()
+ */
+
+static void
+BenchLog(int sev, const char *fmt, ...)
+{
+    va_list	args;
+
+    (void)sev;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
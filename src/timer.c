@@ -46,6 +46,8 @@ TimerStart2(PppTimer timer, const char *file, int line)
     Log(LG_EVENTS, ("EVENT: Starting timer \"%s\" %s() for %d ms at %s:%d",
 	timer->desc, timer->dbg, timer->load, file, line));
     /* Register timeout event */
+    timer->recurring = 0;
+    timer->due = EventNow() + (u_int64_t)timer->load * 1000;
     EventRegister(&timer->event, EVENT_TIMEOUT,
 	timer->load, 0, TimerExpires, timer);
 }
@@ -65,6 +67,8 @@ TimerStartRecurring2(PppTimer timer, const char *file, int line)
 	EventUnRegister(&timer->event);
 
     /* Register timeout event */
+    timer->recurring = 1;
+    timer->due = EventNow() + (u_int64_t)timer->load * 1000;
     EventRegister(&timer->event, EVENT_TIMEOUT,
 	timer->load, EVENT_RECURRING, TimerExpires, timer);
 }
@@ -94,9 +98,14 @@ TimerExpires(int type, void *cookie)
     PppTimer	const timer = (PppTimer) cookie;
     const char	*desc = timer->desc;
     const char	*dbg = timer->dbg;
+    u_int64_t	now = EventNow();
 
     (void)type;
     Log(LG_EVENTS, ("EVENT: Processing timer \"%s\" %s()", desc, dbg));
+    EventStatTimer(dbg, now, timer->due);
+    /* Recurring event is already registered again from now */
+    if (timer->recurring)
+	timer->due = now + (u_int64_t)timer->load * 1000;
     (*timer->func)(timer->arg);
     Log(LG_EVENTS, ("EVENT: Processing timer \"%s\" %s() done", desc, dbg));
 }
@@ -30,6 +30,8 @@ struct pppTimer {
 	void *arg;			/* Arg passed to timeout function */
 	const char *desc;
 	const char *dbg;
+	u_int64_t due;			/* Deadline, EventNow() usec */
+	u_char	recurring;
 };
 
 /*
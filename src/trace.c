@@ -0,0 +1,313 @@
+
+/*
+ * trace.c
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#include "ppp.h"
+#include "trace.h"
+#include "util.h"
+
+#include <time.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  /*
+   * Trace selectors choose sessions to be logged with the trace log
+   * options in addition to the global ones. A link is matched when
+   * its device gets a call or goes up, when the peer sends its auth
+   * name and when selectors change; the result is kept in the link
+   * trace flag. Handlers of link and bundle events make the options
+   * of their session current for the thread, so the Log() check stays
+   * a single mask test. Selectors are only used with gGiantMutex held.
+   */
+
+  enum {
+    TRACE_CMD_ADD,
+    TRACE_CMD_DEL,
+    TRACE_CMD_CLEAR
+  };
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static int	TraceCommand(Context ctx, int ac, const char *const av[], const void *arg);
+  static void	TraceRemove(TraceSel s);
+  static void	TraceExpire(void *arg);
+  static void	TraceUpdateAll(void);
+  static TraceSel	TraceMatch(Link l, const char *authname);
+
+/*
+ * GLOBAL VARIABLES
+ */
+
+  const struct cmdtab TraceCmds[] = {
+    { "add authname|link|calling|peer {value} [{seconds}]",
+	"Trace sessions matching",
+	TraceCommand, NULL, 2, (void *) TRACE_CMD_ADD },
+    { "del {id}",			"Remove trace selector",
+	TraceCommand, NULL, 2, (void *) TRACE_CMD_DEL },
+    { "clear",				"Remove all trace selectors",
+	TraceCommand, NULL, 2, (void *) TRACE_CMD_CLEAR },
+    { "log [+/-{opt} ...]",		"Log options of traced sessions",
+	LogTraceCommand, NULL, 2, NULL },
+    { NULL, NULL, NULL, NULL, 0, NULL },
+  };
+
+/*
+ * INTERNAL VARIABLES
+ */
+
+  static const char	*gTraceTypeNames[TRACE_NUM] = {
+    "authname",
+    "link",
+    "calling",
+    "peer",
+  };
+
+  static SLIST_HEAD(, tracesel)	gTraceSels = SLIST_HEAD_INITIALIZER(gTraceSels);
+  static int			gTraceNum;
+  static int			gTraceNextId = 1;
+
+/*
+ * TraceCommand()
+ */
+
+static int
+TraceCommand(Context ctx, int ac, const char *const av[], const void *arg)
+{
+    TraceSel	s;
+    int		k, id, secs = 0;
+
+    switch ((intptr_t)arg) {
+    case TRACE_CMD_ADD:
+	if (ac < 2 || ac > 3)
+	    return(-1);
+	for (k = 0; k < TRACE_NUM && strcasecmp(av[0], gTraceTypeNames[k]); k++);
+	if (k == TRACE_NUM)
+	    Error("Unknown trace selector type \"%s\"", av[0]);
+	if (ac == 3 && (secs = atoi(av[2])) <= 0)
+	    Error("Incorrect trace timeout");
+	if (gTraceNum >= TRACE_MAX_SEL)
+	    Error("Too many trace selectors");
+	s = Malloc(MB_LOG, sizeof(*s));
+	s->id = gTraceNextId++;
+	s->type = k;
+	strlcpy(s->value, av[1], sizeof(s->value));
+	if (secs > 0) {
+	    s->expire = time(NULL) + secs;
+	    TimerInit(&s->timer, "TraceExpire", secs * SECONDS,
+		TraceExpire, s);
+	    TimerStart(&s->timer);
+	}
+	SLIST_INSERT_HEAD(&gTraceSels, s, next);
+	gTraceNum++;
+	Log(LG_ALWAYS, ("Trace: selector %d %s \"%s\" added", s->id,
+	    gTraceTypeNames[s->type], s->value));
+	break;
+
+    case TRACE_CMD_DEL:
+	if (ac != 1)
+	    return(-1);
+	id = atoi(av[0]);
+	SLIST_FOREACH(s, &gTraceSels, next) {
+	    if (s->id == id)
+		break;
+	}
+	if (s == NULL)
+	    Error("Trace selector %d not found", id);
+	TraceRemove(s);
+	break;
+
+    case TRACE_CMD_CLEAR:
+	if (ac != 0)
+	    return(-1);
+	while ((s = SLIST_FIRST(&gTraceSels)) != NULL)
+	    TraceRemove(s);
+	break;
+
+    default:
+	return(-1);
+    }
+    TraceUpdateAll();
+    return(0);
+}
+
+/*
+ * TraceRemove()
+ */
+
+static void
+TraceRemove(TraceSel s)
+{
+    Log(LG_ALWAYS, ("Trace: selector %d %s \"%s\" removed", s->id,
+	gTraceTypeNames[s->type], s->value));
+    TimerStop(&s->timer);
+    SLIST_REMOVE(&gTraceSels, s, tracesel, next);
+    gTraceNum--;
+    Freee(s);
+}
+
+/*
+ * TraceExpire()
+ */
+
+static void
+TraceExpire(void *arg)
+{
+    TraceSel	const s = (TraceSel)arg;
+
+    TraceRemove(s);
+    TraceUpdateAll();
+}
+
+/*
+ * TraceUpdateAll()
+ */
+
+static void
+TraceUpdateAll(void)
+{
+    int	k;
+
+    for (k = 0; k < gNumLinks; k++) {
+	if (gLinks[k] && !gLinks[k]->tmpl && !gLinks[k]->dead)
+	    TraceLinkUpdate(gLinks[k], NULL);
+    }
+}
+
+/*
+ * TraceMatch()
+ */
+
+static TraceSel
+TraceMatch(Link l, const char *authname)
+{
+    TraceSel	s;
+    char	calling[64], mac[64], peer[64];
+    int		phys = 0;
+
+    SLIST_FOREACH(s, &gTraceSels, next) {
+	switch (s->type) {
+	case TRACE_AUTHNAME:
+	    if (authname[0] && strcmp(s->value, authname) == 0)
+		return (s);
+	    break;
+	case TRACE_LINK:
+	    if (strcmp(s->value, l->name) == 0)
+		return (s);
+	    break;
+	case TRACE_CALLING:
+	case TRACE_PEER:
+	    if (!phys) {
+		/* Calling number may have MAC and iface appended */
+		PhysGetCallingNum(l, calling, sizeof(calling));
+		calling[strcspn(calling, " ")] = 0;
+		PhysGetPeerMacAddr(l, mac, sizeof(mac));
+		PhysGetPeerAddr(l, peer, sizeof(peer));
+		phys = 1;
+	    }
+	    if (s->type == TRACE_PEER) {
+		if (peer[0] && strcmp(s->value, peer) == 0)
+		    return (s);
+	    } else if ((calling[0] && strcasecmp(s->value, calling) == 0) ||
+		    (mac[0] && strcasecmp(s->value, mac) == 0))
+		return (s);
+	    break;
+	}
+    }
+    return (NULL);
+}
+
+/*
+ * TraceLinkUpdate()
+ *
+ * Match link against selectors. If "authname" is NULL the name
+ * of the current session is used.
+ */
+
+void
+TraceLinkUpdate(Link l, const char *authname)
+{
+    TraceSel	s = NULL;
+
+    if (!SLIST_EMPTY(&gTraceSels)) {
+	if (authname == NULL)
+	    authname = l->lcp.auth.params.authname;
+	s = TraceMatch(l, authname);
+    }
+    if (s != NULL && !l->trace) {
+	s->matched++;
+	l->trace = 1;
+	Log(LG_ALWAYS, ("[%s] Trace: matched selector %d %s \"%s\"",
+	    l->name, s->id, gTraceTypeNames[s->type], s->value));
+    } else if (s == NULL && l->trace) {
+	l->trace = 0;
+	Log(LG_ALWAYS, ("[%s] Trace: stopped", l->name));
+    }
+}
+
+/*
+ * TraceBund()
+ *
+ * Bundle is traced if any of its links is.
+ */
+
+void
+TraceBund(Bund b)
+{
+    int	k;
+
+    for (k = 0; k < NG_PPP_MAX_LINKS; k++) {
+	if (b->links[k] && b->links[k]->trace) {
+	    TraceLink(b->links[k]);
+	    return;
+	}
+    }
+    TraceNone();
+}
+
+/*
+ * TraceStat()
+ */
+
+int
+TraceStat(Context ctx, int ac, const char *const av[], const void *arg)
+{
+    TraceSel	s;
+    time_t	now = time(NULL);
+    int		k, traced = 0;
+
+    (void)ac;
+    (void)av;
+    (void)arg;
+
+    for (k = 0; k < gNumLinks; k++) {
+	if (gLinks[k] && gLinks[k]->trace)
+	    traced++;
+    }
+    Printf("Trace selectors:\r\n");
+    Printf("\tSelectors      : %d of %d\r\n", gTraceNum, TRACE_MAX_SEL);
+    Printf("\tTraced links   : %d\r\n", traced);
+    if (SLIST_EMPTY(&gTraceSels))
+	return (0);
+    Printf("\t%-4s %-9s %-24s %8s %8s\r\n", "Id", "Type", "Value",
+	"Expires", "Matched");
+    SLIST_FOREACH(s, &gTraceSels, next) {
+	char	exp[16];
+
+	if (s->expire)
+	    snprintf(exp, sizeof(exp), "%lds",
+		(long)(s->expire > now ? s->expire - now : 0));
+	else
+	    strlcpy(exp, "never", sizeof(exp));
+	Printf("\t%-4d %-9s %-24s %8s %8llu\r\n", s->id,
+	    gTraceTypeNames[s->type], s->value, exp,
+	    (unsigned long long)s->matched);
+    }
+    return (0);
+}
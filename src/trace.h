@@ -0,0 +1,63 @@
+
+/*
+ * trace.h
+ *
+ * See ``COPYRIGHT.mpd''
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include "defs.h"
+#include "timer.h"
+#include <sys/queue.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  #define TRACE_MAX_SEL		32	/* Max selectors at once */
+
+  /* What selector matches */
+  enum {
+    TRACE_AUTHNAME,
+    TRACE_LINK,
+    TRACE_CALLING,			/* Calling number or peer MAC */
+    TRACE_PEER,				/* Peer address */
+    TRACE_NUM
+  };
+
+  struct tracesel {
+    int			id;
+    int			type;
+    char		value[64];
+    time_t		expire;		/* When removed, 0 - never */
+    u_int64_t		matched;	/* Sessions matched */
+    struct pppTimer	timer;		/* Expiry timer */
+    SLIST_ENTRY(tracesel)	next;
+  };
+  typedef struct tracesel	*TraceSel;
+
+  /*
+   * Make log options of traced sessions current for this thread.
+   * Called where processing of a link or bundle event starts.
+   */
+  #define TraceLink(l)		(gLogTrace = (l)->trace ? gLogTraceOptions : 0)
+  #define TraceNone()		(gLogTrace = 0)
+
+/*
+ * VARIABLES
+ */
+
+  extern const struct cmdtab	TraceCmds[];
+
+/*
+ * FUNCTIONS
+ */
+
+  extern void	TraceLinkUpdate(Link l, const char *authname);
+  extern void	TraceBund(Bund b);
+  extern int	TraceStat(Context ctx, int ac, const char *const av[], const void *arg);
+
+#endif
+
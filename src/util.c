@@ -1446,6 +1446,45 @@ GetPeerEther(struct u_addr *addr, struct sockaddr_dl *hwaddr)
 	return (found_entry);
 }
 
+/*
+ * JSONString()
+ *
+ * Write quoted and escaped JSON string.
+ */
+
+void
+JSONString(FILE *f, const char *s)
+{
+    const u_char	*p;
+
+    putc('"', f);
+    for (p = (const u_char *)s; *p != '\0'; p++) {
+	switch (*p) {
+	    case '"':
+	    case '\\':
+		putc('\\', f);
+		putc(*p, f);
+		break;
+	    case '\n':
+		fputs("\\n", f);
+		break;
+	    case '\r':
+		fputs("\\r", f);
+		break;
+	    case '\t':
+		fputs("\\t", f);
+		break;
+	    default:
+		if (*p < 0x20 || *p == 0x7f)
+		    fprintf(f, "\\u%04x", *p);
+		else
+		    putc(*p, f);
+		break;
+	}
+    }
+    putc('"', f);
+}
+
 /*
  * Decode ASCII message
  */
@@ -87,6 +87,7 @@ extern int ExecCmdNosh(int log, const char *label, const char *fmt,...)__printfl
 extern void ShowMesg(int log, const char *pref, const char *buf, int len);
 extern char *Bin2Hex(const unsigned char *bin, size_t len);
 extern u_char *Hex2Bin(char *hexstr);
+extern void JSONString(FILE *f, const char *s);
 
 #ifndef USE_NG_PRED1
 extern u_short Crc16(u_short fcs, u_char *cp, int len);
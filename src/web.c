@@ -7,8 +7,14 @@
 
 #include "ppp.h"
 #include "web.h"
+#include "metrics.h"
+#include "sessevent.h"
+#include "sesssnap.h"
+#include "batch.h"
 #include "util.h"
 
+#include <sched.h>
+#include <zlib.h>
 
 /*
  * DEFINITIONS
@@ -20,7 +26,97 @@
     SET_CLOSE,
     SET_SELF,
     SET_DISABLE,
-    SET_ENABLE
+    SET_ENABLE,
+    SET_METRICS_PERIOD,
+    SET_MAX_CONN,
+    SET_WORKERS,
+    SET_MAX_STREAMS,
+    SET_IDLE_TIMEOUT
+  };
+
+  #define WEB_SESS_PAGE		1000	/* Default sessions per page */
+  #define WEB_SESS_MAX_PAGE	10000
+
+  #define WEB_EV_BATCH		64	/* Events per read from the ring */
+  #define WEB_EV_KEEPALIVE	15	/* Comment line if idle, seconds */
+
+  #define WEB_ZMIN		1024	/* Smaller bodies are sent as is */
+  #define WEB_ZLEVEL		6
+
+  /* Content codings */
+  enum {
+    WEB_ENC_IDENTITY,
+    WEB_ENC_GZIP,
+    WEB_ENC_DEFLATE
+  };
+
+  /* Session fields */
+  enum {
+    WEB_SF_LINK,
+    WEB_SF_BUNDLE,
+    WEB_SF_IFACE,
+    WEB_SF_USER,
+    WEB_SF_TYPE,
+    WEB_SF_STATE,
+    WEB_SF_LCP,
+    WEB_SF_IPCP,
+    WEB_SF_PEER_IP,
+    WEB_SF_IPCP_IP,
+    WEB_SF_CALLING,
+    WEB_SF_CALLED,
+    WEB_SF_SETUP,
+    WEB_SF_GEN,
+    WEB_SF_NUM
+  };
+
+  /* Session query */
+  struct websessq {
+    u_int		fields;		/* Bit mask of WEB_SF_* */
+    const char		*user;		/* Filters */
+    const char		*iface;
+    const char		*ip;
+    const char		*state;
+    const char		*type;
+    int			cursor;		/* Index in gLinks to start from */
+    int			limit;
+    int			delta;		/* Changes since generation only */
+    u_int64_t		since;
+  };
+
+  /* Session, copied under the giant lock */
+  struct websess {
+    int			id;
+    u_int64_t		gen;
+    u_char		gone;		/* Removed or not matching anymore */
+    char		link[LINK_MAX_NAME];
+    char		bundle[LINK_MAX_NAME];
+    char		iface[IFNAMSIZ];
+    char		user[AUTH_MAX_AUTHNAME];
+    char		type[16];
+    const char		*state;
+    const char		*lcp;
+    const char		*ipcp;
+    char		peer_ip[64];
+    char		ipcp_ip[INET_ADDRSTRLEN];
+    char		calling[64];
+    char		called[64];
+    int			setup[LINK_PHASE_NUM];	/* ms, -1 if not done */
+  };
+
+  /* Snapshot being collected */
+  struct websessset {
+    const struct websessq	*q;
+    struct websess		*s;
+    int				n;
+    int				overflow;
+  };
+
+  /* Batch posted to /bincmd, for its cancel cleanup */
+  struct webbatch {
+    char	*buf;
+    Batch	b;
+    int		locked;		/* Running it with gGiantMutex held */
+    int		done;
   };
 
 
@@ -29,6 +125,7 @@
  */
 
   static int	WebSetCommand(Context ctx, int ac, const char *const av[], const void *arg);
+  static void	WebSetLimits(Web w);
 
   static int	WebServletRun(struct http_servlet *servlet,
                          struct http_request *req, struct http_response *resp);
@@ -41,9 +138,33 @@
   static void	WebConsoleSessionShowPrompt(ConsoleSession cs);
 
   static void	WebRunBinCmd(FILE *f, const char *query, int priv);
+  static void	WebRunBatch(FILE *f, struct http_request *req,
+		    const char *query, int priv);
+  static void	WebRunBatchCleanup(void *cookie);
   static void	WebRunCmd(FILE *f, const char *query, int priv);
-  static void	WebShowHTMLSummary(FILE *f, int priv);
-  static void	WebShowJSONSummary(FILE *f, int priv);
+  static void	WebShowHTMLSummary(FILE *f, SessTab t, int priv);
+  static void	WebShowJSONSummary(FILE *f, SessTab t, int priv);
+  static void	WebShowJSONSessions(FILE *f, const char *query);
+  static int	WebSessQuery(struct websessq *q, char *buf);
+  static void	WebSessFill(struct websess *s, Link L);
+  static int	WebSessMatch(const struct websessq *q, const struct websess *s);
+  static void	WebSessChange(Link L, const char *gone, u_int64_t gen, void *arg);
+  static void	WebSessWrite(FILE *f, const struct websess *s, u_int fields);
+  static void	WebSessSetupWrite(FILE *f, const struct websess *s);
+  static void	WebJSONPair(FILE *f, const char *name, const char *val,
+		  const char *sep);
+  static int	WebEncoding(struct http_request *req);
+  static void	WebCompress(struct http_response *resp, FILE *f,
+		    const char *buf, size_t len, int enc);
+  static int	WebETag(struct http_request *req, struct http_response *resp,
+		    const char *path, const char *query, int priv, int enc,
+		    u_int64_t state);
+  static int	WebETagMatch(const char *list, const char *etag);
+  static void	WebServletRunCleanup(void *cookie);
+  static void	WebShowEvents(FILE *f, struct http_request *req,
+		  struct http_response *resp, const char *query);
+  static void	WebShowEventsCleanup(void *cookie);
+  static void	WebEventWrite(FILE *f, const struct sessevent *ev);
 
 /*
  * GLOBAL VARIABLES
@@ -60,6 +181,16 @@
   	WebSetCommand, NULL, 2, (void *) SET_ENABLE },
     { "disable [opt ...]",	"Disable web option" ,
   	WebSetCommand, NULL, 2, (void *) SET_DISABLE },
+    { "metrics-period {seconds}",	"Set metrics snapshot period" ,
+  	WebSetCommand, NULL, 2, (void *) SET_METRICS_PERIOD },
+    { "max-conn {num}",		"Set max open connections" ,
+  	WebSetCommand, NULL, 2, (void *) SET_MAX_CONN },
+    { "workers {num}",		"Set max request worker threads" ,
+  	WebSetCommand, NULL, 2, (void *) SET_WORKERS },
+    { "max-streams {num}",	"Set max /events streams" ,
+  	WebSetCommand, NULL, 2, (void *) SET_MAX_STREAMS },
+    { "idle-timeout {seconds}",	"Set keep-alive idle timeout" ,
+  	WebSetCommand, NULL, 2, (void *) SET_IDLE_TIMEOUT },
     { NULL, NULL, NULL, NULL, 0, NULL },
   };
 
@@ -69,11 +200,30 @@
  */
 
   static const struct confinfo	gConfList[] = {
-    { 0,	WEB_AUTH,	"auth"	},
-    { 0,	0,		NULL	},
+    { 0,	WEB_AUTH,		"auth"	},
+    { 0,	WEB_METRICS_SESSIONS,	"metrics-sessions"	},
+    { 0,	0,			NULL	},
   };
 
   static struct pevent_ctx *gWebCtx = NULL;
+  static time_t		gWebStart;	/* Keeps ETags unique over restarts */
+
+  static const char	*gWebSessFields[WEB_SF_NUM] = {
+    "link",
+    "bundle",
+    "iface",
+    "user",
+    "type",
+    "state",
+    "lcp",
+    "ipcp",
+    "peer_ip",
+    "ipcp_ip",
+    "calling_num",
+    "called_num",
+    "setup",
+    "gen",
+  };
     
 /*
  * WebInit()
@@ -89,6 +239,11 @@ WebInit(Web w)
   
   ParseAddr(DEFAULT_WEB_IP, &w->addr, ALLOW_IPV4|ALLOW_IPV6);
   w->port = DEFAULT_WEB_PORT;
+  w->max_conn = DEFAULT_WEB_MAX_CONN;
+  w->workers = DEFAULT_WEB_WORKERS;
+  w->max_streams = DEFAULT_WEB_STREAMS;
+  w->idle_timeout = DEFAULT_WEB_IDLE;
+  gWebStart = time(NULL);
 
   return 0;
 }
@@ -118,6 +273,7 @@ WebOpen(Web w)
     Log(LG_ERR, ("%s: error http_server_start: %d", __FUNCTION__, errno));
     return(-1);
   }
+  WebSetLimits(w);
 
   w->srvlet.arg=NULL;
   w->srvlet.hook=NULL;
@@ -129,6 +285,8 @@ WebOpen(Web w)
     return(-1);
   }
   
+  MetricsStart();
+
   Log(LG_ERR, ("web: listening on %s %d", 
 	u_addrtoa(&w->addr,addrstr,sizeof(addrstr)), w->port));
   return 0;
@@ -148,10 +306,28 @@ WebClose(Web w)
 
   http_server_stop(&w->srv);
   if (gWebCtx) pevent_ctx_destroy(&gWebCtx);
+  MetricsStop();
   
   return 0;
 }
 
+/*
+ * WebSetLimits()
+ *
+ * Apply connection and worker limits to the running server.
+ */
+
+static void
+WebSetLimits(Web w)
+{
+  if (!w->srv)
+    return;
+#ifdef NOLIBPDEL
+  http_server_set_limits(w->srv, w->max_conn, w->workers, w->max_streams,
+    w->idle_timeout);
+#endif
+}
+
 /*
  * WebStat()
  */
@@ -161,6 +337,9 @@ WebStat(Context ctx, int ac, const char *const av[], const void *arg)
 {
   Web		w = &gWeb;
   char		addrstr[64];
+#ifdef NOLIBPDEL
+  struct http_server_stats	st;
+#endif
 
   (void)ac;
   (void)av;
@@ -170,12 +349,59 @@ WebStat(Context ctx, int ac, const char *const av[], const void *arg)
   Printf("\tState         : %s\r\n", w->srv ? "OPENED" : "CLOSED");
   Printf("\tIP-Address    : %s\r\n", u_addrtoa(&w->addr,addrstr,sizeof(addrstr)));
   Printf("\tPort          : %d\r\n", w->port);
+  Printf("\tMetrics period: %d seconds\r\n", gMetricsPeriod);
+  Printf("\tMax conn      : %u\r\n", w->max_conn);
+  Printf("\tWorkers       : %u\r\n", w->workers);
+  Printf("\tMax streams   : %u\r\n", w->max_streams);
+  Printf("\tIdle timeout  : %u seconds\r\n", w->idle_timeout);
 
   Printf("Web options:\r\n");
   OptStat(ctx, &w->options, gConfList);
 
+#ifdef NOLIBPDEL
+  if (WebServerStats(&st) == 0) {
+    Printf("Web server:\r\n");
+    Printf("\tConnections   : %u (%u idle, %u waiting)\r\n",
+      st.num_conn, st.num_idle, st.num_ready);
+    Printf("\tWorkers       : %u (%u busy)\r\n",
+      st.num_workers, st.busy_workers);
+    Printf("\tStreams       : %u (%llu started, %llu refused)\r\n",
+      st.num_streams, (unsigned long long)st.streams,
+      (unsigned long long)st.streams_refused);
+    Printf("\tAccepted      : %llu\r\n", (unsigned long long)st.accepted);
+    Printf("\tIdle closed   : %llu\r\n", (unsigned long long)st.idle_closed);
+    Printf("\tAccept paused : %llu\r\n", (unsigned long long)st.paused);
+    Printf("\tRequests      : %llu\r\n",
+      (unsigned long long)st.service.count);
+    Printf("\tRequest time  : avg %llu, max %llu us\r\n",
+      (unsigned long long)(st.service.count ?
+	st.service.sum / st.service.count : 0),
+      (unsigned long long)st.service.max);
+    Printf("\tQueue wait    : avg %llu, max %llu us\r\n",
+      (unsigned long long)(st.wait.count ? st.wait.sum / st.wait.count : 0),
+      (unsigned long long)st.wait.max);
+  }
+#endif
+
+  return 0;
+}
+
+#ifdef NOLIBPDEL
+/*
+ * WebServerStats()
+ *
+ * Get web server statistics, -1 if not running.
+ */
+
+int
+WebServerStats(struct http_server_stats *st)
+{
+  if (!gWeb.srv)
+    return -1;
+  http_server_get_stats(gWeb.srv, st);
   return 0;
 }
+#endif
 
 /*
  * ConsoleSessionWriteV()
@@ -234,13 +460,16 @@ WebShowCSS(FILE *f)
 }
 
 static void
-WebShowHTMLSummary(FILE *f, int priv)
+WebShowHTMLSummary(FILE *f, SessTab t, int priv)
 {
   int		b,l;
-  Bund		B;
-  Link  	L;
-  Rep		R;
-  char		buf[64],buf2[64];
+  SessLink	L;
+  struct sessbund	*B;
+  struct sessrep	*R;
+
+  /* Published snapshot, no need for the giant lock */
+  if (t == NULL)
+    return;
 
   fprintf(f, "<h2>Current status summary</h2>\n");
   fprintf(f, "<table>\n");
@@ -249,32 +478,29 @@ WebShowHTMLSummary(FILE *f, int priv)
 	     priv?"<th>State</th>\n":"");
 #define FSM_COLOR(s) (((s)==ST_OPENED)?"g":(((s)==ST_INITIAL)?"r":"y"))
 #define PHYS_COLOR(s) (((s)==PHYS_STATE_UP)?"g":(((s)==PHYS_STATE_DOWN)?"r":"y"))
-    for (b = 0; b<gNumLinks; b++) {
-	if ((L=gLinks[b]) != NULL && L->bund == NULL && L->rep == NULL) {
+    for (b = 0; b<t->nlinks; b++) {
+	if ((L=t->links[b]) != NULL && L->bund < 0 && L->rep < 0) {
 	    fprintf(f, "<tr>\n");
 	    fprintf(f, "<td colspan=\"7\">&#160;</td>\n");
 	    fprintf(f, "<td class=\"%s\"><a href=\"/cmd?link%%20%s&#38;show%%20link\">%s</a></td>\n", 
-	        L->tmpl?"d":FSM_COLOR(L->lcp.fsm.state), L->name, L->name);
+	        L->tmpl?"d":FSM_COLOR(L->lcp), L->name, L->name);
 	    fprintf(f, "<td class=\"%s\"><a href=\"/cmd?link%%20%s&#38;show%%20lcp\">%s</a></td>\n", 
-	        L->tmpl?"d":FSM_COLOR(L->lcp.fsm.state), L->name, FsmStateName(L->lcp.fsm.state));
+	        L->tmpl?"d":FSM_COLOR(L->lcp), L->name, FsmStateName(L->lcp));
 	    fprintf(f, "<td class=\"%s\"><a href=\"/cmd?link%%20%s&#38;show%%20auth\">%s</a></td>\n", 
-	        L->tmpl?"d":FSM_COLOR(L->lcp.fsm.state), L->name, L->lcp.auth.params.authname);
+	        L->tmpl?"d":FSM_COLOR(L->lcp), L->name, L->user);
 	    fprintf(f, "<td class=\"%s\"><a href=\"/cmd?link%%20%s&#38;show%%20device\">%s</a></td>\n", 
-	        L->tmpl?"d":PHYS_COLOR(L->state), L->name, L->type?L->type->name:"");
+	        L->tmpl?"d":PHYS_COLOR(L->state), L->name, L->type);
 	    fprintf(f, "<td class=\"%s\"><a href=\"/cmd?link%%20%s&#38;show%%20device\">%s</a></td>\n", 
 	        L->tmpl?"d":PHYS_COLOR(L->state), L->name, gPhysStateNames[L->state]);
 	    if (L->state != PHYS_STATE_DOWN) {
-		PhysGetPeerAddr(L, buf, sizeof(buf));
-		fprintf(f, "<td>%s</td>\n", buf);
+		fprintf(f, "<td>%s</td>\n", L->peer);
 		fprintf(f, "<td>&#160;</td>\n");
-		PhysGetCallingNum(L, buf, sizeof(buf));
-		PhysGetCalledNum(L, buf2, sizeof(buf2));
-		if (PhysGetOriginate(L) == LINK_ORIGINATE_REMOTE) {
+		if (L->originate == LINK_ORIGINATE_REMOTE) {
 		    fprintf(f, "<td>%s</td>\n<td>&#60;=</td>\n<td>%s</td>\n", 
-			buf2, buf);
+			L->called, L->calling);
 		} else {
 		    fprintf(f, "<td>%s</td>\n<td>=&#62;</td>\n<td>%s</td>\n", 
-			buf, buf2);
+			L->called, L->calling);
 		}
 	    } else {
 	    	fprintf(f, "<td>&#160;</td>\n");
@@ -303,59 +529,56 @@ WebShowHTMLSummary(FILE *f, int priv)
 	    fprintf(f, "</tr>\n");
 	}
     }
-  for (b = 0; b<gNumBundles; b++) {
-    if ((B=gBundles[b]) != NULL) {
+  for (b = 0; b<t->nbunds; b++) {
+    if ((B=&t->bunds[b])->valid) {
 	int rows = B->n_links?B->n_links:1;
 	int first = 1;
 	fprintf(f, "<tr>\n");
 	fprintf(f, "<td rowspan=\"%d\" class=\"%s\"><a href=\"/cmd?bund%%20%s&#38;show%%20bund\">%s</a></td>\n", 
-	    rows, B->tmpl?"d":(B->iface.up?"g":"r"), B->name, B->name);
+	    rows, B->tmpl?"d":(B->up?"g":"r"), B->name, B->name);
 	fprintf(f, "<td rowspan=\"%d\" class=\"%s\"><a href=\"/cmd?bund%%20%s&#38;show%%20iface\">%s</a></td>\n", 
-	    rows, B->tmpl?"d":(B->iface.up?"g":"r"), B->name, B->iface.ifname);
+	    rows, B->tmpl?"d":(B->up?"g":"r"), B->name, B->iface);
 	fprintf(f, "<td rowspan=\"%d\" class=\"%s\"><a href=\"/cmd?bund%%20%s&#38;show%%20iface\">%s</a></td>\n", 
-	    rows, B->tmpl?"d":(B->iface.up?"g":"r"), B->name, (B->iface.up?"Up":"Down"));
+	    rows, B->tmpl?"d":(B->up?"g":"r"), B->name, (B->up?"Up":"Down"));
 	fprintf(f, "<td rowspan=\"%d\" class=\"%s\"><a href=\"/cmd?bund%%20%s&#38;show%%20ipcp\">%s</a></td>\n", 
-	    rows, B->tmpl?"d":FSM_COLOR(B->ipcp.fsm.state), B->name,FsmStateName(B->ipcp.fsm.state));
+	    rows, B->tmpl?"d":FSM_COLOR(B->ipcp), B->name,FsmStateName(B->ipcp));
 	fprintf(f, "<td rowspan=\"%d\" class=\"%s\"><a href=\"/cmd?bund%%20%s&#38;show%%20ipv6cp\">%s</a></td>\n", 
-	    rows, B->tmpl?"d":FSM_COLOR(B->ipv6cp.fsm.state), B->name,FsmStateName(B->ipv6cp.fsm.state));
+	    rows, B->tmpl?"d":FSM_COLOR(B->ipv6cp), B->name,FsmStateName(B->ipv6cp));
 	fprintf(f, "<td rowspan=\"%d\" class=\"%s\"><a href=\"/cmd?bund%%20%s&#38;show%%20ccp\">%s</a></td>\n", 
-	    rows, B->tmpl?"d":FSM_COLOR(B->ccp.fsm.state), B->name,FsmStateName(B->ccp.fsm.state));
+	    rows, B->tmpl?"d":FSM_COLOR(B->ccp), B->name,FsmStateName(B->ccp));
 	fprintf(f, "<td rowspan=\"%d\" class=\"%s\"><a href=\"/cmd?bund%%20%s&#38;show%%20ecp\">%s</a></td>\n", 
-	    rows, B->tmpl?"d":FSM_COLOR(B->ecp.fsm.state), B->name,FsmStateName(B->ecp.fsm.state));
+	    rows, B->tmpl?"d":FSM_COLOR(B->ecp), B->name,FsmStateName(B->ecp));
 	if (B->n_links == 0) {
 	    fprintf(f, "<td colspan=\"11\">&#160;</td>\n</tr>\n");
 	}
 	for (l = 0; l < NG_PPP_MAX_LINKS; l++) {
-	    if ((L=B->links[l]) != NULL) {
+	    if ((L=SessSnapLink(t, B->links[l])) != NULL) {
 		if (first)
 		    first = 0;
 		else
 		    fprintf(f, "<tr>\n");
 		fprintf(f, "<td class=\"%s\"><a href=\"/cmd?link%%20%s&#38;show%%20link\">%s</a></td>\n", 
-		    L->tmpl?"d":FSM_COLOR(L->lcp.fsm.state), L->name, L->name);
+		    L->tmpl?"d":FSM_COLOR(L->lcp), L->name, L->name);
 		fprintf(f, "<td class=\"%s\"><a href=\"/cmd?link%%20%s&#38;show%%20lcp\">%s</a></td>\n", 
-		    L->tmpl?"d":FSM_COLOR(L->lcp.fsm.state), L->name, FsmStateName(L->lcp.fsm.state));
+		    L->tmpl?"d":FSM_COLOR(L->lcp), L->name, FsmStateName(L->lcp));
 		fprintf(f, "<td class=\"%s\"><a href=\"/cmd?link%%20%s&#38;show%%20auth\">%s</a></td>\n", 
-		    L->tmpl?"d":FSM_COLOR(L->lcp.fsm.state), L->name, L->lcp.auth.params.authname);
+		    L->tmpl?"d":FSM_COLOR(L->lcp), L->name, L->user);
 		fprintf(f, "<td class=\"%s\"><a href=\"/cmd?link%%20%s&#38;show%%20device\">%s</a></td>\n", 
-		    L->tmpl?"d":PHYS_COLOR(L->state), L->name, L->type?L->type->name:"");
+		    L->tmpl?"d":PHYS_COLOR(L->state), L->name, L->type);
 		fprintf(f, "<td class=\"%s\"><a href=\"/cmd?link%%20%s&#38;show%%20device\">%s</a></td>\n", 
 		    L->tmpl?"d":PHYS_COLOR(L->state), L->name, gPhysStateNames[L->state]);
 		if (L->state != PHYS_STATE_DOWN) {
-		    PhysGetPeerAddr(L, buf, sizeof(buf));
-		    fprintf(f, "<td>%s</td>\n", buf);
-		    if (L->bund != NULL)
-			fprintf(f, "<td>%s</td>\n", inet_ntoa(L->bund->ipcp.peer_addr));
+		    fprintf(f, "<td>%s</td>\n", L->peer);
+		    if (L->bund >= 0)
+			fprintf(f, "<td>%s</td>\n", L->ipcp_ip);
 		    else
 			fprintf(f, "<td>&#160;</td>\n");
-		    PhysGetCallingNum(L, buf, sizeof(buf));
-		    PhysGetCalledNum(L, buf2, sizeof(buf2));
-		    if (PhysGetOriginate(L) == LINK_ORIGINATE_REMOTE) {
+		    if (L->originate == LINK_ORIGINATE_REMOTE) {
 			    fprintf(f, "<td>%s</td>\n<td>&#60;=</td>\n<td>%s</td>\n", 
-				buf2, buf);
+				L->called, L->calling);
 		    } else {
 			    fprintf(f, "<td>%s</td>\n<td>=&#62;</td>\n<td>%s</td>\n", 
-				buf, buf2);
+				L->called, L->calling);
 		    }
 		} else {
 			fprintf(f, "<td>&#160;</td>\n");
@@ -382,12 +605,12 @@ WebShowHTMLSummary(FILE *f, int priv)
 	}
     }
   }
-  for (b = 0; b<gNumReps; b++) {
-    if ((R=gReps[b]) != NULL) {
+  for (b = 0; b<t->nreps; b++) {
+    if ((R=&t->reps[b])->valid) {
 	int shown = 0;
 #define FSM_COLOR(s) (((s)==ST_OPENED)?"g":(((s)==ST_INITIAL)?"r":"y"))
 #define PHYS_COLOR(s) (((s)==PHYS_STATE_UP)?"g":(((s)==PHYS_STATE_DOWN)?"r":"y"))
-	int rows = (R->links[0]?1:0) + (R->links[1]?1:0);
+	int rows = (R->links[0] >= 0) + (R->links[1] >= 0);
 	if (rows == 0)
 	    rows = 1;
 	fprintf(f, "<tr>\n");
@@ -395,31 +618,28 @@ WebShowHTMLSummary(FILE *f, int priv)
 	fprintf(f, "<td rowspan=\"%d\" class=\"%s\"><a href=\"/cmd?rep%%20%s&#38;show%%20repeater\">%s</a></td>\n", 
 	     rows, R->p_up?"g":"r", R->name, R->name);
 	for (l = 0; l < 2; l++) {
-	    if ((L=R->links[l]) != NULL) {
+	    if ((L=SessSnapLink(t, R->links[l])) != NULL) {
 		if (shown)
 		    fprintf(f, "<tr>\n");
 		fprintf(f, "<td class=\"%s\"><a href=\"/cmd?link%%20%s&#38;show%%20device\">%s</a></td>\n", 
 		    PHYS_COLOR(L->state), L->name, L->name);
 		fprintf(f, "<td colspan=\"2\">&#160;</td>\n");
 		fprintf(f, "<td class=\"%s\"><a href=\"/cmd?link%%20%s&#38;show%%20device\">%s</a></td>\n", 
-		    PHYS_COLOR(L->state), L->name, L->type?L->type->name:"");
+		    PHYS_COLOR(L->state), L->name, L->type);
 		fprintf(f, "<td class=\"%s\"><a href=\"/cmd?link%%20%s&#38;show%%20device\">%s</a></td>\n", 
 		    PHYS_COLOR(L->state), L->name, gPhysStateNames[L->state]);
 		if (L->state != PHYS_STATE_DOWN) {
-		    PhysGetPeerAddr(L, buf, sizeof(buf));
-		    fprintf(f, "<td>%s</td>\n", buf);
-		    if (L->bund != NULL)
-			fprintf(f, "<td>%s</td>\n", inet_ntoa(L->bund->ipcp.peer_addr));
+		    fprintf(f, "<td>%s</td>\n", L->peer);
+		    if (L->bund >= 0)
+			fprintf(f, "<td>%s</td>\n", L->ipcp_ip);
 		    else
 			fprintf(f, "<td>&#160;</td>\n");
-		    PhysGetCallingNum(L, buf, sizeof(buf));
-		    PhysGetCalledNum(L, buf2, sizeof(buf2));
-		    if (PhysGetOriginate(L) == LINK_ORIGINATE_REMOTE) {
+		    if (L->originate == LINK_ORIGINATE_REMOTE) {
 			    fprintf(f, "<td>%s</td>\n<td>&#60;=</td>\n<td>%s</td>\n", 
-				buf2, buf);
+				L->called, L->calling);
 		    } else {
 			    fprintf(f, "<td>%s</td>\n<td>=&#62;</td>\n<td>%s</td>\n", 
-				buf, buf2);
+				L->called, L->calling);
 		    }
 		} else {
 			fprintf(f, "<td>&#160;</td>\n");
@@ -442,47 +662,43 @@ WebShowHTMLSummary(FILE *f, int priv)
 }
 
 static void
-WebShowJSONSummary(FILE *f, int priv)
+WebShowJSONSummary(FILE *f, SessTab t, int priv)
 {
   int		b,l;
-  Bund		B;
-  Link  	L;
-  Rep		R;
-  char		buf[64],buf2[64];
+  SessLink	L;
+  struct sessbund	*B;
+  struct sessrep	*R;
 
   (void)priv;
+
+  /* Published snapshot, no need for the giant lock */
+  if (t == NULL)
+    return;
+
   int first_l = 1;
   fprintf(f, "{\"links\":[\n");
-  for (b = 0; b<gNumLinks; b++) {
-	if ((L=gLinks[b]) != NULL && L->bund == NULL && L->rep == NULL) {
+  for (b = 0; b<t->nlinks; b++) {
+	if ((L=t->links[b]) != NULL && L->bund < 0 && L->rep < 0) {
 	    if (first_l) {
 		fprintf(f, "{\n");
 		first_l = 0;
 	    } else
 		fprintf(f, ",\n{\n");
 
-	    fprintf(f, "\"link\": \"%s\",\n", L->name);
-	    fprintf(f, "\"lcp\": \"%s\",\n", FsmStateName(L->lcp.fsm.state));
-	    fprintf(f, "\"auth\": \"%s\",\n", L->lcp.auth.params.authname);
-	    fprintf(f, "\"type\": \"%s\",\n", L->type?L->type->name:"");
-	    fprintf(f, "\"state\": \"%s\",\n", gPhysStateNames[L->state]);
+	    WebJSONPair(f, "link", L->name, ",\n");
+	    WebJSONPair(f, "lcp", FsmStateName(L->lcp), ",\n");
+	    WebJSONPair(f, "auth", L->user, ",\n");
+	    WebJSONPair(f, "type", L->type, ",\n");
+	    WebJSONPair(f, "state", gPhysStateNames[L->state], ",\n");
 
 	    if (L->state != PHYS_STATE_DOWN) {
-	        PhysGetPeerAddr(L, buf, sizeof(buf));
-	        fprintf(f, "\"peer_ip\": \"%s\",\n", buf);
-
-		PhysGetCallingNum(L, buf, sizeof(buf));
-		PhysGetCalledNum(L, buf2, sizeof(buf2));
-		if (PhysGetOriginate(L) == LINK_ORIGINATE_REMOTE) {
-		    fprintf(f, "\"calling_num\": \"%s\",\n", buf);
-		    fprintf(f, "\"called_num\": \"%s\"\n", buf2);
-		} else {
-		    fprintf(f, "\"calling_num\": \"%s\",\n", buf2);
-		    fprintf(f, "\"called_num\": \"%s\"\n", buf);
-		}
+	        WebJSONPair(f, "peer_ip", L->peer, ",\n");
+
+		WebJSONPair(f, "calling_num", L->calling, ",\n");
+		WebJSONPair(f, "called_num", L->called, "\n");
 	    } else {
-		fprintf(f, "\"calling_num\": \"%s\",\n", "");
-		fprintf(f, "\"called_num\": \"%s\"\n", "");
+		WebJSONPair(f, "calling_num", "", ",\n");
+		WebJSONPair(f, "called_num", "", "\n");
 	    }
 	    fprintf(f, "}\n");
 	}
@@ -491,59 +707,51 @@ WebShowJSONSummary(FILE *f, int priv)
 
   int first_b = 1;
   fprintf(f, "\"bundles\":[\n");
-  for (b = 0; b<gNumBundles; b++) {
-    if ((B=gBundles[b]) != NULL) {
+  for (b = 0; b<t->nbunds; b++) {
+    if ((B=&t->bunds[b])->valid) {
 	if (first_b) {
 	    fprintf(f, "{\n");
 	    first_b = 0;
 	} else
 	    fprintf(f, ",\n{\n");
 
-	fprintf(f, "\"bundle\": \"%s\",\n", B->name);
-	fprintf(f, "\"iface\": \"%s\",\n", B->iface.ifname);
-	fprintf(f, "\"state\": \"%s\",\n", (B->iface.up?"Up":"Down"));
-	fprintf(f, "\"ipcp\": \"%s\",\n", FsmStateName(B->ipcp.fsm.state));
-	fprintf(f, "\"ipv6cp\": \"%s\",\n", FsmStateName(B->ipv6cp.fsm.state));
-	fprintf(f, "\"ccp\": \"%s\",\n", FsmStateName(B->ccp.fsm.state));
-	fprintf(f, "\"ecp\": \"%s\",\n", FsmStateName(B->ecp.fsm.state));
+	WebJSONPair(f, "bundle", B->name, ",\n");
+	WebJSONPair(f, "iface", B->iface, ",\n");
+	WebJSONPair(f, "state", (B->up?"Up":"Down"), ",\n");
+	WebJSONPair(f, "ipcp", FsmStateName(B->ipcp), ",\n");
+	WebJSONPair(f, "ipv6cp", FsmStateName(B->ipv6cp), ",\n");
+	WebJSONPair(f, "ccp", FsmStateName(B->ccp), ",\n");
+	WebJSONPair(f, "ecp", FsmStateName(B->ecp), ",\n");
 
 	first_l = 1;
 	fprintf(f, "\"links\":[\n");
 	for (l = 0; l < NG_PPP_MAX_LINKS; l++) {
-	    if ((L=B->links[l]) != NULL) {
+	    if ((L=SessSnapLink(t, B->links[l])) != NULL) {
 		if (first_l) {
 		    fprintf(f, "{\n");
 		    first_l = 0;
 		} else
 		    fprintf(f, ",\n{\n");
 
-		fprintf(f, "\"link\": \"%s\",\n", L->name);
-		fprintf(f, "\"lcp\": \"%s\",\n", FsmStateName(L->lcp.fsm.state));
-		fprintf(f, "\"auth\": \"%s\",\n", L->lcp.auth.params.authname);
-		fprintf(f, "\"type\": \"%s\",\n", L->type?L->type->name:"");
-		fprintf(f, "\"state\": \"%s\",\n", gPhysStateNames[L->state]);
+		WebJSONPair(f, "link", L->name, ",\n");
+		WebJSONPair(f, "lcp", FsmStateName(L->lcp), ",\n");
+		WebJSONPair(f, "auth", L->user, ",\n");
+		WebJSONPair(f, "type", L->type, ",\n");
+		WebJSONPair(f, "state", gPhysStateNames[L->state], ",\n");
 
 		if (L->state != PHYS_STATE_DOWN) {
-		    PhysGetPeerAddr(L, buf, sizeof(buf));
-		    fprintf(f, "\"peer_ip\": \"%s\",\n", buf);
+		    WebJSONPair(f, "peer_ip", L->peer, ",\n");
 
-		    if (L->bund != NULL)
-			fprintf(f, "\"ipcp_ip\": \"%s\",\n", inet_ntoa(L->bund->ipcp.peer_addr));
+		    if (L->bund >= 0)
+			WebJSONPair(f, "ipcp_ip", L->ipcp_ip, ",\n");
 		    else
-			fprintf(f, "\"ipcp_ip\": \"%s\",\n", "");
+			WebJSONPair(f, "ipcp_ip", "", ",\n");
 
-		    PhysGetCallingNum(L, buf, sizeof(buf));
-		    PhysGetCalledNum(L, buf2, sizeof(buf2));
-		    if (PhysGetOriginate(L) == LINK_ORIGINATE_REMOTE) {
-			fprintf(f, "\"calling_num\": \"%s\",\n", buf);
-			fprintf(f, "\"called_num\": \"%s\"\n", buf2);
-		    } else {
-			fprintf(f, "\"calling_num\": \"%s\",\n", buf2);
-			fprintf(f, "\"called_num\": \"%s\"\n", buf);
-		    }
+		    WebJSONPair(f, "calling_num", L->calling, ",\n");
+		    WebJSONPair(f, "called_num", L->called, "\n");
 		} else {
-			fprintf(f, "\"calling_num\": \"%s\",\n", "");
-			fprintf(f, "\"called_num\": \"%s\"\n", "");
+			WebJSONPair(f, "calling_num", "", ",\n");
+			WebJSONPair(f, "called_num", "", "\n");
 		}
 		fprintf(f, "}\n");
 	    }
@@ -555,58 +763,50 @@ WebShowJSONSummary(FILE *f, int priv)
 
   int first_r = 1;
   fprintf(f, "\"repeaters\":[\n");
-  for (b = 0; b<gNumReps; b++) {
-    if ((R=gReps[b]) != NULL) {
+  for (b = 0; b<t->nreps; b++) {
+    if ((R=&t->reps[b])->valid) {
 	if (first_r) {
 	    fprintf(f, "{\n");
 	    first_r = 0;
 	} else
 	    fprintf(f, ",\n{\n");
 
-	fprintf(f, "\"repeater\": \"%s\",\n", R->name);
+	WebJSONPair(f, "repeater", R->name, ",\n");
 
 	first_l = 1;
 	fprintf(f, "\"links\":[\n");
 	for (l = 0; l < 2; l++) {
-	    if ((L=R->links[l]) != NULL) {
+	    if ((L=SessSnapLink(t, R->links[l])) != NULL) {
 		if (first_l) {
 		    fprintf(f, "{\n");
 		    first_l = 0;
 		} else
 		    fprintf(f, ",\n{\n");
 
-		fprintf(f, "\"link\": \"%s\",\n", L->name);
-		fprintf(f, "\"type\": \"%s\",\n", L->type?L->type->name:"");
-		fprintf(f, "\"state\": \"%s\",\n", gPhysStateNames[L->state]);
+		WebJSONPair(f, "link", L->name, ",\n");
+		WebJSONPair(f, "type", L->type, ",\n");
+		WebJSONPair(f, "state", gPhysStateNames[L->state], ",\n");
 
 		if (L->state != PHYS_STATE_DOWN) {
-		    PhysGetPeerAddr(L, buf, sizeof(buf));
-		    fprintf(f, "\"peer_ip\": \"%s\",\n", buf);
+		    WebJSONPair(f, "peer_ip", L->peer, ",\n");
 
-		    if (L->bund != NULL)
-			fprintf(f, "\"ipcp_ip\": \"%s\",\n", inet_ntoa(L->bund->ipcp.peer_addr));
+		    if (L->bund >= 0)
+			WebJSONPair(f, "ipcp_ip", L->ipcp_ip, ",\n");
 		    else
-			fprintf(f, "\"ipcp_ip\": \"%s\",\n", "");
+			WebJSONPair(f, "ipcp_ip", "", ",\n");
 
-		    PhysGetCallingNum(L, buf, sizeof(buf));
-		    PhysGetCalledNum(L, buf2, sizeof(buf2));
-		    if (PhysGetOriginate(L) == LINK_ORIGINATE_REMOTE) {
-			fprintf(f, "\"calling_num\": \"%s\",\n", buf);
-			fprintf(f, "\"called_num\": \"%s\"\n", buf2);
-		    } else {
-			fprintf(f, "\"calling_num\": \"%s\",\n", buf2);
-			fprintf(f, "\"called_num\": \"%s\"\n", buf);
-		    }
+		    WebJSONPair(f, "calling_num", L->calling, ",\n");
+		    WebJSONPair(f, "called_num", L->called, "\n");
 		} else {
-		    fprintf(f, "\"calling_num\": \"%s\",\n", "");
-		    fprintf(f, "\"called_num\": \"%s\"\n", "");
+		    WebJSONPair(f, "calling_num", "", ",\n");
+		    WebJSONPair(f, "called_num", "", "\n");
 		}
 		fprintf(f, "}\n");
 	    }
 	}
 	fprintf(f, "]\n");
 
-        if (b == (gNumReps - 1)) {
+        if (b == (t->nreps - 1)) {
 	    fprintf(f, "}\n");
 	} else {
 	    fprintf(f, "},\n");
@@ -616,6 +816,416 @@ WebShowJSONSummary(FILE *f, int priv)
   fprintf(f, "]}\n");
 }
 
+/*
+ * WebShowJSONSessions()
+ *
+ * Flat list of sessions selected by the query. Matching sessions are
+ * copied under the giant lock and encoded after it is released. With
+ * "since" only sessions changed after that generation are collected,
+ * walking the changed list from the newest, so the cost depends on
+ * the number of changes rather than sessions.
+ */
+
+static void
+WebShowJSONSessions(FILE *f, const char *query)
+{
+    struct websessq	q;
+    struct websessset	set;
+    Link		L;
+    char		*buf;
+    u_int64_t		gen;
+    int			k, next = -1, resync = 0, first;
+
+    buf = Mstrdup(MB_WEB, query);
+    if (WebSessQuery(&q, buf) < 0) {
+	fprintf(f, "{\"error\": \"bad query\"}\n");
+	Freee(buf);
+	return;
+    }
+    memset(&set, 0, sizeof(set));
+    set.q = &q;
+    set.s = Malloc(MB_WEB, q.limit * sizeof(*set.s));
+
+    pthread_cleanup_push(WebServletRunCleanup, NULL);
+    GIANT_MUTEX_LOCK();
+
+    gen = gLinkGen;
+    if (q.delta) {
+	if (LinkChangesSince(q.since, WebSessChange, &set) < 0 ||
+		set.overflow)
+	    resync = 1;
+    } else {
+	for (k = q.cursor; k < gNumLinks; k++) {
+	    if ((L = gLinks[k]) == NULL || L->tmpl || L->rep != NULL)
+		continue;
+	    if (set.n == q.limit) {
+		next = k;
+		break;
+	    }
+	    WebSessFill(&set.s[set.n], L);
+	    if (WebSessMatch(&q, &set.s[set.n]))
+		set.n++;
+	}
+    }
+
+    GIANT_MUTEX_UNLOCK();
+    pthread_cleanup_pop(0);
+
+    fprintf(f, "{\"generation\": %llu,\n", (unsigned long long)gen);
+    if (resync) {
+	fprintf(f, "\"resync\": true}\n");
+	goto done;
+    }
+    fprintf(f, "\"sessions\": [");
+    for (k = 0, first = 1; k < set.n; k++) {
+	if (set.s[k].gone)
+	    continue;
+	fprintf(f, first ? "\n" : ",\n");
+	WebSessWrite(f, &set.s[k], q.fields);
+	first = 0;
+    }
+    fprintf(f, "\n]");
+    if (q.delta) {
+	fprintf(f, ",\n\"removed\": [");
+	for (k = 0, first = 1; k < set.n; k++) {
+	    if (!set.s[k].gone)
+		continue;
+	    fprintf(f, first ? "\n" : ",\n");
+	    JSONString(f, set.s[k].link);
+	    first = 0;
+	}
+	fprintf(f, "\n]");
+    } else if (next >= 0)
+	fprintf(f, ",\n\"next_cursor\": %d", next);
+    else
+	fprintf(f, ",\n\"next_cursor\": null");
+    fprintf(f, "}\n");
+done:
+    Freee(set.s);
+    Freee(buf);
+}
+
+/*
+ * WebSessQuery()
+ *
+ * Parse query, filter values point into "buf".
+ */
+
+static int
+WebSessQuery(struct websessq *q, char *buf)
+{
+    char	*tmp = buf, *arg, *val, *fld;
+    int		k;
+
+    memset(q, 0, sizeof(*q));
+    q->fields = (1 << WEB_SF_NUM) - 1;
+    q->limit = WEB_SESS_PAGE;
+    while ((arg = strsep(&tmp, "&")) != NULL) {
+	if (arg[0] == '\0')
+	    continue;
+	if ((val = strchr(arg, '=')) == NULL)
+	    return (-1);
+	*val++ = '\0';
+	http_request_url_decode(val, val);
+	if (strcmp(arg, "fields") == 0) {
+	    q->fields = 0;
+	    while ((fld = strsep(&val, ",")) != NULL) {
+		for (k = 0; k < WEB_SF_NUM; k++) {
+		    if (strcmp(fld, gWebSessFields[k]) == 0)
+			break;
+		}
+		if (k == WEB_SF_NUM)
+		    return (-1);
+		q->fields |= (1 << k);
+	    }
+	} else if (strcmp(arg, "user") == 0)
+	    q->user = val;
+	else if (strcmp(arg, "iface") == 0)
+	    q->iface = val;
+	else if (strcmp(arg, "ip") == 0)
+	    q->ip = val;
+	else if (strcmp(arg, "state") == 0)
+	    q->state = val;
+	else if (strcmp(arg, "type") == 0)
+	    q->type = val;
+	else if (strcmp(arg, "cursor") == 0)
+	    q->cursor = atoi(val);
+	else if (strcmp(arg, "limit") == 0)
+	    q->limit = atoi(val);
+	else if (strcmp(arg, "since") == 0) {
+	    q->delta = 1;
+	    q->since = strtoull(val, NULL, 10);
+	} else
+	    return (-1);
+    }
+    if (q->cursor < 0)
+	q->cursor = 0;
+    if (q->limit <= 0 || q->limit > WEB_SESS_MAX_PAGE || q->delta)
+	q->limit = WEB_SESS_MAX_PAGE;
+    return (0);
+}
+
+/*
+ * WebSessFill()
+ */
+
+static void
+WebSessFill(struct websess *s, Link L)
+{
+    char	buf[64], buf2[64];
+
+    memset(s, 0, sizeof(*s));
+    s->id = L->id;
+    s->gen = L->gen;
+    strlcpy(s->link, L->name, sizeof(s->link));
+    if (L->bund != NULL) {
+	strlcpy(s->bundle, L->bund->name, sizeof(s->bundle));
+	strlcpy(s->iface, L->bund->iface.ifname, sizeof(s->iface));
+	s->ipcp = FsmStateName(L->bund->ipcp.fsm.state);
+	inet_ntop(AF_INET, &L->bund->ipcp.peer_addr, s->ipcp_ip,
+	    sizeof(s->ipcp_ip));
+    } else
+	s->ipcp = "";
+    strlcpy(s->user, L->lcp.auth.params.authname, sizeof(s->user));
+    strlcpy(s->type, L->type ? L->type->name : "", sizeof(s->type));
+    s->state = gPhysStateNames[L->state];
+    s->lcp = FsmStateName(L->lcp.fsm.state);
+    LinkSetupPhases(L, s->setup);
+    if (L->state != PHYS_STATE_DOWN) {
+	PhysGetPeerAddr(L, s->peer_ip, sizeof(s->peer_ip));
+	PhysGetCallingNum(L, buf, sizeof(buf));
+	PhysGetCalledNum(L, buf2, sizeof(buf2));
+	if (PhysGetOriginate(L) == LINK_ORIGINATE_REMOTE) {
+	    strlcpy(s->calling, buf, sizeof(s->calling));
+	    strlcpy(s->called, buf2, sizeof(s->called));
+	} else {
+	    strlcpy(s->calling, buf2, sizeof(s->calling));
+	    strlcpy(s->called, buf, sizeof(s->called));
+	}
+    }
+}
+
+/*
+ * WebSessMatch()
+ *
+ * State matches either device or LCP state name.
+ */
+
+static int
+WebSessMatch(const struct websessq *q, const struct websess *s)
+{
+    if (q->user && strcmp(q->user, s->user) != 0)
+	return (0);
+    if (q->iface && strcmp(q->iface, s->iface) != 0)
+	return (0);
+    if (q->ip && strcmp(q->ip, s->ipcp_ip) != 0 &&
+	    strcmp(q->ip, s->peer_ip) != 0)
+	return (0);
+    if (q->state && strcasecmp(q->state, s->state) != 0 &&
+	    strcasecmp(q->state, s->lcp) != 0)
+	return (0);
+    if (q->type && strcmp(q->type, s->type) != 0)
+	return (0);
+    return (1);
+}
+
+/*
+ * WebSessChange()
+ *
+ * Collect one change. Sessions not matching the filters anymore
+ * are reported as removed, so a filtered view stays consistent.
+ */
+
+static void
+WebSessChange(Link L, const char *gone, u_int64_t gen, void *arg)
+{
+    struct websessset	*const set = (struct websessset *)arg;
+    struct websess	*s;
+
+    if (set->n == set->q->limit) {
+	set->overflow = 1;
+	return;
+    }
+    s = &set->s[set->n];
+    if (L == NULL) {
+	memset(s, 0, sizeof(*s));
+	strlcpy(s->link, gone, sizeof(s->link));
+	s->gen = gen;
+	s->gone = 1;
+    } else if (L->rep != NULL)
+	return;
+    else {
+	WebSessFill(s, L);
+	s->gone = !WebSessMatch(set->q, s);
+    }
+    set->n++;
+}
+
+/*
+ * WebSessWrite()
+ */
+
+static void
+WebSessWrite(FILE *f, const struct websess *s, u_int fields)
+{
+    const char	*val;
+    int		k, first = 1;
+
+    fprintf(f, "{");
+    for (k = 0; k < WEB_SF_NUM; k++) {
+	if ((fields & (1 << k)) == 0)
+	    continue;
+	if (!first)
+	    fprintf(f, ", ");
+	first = 0;
+	switch (k) {
+	    case WEB_SF_LINK:	val = s->link; break;
+	    case WEB_SF_BUNDLE:	val = s->bundle; break;
+	    case WEB_SF_IFACE:	val = s->iface; break;
+	    case WEB_SF_USER:	val = s->user; break;
+	    case WEB_SF_TYPE:	val = s->type; break;
+	    case WEB_SF_STATE:	val = s->state; break;
+	    case WEB_SF_LCP:	val = s->lcp; break;
+	    case WEB_SF_IPCP:	val = s->ipcp; break;
+	    case WEB_SF_PEER_IP:	val = s->peer_ip; break;
+	    case WEB_SF_IPCP_IP:	val = s->ipcp_ip; break;
+	    case WEB_SF_CALLING:	val = s->calling; break;
+	    case WEB_SF_CALLED:	val = s->called; break;
+	    case WEB_SF_SETUP:
+		WebSessSetupWrite(f, s);
+		continue;
+	    default:
+		fprintf(f, "\"%s\": %llu", gWebSessFields[k],
+		    (unsigned long long)s->gen);
+		continue;
+	}
+	WebJSONPair(f, gWebSessFields[k], val, "");
+    }
+    fprintf(f, "}");
+}
+
+/*
+ * WebSessSetupWrite()
+ *
+ * Setup phase times in ms, null for phases not completed.
+ */
+
+static void
+WebSessSetupWrite(FILE *f, const struct websess *s)
+{
+    int		k;
+
+    fprintf(f, "\"%s\": {", gWebSessFields[WEB_SF_SETUP]);
+    for (k = 0; k < LINK_PHASE_NUM; k++) {
+	if (!s->gone && s->setup[k] >= 0)
+	    fprintf(f, "%s\"%s\": %d", k ? ", " : "", gLinkPhaseNames[k],
+		s->setup[k]);
+	else
+	    fprintf(f, "%s\"%s\": null", k ? ", " : "", gLinkPhaseNames[k]);
+    }
+    fprintf(f, "}");
+}
+
+/*
+ * WebJSONPair()
+ */
+
+static void
+WebJSONPair(FILE *f, const char *name, const char *val, const char *sep)
+{
+    fprintf(f, "\"%s\": ", name);
+    JSONString(f, val);
+    fputs(sep, f);
+}
+
+/*
+ * WebShowEvents()
+ *
+ * Stream session events as server-sent events until the client goes
+ * away. Runs in a web server thread taken out of the worker pool, so
+ * the streams never leave requests without workers, and never takes
+ * the giant lock. Clients resume with Last-Event-ID header or
+ * "cursor={id}".
+ */
+
+static void
+WebShowEvents(FILE *f, struct http_request *req, struct http_response *resp,
+	const char *query)
+{
+    struct sessevsub	sub;
+    struct sessevent	evs[WEB_EV_BATCH];
+    struct in_addr	ip;
+    const char		*hdr;
+    char		buf[INET_ADDRSTRLEN];
+    u_int64_t		cursor = 0, lost;
+    int			k, n;
+
+    if ((hdr = http_request_get_header(req, "Last-Event-ID")) != NULL)
+	cursor = strtoull(hdr, NULL, 10) + 1;
+    else if (strncmp(query, "cursor=", 7) == 0)
+	cursor = strtoull(query + 7, NULL, 10);
+
+    if (http_server_stream(resp) == -1) {
+	http_response_send_error(resp, HTTP_STATUS_SERVICE_UNAVAILABLE,
+	    "Too many event streams");
+	return;
+    }
+
+    memset(&sub, 0, sizeof(sub));
+    ip = http_request_get_remote_ip(req);
+    snprintf(sub.peer, sizeof(sub.peer), "%s:%u",
+	inet_ntop(AF_INET, &ip, buf, sizeof(buf)),
+	http_request_get_remote_port(req));
+    SessEventSubscribe(&sub, cursor);
+    pthread_cleanup_push(WebShowEventsCleanup, &sub);
+
+    http_response_send_headers(resp, 1);
+    fprintf(f, "retry: 5000\n\n");
+    while (fflush(f) == 0 && !ferror(f)) {
+	if (!SessEventWait(&sub, WEB_EV_KEEPALIVE)) {
+	    fprintf(f, ": keepalive\n\n");
+	    continue;
+	}
+	do {
+	    n = SessEventRead(&sub, evs, WEB_EV_BATCH, &lost);
+	    if (lost) {
+		fprintf(f, "event: dropped\ndata: {\"count\": %llu, "
+		    "\"total\": %llu}\n\n", (unsigned long long)lost,
+		    (unsigned long long)sub.dropped);
+	    }
+	    for (k = 0; k < n; k++)
+		WebEventWrite(f, &evs[k]);
+	} while (n == WEB_EV_BATCH);
+    }
+
+    pthread_cleanup_pop(1);
+}
+
+static void
+WebShowEventsCleanup(void *cookie)
+{
+    SessEventUnsubscribe((SessEvSub)cookie);
+}
+
+/*
+ * WebEventWrite()
+ */
+
+static void
+WebEventWrite(FILE *f, const struct sessevent *ev)
+{
+    const char	*name = SessEventName(ev->type);
+
+    fprintf(f, "id: %llu\nevent: %s\n", (unsigned long long)ev->id, name);
+    fprintf(f, "data: {\"id\": %llu, \"time\": %lld, ",
+	(unsigned long long)ev->id, (long long)ev->time);
+    WebJSONPair(f, "type", name, ", ");
+    WebJSONPair(f, "link", ev->link, ", ");
+    WebJSONPair(f, "bundle", ev->bundle, ", ");
+    WebJSONPair(f, "user", ev->user, ", ");
+    WebJSONPair(f, "info", ev->info, "}\n\n");
+}
+
 static void 
 WebRunBinCmd(FILE *f, const char *query, int priv)
 {
@@ -667,6 +1277,82 @@ WebRunBinCmd(FILE *f, const char *query, int priv)
     RESETREF(cs->context.rep, NULL);
 }
 
+/*
+ * WebRunBatch()
+ *
+ * Run script posted to /bincmd as a batch, releasing the giant lock
+ * between its chunks.
+ */
+
+static void
+WebRunBatch(FILE *f, struct http_request *req, const char *query, int priv)
+{
+    struct webbatch	wb;
+    FILE		*in;
+    size_t		len = 0, n;
+
+    if ((in = http_request_get_input(req)) == NULL) {
+	fprintf(f, "{\"error\": \"no input\"}\n");
+	return;
+    }
+    memset(&wb, 0, sizeof(wb));
+    pthread_cleanup_push(WebRunBatchCleanup, &wb);
+
+    wb.buf = Malloc(MB_WEB, BATCH_MAX_SCRIPT + 1);
+    while (len <= BATCH_MAX_SCRIPT &&
+	    (n = fread(wb.buf + len, 1, BATCH_MAX_SCRIPT + 1 - len, in)) > 0)
+	len += n;
+    if (len > BATCH_MAX_SCRIPT)
+	fprintf(f, "{\"error\": \"script too large\"}\n");
+    else {
+	wb.buf[len] = '\0';
+	wb.b = BatchCreate(wb.buf, priv, strcmp(query, "dry-run") == 0);
+	Freee(wb.buf);
+	wb.buf = NULL;
+
+	do {
+	    GIANT_MUTEX_LOCK();
+	    wb.locked = 1;
+	    wb.done = BatchRun(wb.b);
+	    wb.locked = 0;
+	    GIANT_MUTEX_UNLOCK();
+	    /* Let the event loop and other waiters have the lock */
+	    if (!wb.done)
+		sched_yield();
+	} while (!wb.done);
+
+	BatchWrite(wb.b, f);
+    }
+
+    pthread_cleanup_pop(1);
+}
+
+/*
+ * WebRunBatchCleanup()
+ *
+ * Free the script and the batch, also when the worker is cancelled
+ * while reading the script, running it or writing the results. An
+ * unfinished batch is destroyed with the giant lock held.
+ */
+
+static void
+WebRunBatchCleanup(void *cookie) NO_THREAD_SAFETY_ANALYSIS
+{
+    struct webbatch	*wb = cookie;
+
+    Freee(wb->buf);
+    if (wb->b == NULL)
+	return;
+    if (wb->done)
+	BatchDestroy(wb->b);
+    else {
+	if (!wb->locked)
+	    GIANT_MUTEX_LOCK();
+	BatchDestroy(wb->b);
+	GIANT_MUTEX_UNLOCK();
+    }
+}
+
 static void 
 WebRunCmd(FILE *f, const char *query, int priv)
 {
@@ -731,6 +1417,149 @@ done:
     RESETREF(cs->context.rep, NULL);
 }
 
+/*
+ * WebEncoding()
+ *
+ * Pick content coding from Accept-Encoding, gzip preferred.
+ */
+
+static int
+WebEncoding(struct http_request *req)
+{
+    const char	*hdr;
+    char	*buf, *tmp, *tok, *q;
+    int		gzip = 0, deflate = 0;
+
+    if ((hdr = http_request_get_header(req, "Accept-Encoding")) == NULL)
+	return (WEB_ENC_IDENTITY);
+    tmp = buf = Mstrdup(MB_WEB, hdr);
+    while ((tok = strsep(&tmp, ",")) != NULL) {
+	tok += strspn(tok, " \t");
+	if ((q = strchr(tok, ';')) != NULL) {
+	    *q++ = '\0';
+	    q += strspn(q, " \t");
+	    /* q=0 means not acceptable */
+	    if ((q[0] == 'q' || q[0] == 'Q') && q[1] == '=' &&
+		    strtod(q + 2, NULL) <= 0)
+		continue;
+	}
+	tok[strcspn(tok, " \t")] = '\0';
+	if (strcasecmp(tok, "gzip") == 0 || strcasecmp(tok, "x-gzip") == 0)
+	    gzip = 1;
+	else if (strcasecmp(tok, "deflate") == 0)
+	    deflate = 1;
+    }
+    Freee(buf);
+    if (gzip)
+	return (WEB_ENC_GZIP);
+    if (deflate)
+	return (WEB_ENC_DEFLATE);
+    return (WEB_ENC_IDENTITY);
+}
+
+/*
+ * WebCompress()
+ *
+ * Write body compressed, or as is if small or zlib fails to start.
+ */
+
+static void
+WebCompress(struct http_response *resp, FILE *f, const char *buf, size_t len,
+	int enc)
+{
+    z_stream	zs;
+    u_char	out[8192];
+    int		ret;
+
+    memset(&zs, 0, sizeof(zs));
+    if (enc == WEB_ENC_IDENTITY || len < WEB_ZMIN ||
+	    deflateInit2(&zs, WEB_ZLEVEL, Z_DEFLATED,
+	    enc == WEB_ENC_GZIP ? MAX_WBITS + 16 : MAX_WBITS, 8,
+	    Z_DEFAULT_STRATEGY) != Z_OK) {
+	fwrite(buf, 1, len, f);
+	return;
+    }
+    http_response_set_header(resp, 0, "Content-Encoding", "%s",
+	enc == WEB_ENC_GZIP ? "gzip" : "deflate");
+    zs.next_in = (Bytef *)(uintptr_t)buf;
+    zs.avail_in = len;
+    do {
+	zs.next_out = out;
+	zs.avail_out = sizeof(out);
+	ret = deflate(&zs, Z_FINISH);
+	fwrite(out, 1, sizeof(out) - zs.avail_out, f);
+    } while (ret == Z_OK);
+    deflateEnd(&zs);
+}
+
+/*
+ * WebETag()
+ *
+ * Tag response with the session snapshot state and send 304 if the
+ * client has it already. The state changes with everything shown but
+ * the counters, so checking it does not walk any sessions. Returns
+ * non-zero if the response is complete.
+ */
+
+static int
+WebETag(struct http_request *req, struct http_response *resp,
+	const char *path, const char *query, int priv, int enc, u_int64_t state)
+{
+    static const char	*const encs[] = { "id", "gz", "df" };
+    const char		*hdr, *p;
+    char		etag[64];
+    u_int		h = 2166136261U;
+
+    /* Variant of the representation */
+    for (p = path; *p; p++)
+	h = (h ^ (u_char)*p) * 16777619U;
+    h = (h ^ '?') * 16777619U;
+    for (p = query; *p; p++)
+	h = (h ^ (u_char)*p) * 16777619U;
+    h = (h ^ priv) * 16777619U;
+
+    snprintf(etag, sizeof(etag), "\"%lx-%llx-%08x-%s\"", (u_long)gWebStart,
+	(unsigned long long)state, h, encs[enc]);
+    http_response_set_header(resp, 0, "ETag", "%s", etag);
+    if ((hdr = http_request_get_header(req, "If-None-Match")) == NULL ||
+	    !WebETagMatch(hdr, etag))
+	return (0);
+    http_response_set_header(resp, 0, "Cache-Control", "no-cache");
+    http_response_set_header(resp, 0, HDR_REPLY_STATUS, "%d",
+	HTTP_STATUS_NOT_MODIFIED);
+    http_response_set_header(resp, 0, HDR_REPLY_REASON, "%s",
+	http_response_status_msg(HTTP_STATUS_NOT_MODIFIED));
+    return (1);
+}
+
+/*
+ * WebETagMatch()
+ *
+ * Check If-None-Match list, weak comparison.
+ */
+
+static int
+WebETagMatch(const char *list, const char *etag)
+{
+    const char	*p = list, *q;
+    size_t	len = strlen(etag);
+
+    while (*p != '\0') {
+	p += strspn(p, " \t,");
+	if (*p == '*')
+	    return (1);
+	if (strncmp(p, "W/", 2) == 0)
+	    p += 2;
+	if (strncmp(p, etag, len) == 0 &&
+		(p[len] == '\0' || strchr(" \t,", p[len]) != NULL))
+	    return (1);
+	if (*p == '"' && (q = strchr(p + 1, '"')) != NULL)
+	    p = q + 1;
+	p += strcspn(p, ",");
+    }
+    return (0);
+}
+
 static void
 WebServletRunCleanup(void *cookie) NO_THREAD_SAFETY_ANALYSIS
 {
@@ -742,10 +1571,14 @@ static int
 WebServletRun(struct http_servlet *servlet,
                          struct http_request *req, struct http_response *resp)
 {
-    FILE *f;
+    FILE *f, *out;
     const char *path;
     const char *query;
+    SessTab t = NULL;
+    char *zbuf = NULL;
+    size_t zlen = 0;
     int priv = 0;
+    int enc = WEB_ENC_IDENTITY;
     
     (void)servlet;
     if (Enabled(&gWeb.options, WEB_AUTH)) {
@@ -779,11 +1612,63 @@ WebServletRun(struct http_servlet *servlet,
 	return 0;
     if (!(query = http_request_get_query_string(req)))
 	return 0;
+    out = f;
+
+    /* Large and polled often, worth compressing and revalidating */
+    if (!strcmp(path,"/") || !strcmp(path,"/json") ||
+	    !strcmp(path,"/metrics")) {
+	enc = WebEncoding(req);
+	http_response_set_header(resp, 0, "Vary", "Accept-Encoding");
+	if (strcmp(path,"/metrics") != 0) {
+	    t = SessSnapGet();
+	    /* Changes since a generation are not worth tagging */
+	    if (t != NULL && strstr(query, "since=") == NULL &&
+		    WebETag(req, resp, path, query, priv, enc, t->state)) {
+		SessSnapRelease(t);
+		return 1;
+	    }
+	}
+	/* Compressed once complete, Content-Length is known anyway */
+	if (enc != WEB_ENC_IDENTITY &&
+		(out = open_memstream(&zbuf, &zlen)) == NULL)
+	    out = f;
+    }
 
     if (!strcmp(path,"/mpd.css")) {
 	http_response_set_header(resp, 0, "Content-Type", "text/css");
 	WebShowCSS(f);
-    } else if (!strcmp(path,"/bincmd") || !strcmp(path,"/json")) {
+    } else if (!strcmp(path,"/events")) {
+	http_response_set_header(resp, 0, "Content-Type", "text/event-stream");
+	http_response_set_header(resp, 1, "Cache-Control", "no-cache");
+
+	WebShowEvents(f, req, resp, query);
+
+    } else if (!strcmp(path,"/json") && query[0] != '\0') {
+	http_response_set_header(resp, 0, "Content-Type", "application/json");
+	http_response_set_header(resp, 1, "Pragma", "no-cache");
+	http_response_set_header(resp, 1, "Cache-Control", "no-cache, must-revalidate");
+
+	/* Takes the giant lock only while copying sessions */
+	WebShowJSONSessions(out, query);
+
+    } else if (!strcmp(path,"/json")) {
+	http_response_set_header(resp, 0, "Content-Type", "text/plain");
+	http_response_set_header(resp, 1, "Pragma", "no-cache");
+	http_response_set_header(resp, 1, "Cache-Control", "no-cache, must-revalidate");
+
+	/* Session snapshot, no need for the giant lock */
+	WebShowJSONSummary(out, t, priv);
+
+    } else if (!strcmp(path,"/bincmd") &&
+	    !strcmp(http_request_get_method(req), HTTP_METHOD_POST)) {
+	http_response_set_header(resp, 0, "Content-Type", "application/json");
+	http_response_set_header(resp, 1, "Pragma", "no-cache");
+	http_response_set_header(resp, 1, "Cache-Control", "no-cache, must-revalidate");
+
+	/* Takes the giant lock for each chunk of commands */
+	WebRunBatch(f, req, query, priv);
+
+    } else if (!strcmp(path,"/bincmd")) {
 	http_response_set_header(resp, 0, "Content-Type", "text/plain");
 	http_response_set_header(resp, 1, "Pragma", "no-cache");
 	http_response_set_header(resp, 1, "Cache-Control", "no-cache, must-revalidate");
@@ -791,41 +1676,56 @@ WebServletRun(struct http_servlet *servlet,
 	pthread_cleanup_push(WebServletRunCleanup, NULL);
 	GIANT_MUTEX_LOCK();
 	
-	if (!strcmp(path,"/bincmd"))
-	    WebRunBinCmd(f, query, priv);
-	else if (!strcmp(path,"/json"))
-	    WebShowJSONSummary(f, priv);
+	WebRunBinCmd(f, query, priv);
 
 	GIANT_MUTEX_UNLOCK();
 	pthread_cleanup_pop(0);
 
+    } else if (!strcmp(path,"/metrics")) {
+	http_response_set_header(resp, 0, "Content-Type",
+	    "text/plain; version=0.0.4");
+	http_response_set_header(resp, 1, "Pragma", "no-cache");
+	http_response_set_header(resp, 1, "Cache-Control", "no-cache, must-revalidate");
+
+	/* Published snapshot, no need for the giant lock */
+	MetricsWrite(out, query);
+
     } else if (!strcmp(path,"/") || !strcmp(path,"/cmd")) {
 	http_response_set_header(resp, 0, "Content-Type", "text/html");
 	http_response_set_header(resp, 1, "Pragma", "no-cache");
 	http_response_set_header(resp, 1, "Cache-Control", "no-cache, must-revalidate");
 	
-	pthread_cleanup_push(WebServletRunCleanup, NULL);
-	GIANT_MUTEX_LOCK();
-
-	fprintf(f, "<!DOCTYPE html>\n");
-	fprintf(f, "<html>\n");
-	fprintf(f, "<head>\n<title>Multi-link PPP Daemon for FreeBSD (mpd)</title>\n");
-	fprintf(f, "<link rel=\"stylesheet\" href=\"/mpd.css\" type=\"text/css\"/>\n");
-	fprintf(f, "</head>\n<body>\n");
-	fprintf(f, "<h1>Multi-link PPP Daemon for FreeBSD</h1>\n");
+	fprintf(out, "<!DOCTYPE html>\n");
+	fprintf(out, "<html>\n");
+	fprintf(out, "<head>\n<title>Multi-link PPP Daemon for FreeBSD (mpd)</title>\n");
+	fprintf(out, "<link rel=\"stylesheet\" href=\"/mpd.css\" type=\"text/css\"/>\n");
+	fprintf(out, "</head>\n<body>\n");
+	fprintf(out, "<h1>Multi-link PPP Daemon for FreeBSD</h1>\n");
     
-	if (!strcmp(path,"/"))
-	    WebShowHTMLSummary(f, priv);
-	else if (!strcmp(path,"/cmd"))
+	if (!strcmp(path,"/")) {
+	    /* Session snapshot, no need for the giant lock */
+	    WebShowHTMLSummary(out, t, priv);
+	} else {
+	    pthread_cleanup_push(WebServletRunCleanup, NULL);
+	    GIANT_MUTEX_LOCK();
+
 	    WebRunCmd(f, query, priv);
-	    
-	GIANT_MUTEX_UNLOCK();
-	pthread_cleanup_pop(0);
+
+	    GIANT_MUTEX_UNLOCK();
+	    pthread_cleanup_pop(0);
+	}
 	
-	fprintf(f, "</body>\n</html>\n");
+	fprintf(out, "</body>\n</html>\n");
     } else {
 	http_response_send_error(resp, 404, NULL);
     }
+    if (out != f) {
+	fclose(out);
+	WebCompress(resp, f, zbuf, zlen, enc);
+	free(zbuf);
+    }
+    if (t != NULL)
+	SessSnapRelease(t);
     return 1;
 }
 
@@ -854,7 +1754,7 @@ static int
 WebSetCommand(Context ctx, int ac, const char *const av[], const void *arg) 
 {
   Web	 		w = &gWeb;
-  int			port;
+  int			port, period, val;
 
   switch ((intptr_t)arg) {
 
@@ -868,10 +1768,63 @@ WebSetCommand(Context ctx, int ac, const char *const av[], const void *arg)
 
     case SET_ENABLE:
 	EnableCommand(ac, av, &w->options, gConfList);
+	gMetricsSessions = Enabled(&w->options, WEB_METRICS_SESSIONS);
       break;
 
     case SET_DISABLE:
 	DisableCommand(ac, av, &w->options, gConfList);
+	gMetricsSessions = Enabled(&w->options, WEB_METRICS_SESSIONS);
+      break;
+
+    case SET_METRICS_PERIOD:
+      if (ac != 1)
+	return(-1);
+      period = atoi(av[0]);
+      if (period < 1 || period > 3600)
+	Error("Bogus metrics period given %s", av[0]);
+      gMetricsPeriod = period;
+      if (w->srv)
+	MetricsStart();
+      break;
+
+    case SET_MAX_CONN:
+      if (ac != 1)
+	return(-1);
+      val = atoi(av[0]);
+      if (val < 1 || val > 65536)
+	Error("Bogus max connections given %s", av[0]);
+      w->max_conn = val;
+      WebSetLimits(w);
+      break;
+
+    case SET_WORKERS:
+      if (ac != 1)
+	return(-1);
+      val = atoi(av[0]);
+      if (val < 1 || val > 1024)
+	Error("Bogus workers number given %s", av[0]);
+      w->workers = val;
+      WebSetLimits(w);
+      break;
+
+    case SET_MAX_STREAMS:
+      if (ac != 1)
+	return(-1);
+      val = atoi(av[0]);
+      if (val < 0 || val > 1024)
+	Error("Bogus max streams given %s", av[0]);
+      w->max_streams = val;
+      WebSetLimits(w);
+      break;
+
+    case SET_IDLE_TIMEOUT:
+      if (ac != 1)
+	return(-1);
+      val = atoi(av[0]);
+      if (val < 0 || val > 3600)
+	Error("Bogus idle timeout given %s", av[0]);
+      w->idle_timeout = val;
+      WebSetLimits(w);
       break;
 
     case SET_SELF:
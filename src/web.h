@@ -28,13 +28,18 @@
 
  /* Configuration options */
 enum {
-	WEB_AUTH			/* enable auth */
+	WEB_AUTH,			/* enable auth */
+	WEB_METRICS_SESSIONS		/* per session series in /metrics */
 };
 
 struct web {
 	struct optinfo options;
 	struct u_addr addr;
 	in_port_t port;
+	u_int max_conn;			/* open connections */
+	u_int workers;			/* request worker threads */
+	u_int max_streams;		/* /events streams */
+	u_int idle_timeout;		/* keep-alive idle, seconds */
 	struct http_server *srv;
 	struct http_servlet srvlet;
 	EventRef event;			/* connect-event */
@@ -57,6 +62,9 @@ extern int WebInit(Web c);
 extern int WebOpen(Web c);
 extern int WebClose(Web c);
 extern int WebStat(Context ctx, int ac, const char *const av[], const void *arg);
+#ifdef NOLIBPDEL
+extern int WebServerStats(struct http_server_stats *st);
+#endif
 
 
 #endif